@@ -135,3 +135,38 @@ glm::mat4 Camera::CalculateCameraRotation(App* app)
 
 	return viewMatrix;
 }
+
+void Camera::CalculateFrustumPlanes()
+{
+	ExtractFrustumPlanes(projectionMatrix * viewMatrix, frustumPlanes);
+}
+
+void ExtractFrustumPlanes(const glm::mat4& viewProjection, glm::vec4 planes[6])
+{
+	// Planes extracted from the rows of the view projection matrix (Gribb & Hartmann)
+	glm::vec4 row0(viewProjection[0][0], viewProjection[1][0], viewProjection[2][0], viewProjection[3][0]);
+	glm::vec4 row1(viewProjection[0][1], viewProjection[1][1], viewProjection[2][1], viewProjection[3][1]);
+	glm::vec4 row2(viewProjection[0][2], viewProjection[1][2], viewProjection[2][2], viewProjection[3][2]);
+	glm::vec4 row3(viewProjection[0][3], viewProjection[1][3], viewProjection[2][3], viewProjection[3][3]);
+
+	planes[0] = row3 + row0;
+	planes[1] = row3 - row0;
+	planes[2] = row3 + row1;
+	planes[3] = row3 - row1;
+	planes[4] = row3 + row2;
+	planes[5] = row3 - row2;
+
+	for (int i = 0; i < 6; ++i)
+		planes[i] /= glm::length(glm::vec3(planes[i]));
+}
+
+bool Camera::IsSphereInFrustum(const glm::vec3& center, float radius) const
+{
+	for (int i = 0; i < 6; ++i)
+	{
+		if (glm::dot(glm::vec3(frustumPlanes[i]), center) + frustumPlanes[i].w < -radius)
+			return false;
+	}
+
+	return true;
+}
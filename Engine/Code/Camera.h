@@ -31,9 +31,18 @@ struct Camera
 	glm::mat4 viewMatrix;
 	glm::mat4 projectionMatrix;
 
+	// Left, right, bottom, top, near, far; normals point inside, xyz normalized
+	glm::vec4 frustumPlanes[6];
+
 	void Update(App* app);
 	glm::mat4 CalculateCameraRotation(App* app);
 
+	void CalculateFrustumPlanes();
+	bool IsSphereInFrustum(const glm::vec3& center, float radius) const;
+
 	bool isOrbit = false;
 	
-};
\ No newline at end of file
+};
+
+// Left, right, bottom, top, near and far planes of a view projection, as in Camera::frustumPlanes
+void ExtractFrustumPlanes(const glm::mat4& viewProjection, glm::vec4 planes[6]);
\ No newline at end of file
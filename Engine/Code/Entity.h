@@ -12,13 +12,16 @@ enum EntityType
 };
 struct Entity
 {
-	Entity(glm::mat4 worldMatrix, u32 modelIndex, u32 localParamsOffset, u32 localParamsSize, EntityType type)
-		: worldMatrix(worldMatrix), modelIndex(modelIndex), localParamsOffset(localParamsOffset), localParamsSize(localParamsSize), type(type) {}
+	Entity(glm::mat4 worldMatrix, u32 modelIndex, EntityType type)
+		: worldMatrix(worldMatrix), modelIndex(modelIndex), type(type) {}
 
 	glm::mat4   worldMatrix;
 	u32         modelIndex;
-	u32         localParamsOffset;
-	u32         localParamsSize;
 
 	EntityType type = EntityType::NONE;
+
+	// GPU object records of the submeshes start at this index of the object buffer. They stay
+	// resident and are only uploaded again when the transform changes (see SetEntityTransform).
+	u32         firstObject = 0;
+	bool        transformDirty = true;
 };
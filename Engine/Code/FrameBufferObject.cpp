@@ -12,11 +12,6 @@ FrameBufferObject::~FrameBufferObject()
 
 void FrameBufferObject::Initialize(float _width, float _height)
 {
-	for (u32 i = 0; i < RenderTargetType::MAX; ++i)
-	{
-		IDs[i] = 0u;
-	}
-
 	width = _width; 
 	height = _height;
 
@@ -32,19 +27,34 @@ void FrameBufferObject::Resize(float _width, float _height)
 	UpdateFBO();
 }
 
-void FrameBufferObject::Bind(bool aClear)
+void FrameBufferObject::Release()
+{
+	FreeMemory();
+
+	for (u32 i = 0; i < RenderTargetType::MAX; ++i)
+	{
+		IDs[i] = 0u;
+	}
+}
+
+bool FrameBufferObject::IsInitialized() const
+{
+	return IDs[FBO] != 0u;
+}
+
+void FrameBufferObject::Bind(GLbitfield clearMask)
 {
-	glBindFramebuffer(GL_FRAMEBUFFER, IDs[FBO]);
-	if (aClear)
+	BindFramebuffer(GL_FRAMEBUFFER, IDs[FBO]);
+	if (clearMask != 0)
 	{
 		glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
-		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
+		glClear(clearMask);
 	}
 }
 
 void FrameBufferObject::Unbind()
 {
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	BindFramebuffer(GL_FRAMEBUFFER, 0);
 }
 
 u32 FrameBufferObject::GetTexture(RenderTargetType textureType)
@@ -56,107 +66,66 @@ void GBuffer::ReserveMemory()
 {
 	// Here we reserve all the memory, to be later on easy to delete 
 
-	glGenTextures(1, &IDs[RENDER_TEXTURE]);
-	glGenTextures(1, &IDs[DEPTH_TEXTURE]);
-	glGenTextures(1, &IDs[G_POSITION_TEXTURE]);
 	glGenTextures(1, &IDs[G_ALBEDO_TEXTURE]);
 	glGenTextures(1, &IDs[G_NORMALS_TEXTURE]);
 
 	glGenFramebuffers(1, &IDs[FBO]);
-	glGenRenderbuffers(1, &IDs[ZBO]);
+	glGenTextures(1, &IDs[ZBO]);
 }
 
 void GBuffer::FreeMemory()
 {
-	glDeleteTextures(1, &IDs[RENDER_TEXTURE]);
-	glDeleteTextures(1, &IDs[DEPTH_TEXTURE]);
-	glDeleteTextures(1, &IDs[G_POSITION_TEXTURE]);
 	glDeleteTextures(1, &IDs[G_ALBEDO_TEXTURE]);
 	glDeleteTextures(1, &IDs[G_NORMALS_TEXTURE]);
 
 	glDeleteFramebuffers(1, &IDs[FBO]);
-	glDeleteRenderbuffers(1, &IDs[ZBO]);
+	glDeleteTextures(1, &IDs[ZBO]);
+
+	// Deleted objects are unbound behind the state cache
+	InvalidateGLState();
 }
 
 void GBuffer::UpdateFBO()
 {
-	// ------------------------ Define Render Texture ------------------------
+	// ------------------------ Define Albedo Texture ------------------------
 
-	glBindTexture(GL_TEXTURE_2D, IDs[RENDER_TEXTURE]);
+	BindTexture(GL_TEXTURE_2D, IDs[G_ALBEDO_TEXTURE]);
 	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-	//glTexParameteri(GL_TEXTURE_2D, GL_GENERATE_MIPMAP, GL_TRUE);
-	glBindTexture(GL_TEXTURE_2D, 0);
-
-	// ----------------------------------------------------------------------
-
-
-	// ------------------------ Define Depth Texture ------------------------
-
-	glBindTexture(GL_TEXTURE_2D, IDs[DEPTH_TEXTURE]);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, width, height, 0, GL_RGBA, GL_FLOAT, NULL);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-	//glTexParameteri(GL_TEXTURE_2D, GL_GENERATE_MIPMAP, GL_TRUE);
-	glBindTexture(GL_TEXTURE_2D, 0);
-
-	// ----------------------------------------------------------------------
-
-
-	// ------------------------ Define Position Texture ------------------------
-
-	glBindTexture(GL_TEXTURE_2D, IDs[G_POSITION_TEXTURE]);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, width, height, 0, GL_RGBA, GL_FLOAT, NULL);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-	glBindTexture(GL_TEXTURE_2D, 0);
+	BindTexture(GL_TEXTURE_2D, 0);
 
 	// ----------------------------------------------------------------------
 
 	// ------------------------ Define Normal Texture ------------------------
+	// Octahedral encoded, see GEOMETRY_PASS_SHADER_COMPACT
 
-	glBindTexture(GL_TEXTURE_2D, IDs[G_NORMALS_TEXTURE]);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, width, height, 0, GL_RGBA, GL_FLOAT, NULL);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-	glBindTexture(GL_TEXTURE_2D, 0);
-	// ----------------------------------------------------------------------
-
-	// ------------------------ Define Albedo Texture ------------------------
-
-	glBindTexture(GL_TEXTURE_2D, IDs[G_ALBEDO_TEXTURE]);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+	BindTexture(GL_TEXTURE_2D, IDs[G_NORMALS_TEXTURE]);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RG16, width, height, 0, GL_RG, GL_UNSIGNED_SHORT, NULL);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-	glBindTexture(GL_TEXTURE_2D, 0);
+	BindTexture(GL_TEXTURE_2D, 0);
 
 	// ----------------------------------------------------------------------
 
 
 
 	// ------------------------ Define FrameBuffer Object------------------------
-	glBindFramebuffer(GL_FRAMEBUFFER, IDs[FBO]);
-	glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, IDs[RENDER_TEXTURE], 0);
-	glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, IDs[G_POSITION_TEXTURE], 0);
-	glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT2, IDs[G_NORMALS_TEXTURE], 0);
-	glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT3, IDs[G_ALBEDO_TEXTURE], 0);
-	glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT4, IDs[DEPTH_TEXTURE], 0);
+	BindFramebuffer(GL_FRAMEBUFFER, IDs[FBO]);
+	glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, IDs[G_ALBEDO_TEXTURE], 0);
+	glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, IDs[G_NORMALS_TEXTURE], 0);
 
-	GLuint drawBuffers[5] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1, GL_COLOR_ATTACHMENT2, GL_COLOR_ATTACHMENT3,GL_COLOR_ATTACHMENT4 };
-	glDrawBuffers(5, drawBuffers);
+	GLuint drawBuffers[2] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
+	glDrawBuffers(2, drawBuffers);
 
 	// ------------------------ Define ZBuffer Object------------------------
-	glBindRenderbuffer(GL_RENDERBUFFER, IDs[ZBO]);
-	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT, width, height);
-	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, IDs[ZBO]);
-	glBindRenderbuffer(GL_RENDERBUFFER, 0);
+	// A texture so the shading buffer can attach the same depth instead of blitting it
+	BindTexture(GL_TEXTURE_2D, IDs[ZBO]);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH24_STENCIL8, width, height, 0, GL_DEPTH_STENCIL, GL_UNSIGNED_INT_24_8, NULL);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	BindTexture(GL_TEXTURE_2D, 0);
+	glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, IDs[ZBO], 0);
 
 	GLenum frameBufferStatus = glCheckFramebufferStatus(GL_FRAMEBUFFER);
 	if (frameBufferStatus != GL_FRAMEBUFFER_COMPLETE)
@@ -176,9 +145,8 @@ void GBuffer::UpdateFBO()
 	}
 
 	
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
-	glBindTexture(GL_TEXTURE_2D, 0);
-	glBindRenderbuffer(GL_RENDERBUFFER, 0);
+	BindFramebuffer(GL_FRAMEBUFFER, 0);
+	BindTexture(GL_TEXTURE_2D, 0);
 }
 
 void ShadingBuffer::ReserveMemory()
@@ -188,6 +156,7 @@ void ShadingBuffer::ReserveMemory()
 	glGenTextures(1, &IDs[BRIGHT_COLOR_TEXTURE]);
 
 	glGenFramebuffers(1, &IDs[FBO]);
+	glGenFramebuffers(1, &brightColorFBO);
 	
 
 }
@@ -199,14 +168,18 @@ void ShadingBuffer::FreeMemory()
 	glDeleteTextures(1, &IDs[BRIGHT_COLOR_TEXTURE]);
 
 	glDeleteFramebuffers(1, &IDs[FBO]);
-	
+	glDeleteFramebuffers(1, &brightColorFBO);
+	brightColorFBO = 0;
+
+	// Deleted objects are unbound behind the state cache
+	InvalidateGLState();
 }
 
 void ShadingBuffer::UpdateFBO()
 {
 	// ------------------------ Define Render Texture ------------------------
 
-	glBindTexture(GL_TEXTURE_2D, IDs[RENDER_TEXTURE]);
+	BindTexture(GL_TEXTURE_2D, IDs[RENDER_TEXTURE]);
 	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, width, height, 0, GL_RGBA, GL_FLOAT, NULL);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
@@ -214,35 +187,40 @@ void ShadingBuffer::UpdateFBO()
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
 	//glTexParameteri(GL_TEXTURE_2D, GL_GENERATE_MIPMAP, GL_TRUE);
-	glBindTexture(GL_TEXTURE_2D, 0);
+	BindTexture(GL_TEXTURE_2D, 0);
 
 	// ----------------------------------------------------------------------
 
 	// ------------------------ Define Render Texture ------------------------
 
-	glBindTexture(GL_TEXTURE_2D, IDs[BRIGHT_COLOR_TEXTURE]);
+	BindTexture(GL_TEXTURE_2D, IDs[BRIGHT_COLOR_TEXTURE]);
 	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, width, height, 0, GL_RGBA, GL_FLOAT, NULL);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	// Filtered: the bloom downsample reads it with bilinear taps
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
 	//glTexParameteri(GL_TEXTURE_2D, GL_GENERATE_MIPMAP, GL_TRUE);
-	glBindTexture(GL_TEXTURE_2D, 0);
+	BindTexture(GL_TEXTURE_2D, 0);
 
 	// ----------------------------------------------------------------------
 
-	// ------------------------ Define Depth Texture ------------------------
+	// ------------------------ Define Depth Stencil Texture ------------------------
+	// Only when the G-Buffer depth is not shared, stencil is used by the light volumes
 
-	glBindTexture(GL_TEXTURE_2D, IDs[DEPTH_TEXTURE]);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, width, height, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-	//glTexParameteri(GL_TEXTURE_2D, GL_GENERATE_MIPMAP, GL_TRUE);
-	glBindTexture(GL_TEXTURE_2D, 0);
+	if (sharedDepthStencil == 0)
+	{
+		BindTexture(GL_TEXTURE_2D, IDs[DEPTH_TEXTURE]);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH24_STENCIL8, width, height, 0, GL_DEPTH_STENCIL, GL_UNSIGNED_INT_24_8, NULL);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		//glTexParameteri(GL_TEXTURE_2D, GL_GENERATE_MIPMAP, GL_TRUE);
+		BindTexture(GL_TEXTURE_2D, 0);
+	}
 
 	// ----------------------------------------------------------------------
 
@@ -250,10 +228,10 @@ void ShadingBuffer::UpdateFBO()
 
 	// ------------------------ Define FrameBuffer Object------------------------
 
-	glBindFramebuffer(GL_FRAMEBUFFER, IDs[FBO]);
+	BindFramebuffer(GL_FRAMEBUFFER, IDs[FBO]);
 	glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, IDs[RENDER_TEXTURE], 0);
 	glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, IDs[BRIGHT_COLOR_TEXTURE], 0);
-	glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, IDs[DEPTH_TEXTURE], 0);
+	glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, sharedDepthStencil != 0 ? sharedDepthStencil : IDs[DEPTH_TEXTURE], 0);
 
 	GLenum frameBufferStatus = glCheckFramebufferStatus(GL_FRAMEBUFFER);
 	if (frameBufferStatus != GL_FRAMEBUFFER_COMPLETE)
@@ -274,62 +252,27 @@ void ShadingBuffer::UpdateFBO()
 
 	GLuint drawBuffers[] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
 	glDrawBuffers(2, drawBuffers);
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
-}
 
-void PingPongBuffer::ReserveMemory()
-{
-	glGenFramebuffers(2, pingPongFBO);
-	glGenTextures(2, pingPongTextures);
-}
+	// ------------------------ Bright Color only FrameBuffer Object------------------------
 
-void PingPongBuffer::FreeMemory()
-{
-	glDeleteTextures(2, pingPongTextures);
-	glDeleteFramebuffers(2, pingPongFBO);
+	BindFramebuffer(GL_FRAMEBUFFER, brightColorFBO);
+	glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, IDs[BRIGHT_COLOR_TEXTURE], 0);
+	glDrawBuffer(GL_COLOR_ATTACHMENT0);
+
+	BindFramebuffer(GL_FRAMEBUFFER, 0);
 }
 
-void PingPongBuffer::UpdateFBO()
+void ShadingBuffer::BindBrightColorTarget()
 {
-	for (u32 i = 0; i < 2; ++i)
-	{
-		glBindFramebuffer(GL_FRAMEBUFFER, pingPongFBO[i]);
-		glBindTexture(GL_TEXTURE_2D, pingPongTextures[i]);
-		glTexImage2D(
-			GL_TEXTURE_2D, 0, GL_RGBA16F, width, height, 0, GL_RGBA, GL_FLOAT, NULL
-		);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-		glFramebufferTexture2D(
-			GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, pingPongTextures[i], 0
-		);
-	}
-
-
+	BindFramebuffer(GL_FRAMEBUFFER, brightColorFBO);
 }
 
-void PingPongBuffer::BlurImage(int iterations, u32 colorTexture, Program shaderBlur, void (*f)())
+void ShadingBuffer::ShareDepthStencil(u32 depthStencilTexture)
 {
-	bool horizontal = true, first_iteration = true;
-	glUseProgram(shaderBlur.handle);
-	for (unsigned int i = 0; i < iterations; i++)
-	{
-		glBindFramebuffer(GL_FRAMEBUFFER, pingPongFBO[horizontal]);
-		glUniform1f(glGetUniformLocation(shaderBlur.handle, "horizontal"), horizontal);		
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D, first_iteration ? colorTexture : pingPongTextures[!horizontal]);
-		(*f)(); // RENDER QUAD FUNCTION 
-		horizontal = !horizontal;
-		if (first_iteration)
-			first_iteration = false;
-	}
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
-	glUseProgram(0);
+	sharedDepthStencil = depthStencilTexture;
 }
 
-u32 PingPongBuffer::GetBlurredTexture()
+u32 ShadingBuffer::GetDepthStencil()
 {
-	return pingPongTextures[0];
+	return sharedDepthStencil != 0 ? sharedDepthStencil : IDs[DEPTH_TEXTURE];
 }
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "platform.h"
+#include <glad/glad.h>
 
 enum RenderTargetType
 {
@@ -16,8 +17,6 @@ enum RenderTargetType
 	MAX
 };
 
-class Program;
-
 class FrameBufferObject
 {
 
@@ -36,7 +35,12 @@ public:
 
 	void Resize(float _width, float _height);
 
-	void Bind(bool aClear = true); 
+	// Deletes the targets, Initialize allocates them again
+	void Release();
+	bool IsInitialized() const;
+
+	// Only clears the buffers in clearMask, color is cleared to black
+	void Bind(GLbitfield clearMask = 0); 
 	void Unbind(); 
 
 	u32 GetTexture(RenderTargetType textureType);
@@ -46,9 +50,11 @@ protected:
 	float width = 0.f;
 	float height = 0.f; 
 
-	u32 IDs[RenderTargetType::MAX];
+	u32 IDs[RenderTargetType::MAX] = {};
 };
 
+// Same layout as the compact G-Buffer of the deferred pipeline: albedo, octahedral normals and the
+// depth stencil, positions are reconstructed from the depth
 class GBuffer : public FrameBufferObject
 {
 public: 
@@ -66,23 +72,19 @@ public:
 	void FreeMemory() override; 
 
 	void UpdateFBO() override;
-};
-
-class PingPongBuffer : public FrameBufferObject
-{
-public:
-	void ReserveMemory() override;
-	void FreeMemory() override;
 
-	void UpdateFBO() override;
+	// Framebuffer with only the bright color texture attached, to extract it from the render texture
+	void BindBrightColorTarget();
 
-	void BlurImage(int iterations, u32 colorTexture, Program shaderBlur, void (*f)());
+	// Attach this depth stencil texture (the G-Buffer one) instead of owning one, call before Initialize.
+	// 0 goes back to an own depth stencil.
+	void ShareDepthStencil(u32 depthStencilTexture);
 
-	u32 GetBlurredTexture();
+	// The attached depth stencil, shared or not
+	u32 GetDepthStencil();
 
 private:
 
-	u32 pingPongFBO[2];
-	u32 pingPongTextures[2];
-
+	u32 brightColorFBO = 0;
+	u32 sharedDepthStencil = 0;
 };
@@ -2,6 +2,9 @@
 
 #include "platform.h"
 
+// Contribution under which a point light is considered to no longer affect a pixel
+#define LIGHT_CUTOFF (1.0f / 256.0f)
+
 enum class LightType
 {
 	LIGHT_TYPE_POINT = 0,
@@ -15,6 +18,7 @@ struct Light
 	glm::vec3 direction;
 	glm::vec3 color;
 	unsigned int intensity; // From 0 to 100
+	float radius; // Influence radius of point lights, see CalculateRadius()
 
 	Light(){}
 	Light(glm::vec3 position, glm::vec3 color, LightType type = LightType::LIGHT_TYPE_POINT, glm::vec3 direction = glm::vec3(0.0f, -1.0f, -1.0f), unsigned int intensity = 100U)
@@ -23,7 +27,17 @@ struct Light
 		type(type),
 		direction(direction),
 		intensity(intensity)
-	{}
+	{
+		radius = CalculateRadius();
+	}
+
+	// Distance at which intensity / (1 + 0.3 * d + 0.5 * d^2) falls below LIGHT_CUTOFF
+	float CalculateRadius() const
+	{
+		float brightest = glm::max(glm::max(color.r, color.g), color.b) * (float)intensity * 0.01f;
+		float c = 1.0f - brightest / LIGHT_CUTOFF;
+		return glm::max(-0.3f + glm::sqrt(glm::max(0.09f - 2.0f * c, 0.0f)), 0.0f);
+	}
 
 	glm::mat4 CalculateLightRotation()
 	{
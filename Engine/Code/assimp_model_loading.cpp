@@ -208,6 +208,8 @@ u32 LoadModel(App* app, const char* filename)
 
     aiReleaseImport(scene);
 
+    ComputeMeshBounds(mesh);
+
     u32 vertexBufferSize = 0;
     u32 indexBufferSize = 0;
 
@@ -31,6 +31,19 @@ void BindBuffer(const Buffer& buffer)
     glBindBuffer(buffer.type, buffer.handle);
 }
 
+void GrowBuffer(Buffer& buffer, u32 requiredSize, GLenum usage)
+{
+    if (requiredSize <= buffer.size)
+        return;
+
+    while (buffer.size < requiredSize)
+        buffer.size *= 2;
+
+    glBindBuffer(buffer.type, buffer.handle);
+    glBufferData(buffer.type, buffer.size, NULL, usage);
+    glBindBuffer(buffer.type, 0);
+}
+
 void MapBuffer(Buffer& buffer, GLenum access)
 {
     glBindBuffer(buffer.type, buffer.handle);
@@ -44,6 +57,79 @@ void UnmapBuffer(Buffer& buffer)
     glBindBuffer(buffer.type, 0);
 }
 
+RingBuffer CreateRingBuffer(u32 regionSize, u32 alignment, GLenum type)
+{
+    RingBuffer ring = {};
+    ring.regionSize = Align(regionSize, alignment);
+    ring.region = 0;
+    ring.buffer = CreateBuffer(ring.regionSize * FRAMES_IN_FLIGHT, type, GL_DYNAMIC_DRAW);
+
+    return ring;
+}
+
+void GrowRingBuffer(RingBuffer& ring, u32 regionSize)
+{
+    if (regionSize <= ring.regionSize)
+        return;
+
+    // Doubling keeps the region size a multiple of the alignment
+    while (ring.regionSize < regionSize)
+        ring.regionSize *= 2;
+
+    ring.buffer.size = ring.regionSize * FRAMES_IN_FLIGHT;
+    glBindBuffer(ring.buffer.type, ring.buffer.handle);
+    glBufferData(ring.buffer.type, ring.buffer.size, NULL, GL_DYNAMIC_DRAW);
+    glBindBuffer(ring.buffer.type, 0);
+
+    // Nothing reads the new storage yet
+    for (u32 i = 0; i < FRAMES_IN_FLIGHT; ++i)
+    {
+        if (ring.fences[i])
+            glDeleteSync(ring.fences[i]);
+        ring.fences[i] = 0;
+    }
+    ring.region = 0;
+}
+
+void MapRingRegion(RingBuffer& ring)
+{
+    GLsync& fence = ring.fences[ring.region];
+    if (fence)
+    {
+        // Only blocks when the CPU is FRAMES_IN_FLIGHT frames ahead
+        GLbitfield flags = 0;
+        while (glClientWaitSync(fence, flags, 1000000) == GL_TIMEOUT_EXPIRED)
+            flags = GL_SYNC_FLUSH_COMMANDS_BIT;
+
+        glDeleteSync(fence);
+        fence = 0;
+    }
+
+    const GLbitfield access = GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT;
+
+    glBindBuffer(ring.buffer.type, ring.buffer.handle);
+    ring.buffer.data = (u8*)glMapBufferRange(ring.buffer.type, RingRegionOffset(ring), ring.regionSize, access);
+    ring.buffer.head = 0;
+}
+
+void UnmapRingRegion(RingBuffer& ring)
+{
+    ASSERT(ring.buffer.head <= ring.regionSize, "Ring buffer region overflow");
+    UnmapBuffer(ring.buffer);
+    ring.buffer.data = NULL;
+}
+
+u32 RingRegionOffset(const RingBuffer& ring)
+{
+    return ring.region * ring.regionSize;
+}
+
+void FenceRingRegion(RingBuffer& ring)
+{
+    ring.fences[ring.region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    ring.region = (ring.region + 1) % FRAMES_IN_FLIGHT;
+}
+
 void AlignHead(Buffer& buffer, u32 alignment)
 {
     ASSERT(IsPowerOf2(alignment), "The alignment must be a power of 2");
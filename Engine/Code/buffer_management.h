@@ -21,10 +21,15 @@ Buffer CreateBuffer(u32 size, GLenum type, GLenum usage);
 #define CreateConstantBuffer(size) CreateBuffer(size, GL_UNIFORM_BUFFER, GL_STREAM_DRAW)
 #define CreateStaticVertexBuffer(size) CreateBuffer(size, GL_ARRAY_BUFFER, GL_STATIC_DRAW)
 #define CreateStaticIndexBuffer(size) CreateBuffer(size, GL_ELEMENT_ARRAY_BUFFER, GL_STATIC_DRAW)
+#define CreateDynamicVertexBuffer(size) CreateBuffer(size, GL_ARRAY_BUFFER, GL_STREAM_DRAW)
+#define CreateStorageBuffer(size) CreateBuffer(size, GL_SHADER_STORAGE_BUFFER, GL_DYNAMIC_COPY)
 
 
 void BindBuffer(const Buffer& buffer);
 
+// Reallocates the storage (same handle, contents lost) so it holds at least requiredSize bytes
+void GrowBuffer(Buffer& buffer, u32 requiredSize, GLenum usage);
+
 void MapBuffer(Buffer& buffer, GLenum access);
 
 void UnmapBuffer(Buffer& buffer);
@@ -33,6 +38,36 @@ void AlignHead(Buffer& buffer, u32 alignment);
 
 void PushAlignedData(Buffer& buffer, const void* data, u32 size, u32 alignment);
 
+// Frames the CPU may run ahead of the GPU when writing a ring buffer
+#define FRAMES_IN_FLIGHT 3
+
+// Buffer split in FRAMES_IN_FLIGHT regions, one written per frame. Each region is guarded by a fence
+// so it is mapped unsynchronized only once the GPU is done with the frame that last used it.
+struct RingBuffer
+{
+	Buffer buffer;
+	u32 regionSize;
+	u32 region;
+	GLsync fences[FRAMES_IN_FLIGHT];
+};
+
+RingBuffer CreateRingBuffer(u32 regionSize, u32 alignment, GLenum type);
+
+// Reallocates the storage (same handle, contents lost) so every region holds at least regionSize bytes,
+// the draws still reading the old regions keep the orphaned storage
+void GrowRingBuffer(RingBuffer& ring, u32 regionSize);
+
+// Waits for the current region and maps it, PushAlignedData(ring.buffer, ...) then writes into it
+void MapRingRegion(RingBuffer& ring);
+
+void UnmapRingRegion(RingBuffer& ring);
+
+// Offset of the current region in the buffer, add it to the head to bind what was pushed
+u32 RingRegionOffset(const RingBuffer& ring);
+
+// Call once the draws reading the current region were submitted, moves to the next region
+void FenceRingRegion(RingBuffer& ring);
+
 #define PushData(buffer, data, size) PushAlignedData(buffer, data, size, 1)
 #define PushUInt(buffer, value) { u32 v = value; PushAlignedData(buffer, &v, sizeof(v), 4); }
 #define PushVec3(buffer, value) PushAlignedData(buffer, value_ptr(value), sizeof(value), sizeof(vec4))
@@ -0,0 +1,474 @@
+#include "bvh.h"
+#include <xmmintrin.h>
+#include <algorithm>
+#include <float.h>
+
+// Lanes of the four boxes of a node or of up to four leaf items
+struct BoxLanes
+{
+	__m128 minX, minY, minZ;
+	__m128 maxX, maxY, maxZ;
+};
+
+static BoxLanes LoadNodeLanes(const BVHNode& node)
+{
+	BoxLanes lanes;
+	lanes.minX = _mm_loadu_ps(node.minX);
+	lanes.minY = _mm_loadu_ps(node.minY);
+	lanes.minZ = _mm_loadu_ps(node.minZ);
+	lanes.maxX = _mm_loadu_ps(node.maxX);
+	lanes.maxY = _mm_loadu_ps(node.maxY);
+	lanes.maxZ = _mm_loadu_ps(node.maxZ);
+	return lanes;
+}
+
+// Gathers the boxes of a leaf, lanes past count get an empty box
+static BoxLanes LoadItemLanes(const BVH& bvh, u32 firstItem, u32 count)
+{
+	float minX[4], minY[4], minZ[4], maxX[4], maxY[4], maxZ[4];
+	for (u32 i = 0; i < 4; ++i)
+	{
+		const AABB box = i < count ? bvh.itemBounds[bvh.items[firstItem + i]] : AABB{ glm::vec3(FLT_MAX), glm::vec3(-FLT_MAX) };
+		minX[i] = box.min.x; minY[i] = box.min.y; minZ[i] = box.min.z;
+		maxX[i] = box.max.x; maxY[i] = box.max.y; maxZ[i] = box.max.z;
+	}
+
+	BoxLanes lanes;
+	lanes.minX = _mm_loadu_ps(minX);
+	lanes.minY = _mm_loadu_ps(minY);
+	lanes.minZ = _mm_loadu_ps(minZ);
+	lanes.maxX = _mm_loadu_ps(maxX);
+	lanes.maxY = _mm_loadu_ps(maxY);
+	lanes.maxZ = _mm_loadu_ps(maxZ);
+	return lanes;
+}
+
+static void SetLane(BVHNode& node, u32 lane, const AABB& box)
+{
+	node.minX[lane] = box.min.x; node.minY[lane] = box.min.y; node.minZ[lane] = box.min.z;
+	node.maxX[lane] = box.max.x; node.maxY[lane] = box.max.y; node.maxZ[lane] = box.max.z;
+}
+
+static AABB GetLane(const BVHNode& node, u32 lane)
+{
+	return { glm::vec3(node.minX[lane], node.minY[lane], node.minZ[lane]), glm::vec3(node.maxX[lane], node.maxY[lane], node.maxZ[lane]) };
+}
+
+static AABB EmptyAABB()
+{
+	return { glm::vec3(FLT_MAX), glm::vec3(-FLT_MAX) };
+}
+
+static AABB ItemsBounds(const BVH& bvh, u32 first, u32 count)
+{
+	AABB box = EmptyAABB();
+	for (u32 i = first; i < first + count; ++i)
+		box = MergeAABB(box, bvh.itemBounds[bvh.items[i]]);
+	return box;
+}
+
+// Orders items [first, first + count) so the first half has the lower centroids on the widest axis
+static u32 SplitAtMedian(BVH& bvh, u32 first, u32 count)
+{
+	AABB centroids = EmptyAABB();
+	for (u32 i = first; i < first + count; ++i)
+	{
+		const AABB& box = bvh.itemBounds[bvh.items[i]];
+		const glm::vec3 centroid = (box.min + box.max) * 0.5f;
+		centroids.min = glm::min(centroids.min, centroid);
+		centroids.max = glm::max(centroids.max, centroid);
+	}
+
+	const glm::vec3 extent = centroids.max - centroids.min;
+	const u32 axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+
+	const u32 half = count / 2;
+	const std::vector<AABB>& bounds = bvh.itemBounds;
+	std::nth_element(bvh.items.begin() + first, bvh.items.begin() + first + half, bvh.items.begin() + first + count,
+		[&bounds, axis](u32 a, u32 b) { return bounds[a].min[axis] + bounds[a].max[axis] < bounds[b].min[axis] + bounds[b].max[axis]; });
+
+	return half;
+}
+
+static u32 BuildNode(BVH& bvh, u32 first, u32 count)
+{
+	const u32 nodeIndex = bvh.nodes.size();
+	bvh.nodes.push_back(BVHNode{});
+
+	// Up to four groups: the range split in halves, and each half in halves again
+	u32 groupFirst[BVH_WIDTH];
+	u32 groupCount[BVH_WIDTH];
+	u32 groups = 0;
+
+	if (count <= BVH_LEAF_SIZE)
+	{
+		groupFirst[0] = first;
+		groupCount[0] = count;
+		groups = 1;
+	}
+	else
+	{
+		const u32 half = SplitAtMedian(bvh, first, count);
+		const u32 halfFirst[2] = { first, first + half };
+		const u32 halfCount[2] = { half, count - half };
+
+		for (u32 h = 0; h < 2; ++h)
+		{
+			if (halfCount[h] <= BVH_LEAF_SIZE)
+			{
+				groupFirst[groups] = halfFirst[h];
+				groupCount[groups++] = halfCount[h];
+				continue;
+			}
+
+			const u32 quarter = SplitAtMedian(bvh, halfFirst[h], halfCount[h]);
+			groupFirst[groups] = halfFirst[h];
+			groupCount[groups++] = quarter;
+			groupFirst[groups] = halfFirst[h] + quarter;
+			groupCount[groups++] = halfCount[h] - quarter;
+		}
+	}
+
+	// Children are built first and the node filled after, the vector may reallocate meanwhile
+	u32 child[BVH_WIDTH];
+	u32 itemCount[BVH_WIDTH];
+	AABB box[BVH_WIDTH];
+
+	for (u32 lane = 0; lane < BVH_WIDTH; ++lane)
+	{
+		if (lane >= groups || groupCount[lane] == 0)
+		{
+			child[lane] = BVH_INVALID;
+			itemCount[lane] = 0;
+			box[lane] = EmptyAABB();
+		}
+		else if (groupCount[lane] <= BVH_LEAF_SIZE)
+		{
+			child[lane] = groupFirst[lane];
+			itemCount[lane] = groupCount[lane];
+			box[lane] = ItemsBounds(bvh, groupFirst[lane], groupCount[lane]);
+		}
+		else
+		{
+			child[lane] = BuildNode(bvh, groupFirst[lane], groupCount[lane]);
+			itemCount[lane] = 0;
+			box[lane] = ItemsBounds(bvh, groupFirst[lane], groupCount[lane]);
+		}
+	}
+
+	BVHNode& node = bvh.nodes[nodeIndex];
+	for (u32 lane = 0; lane < BVH_WIDTH; ++lane)
+	{
+		node.child[lane] = child[lane];
+		node.itemCount[lane] = itemCount[lane];
+		SetLane(node, lane, box[lane]);
+	}
+
+	return nodeIndex;
+}
+
+void BuildBVH(BVH& bvh, const std::vector<AABB>& itemBounds)
+{
+	bvh.nodes.clear();
+	bvh.itemBounds = itemBounds;
+	bvh.items.resize(itemBounds.size());
+	for (u32 i = 0; i < bvh.items.size(); ++i)
+		bvh.items[i] = i;
+
+	BuildNode(bvh, 0, bvh.items.size());
+}
+
+void RefitBVH(BVH& bvh, const std::vector<u32>& moved, const std::vector<AABB>& itemBounds)
+{
+	if (moved.empty())
+		return;
+
+	for (u32 i = 0; i < moved.size(); ++i)
+		bvh.itemBounds[moved[i]] = itemBounds[moved[i]];
+
+	// Children come after their parent, walking backwards refits them first
+	for (u32 n = bvh.nodes.size(); n-- > 0;)
+	{
+		BVHNode& node = bvh.nodes[n];
+		for (u32 lane = 0; lane < BVH_WIDTH; ++lane)
+		{
+			if (node.child[lane] == BVH_INVALID)
+				continue;
+
+			AABB box = EmptyAABB();
+			if (node.itemCount[lane] > 0)
+			{
+				box = ItemsBounds(bvh, node.child[lane], node.itemCount[lane]);
+			}
+			else
+			{
+				const BVHNode& childNode = bvh.nodes[node.child[lane]];
+				for (u32 c = 0; c < BVH_WIDTH; ++c)
+				{
+					if (childNode.child[c] != BVH_INVALID)
+						box = MergeAABB(box, GetLane(childNode, c));
+				}
+			}
+			SetLane(node, lane, box);
+		}
+	}
+}
+
+// Lanes whose box is not fully outside one of the planes in planeMask. straddledPlanes gets, per
+// lane, the planes of planeMask its box crosses; a box inside all of them needs no more tests.
+static u32 TestFrustumLanes(const BoxLanes& lanes, const glm::vec4 planes[6], u32 planeMask, u32 straddledPlanes[BVH_WIDTH])
+{
+	__m128 outside = _mm_setzero_ps();
+	for (u32 lane = 0; lane < BVH_WIDTH; ++lane)
+		straddledPlanes[lane] = 0;
+
+	for (u32 p = 0; p < 6; ++p)
+	{
+		if (!(planeMask & (1u << p)))
+			continue;
+
+		const glm::vec4& plane = planes[p];
+
+		// Corner furthest along the normal (the last to leave the inside) and the nearest one
+		const __m128 farX  = plane.x > 0.0f ? lanes.maxX : lanes.minX;
+		const __m128 farY  = plane.y > 0.0f ? lanes.maxY : lanes.minY;
+		const __m128 farZ  = plane.z > 0.0f ? lanes.maxZ : lanes.minZ;
+		const __m128 nearX = plane.x > 0.0f ? lanes.minX : lanes.maxX;
+		const __m128 nearY = plane.y > 0.0f ? lanes.minY : lanes.maxY;
+		const __m128 nearZ = plane.z > 0.0f ? lanes.minZ : lanes.maxZ;
+
+		const __m128 nx = _mm_set1_ps(plane.x);
+		const __m128 ny = _mm_set1_ps(plane.y);
+		const __m128 nz = _mm_set1_ps(plane.z);
+		const __m128 d = _mm_set1_ps(plane.w);
+
+		const __m128 farDistance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, farX), _mm_mul_ps(ny, farY)), _mm_add_ps(_mm_mul_ps(nz, farZ), d));
+		const __m128 nearDistance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, nearX), _mm_mul_ps(ny, nearY)), _mm_add_ps(_mm_mul_ps(nz, nearZ), d));
+
+		outside = _mm_or_ps(outside, _mm_cmplt_ps(farDistance, _mm_setzero_ps()));
+
+		const u32 straddling = (u32)_mm_movemask_ps(_mm_cmplt_ps(nearDistance, _mm_setzero_ps()));
+		for (u32 lane = 0; lane < BVH_WIDTH; ++lane)
+		{
+			if (straddling & (1u << lane))
+				straddledPlanes[lane] |= 1u << p;
+		}
+	}
+
+	return ~(u32)_mm_movemask_ps(outside) & 0xF;
+}
+
+// Every item below a node, for subtrees found fully inside
+static void CollectItems(const BVH& bvh, u32 nodeIndex, std::vector<u32>& items)
+{
+	const BVHNode& node = bvh.nodes[nodeIndex];
+	for (u32 lane = 0; lane < BVH_WIDTH; ++lane)
+	{
+		if (node.child[lane] == BVH_INVALID)
+			continue;
+
+		if (node.itemCount[lane] > 0)
+		{
+			for (u32 i = 0; i < node.itemCount[lane]; ++i)
+				items.push_back(bvh.items[node.child[lane] + i]);
+		}
+		else
+		{
+			CollectItems(bvh, node.child[lane], items);
+		}
+	}
+}
+
+struct CullStackEntry
+{
+	u32 node;
+	u32 planeMask; // planes the node box still straddles
+};
+
+void CullBVH(const BVH& bvh, const glm::vec4 planes[6], std::vector<u32>& visibleItems)
+{
+	visibleItems.clear();
+	if (bvh.items.empty())
+		return;
+
+	CullStackEntry stack[64];
+	u32 stackSize = 0;
+	stack[stackSize++] = { 0, 0x3F };
+
+	while (stackSize > 0)
+	{
+		const CullStackEntry entry = stack[--stackSize];
+		const BVHNode& node = bvh.nodes[entry.node];
+
+		u32 straddledPlanes[BVH_WIDTH];
+		const u32 visibleMask = TestFrustumLanes(LoadNodeLanes(node), planes, entry.planeMask, straddledPlanes);
+
+		for (u32 lane = 0; lane < BVH_WIDTH; ++lane)
+		{
+			if (!(visibleMask & (1u << lane)) || node.child[lane] == BVH_INVALID)
+				continue;
+
+			const u32 first = node.child[lane];
+			const u32 count = node.itemCount[lane];
+
+			if (count > 0)
+			{
+				// Leaf items are tested four at a time, against the planes the leaf box crosses
+				u32 itemStraddledPlanes[BVH_WIDTH];
+				const u32 itemMask = straddledPlanes[lane] == 0 ? 0xF : TestFrustumLanes(LoadItemLanes(bvh, first, count), planes, straddledPlanes[lane], itemStraddledPlanes);
+				for (u32 i = 0; i < count; ++i)
+				{
+					if (itemMask & (1u << i))
+						visibleItems.push_back(bvh.items[first + i]);
+				}
+			}
+			else if (straddledPlanes[lane] == 0)
+			{
+				CollectItems(bvh, first, visibleItems);
+			}
+			else
+			{
+				ASSERT(stackSize < ARRAY_COUNT(stack), "BVH deeper than the traversal stack");
+				stack[stackSize++] = { first, straddledPlanes[lane] };
+			}
+		}
+	}
+}
+
+// Entry distance of the ray into each box, FLT_MAX for the lanes it misses
+static __m128 IntersectRayLanes(const BoxLanes& lanes, const __m128 origin[3], const __m128 inverseDirection[3], float maxDistance)
+{
+	const __m128 t0x = _mm_mul_ps(_mm_sub_ps(lanes.minX, origin[0]), inverseDirection[0]);
+	const __m128 t1x = _mm_mul_ps(_mm_sub_ps(lanes.maxX, origin[0]), inverseDirection[0]);
+	const __m128 t0y = _mm_mul_ps(_mm_sub_ps(lanes.minY, origin[1]), inverseDirection[1]);
+	const __m128 t1y = _mm_mul_ps(_mm_sub_ps(lanes.maxY, origin[1]), inverseDirection[1]);
+	const __m128 t0z = _mm_mul_ps(_mm_sub_ps(lanes.minZ, origin[2]), inverseDirection[2]);
+	const __m128 t1z = _mm_mul_ps(_mm_sub_ps(lanes.maxZ, origin[2]), inverseDirection[2]);
+
+	__m128 entry = _mm_max_ps(_mm_max_ps(_mm_min_ps(t0x, t1x), _mm_min_ps(t0y, t1y)), _mm_min_ps(t0z, t1z));
+	__m128 exit = _mm_min_ps(_mm_min_ps(_mm_max_ps(t0x, t1x), _mm_max_ps(t0y, t1y)), _mm_max_ps(t0z, t1z));
+	entry = _mm_max_ps(entry, _mm_setzero_ps());
+	exit = _mm_min_ps(exit, _mm_set1_ps(maxDistance));
+
+	const __m128 hit = _mm_cmple_ps(entry, exit);
+	return _mm_or_ps(_mm_and_ps(hit, entry), _mm_andnot_ps(hit, _mm_set1_ps(FLT_MAX)));
+}
+
+u32 RaycastBVH(const BVH& bvh, const glm::vec3& origin, const glm::vec3& direction, float maxDistance, float* hitDistance)
+{
+	u32 closestItem = BVH_INVALID;
+	float closestDistance = maxDistance;
+	if (bvh.items.empty())
+		return closestItem;
+
+	// Axis aligned rays would divide by zero, a tiny component keeps the slabs finite
+	__m128 origins[3];
+	__m128 inverseDirection[3];
+	for (u32 axis = 0; axis < 3; ++axis)
+	{
+		const float component = fabsf(direction[axis]) > 1e-8f ? direction[axis] : 1e-8f;
+		origins[axis] = _mm_set1_ps(origin[axis]);
+		inverseDirection[axis] = _mm_set1_ps(1.0f / component);
+	}
+
+	u32 stack[64];
+	u32 stackSize = 0;
+	stack[stackSize++] = 0;
+
+	while (stackSize > 0)
+	{
+		const BVHNode& node = bvh.nodes[stack[--stackSize]];
+
+		float distances[BVH_WIDTH];
+		_mm_storeu_ps(distances, IntersectRayLanes(LoadNodeLanes(node), origins, inverseDirection, closestDistance));
+
+		for (u32 lane = 0; lane < BVH_WIDTH; ++lane)
+		{
+			if (node.child[lane] == BVH_INVALID || distances[lane] == FLT_MAX)
+				continue;
+
+			const u32 first = node.child[lane];
+			const u32 count = node.itemCount[lane];
+
+			if (count > 0)
+			{
+				float itemDistances[4];
+				_mm_storeu_ps(itemDistances, IntersectRayLanes(LoadItemLanes(bvh, first, count), origins, inverseDirection, closestDistance));
+				for (u32 i = 0; i < count; ++i)
+				{
+					if (itemDistances[i] != FLT_MAX && (closestItem == BVH_INVALID || itemDistances[i] < closestDistance))
+					{
+						closestDistance = itemDistances[i];
+						closestItem = bvh.items[first + i];
+					}
+				}
+			}
+			else
+			{
+				ASSERT(stackSize < ARRAY_COUNT(stack), "BVH deeper than the traversal stack");
+				stack[stackSize++] = first;
+			}
+		}
+	}
+
+	if (hitDistance && closestItem != BVH_INVALID)
+		*hitDistance = closestDistance;
+
+	return closestItem;
+}
+
+// Lanes whose box is closer to the center than the radius
+static u32 TestSphereLanes(const BoxLanes& lanes, const __m128 center[3], __m128 radiusSquared)
+{
+	// Distance from the center to the closest point of each box, per axis
+	const __m128 dx = _mm_sub_ps(center[0], _mm_min_ps(_mm_max_ps(center[0], lanes.minX), lanes.maxX));
+	const __m128 dy = _mm_sub_ps(center[1], _mm_min_ps(_mm_max_ps(center[1], lanes.minY), lanes.maxY));
+	const __m128 dz = _mm_sub_ps(center[2], _mm_min_ps(_mm_max_ps(center[2], lanes.minZ), lanes.maxZ));
+
+	const __m128 distanceSquared = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+	return (u32)_mm_movemask_ps(_mm_cmple_ps(distanceSquared, radiusSquared));
+}
+
+void QuerySphereBVH(const BVH& bvh, const glm::vec3& center, float radius, std::vector<u32>& items)
+{
+	items.clear();
+	if (bvh.items.empty())
+		return;
+
+	const __m128 centers[3] = { _mm_set1_ps(center.x), _mm_set1_ps(center.y), _mm_set1_ps(center.z) };
+	const __m128 radiusSquared = _mm_set1_ps(radius * radius);
+
+	u32 stack[64];
+	u32 stackSize = 0;
+	stack[stackSize++] = 0;
+
+	while (stackSize > 0)
+	{
+		const BVHNode& node = bvh.nodes[stack[--stackSize]];
+		const u32 touchedMask = TestSphereLanes(LoadNodeLanes(node), centers, radiusSquared);
+
+		for (u32 lane = 0; lane < BVH_WIDTH; ++lane)
+		{
+			if (!(touchedMask & (1u << lane)) || node.child[lane] == BVH_INVALID)
+				continue;
+
+			const u32 first = node.child[lane];
+			const u32 count = node.itemCount[lane];
+
+			if (count > 0)
+			{
+				const u32 itemMask = TestSphereLanes(LoadItemLanes(bvh, first, count), centers, radiusSquared);
+				for (u32 i = 0; i < count; ++i)
+				{
+					if (itemMask & (1u << i))
+						items.push_back(bvh.items[first + i]);
+				}
+			}
+			else
+			{
+				ASSERT(stackSize < ARRAY_COUNT(stack), "BVH deeper than the traversal stack");
+				stack[stackSize++] = first;
+			}
+		}
+	}
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include "platform.h"
+#include "geometry.h"
+
+// Bounding volume hierarchy over world space boxes, one item per entity. Nodes are 4 wide and keep
+// the boxes of their four children side by side, so the frustum, ray and sphere queries test the
+// children of a node at once with SSE.
+//
+// BuildBVH splits at the median of the widest axis, top down. When items only moved, RefitBVH
+// grows and shrinks the boxes bottom up and the items keep their leaves, which is cheap but lets
+// the tree degrade if things travel far; adding items rebuilds it.
+
+#define BVH_WIDTH     4
+#define BVH_LEAF_SIZE 4
+#define BVH_INVALID   0xFFFFFFFF
+
+struct BVHNode
+{
+	// Boxes of the children, one lane each
+	float minX[BVH_WIDTH], minY[BVH_WIDTH], minZ[BVH_WIDTH];
+	float maxX[BVH_WIDTH], maxY[BVH_WIDTH], maxZ[BVH_WIDTH];
+
+	// An inner child is the node at child, a leaf child the itemCount items from child in
+	// BVH::items. Unused lanes have child BVH_INVALID and an empty box.
+	u32 child[BVH_WIDTH];
+	u32 itemCount[BVH_WIDTH];
+};
+
+struct BVH
+{
+	std::vector<BVHNode> nodes;      // nodes[0] is the root, children always come after their parent
+	std::vector<u32>     items;      // item indices grouped per leaf
+	std::vector<AABB>    itemBounds; // indexed by item
+};
+
+void BuildBVH(BVH& bvh, const std::vector<AABB>& itemBounds);
+
+// Takes the new box of every item in moved, the tree keeps its shape
+void RefitBVH(BVH& bvh, const std::vector<u32>& moved, const std::vector<AABB>& itemBounds);
+
+// Items whose box is at least partially inside the six planes (normals pointing inside, see
+// Camera::frustumPlanes)
+void CullBVH(const BVH& bvh, const glm::vec4 planes[6], std::vector<u32>& visibleItems);
+
+// Closest item whose box the ray hits within maxDistance, BVH_INVALID if none. The distance is the
+// ray entry into the box, direction has to be normalized for it to be in world units.
+u32 RaycastBVH(const BVH& bvh, const glm::vec3& origin, const glm::vec3& direction, float maxDistance, float* hitDistance);
+
+// Items whose box touches the sphere
+void QuerySphereBVH(const BVH& bvh, const glm::vec3& center, float radius, std::vector<u32>& items);
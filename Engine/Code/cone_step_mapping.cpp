@@ -0,0 +1,220 @@
+#include "cone_step_mapping.h"
+
+// Cone ratios are clamped to this, wider cones do not shorten the ray any further at usable view angles
+#define CONE_STEP_MAX_RATIO 1.0f
+
+#define CONE_STEP_MAP_FILE_MAGIC 0x314E4F43 // "CON1"
+
+struct ConeStepMapFileHeader
+{
+	u32 magic;
+	u32 width;
+	u32 height;
+	u32 maxSize;
+	u64 sourceTimestamp;
+};
+
+// Highest surface (smallest depth) of the 2^level x 2^level texel blocks, level 0 being the depths
+struct ConeStepMapBuild
+{
+	std::vector<std::vector<float>> levels;
+	std::vector<u32> levelWidths;
+	std::vector<u32> levelHeights;
+	u32 width;
+	u32 height;
+	u8* texels;
+};
+
+static void BuildMinDepthPyramid(ConeStepMapBuild& build, std::vector<float>& depths)
+{
+	build.levels.push_back(std::move(depths));
+	build.levelWidths.push_back(build.width);
+	build.levelHeights.push_back(build.height);
+
+	while (build.levelWidths.back() > 1 || build.levelHeights.back() > 1)
+	{
+		const std::vector<float>& finer = build.levels.back();
+		const u32 finerWidth = build.levelWidths.back();
+		const u32 finerHeight = build.levelHeights.back();
+		const u32 width = (finerWidth + 1) / 2;
+		const u32 height = (finerHeight + 1) / 2;
+
+		std::vector<float> level(width * height);
+		for (u32 y = 0; y < height; ++y)
+		{
+			for (u32 x = 0; x < width; ++x)
+			{
+				const u32 x0 = 2 * x, x1 = glm::min(2 * x + 1, finerWidth - 1);
+				const u32 y0 = 2 * y, y1 = glm::min(2 * y + 1, finerHeight - 1);
+				level[y * width + x] = glm::min(glm::min(finer[y0 * finerWidth + x0], finer[y0 * finerWidth + x1]),
+					glm::min(finer[y1 * finerWidth + x0], finer[y1 * finerWidth + x1]));
+			}
+		}
+
+		build.levels.push_back(std::move(level));
+		build.levelWidths.push_back(width);
+		build.levelHeights.push_back(height);
+	}
+}
+
+// A ray from the top of q down to p crosses the surface before p exactly when it passes under some
+// texel s higher than p, which happens for every q far enough behind s: the farthest such q along
+// the direction of s is at distance(p, s) * pDepth / (pDepth - depth(s)). The cone of p is then the
+// smallest distance(p, s) / (pDepth - depth(s)) over the texels above it. Distances are taken to the
+// closest point of each texel rather than its centre, so filtering between texels never lets a ray
+// through a cone that the texel centres alone would allow.
+//
+// Blocks of the pyramid bound it with their closest texel and their highest surface, so whole
+// blocks are skipped as soon as none of their texels could narrow the cone any more.
+static float RelaxedConeRatio(const ConeStepMapBuild& build, int px, int py)
+{
+	const float pDepth = build.levels[0][py * build.width + px];
+	if (pDepth <= 0.0f)
+		return CONE_STEP_MAX_RATIO;
+
+	float ratio = CONE_STEP_MAX_RATIO;
+
+	struct Block { u32 level, x, y; };
+	Block stack[4 * 32];
+	u32 stackSize = 0;
+	stack[stackSize++] = { (u32)build.levels.size() - 1, 0, 0 };
+
+	while (stackSize > 0)
+	{
+		const Block block = stack[--stackSize];
+		const float blockDepth = build.levels[block.level][block.y * build.levelWidths[block.level] + block.x];
+		if (blockDepth >= pDepth)
+			continue;
+
+		// Closest point of the block to p, texels covering half a texel around their centre, in texture space
+		const int x0 = block.x << block.level;
+		const int y0 = block.y << block.level;
+		const int x1 = glm::min((int)((block.x + 1) << block.level), (int)build.width) - 1;
+		const int y1 = glm::min((int)((block.y + 1) << block.level), (int)build.height) - 1;
+		const float u = glm::max((float)glm::max(x0 - px, px - x1) - 0.5f, 0.0f) / (float)build.width;
+		const float v = glm::max((float)glm::max(y0 - py, py - y1) - 0.5f, 0.0f) / (float)build.height;
+
+		const float bound = sqrtf(u * u + v * v) / (pDepth - blockDepth);
+		if (bound >= ratio)
+			continue;
+
+		if (block.level == 0)
+		{
+			ratio = bound;
+			continue;
+		}
+
+		// The children on the side of p are popped first, the cone narrows sooner and prunes more
+		const u32 level = block.level - 1;
+		const u32 nearX = px < ((2 * block.x + 1) << level) ? 0 : 1;
+		const u32 nearY = py < ((2 * block.y + 1) << level) ? 0 : 1;
+		for (u32 child = 4; child-- > 0;)
+		{
+			const u32 x = 2 * block.x + (nearX ^ (child & 1));
+			const u32 y = 2 * block.y + (nearY ^ (child >> 1));
+			if (x < build.levelWidths[level] && y < build.levelHeights[level])
+				stack[stackSize++] = { level, x, y };
+		}
+	}
+
+	return ratio;
+}
+
+static void BuildConeStepRow(const ConeStepMapBuild& build, u32 y)
+{
+	for (u32 x = 0; x < build.width; ++x)
+	{
+		const float ratio = RelaxedConeRatio(build, x, y);
+
+		u8* texel = build.texels + 2 * (y * build.width + x);
+		texel[0] = (u8)(build.levels[0][y * build.width + x] * 255.0f + 0.5f);
+		texel[1] = (u8)(sqrtf(ratio / CONE_STEP_MAX_RATIO) * 255.0f + 0.5f);
+	}
+}
+
+void BuildConeStepMap(const u8* pixels, u32 width, u32 height, u32 channels, ConeStepMap& coneMap)
+{
+	ASSERT(pixels != NULL && width > 0 && height > 0, "Invalid depth map");
+
+	coneMap.width = glm::min(width, (u32)CONE_STEP_MAP_MAX_SIZE);
+	coneMap.height = glm::min(height, (u32)CONE_STEP_MAP_MAX_SIZE);
+	coneMap.texels.resize(2 * coneMap.width * coneMap.height);
+
+	// Box filtered down to the cone map size
+	std::vector<float> depths(coneMap.width * coneMap.height);
+	for (u32 y = 0; y < coneMap.height; ++y)
+	{
+		const u32 y0 = y * height / coneMap.height;
+		const u32 y1 = glm::max((y + 1) * height / coneMap.height, y0 + 1);
+
+		for (u32 x = 0; x < coneMap.width; ++x)
+		{
+			const u32 x0 = x * width / coneMap.width;
+			const u32 x1 = glm::max((x + 1) * width / coneMap.width, x0 + 1);
+
+			u32 sum = 0;
+			for (u32 sy = y0; sy < y1; ++sy)
+				for (u32 sx = x0; sx < x1; ++sx)
+					sum += pixels[(sy * width + sx) * channels];
+
+			depths[y * coneMap.width + x] = sum / (255.0f * (y1 - y0) * (x1 - x0));
+		}
+	}
+
+	ConeStepMapBuild build = {};
+	build.width = coneMap.width;
+	build.height = coneMap.height;
+	build.texels = coneMap.texels.data();
+	BuildMinDepthPyramid(build, depths);
+
+	// Rows with deep texels search more blocks, the idle workers steal the rest
+	ParallelFor(build.height, 1, [&build](u32 y) {
+		BuildConeStepRow(build, y);
+	});
+}
+
+void SaveConeStepMapCache(const ConeStepMap& coneMap, u64 sourceTimestamp, const char* filepath)
+{
+	ConeStepMapFileHeader header = {};
+	header.magic = CONE_STEP_MAP_FILE_MAGIC;
+	header.width = coneMap.width;
+	header.height = coneMap.height;
+	header.maxSize = CONE_STEP_MAP_MAX_SIZE;
+	header.sourceTimestamp = sourceTimestamp;
+
+	FILE* file = fopen(filepath, "wb");
+	if (!file)
+	{
+		ELOG("fopen() failed writing file %s", filepath);
+		return;
+	}
+
+	fwrite(&header, sizeof(header), 1, file);
+	fwrite(coneMap.texels.data(), sizeof(u8), coneMap.texels.size(), file);
+	fclose(file);
+}
+
+bool LoadConeStepMapCache(ConeStepMap& coneMap, u64 sourceTimestamp, const char* filepath)
+{
+	FILE* file = fopen(filepath, "rb");
+	if (!file)
+		return false;
+
+	// Maps cached at another size or before the depth map changed are rebuilt
+	ConeStepMapFileHeader header = {};
+	if (fread(&header, sizeof(header), 1, file) != 1 || header.magic != CONE_STEP_MAP_FILE_MAGIC ||
+		header.maxSize != CONE_STEP_MAP_MAX_SIZE || header.sourceTimestamp != sourceTimestamp ||
+		header.width == 0 || header.width > CONE_STEP_MAP_MAX_SIZE || header.height == 0 || header.height > CONE_STEP_MAP_MAX_SIZE)
+	{
+		fclose(file);
+		return false;
+	}
+
+	coneMap.width = header.width;
+	coneMap.height = header.height;
+	coneMap.texels.resize(2 * header.width * header.height);
+	const bool complete = fread(coneMap.texels.data(), sizeof(u8), coneMap.texels.size(), file) == coneMap.texels.size();
+	fclose(file);
+
+	return complete;
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include "platform.h"
+
+// Relaxed cone step maps (Policarpo and Oliveira, GPU Gems 3 chapter 18) for the relief surfaces.
+//
+// Every texel stores the ratio (horizontal distance / depth) of the widest cone, with its apex on
+// the surface at the texel, that any view ray entering it from above crosses the surface at most
+// once within. The relief shader steps a ray from cone to cone and finishes with a short binary
+// search, instead of marching it through dozens of evenly spaced depth layers.
+
+// Cone maps are built at this size at most: the cones only bound the ray steps, the binary search
+// still finds the intersection in the full resolution depth map
+#define CONE_STEP_MAP_MAX_SIZE 256
+
+struct ConeStepMap
+{
+	u32 width;
+	u32 height;
+	std::vector<u8> texels; // RG8: depth, square root of the cone ratio (more precision for narrow cones)
+};
+
+// Built cone maps are cached next to their depth map, in depth map path + CONE_STEP_MAP_CACHE_EXTENSION,
+// and rebuilt when the depth map is written after the cache
+#define CONE_STEP_MAP_CACHE_EXTENSION ".cone"
+
+// Builds the cone map of a depth map (first channel of pixels, white is deepest) on the job system
+void BuildConeStepMap(const u8* pixels, u32 width, u32 height, u32 channels, ConeStepMap& coneMap);
+
+// Writes the cone map with the last write time of the depth map it was built from
+void SaveConeStepMapCache(const ConeStepMap& coneMap, u64 sourceTimestamp, const char* filepath);
+
+// Reads a cached cone map, false if it is missing, malformed or not built from the depth map as of sourceTimestamp
+bool LoadConeStepMapCache(ConeStepMap& coneMap, u64 sourceTimestamp, const char* filepath);
@@ -10,6 +10,7 @@
 #include <stb_image.h>
 #include <stb_image_write.h>
 #include<time.h>
+#include <algorithm>
 
 
 
@@ -82,7 +83,7 @@ GLuint CreateProgramFromSource(String programSource, const char* shaderName)
         ELOG("glLinkProgram() failed with program %s\nReported message:\n%s\n", shaderName, infoLogBuffer);
     }
 
-    glUseProgram(0);
+    UseProgram(0);
 
     glDetachShader(programHandle, vshader);
     glDetachShader(programHandle, fshader);
@@ -92,6 +93,57 @@ GLuint CreateProgramFromSource(String programSource, const char* shaderName)
     return programHandle;
 }
 
+GLuint CreateComputeProgramFromSource(String programSource, const char* shaderName)
+{
+    GLchar  infoLogBuffer[1024] = {};
+    GLsizei infoLogBufferSize = sizeof(infoLogBuffer);
+    GLsizei infoLogSize;
+    GLint   success;
+
+    char versionString[] = "#version 430\n";
+    char shaderNameDefine[128];
+    sprintf(shaderNameDefine, "#define %s\n", shaderName);
+    char computeShaderDefine[] = "#define COMPUTE\n";
+
+    const GLchar* computeShaderSource[] = {
+        versionString,
+        shaderNameDefine,
+        computeShaderDefine,
+        programSource.str
+    };
+    const GLint computeShaderLengths[] = {
+        (GLint) strlen(versionString),
+        (GLint) strlen(shaderNameDefine),
+        (GLint) strlen(computeShaderDefine),
+        (GLint) programSource.len
+    };
+
+    GLuint cshader = glCreateShader(GL_COMPUTE_SHADER);
+    glShaderSource(cshader, ARRAY_COUNT(computeShaderSource), computeShaderSource, computeShaderLengths);
+    glCompileShader(cshader);
+    glGetShaderiv(cshader, GL_COMPILE_STATUS, &success);
+    if (!success)
+    {
+        glGetShaderInfoLog(cshader, infoLogBufferSize, &infoLogSize, infoLogBuffer);
+        ELOG("glCompileShader() failed with compute shader %s\nReported message:\n%s\n", shaderName, infoLogBuffer);
+    }
+
+    GLuint programHandle = glCreateProgram();
+    glAttachShader(programHandle, cshader);
+    glLinkProgram(programHandle);
+    glGetProgramiv(programHandle, GL_LINK_STATUS, &success);
+    if (!success)
+    {
+        glGetProgramInfoLog(programHandle, infoLogBufferSize, &infoLogSize, infoLogBuffer);
+        ELOG("glLinkProgram() failed with program %s\nReported message:\n%s\n", shaderName, infoLogBuffer);
+    }
+
+    glDetachShader(programHandle, cshader);
+    glDeleteShader(cshader);
+
+    return programHandle;
+}
+
 u32 LoadProgram(App* app, const char* filepath, const char* programName)
 {
     String programSource = ReadTextFile(filepath);
@@ -101,6 +153,22 @@ u32 LoadProgram(App* app, const char* filepath, const char* programName)
     program.filepath = filepath;
     program.programName = programName;
     program.lastWriteTimestamp = GetFileLastWriteTimestamp(filepath);
+    ReflectProgram(program);
+    app->programs.push_back(program);
+
+    return app->programs.size() - 1;
+}
+
+u32 LoadComputeProgram(App* app, const char* filepath, const char* programName)
+{
+    String programSource = ReadTextFile(filepath);
+
+    Program program = {};
+    program.handle = CreateComputeProgramFromSource(programSource, programName);
+    program.filepath = filepath;
+    program.programName = programName;
+    program.lastWriteTimestamp = GetFileLastWriteTimestamp(filepath);
+    ReflectProgram(program);
     app->programs.push_back(program);
 
     return app->programs.size() - 1;
@@ -142,7 +210,7 @@ GLuint CreateTexture2DFromImage(Image image)
 
     GLuint texHandle;
     glGenTextures(1, &texHandle);
-    glBindTexture(GL_TEXTURE_2D, texHandle);
+    BindTexture(GL_TEXTURE_2D, texHandle);
     glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, image.size.x, image.size.y, 0, dataFormat, dataType, image.pixels);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR_MIPMAP_LINEAR);
@@ -150,7 +218,7 @@ GLuint CreateTexture2DFromImage(Image image)
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
     glGenerateMipmap(GL_TEXTURE_2D);
-    glBindTexture(GL_TEXTURE_2D, 0);
+    BindTexture(GL_TEXTURE_2D, 0);
 
     return texHandle;
 }
@@ -181,6 +249,82 @@ u32 LoadTexture2D(App* app, const char* filepath)
     }
 }
 
+u32 LoadConeStepMap(App* app, const char* depthMapPath)
+{
+    const std::string filepath = std::string(depthMapPath) + "#cone";
+    for (u32 texIdx = 0; texIdx < app->textures.size(); ++texIdx)
+        if (app->textures[texIdx].filepath == filepath)
+            return texIdx;
+
+    // The build is only paid the first time, or after the depth map changes
+    const u64 depthMapTimestamp = GetFileLastWriteTimestamp(depthMapPath);
+    const std::string cachePath = std::string(depthMapPath) + CONE_STEP_MAP_CACHE_EXTENSION;
+
+    ConeStepMap coneMap;
+    if (!LoadConeStepMapCache(coneMap, depthMapTimestamp, cachePath.c_str()))
+    {
+        Image image = LoadImage(depthMapPath);
+        if (!image.pixels)
+            return UINT32_MAX;
+
+        const f64 startTime = GetTime();
+        BuildConeStepMap((const u8*)image.pixels, image.size.x, image.size.y, image.nchannels, coneMap);
+        FreeImage(image);
+        ILOG("Cone step map of %s built in %.2f s", depthMapPath, GetTime() - startTime);
+
+        SaveConeStepMapCache(coneMap, depthMapTimestamp, cachePath.c_str());
+    }
+
+    // Linear filtering without mipmaps: the cone steps assume the cone of the nearby texels
+    Texture tex = {};
+    glGenTextures(1, &tex.handle);
+    BindTexture(GL_TEXTURE_2D, tex.handle);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RG8, coneMap.width, coneMap.height, 0, GL_RG, GL_UNSIGNED_BYTE, coneMap.texels.data());
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    BindTexture(GL_TEXTURE_2D, 0);
+    tex.filepath = filepath;
+
+    app->textures.push_back(tex);
+    return app->textures.size() - 1;
+}
+
+static ReliefMappingUniforms FindReliefMappingUniforms(const Program& program)
+{
+	ReliefMappingUniforms uniforms = {};
+	uniforms.projection = FindUniform(program, "projection");
+	uniforms.view = FindUniform(program, "view");
+	uniforms.model = FindUniform(program, "model");
+	uniforms.viewPos = FindUniform(program, "viewPos");
+	uniforms.lightPos = FindUniform(program, "lightPos");
+	uniforms.heightScale = FindUniform(program, "heightScale");
+	uniforms.clipBorders = FindUniform(program, "clipBorders");
+	uniforms.minLayers = FindUniform(program, "minLayers");
+	uniforms.maxLayers = FindUniform(program, "maxLayers");
+	uniforms.coneStepMapping = FindUniform(program, "coneStepMapping");
+	uniforms.coneSteps = FindUniform(program, "coneSteps");
+	uniforms.layerScale = FindUniform(program, "layerScale");
+	return uniforms;
+}
+
+static ClusterUniforms FindClusterUniforms(const Program& program)
+{
+	ClusterUniforms uniforms = {};
+	uniforms.screenSize = FindUniform(program, "uScreenSize");
+	uniforms.nearPlane = FindUniform(program, "uNear");
+	uniforms.farPlane = FindUniform(program, "uFar");
+	uniforms.clusterScale = FindUniform(program, "uClusterScale");
+	uniforms.clusterBias = FindUniform(program, "uClusterBias");
+	uniforms.brightColorThreshold = FindUniform(program, "bright_color_threshold");
+	return uniforms;
+}
+
+static void UpdateEntityBounds(App* app);
+
 void Init(App* app)
 {
     // TODO: Initialize your resources here!
@@ -223,123 +367,56 @@ void Init(App* app)
 
 	// VAO
 	glGenVertexArrays(1, &app->vao);
-	glBindVertexArray(app->vao);
+	BindVertexArray(app->vao);
 	glBindBuffer(GL_ARRAY_BUFFER, app->embeddedVertices);
 	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(VertexV3V2), (void*)0);
 	glEnableVertexAttribArray(0);
 	glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(VertexV3V2), (void*)12);
 	glEnableVertexAttribArray(1);
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, app->embeddedElements);
-	glBindVertexArray(0);
+	BindVertexArray(0);
 
 	// Program 
 	app->finalPassShaderIdx = LoadProgram(app, "shaders.glsl", "FINAL_PASS_SHADER");
 	Program& finalPassShader = app->programs[app->finalPassShaderIdx];
+	app->programFinalPassUniformUsingBloom = FindUniform(finalPassShader, "using_bloom");
 
-	glUseProgram(finalPassShader.handle);
-	glUniform1i(glGetUniformLocation(finalPassShader.handle, "sceneTexture"), 0);
-	glUniform1i(glGetUniformLocation(finalPassShader.handle, "bloomBlurTexture"), 1);
-	glUseProgram(0);
-
-
-
-	app->geometryPassShaderID = LoadProgram(app, "shaders.glsl", "GEOMETRY_PASS_SHADER");
-	Program& geometryPassShader = app->programs[app->geometryPassShaderID];
-	app->programGPassUniformTexture = glGetUniformLocation(geometryPassShader.handle, "uTexture");
-
-	{
-		int attributeCount;
-		glGetProgramiv(geometryPassShader.handle, GL_ACTIVE_ATTRIBUTES, &attributeCount);
-
-		GLchar attributeName[64];
-		GLsizei attributeNameLength;
-		GLint attributeSize;
-		GLenum attributeType;
-
-		for (int i = 0; i < attributeCount; ++i)
-		{
-			glGetActiveAttrib(geometryPassShader.handle, i, 64, &attributeNameLength, &attributeSize, &attributeType, attributeName);
-
-			GLint attributeLocation = glGetAttribLocation(geometryPassShader.handle, attributeName);
-			geometryPassShader.vertexInputLayout.attributes.push_back({ (u8)attributeLocation,(u8)attributeSize });
-		}
-	}
-	
-	app->shadingPassShaderID = LoadProgram(app, "shaders.glsl", "SHADING_PASS_SHADER");
-	Program& shadingPassShader = app->programs[app->shadingPassShaderID];
-	app->programShadingPassUniformTexturePosition = glGetUniformLocation(shadingPassShader.handle, "gPosition");
-	app->programShadingPassUniformTextureNormals = glGetUniformLocation(shadingPassShader.handle, "gNormal");
-	app->programShadingPassUniformTextureAlbedo = glGetUniformLocation(shadingPassShader.handle, "gAlbedoSpec");
-	app->programShadingPassUniformTextureDepth = glGetUniformLocation(shadingPassShader.handle, "gDepth");
-
-	{
-		int attributeCount;
-		glGetProgramiv(shadingPassShader.handle, GL_ACTIVE_ATTRIBUTES, &attributeCount);
-
-		GLchar attributeName[64];
-		GLsizei attributeNameLength;
-		GLint attributeSize;
-		GLenum attributeType;
+	SetUniform1i(finalPassShader, FindUniform(finalPassShader, "sceneTexture"), 0);
+	SetUniform1i(finalPassShader, FindUniform(finalPassShader, "bloomBlurTexture"), 1);
 
-		for (int i = 0; i < attributeCount; ++i)
-		{
-			glGetActiveAttrib(shadingPassShader.handle, i, 64, &attributeNameLength, &attributeSize, &attributeType, attributeName);
-
-			GLint attributeLocation = glGetAttribLocation(shadingPassShader.handle, attributeName);
-			shadingPassShader.vertexInputLayout.attributes.push_back({ (u8)attributeLocation,(u8)attributeSize });
-		}
-
-	}
 
 	app->lightsShaderID = LoadProgram(app, "shaders.glsl", "LIGHTS_SHADER");
 	Program& lightsShader = app->programs[app->lightsShaderID];
-	app->programLightsUniformColor = glGetUniformLocation(lightsShader.handle, "lightColor");
-	app->programLightsUniformWorldMatrix = glGetUniformLocation(lightsShader.handle, "uWorldViewProjectionMatrix");
-
-	{
-		int attributeCount;
-		glGetProgramiv(lightsShader.handle, GL_ACTIVE_ATTRIBUTES, &attributeCount);
-
-		GLchar attributeName[64];
-		GLsizei attributeNameLength;
-		GLint attributeSize;
-		GLenum attributeType;
-
-		for (int i = 0; i < attributeCount; ++i)
-		{
-			glGetActiveAttrib(lightsShader.handle, i, 64, &attributeNameLength, &attributeSize, &attributeType, attributeName);
-
-			GLint attributeLocation = glGetAttribLocation(lightsShader.handle, attributeName);
-			lightsShader.vertexInputLayout.attributes.push_back({ (u8)attributeLocation,(u8)attributeSize });
-		}
-
-	}
+	app->programLightsUniformColor = FindUniform(lightsShader, "lightColor");
+	app->programLightsUniformWorldMatrix = FindUniform(lightsShader, "uWorldViewProjectionMatrix");
 
 	app->blurShaderID = LoadProgram(app, "shaders.glsl", "BLUR_SHADER");
 	Program& blurShader = app->programs[app->blurShaderID];
 
-	glUseProgram(blurShader.handle);
-	glUniform1i(glGetUniformLocation(blurShader.handle, "image"), 0);
+	app->programBlurUniformHorizontal = FindUniform(blurShader, "horizontal");
+	app->programBlurUniformRadius = FindUniform(blurShader, "uRadius");
+	app->programBlurUniformWeights = FindUniform(blurShader, "uWeights");
 
-	// Attributes Program ----------
-	{
-		int attributeCount;
-		glGetProgramiv(blurShader.handle, GL_ACTIVE_ATTRIBUTES, &attributeCount);
+	SetUniform1i(blurShader, FindUniform(blurShader, "image"), 0);
 
-		GLchar attributeName[64];
-		GLsizei attributeNameLength;
-		GLint attributeSize;
-		GLenum attributeType;
+	app->blurComputeShaderID = LoadComputeProgram(app, "shaders.glsl", "BLUR_COMPUTE_SHADER");
+	Program& blurComputeShader = app->programs[app->blurComputeShaderID];
+	app->programBlurComputeUniformHorizontal = FindUniform(blurComputeShader, "uHorizontal");
+	app->programBlurComputeUniformRadius = FindUniform(blurComputeShader, "uRadius");
+	app->programBlurComputeUniformWeights = FindUniform(blurComputeShader, "uWeights");
 
-		for (int i = 0; i < attributeCount; ++i)
-		{
-			glGetActiveAttrib(blurShader.handle, i, 64, &attributeNameLength, &attributeSize, &attributeType, attributeName);
+	SetUniform1i(blurComputeShader, FindUniform(blurComputeShader, "uInput"), 0);
 
-			GLint attributeLocation = glGetAttribLocation(blurShader.handle, attributeName);
-			blurShader.vertexInputLayout.attributes.push_back({ (u8)attributeLocation,(u8)attributeSize });
-		}
-	}
-	glUseProgram(0);
+	app->tiledDeferredShaderID = LoadComputeProgram(app, "shaders.glsl", "TILED_DEFERRED_SHADING_SHADER");
+	Program& tiledDeferredShader = app->programs[app->tiledDeferredShaderID];
+	app->programTiledDeferredUniformView = FindUniform(tiledDeferredShader, "uView");
+	app->programTiledDeferredUniformInverseProjection = FindUniform(tiledDeferredShader, "uInverseProjection");
+	app->programTiledDeferredUniformInverseViewProjection = FindUniform(tiledDeferredShader, "uInverseViewProjection");
+	app->programTiledDeferredUniformBrightThreshold = FindUniform(tiledDeferredShader, "bright_color_threshold");
+
+	SetUniform1i(tiledDeferredShader, FindUniform(tiledDeferredShader, "gNormal"), 0);
+	SetUniform1i(tiledDeferredShader, FindUniform(tiledDeferredShader, "gAlbedoSpec"), 1);
+	SetUniform1i(tiledDeferredShader, FindUniform(tiledDeferredShader, "gDepthStencil"), 2);
 
 
 	// Textures 
@@ -370,47 +447,127 @@ void Init(App* app)
 	app->texturedMeshProgramIdx = LoadProgram(app, "shaders.glsl", "SHOW_TEXTURED_MESH");
 	Program& texturedMeshProgram = app->programs[app->texturedMeshProgramIdx];
 
+	SetUniform1i(texturedMeshProgram, FindUniform(texturedMeshProgram, "uAlbedoArray"), 0);
 
-	// Attributes Program ----------
-	{
-		int attributeCount;
-		glGetProgramiv(texturedMeshProgram.handle, GL_ACTIVE_ATTRIBUTES, &attributeCount);
+	app->texturedMeshClusteredProgramIdx = LoadProgram(app, "shaders.glsl", "SHOW_TEXTURED_MESH_CLUSTERED");
+	Program& texturedMeshClusteredProgram = app->programs[app->texturedMeshClusteredProgramIdx];
+	app->texturedMeshClusterUniforms = FindClusterUniforms(texturedMeshClusteredProgram);
 
-		GLchar attributeName[64];
-		GLsizei attributeNameLength;
-		GLint attributeSize;
-		GLenum attributeType;
+	SetUniform1i(texturedMeshClusteredProgram, FindUniform(texturedMeshClusteredProgram, "uAlbedoArray"), 0);
 
-		for (int i = 0; i < attributeCount; ++i)
-		{
-			glGetActiveAttrib(texturedMeshProgram.handle, i, 64, &attributeNameLength, &attributeSize, &attributeType, attributeName);
+	app->clusteredLightCullingShaderID = LoadComputeProgram(app, "shaders.glsl", "CLUSTERED_LIGHT_CULLING_SHADER");
+	Program& clusteredLightCullingShader = app->programs[app->clusteredLightCullingShaderID];
+	app->programClusterCullingUniformView = FindUniform(clusteredLightCullingShader, "uView");
+	app->programClusterCullingUniformInverseProjection = FindUniform(clusteredLightCullingShader, "uInverseProjection");
+	app->programClusterCullingUniformNear = FindUniform(clusteredLightCullingShader, "uNear");
+	app->programClusterCullingUniformFar = FindUniform(clusteredLightCullingShader, "uFar");
 
-			GLint attributeLocation = glGetAttribLocation(texturedMeshProgram.handle, attributeName);
-			texturedMeshProgram.vertexInputLayout.attributes.push_back({ (u8)attributeLocation,(u8)attributeSize });
-		}
+	// GPU culling ---------
+	app->hiZBuildShaderID = LoadComputeProgram(app, "shaders.glsl", "HIZ_BUILD_SHADER");
+	Program& hiZBuildShader = app->programs[app->hiZBuildShaderID];
+	app->programHiZBuildUniformSourceLevel = FindUniform(hiZBuildShader, "uSourceLevel");
+
+	SetUniform1i(hiZBuildShader, FindUniform(hiZBuildShader, "uSource"), 0);
+
+	app->objectCullingShaderID = LoadComputeProgram(app, "shaders.glsl", "OBJECT_CULLING_SHADER");
+	Program& objectCullingShader = app->programs[app->objectCullingShaderID];
+	app->programObjectCullingUniformObjectCount = FindUniform(objectCullingShader, "uObjectCount");
+	app->programObjectCullingUniformBatchCount = FindUniform(objectCullingShader, "uBatchCount");
+	app->programObjectCullingUniformPhase = FindUniform(objectCullingShader, "uPhase");
+	app->programObjectCullingUniformFrustumPlanes = FindUniform(objectCullingShader, "uFrustumPlanes");
+	app->programObjectCullingUniformDepthSize = FindUniform(objectCullingShader, "uDepthSize");
+	app->programObjectCullingUniformHiZLevels = FindUniform(objectCullingShader, "uHiZLevels");
+
+	SetUniform1i(objectCullingShader, FindUniform(objectCullingShader, "uHiZ"), 0);
+
+	// Light volume deferred shading ---------
+
+	app->lightVolumeStencilShaderID = LoadProgram(app, "shaders.glsl", "LIGHT_VOLUME_STENCIL_SHADER");
+	app->lightVolumePointShaderID = LoadProgram(app, "shaders.glsl", "LIGHT_VOLUME_POINT_SHADER");
+	app->lightVolumeDirectionalShaderID = LoadProgram(app, "shaders.glsl", "LIGHT_VOLUME_DIRECTIONAL_SHADER");
+	app->brightExtractShaderID = LoadProgram(app, "shaders.glsl", "BRIGHT_EXTRACT_SHADER");
+
+	Program& lightVolumeStencilShader = app->programs[app->lightVolumeStencilShaderID];
+	app->programLightVolumeStencilUniformWorldViewProjection = FindUniform(lightVolumeStencilShader, "uWorldViewProjectionMatrix");
+
+	Program& lightVolumePointShader = app->programs[app->lightVolumePointShaderID];
+	app->programLightVolumePointUniformWorldViewProjection = FindUniform(lightVolumePointShader, "uWorldViewProjectionMatrix");
+	app->programLightVolumePointUniformLightIndex = FindUniform(lightVolumePointShader, "uLightIndex");
+	app->programLightVolumePointUniformScreenSize = FindUniform(lightVolumePointShader, "uScreenSize");
+	app->programLightVolumePointUniformInverseViewProjection = FindUniform(lightVolumePointShader, "uInverseViewProjection");
+
+	Program& lightVolumeDirectionalShader = app->programs[app->lightVolumeDirectionalShaderID];
+	app->programLightVolumeDirectionalUniformScreenSize = FindUniform(lightVolumeDirectionalShader, "uScreenSize");
+	app->programLightVolumeDirectionalUniformInverseViewProjection = FindUniform(lightVolumeDirectionalShader, "uInverseViewProjection");
+
+	Program* lightVolumeShadingPrograms[] = { &lightVolumePointShader, &lightVolumeDirectionalShader };
+	for (u32 p = 0; p < ARRAY_COUNT(lightVolumeShadingPrograms); ++p)
+	{
+		Program& program = *lightVolumeShadingPrograms[p];
+		SetUniform1i(program, FindUniform(program, "gNormal"), 0);
+		SetUniform1i(program, FindUniform(program, "gAlbedoSpec"), 1);
+		SetUniform1i(program, FindUniform(program, "gDepthStencil"), 2);
 	}
+
+	Program& brightExtractShader = app->programs[app->brightExtractShaderID];
+	app->programBrightExtractUniformThreshold = FindUniform(brightExtractShader, "bright_color_threshold");
+	SetUniform1i(brightExtractShader, FindUniform(brightExtractShader, "uColorTexture"), 0);
+
+	// Bloom mip chain ---------
+
+	app->bloomDownsampleShaderID = LoadProgram(app, "shaders.glsl", "BLOOM_DOWNSAMPLE_SHADER");
+	app->bloomUpsampleShaderID = LoadProgram(app, "shaders.glsl", "BLOOM_UPSAMPLE_SHADER");
+
+	Program& bloomDownsampleShader = app->programs[app->bloomDownsampleShaderID];
+	app->programBloomDownsampleUniformTexelSize = FindUniform(bloomDownsampleShader, "uSourceTexelSize");
+	app->programBloomDownsampleUniformKarisAverage = FindUniform(bloomDownsampleShader, "uKarisAverage");
+	SetUniform1i(bloomDownsampleShader, FindUniform(bloomDownsampleShader, "uSourceTexture"), 0);
+
+	Program& bloomUpsampleShader = app->programs[app->bloomUpsampleShaderID];
+	app->programBloomUpsampleUniformTexelSize = FindUniform(bloomUpsampleShader, "uSourceTexelSize");
+	app->programBloomUpsampleUniformFilterRadius = FindUniform(bloomUpsampleShader, "uFilterRadius");
+	SetUniform1i(bloomUpsampleShader, FindUniform(bloomUpsampleShader, "uSourceTexture"), 0);
+
 	// Uniform blocks ---------
 
-	// Local Params
-	glGetIntegerv(GL_MAX_UNIFORM_BLOCK_SIZE, &app->maxUniformBufferSize);
-	glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &app->uniformBlockAlignment);
-	app->ubuffer = CreateConstantBuffer(app->maxUniformBufferSize);
-	
 	// Global Params
 	glGetIntegerv(GL_MAX_UNIFORM_BLOCK_SIZE, &app->maxGlobalParamsBufferSize);
 	glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &app->globalParamsAlignment);
-	app->gpBuffer = CreateConstantBuffer(app->maxGlobalParamsBufferSize);
+	app->gpBuffer = CreateRingBuffer(app->maxGlobalParamsBufferSize, app->globalParamsAlignment, GL_UNIFORM_BUFFER);
+
+	// Cluster light lists (written by the culling compute pass, read by the clustered forward shaders)
+	const u32 clusterCount = CLUSTER_GRID_X * CLUSTER_GRID_Y * CLUSTER_GRID_Z;
+	app->clusterLightCounts = CreateStorageBuffer(clusterCount * sizeof(u32));
+	app->clusterLightIndices = CreateStorageBuffer(clusterCount * MAX_LIGHTS_PER_CLUSTER * sizeof(u32));
+
+	// Light records, grows on demand
+	InitLightStore(app->lightStore, 1024);
+
+	// Object records, their instance index stream and the indirect draw commands, grow on demand
+	app->objectBuffer = CreateBuffer(1024 * sizeof(GPUObject), GL_SHADER_STORAGE_BUFFER, GL_DYNAMIC_DRAW);
+	app->objectIndexBuffer = CreateRingBuffer(1024 * sizeof(u32), sizeof(u32), GL_ARRAY_BUFFER);
+	app->drawCommandBuffer = CreateRingBuffer(256 * sizeof(DrawElementsIndirectCommand), sizeof(u32), GL_DRAW_INDIRECT_BUFFER);
 
 	// Model ----------
 	app->model = LoadModel(app, "Patrick/Patrick.obj");
 	app->plane = app->geo.LoadPlane(app);
 	app->sphere = app->geo.LoadSphere(app);
 
+	// Every submesh is copied into the pool of its vertex layout and every albedo texture into one array,
+	// so the entities can be drawn with one multi-draw call per vertex layout
+	BuildGeometryPools(app);
+	BuildAlbedoTextureArray(app);
+
+	// Occluders of the software occlusion culling
+	ParallelFor(app->meshes.size(), 1, [app](u32 i) {
+		BuildOccluderTriangles(app->meshes[i], OCCLUDER_MAX_TRIANGLES);
+	});
+
 	app->mode = Mode_Model;
 
 	// -------------------------------- ENTITIES --------------------------------
 
-	Entity e0 = Entity(glm::mat4(1.0), app->plane, 0, 0, EntityType::PLANE);
+	Entity e0 = Entity(glm::mat4(1.0), app->plane, EntityType::PLANE);
 	e0.worldMatrix = TransformPositionScale(vec3(0.0, -1.0, 0.0), vec3(100.0, 1.0, 100.0));
 	e0.worldMatrix = TransformRotation(e0.worldMatrix, 90, { 1, 0, 0 });
 	app->entities.push_back(e0);
@@ -423,11 +580,15 @@ void Init(App* app)
 	{
 		for (int y = -COLUMNS; y < COLUMNS; ++y)
 		{
-			Entity e1 = Entity(glm::mat4(1.0), app->model, 0, 0, EntityType::PATRICK);
+			Entity e1 = Entity(glm::mat4(1.0), app->model, EntityType::PATRICK);
 			e1.worldMatrix = TransformPositionScale(vec3((float)x * (float)distance, 2.4f, (float)y * (float)distance), vec3(1.0f));
 			app->entities.push_back(e1);
 		}
 	}
+
+	// Sets baked for these entities, if any (see pvs.h); the check needs their bounds
+	UpdateEntityBounds(app);
+	LoadPVS(app, PVS_FILENAME);
 	
 	// -------------------------------- LIGHTS --------------------------------
 
@@ -452,30 +613,6 @@ void Init(App* app)
 
 	// -------------------------------- RELIEF MAPPING --------------------------------
 
-	//Shader
-	app->reliefMapShaderID = LoadProgram(app, "shaders.glsl", "RELIEF_MAPPING_SHADER");
-	Program& reliefMapShader = app->programs[app->reliefMapShaderID];
-
-
-	// Attributes Program ----------
-	{
-		int attributeCount;
-		glGetProgramiv(reliefMapShader.handle, GL_ACTIVE_ATTRIBUTES, &attributeCount);
-
-		GLchar attributeName[64];
-		GLsizei attributeNameLength;
-		GLint attributeSize;
-		GLenum attributeType;
-
-		for (int i = 0; i < attributeCount; ++i)
-		{
-			glGetActiveAttrib(reliefMapShader.handle, i, 64, &attributeNameLength, &attributeSize, &attributeType, attributeName);
-
-			GLint attributeLocation = glGetAttribLocation(reliefMapShader.handle, attributeName);
-			reliefMapShader.vertexInputLayout.attributes.push_back({ (u8)attributeLocation,(u8)attributeSize });
-		}
-	}
-
 	//Relief Textures
 	app->reliefTextures.push_back(LoadTexture2D(app, "Relief/bricks2.jpg"));
 	app->reliefTextures.push_back(LoadTexture2D(app, "Relief/bricks2_normal.jpg"));
@@ -496,42 +633,69 @@ void Init(App* app)
 	app->reliefTextures.push_back(LoadTexture2D(app, "Relief/CobbleStone_01_BC.png"));
 	app->reliefTextures.push_back(LoadTexture2D(app, "Relief/CobbleStone_01_NOpenGL.png"));
 	app->reliefTextures.push_back(LoadTexture2D(app, "Relief/CobbleStone_01_H.png"));
-	
 
-	glUseProgram(reliefMapShader.handle);
-	glUniform1i(glGetUniformLocation(reliefMapShader.handle, "diffuseMap"), 0);
-	glUniform1i(glGetUniformLocation(reliefMapShader.handle, "normalMap"), 1);
-	glUniform1i(glGetUniformLocation(reliefMapShader.handle, "depthMap"), 2);
+	// Cone step maps of the depth maps above, in the same order
+	app->reliefConeMaps.push_back(LoadConeStepMap(app, "Relief/bricks2_disp.jpg"));
+	app->reliefConeMaps.push_back(LoadConeStepMap(app, "Relief/LeatherPadded_03_H.png"));
+	app->reliefConeMaps.push_back(LoadConeStepMap(app, "Relief/BrokenTiles_01_H.png"));
+	app->reliefConeMaps.push_back(LoadConeStepMap(app, "Relief/Wood_Height.png"));
+	app->reliefConeMaps.push_back(LoadConeStepMap(app, "Relief/CobbleStone_01_H.png"));
+
+	// Distance past which each texture set is only normal mapped
+	app->reliefLodCutoffs.assign(app->reliefConeMaps.size(), 150.0f);
+
+	// Compact G-Buffer ---------
+	// Albedo + octahedral normal + the hardware depth, positions are reconstructed from the depth.
+	// Every deferred pipeline writes it, the tiled and light volume ones into GBuffer.
+
+	app->geometryPassCompactShaderID = LoadProgram(app, "shaders.glsl", "GEOMETRY_PASS_SHADER_COMPACT");
+	Program& geometryPassCompactShader = app->programs[app->geometryPassCompactShaderID];
+	SetUniform1i(geometryPassCompactShader, FindUniform(geometryPassCompactShader, "uAlbedoArray"), 0);
+
+	app->reliefMapCompactShaderID = LoadProgram(app, "shaders.glsl", "RELIEF_MAPPING_SHADER_COMPACT");
+	Program& reliefMapCompactShader = app->programs[app->reliefMapCompactShaderID];
+	app->reliefMapCompactUniforms = FindReliefMappingUniforms(reliefMapCompactShader);
+	SetUniform1i(reliefMapCompactShader, FindUniform(reliefMapCompactShader, "diffuseMap"), 0);
+	SetUniform1i(reliefMapCompactShader, FindUniform(reliefMapCompactShader, "normalMap"), 1);
+	SetUniform1i(reliefMapCompactShader, FindUniform(reliefMapCompactShader, "depthMap"), 2);
+	SetUniform1i(reliefMapCompactShader, FindUniform(reliefMapCompactShader, "coneMap"), 3);
+
+	app->shadingPassCompactShaderID = LoadProgram(app, "shaders.glsl", "SHADING_PASS_SHADER_COMPACT");
+	Program& shadingPassCompactShader = app->programs[app->shadingPassCompactShaderID];
+	app->programShadingPassCompactUniformInverseViewProjection = FindUniform(shadingPassCompactShader, "uInverseViewProjection");
+	app->programShadingPassCompactUniformBrightThreshold = FindUniform(shadingPassCompactShader, "bright_color_threshold");
+	SetUniform1i(shadingPassCompactShader, FindUniform(shadingPassCompactShader, "gNormal"), 0);
+	SetUniform1i(shadingPassCompactShader, FindUniform(shadingPassCompactShader, "gAlbedoSpec"), 1);
+	SetUniform1i(shadingPassCompactShader, FindUniform(shadingPassCompactShader, "gDepthStencil"), 2);
+
+	// Decodes the compact G-Buffer for the Render Target debug views
+	app->gBufferDebugShaderID = LoadProgram(app, "shaders.glsl", "GBUFFER_DEBUG_SHADER");
+	Program& gBufferDebugShader = app->programs[app->gBufferDebugShaderID];
+	app->programGBufferDebugUniformInverseViewProjection = FindUniform(gBufferDebugShader, "uInverseViewProjection");
+	app->programGBufferDebugUniformMode = FindUniform(gBufferDebugShader, "uMode");
+	SetUniform1i(gBufferDebugShader, FindUniform(gBufferDebugShader, "gNormal"), 0);
+	SetUniform1i(gBufferDebugShader, FindUniform(gBufferDebugShader, "gDepthStencil"), 1);
 
 	//Shader
 	app->reliefMapShaderForwardID = LoadProgram(app, "shaders.glsl", "RELIEF_MAPPING_SHADER_FORWARD");
 	Program& reliefMapShaderForward = app->programs[app->reliefMapShaderForwardID];
+	app->reliefMapForwardUniforms = FindReliefMappingUniforms(reliefMapShaderForward);
 
+	SetUniform1i(reliefMapShaderForward, FindUniform(reliefMapShaderForward, "diffuseMap"), 0);
+	SetUniform1i(reliefMapShaderForward, FindUniform(reliefMapShaderForward, "normalMap"), 1);
+	SetUniform1i(reliefMapShaderForward, FindUniform(reliefMapShaderForward, "depthMap"), 2);
+	SetUniform1i(reliefMapShaderForward, FindUniform(reliefMapShaderForward, "coneMap"), 3);
 
-	// Attributes Program ----------
-	{
-		int attributeCount;
-		glGetProgramiv(reliefMapShaderForward.handle, GL_ACTIVE_ATTRIBUTES, &attributeCount);
-
-		GLchar attributeName[64];
-		GLsizei attributeNameLength;
-		GLint attributeSize;
-		GLenum attributeType;
-
-		for (int i = 0; i < attributeCount; ++i)
-		{
-			glGetActiveAttrib(reliefMapShaderForward.handle, i, 64, &attributeNameLength, &attributeSize, &attributeType, attributeName);
-
-			GLint attributeLocation = glGetAttribLocation(reliefMapShaderForward.handle, attributeName);
-			reliefMapShaderForward.vertexInputLayout.attributes.push_back({ (u8)attributeLocation,(u8)attributeSize });
-		}
-	}
+	//Shader
+	app->reliefMapShaderForwardClusteredID = LoadProgram(app, "shaders.glsl", "RELIEF_MAPPING_SHADER_FORWARD_CLUSTERED");
+	Program& reliefMapShaderForwardClustered = app->programs[app->reliefMapShaderForwardClusteredID];
+	app->reliefMapForwardClusteredUniforms = FindReliefMappingUniforms(reliefMapShaderForwardClustered);
+	app->reliefMapClusterUniforms = FindClusterUniforms(reliefMapShaderForwardClustered);
 
-	glUseProgram(reliefMapShaderForward.handle);
-	glUniform1i(glGetUniformLocation(reliefMapShaderForward.handle, "diffuseMap"), 0);
-	glUniform1i(glGetUniformLocation(reliefMapShaderForward.handle, "normalMap"), 1);
-	glUniform1i(glGetUniformLocation(reliefMapShaderForward.handle, "depthMap"), 2);
-	glUseProgram(0);
+	SetUniform1i(reliefMapShaderForwardClustered, FindUniform(reliefMapShaderForwardClustered, "diffuseMap"), 0);
+	SetUniform1i(reliefMapShaderForwardClustered, FindUniform(reliefMapShaderForwardClustered, "normalMap"), 1);
+	SetUniform1i(reliefMapShaderForwardClustered, FindUniform(reliefMapShaderForwardClustered, "depthMap"), 2);
+	SetUniform1i(reliefMapShaderForwardClustered, FindUniform(reliefMapShaderForwardClustered, "coneMap"), 3);
 
 	srand(20);
 	const int RELIEFS = 3;
@@ -548,11 +712,6 @@ void Init(App* app)
 			app->ReliefPositions.push_back(glm::vec3((float)x * (float)distance2, 15.0f, (float)y * (float)distance));
 		}
 	}
-	
-	// FBO --------------
-	app->gFbo.Initialize(app->displaySize.x, app->displaySize.y);
-	app->shadingFbo.Initialize(app->displaySize.x, app->displaySize.y);
-	app->blurFbo.Initialize(app->displaySize.x, app->displaySize.y);
 }
 
 void Gui(App* app)
@@ -574,6 +733,42 @@ void Gui(App* app)
 
 		// FPS information ------------------
 		ImGui::Text("FPS: %f", 1.0f / app->deltaTime);
+		ImGui::Text("Entities: %u  Entity draw calls: %u", (u32)app->entities.size(), app->entityDrawCalls);
+		if (app->gpu_culling)
+		{
+			const GPUCulling& culling = app->gpuCulling;
+			ImGui::Text("GPU culling: %u objects drawn from last frame, %u newly visible, %u culled", culling.drawnPhase1, culling.drawnPhase2, culling.objectCount - culling.drawnPhase1 - culling.drawnPhase2);
+		}
+		else
+		{
+			if (app->pvs_culling && app->pvs.loaded && app->pvs.cameraCell != PVS_INVALID_CELL)
+				ImGui::Text("PVS: cell %u, %u of %u entities potentially visible", app->pvs.cameraCell, app->pvs.potentiallyVisible, (u32)app->entities.size());
+			ImGui::Text("Frustum culling: %u entities visible, %u culled", (u32)app->visibleEntities.size(), (u32)(app->entities.size() - app->visibleEntities.size()));
+			if (app->software_occlusion)
+			{
+				const SoftwareOcclusion& occlusion = app->softwareOcclusion;
+				ImGui::Text("Software occlusion: %u occluders (%u triangles), %u entities occluded", (u32)occlusion.occluders.size(), occlusion.occluderTriangles, occlusion.occludedEntities);
+				ImGui::Text("  rasterize %.3f ms on %u workers, test %.3f ms", occlusion.rasterizeMilliseconds, GetWorkerCount(), occlusion.testMilliseconds);
+			}
+		}
+		ImGui::Text("Light gizmos: %u visible, %u culled", app->visibleLightGizmos, (u32)app->lights.size() - app->visibleLightGizmos);
+		if (app->pickedEntity != BVH_INVALID && app->pickedEntity < app->entities.size())
+		{
+			ImGui::Text("Picked entity: %u at %.1f m, in range of %u point lights", app->pickedEntity, app->pickedDistance, app->pickedEntityLights);
+
+			// Moving it refits the BVH and uploads only its object records in the next update
+			glm::mat4 worldMatrix = app->entities[app->pickedEntity].worldMatrix;
+			if (ImGui::DragFloat3("Picked position", glm::value_ptr(worldMatrix[3]), 0.1f))
+				SetEntityTransform(app, app->pickedEntity, worldMatrix);
+		}
+		else
+			ImGui::Text("Picked entity: none (left click in the scene)");
+		ImGui::Text("Object records uploaded: %u of %u", app->uploadedObjects, (u32)app->objects.size());
+		ImGui::Text("State changes: %u unsorted, %u sorted", app->renderQueue.stateChangesUnsorted, app->renderQueue.stateChangesSorted);
+		const GLStateStats glStats = GetGLStateStats();
+		ImGui::Text("GL state calls: %u issued, %u elided", glStats.issued, glStats.elided);
+		const UniformStats uniformStats = GetUniformStats();
+		ImGui::Text("Uniform sets: %u sent, %u elided", uniformStats.sent, uniformStats.elided);
 
 		// OpenGL information ------------------
 		ImGui::Text("OpenGL version: %s", app->info.version.c_str());
@@ -606,17 +801,24 @@ void Gui(App* app)
 
 		ImGui::Separator();
 		ImGui::Text("Render Pipeline");
-		const char* items_pipeline_list[] = { "Forward Shading", "Deferred Shading" };
+		const char* items_pipeline_list[] = { "Forward Shading", "Deferred Shading", "Tiled Deferred Shading", "Clustered Forward Shading", "Light Volume Deferred Shading" };
 		static int item_pipeline = (int)app->render_pipeline;
 		if (ImGui::Combo("Render Pipeline", &item_pipeline, items_pipeline_list, IM_ARRAYSIZE(items_pipeline_list)))
 		{
 			app->render_pipeline = (RenderPipeline)item_pipeline;
 		}
+		ImGui::Checkbox("GPU culling (Hi-Z)", &app->gpu_culling);
+		if (!app->gpu_culling)
+		{
+			if (app->pvs.loaded)
+				ImGui::Checkbox("PVS culling", &app->pvs_culling);
+			ImGui::Checkbox("Software occlusion culling", &app->software_occlusion);
+		}
 
 		// Render target information -------------------
 
 		static int item_current = 0;
-		if (app->render_pipeline == RenderPipeline::DEFERRED)
+		if (app->render_pipeline == RenderPipeline::DEFERRED || app->render_pipeline == RenderPipeline::DEFERRED_TILED || app->render_pipeline == RenderPipeline::DEFERRED_LIGHT_VOLUMES)
 		{
 			ImGui::Separator();
 			ImGui::Text("Render Targets");
@@ -625,8 +827,15 @@ void Gui(App* app)
 			{
 				app->displayedTexture = (RenderTargetType)item_current;
 			}
+
+			if (app->render_pipeline == RenderPipeline::DEFERRED)
+			{
+				const FrameGraph& graph = app->frameGraph;
+				ImGui::Text("Frame graph: %u passes (%u culled)", (u32)graph.passes.size(), graph.culledPasses);
+				ImGui::Text("Transient textures: %u, %.1f MB (%.1f MB without aliasing)", graph.transientTextures, graph.transientBytes / (1024.0f * 1024.0f), graph.virtualBytes / (1024.0f * 1024.0f));
+			}
 		}
-		else if (app->render_pipeline == RenderPipeline::FORWARD)
+		else if (app->render_pipeline == RenderPipeline::FORWARD || app->render_pipeline == RenderPipeline::FORWARD_CLUSTERED)
 		{
 			item_current = 0;
 			app->displayedTexture = RenderTargetType::RENDER_TEXTURE;
@@ -638,6 +847,11 @@ void Gui(App* app)
 		ImGui::Separator();
 		ImGui::Text("Lights");
 		ImGui::Spacing();
+		ImGui::Text("Point lights: %u (%u visible)  Directional lights: %u", app->lightStore.pointLights.count, app->lightStore.visiblePointLights.count, app->lightStore.directionalLights.count);
+		ImGui::Text("Light upload: %u bytes in %u ranges", app->lightStore.uploadedBytes, app->lightStore.uploadedRanges);
+		if (ImGui::Button("Add 1000 point lights"))
+			SpawnRandomPointLights(app, 1000);
+		ImGui::Spacing();
 		if (ImGui::TreeNode("Directional Lights"))
 		{
 			int j = 1;
@@ -662,19 +876,30 @@ void Gui(App* app)
 
 		if (ImGui::TreeNode("Point Lights"))
 		{
-			int j = 1;
-			for (int i = 0; i < app->lights.size(); ++i) {
+			std::vector<u32> pointLights;
+			for (u32 i = 0; i < app->lights.size(); ++i)
 				if (app->lights[i].type == LightType::LIGHT_TYPE_POINT)
+					pointLights.push_back(i);
+
+			// Only the visible entries are submitted, the list can hold thousands of lights. Each of them
+			// gathers the entities its volume reaches from the BVH.
+			std::vector<u32> reached;
+			ImGuiListClipper clipper;
+			clipper.Begin(pointLights.size());
+			while (clipper.Step())
+			{
+				for (int j = clipper.DisplayStart; j < clipper.DisplayEnd; ++j)
 				{
+					const u32 i = pointLights[j];
+					QuerySphereBVH(app->entityBVH, app->lights[i].position, app->lights[i].radius, reached);
+
 					ImGui::PushID(i);
-					ImGui::Text("Point Light %d", j);
+					ImGui::Text("Point Light %d, reaches %u entities", j + 1, (u32)reached.size());
 					ImGui::ColorEdit3("color", glm::value_ptr(app->lights[i].color), ImGuiColorEditFlags_::ImGuiColorEditFlags_Uint8);
 					ImGui::DragFloat3("position", glm::value_ptr(app->lights[i].position), 0.01f);
 					ImGui::DragInt("intensity", (int*)&app->lights[i].intensity, 0.5f, 0, 100);
-					j++;
 					ImGui::PopID();
 				}
-				//ImGui::NewLine();
 			}
 		ImGui::TreePop();
 		}
@@ -693,8 +918,26 @@ void Gui(App* app)
 		ImGui::Checkbox("Clip borders", &app->clip_borders);
 		ImGui::Checkbox("Rotate", &app->rotate);
 		ImGui::SliderFloat("Height Scale", &app->heigth_scale, 0.0f, 1.f);
-		ImGui::SliderInt("Min layers", &app->min_layers, 0.0f, 100.f);
-		ImGui::SliderInt("Max layers", &app->max_layers, 0.0f, 100.f);
+		const char* reliefSearches[] = { "Linear Search", "Relaxed Cone Stepping" };
+		int reliefSearch = (int)app->relief_search;
+		if (ImGui::Combo("Search", &reliefSearch, reliefSearches, IM_ARRAYSIZE(reliefSearches)))
+			app->relief_search = (ReliefSearch)reliefSearch;
+		if (app->relief_search == ReliefSearch::LINEAR)
+		{
+			ImGui::SliderInt("Min layers", &app->min_layers, 0.0f, 100.f);
+			ImGui::SliderInt("Max layers", &app->max_layers, 0.0f, 100.f);
+		}
+		else
+		{
+			ImGui::SliderInt("Cone steps", &app->cone_steps, 1, 32);
+		}
+		ImGui::Checkbox("Relief LOD", &app->relief_lod);
+		if (app->relief_lod)
+		{
+			ImGui::SliderInt("Full detail size (px)", &app->relief_lod_full_detail_pixels, 64, 2048);
+			ImGui::DragFloat("Cutoff distance", &app->reliefLodCutoffs[app->reliefIdx - 1], 1.0f, 1.0f, 1000.0f);
+			ImGui::Text("Layer scale: %.2f", app->reliefLayerScale);
+		}
 		ImGui::SliderInt("Textures", &app->reliefIdx, 1.0f, 5.f);
 		ImGui::Separator();
 
@@ -702,9 +945,36 @@ void Gui(App* app)
 		ImGui::Text("Bloom");
 		ImGui::Spacing();
 		ImGui::Checkbox("Bloom", &app->using_bloom);
-		ImGui::DragInt("Blur Iterations", &app->blurIterations, 2.0f, 0, 50);
+		const char* bloomModes[] = { "Gaussian", "Mip Chain" };
+		int bloomMode = (int)app->bloomMode;
+		if (ImGui::Combo("Bloom Mode", &bloomMode, bloomModes, IM_ARRAYSIZE(bloomModes)))
+			app->bloomMode = (BloomMode)bloomMode;
+		if (app->bloomMode == BloomMode::GAUSSIAN)
+		{
+			ImGui::DragInt("Blur Iterations", &app->blurIterations, 2.0f, 0, 50);
+			ImGui::SliderInt("Blur Radius", &app->blurRadius, 1, MAX_BLUR_RADIUS);
+			const char* blurBackends[] = { "Fragment", "Compute" };
+			int blurBackend = (int)app->blurBackend;
+			if (ImGui::Combo("Blur Backend", &blurBackend, blurBackends, IM_ARRAYSIZE(blurBackends)))
+				app->blurBackend = (BlurBackend)blurBackend;
+		}
+		else
+			ImGui::DragFloat("Filter Radius", &app->bloomFilterRadius, 0.05f, 0.0f, 4.0f);
 		ImGui::DragFloat("Threshold", &app->bright_threshold, 0.05f, 0.0f, 20.f);
 
+		// GPU timings of the frame graph passes -------------------
+		ImGui::Separator();
+		ImGui::Text("GPU Timings");
+		ImGui::Spacing();
+		float totalMilliseconds = 0.0f;
+		for (u32 i = 0; i < app->frameGraph.passTimings.size(); ++i)
+		{
+			const FrameGraphPassTiming& timing = app->frameGraph.passTimings[i];
+			ImGui::Text("%-24s %.3f ms", timing.name, timing.milliseconds);
+			totalMilliseconds += timing.milliseconds;
+		}
+		ImGui::Text("%-24s %.3f ms", "Total", totalMilliseconds);
+
 
 
 		ImGui::End();
@@ -713,241 +983,1117 @@ void Gui(App* app)
 
 
 
-void Update(App* app)
+void SetEntityTransform(App* app, u32 entityIndex, const glm::mat4& worldMatrix)
 {
-    // You can handle app->input keyboard/mouse here
-	app->camera.Update(app);
+	Entity& entity = app->entities[entityIndex];
+	entity.worldMatrix = worldMatrix;
 
-	// Resize window
+	// The sets were baked for the scene as it was loaded
+	if (app->pvs.loaded)
+	{
+		app->pvs.loaded = false;
+		ILOG("Entity %u moved, PVS culling disabled until the PVS is baked again", entityIndex);
+	}
 
-	if (app->lastFrameDisplaySize != app->displaySize)
+	if (!entity.transformDirty)
 	{
-		app->gFbo.Resize(app->displaySize.x, app->displaySize.y);
-		app->shadingFbo.Resize(app->displaySize.x, app->displaySize.y);
-		app->blurFbo.Resize(app->displaySize.x, app->displaySize.y);
+		entity.transformDirty = true;
+		app->dirtyEntities.push_back(entityIndex);
 	}
-	app->lastFrameDisplaySize = app->displaySize;
+}
 
-	// Global params
+static void PackObjectRecords(App* app, Entity& entity)
+{
+	const Model& model = app->models[entity.modelIndex];
+	const u32 submeshCount = app->meshes[model.meshIdx].submeshes.size();
+	const glm::mat4 rows = glm::transpose(entity.worldMatrix);
 
-	MapBuffer(app->gpBuffer, GL_WRITE_ONLY);
-	app->globalParamsOffset = app->gpBuffer.head;
+	for (u32 i = 0; i < submeshCount; ++i)
+	{
+		GPUObject& object = app->objects[entity.firstObject + i];
+		object.worldRows[0] = rows[0];
+		object.worldRows[1] = rows[1];
+		object.worldRows[2] = rows[2];
+		object.materialIndex = app->materials[model.materialIdx[i]].albedoLayer;
+		object.flags = (u32)entity.type & 0xff;
+		object.padding[0] = object.padding[1] = 0;
+	}
 
-	PushVec3(app->gpBuffer, app->camera.position);
-	PushUInt(app->gpBuffer, app->lights.size());
+	entity.transformDirty = false;
+}
 
-	for (u32 i = 0; i < app->lights.size(); ++i)
+// Keeps the entity BVH in step: rebuilt when entities were added, refitted when some moved. Runs
+// before UpdateObjectRecords, which clears the moved entities.
+static void UpdateEntityBounds(App* app)
+{
+	if (app->entityBounds.size() != app->entities.size())
 	{
-		AlignHead(app->gpBuffer, sizeof(vec4));
-
-		const Light& light = app->lights[i];
-		PushUInt(app->gpBuffer, static_cast<u32>(light.type));
-		PushVec3(app->gpBuffer, light.position);
-		PushVec3(app->gpBuffer, light.color);
-		PushVec3(app->gpBuffer, light.direction);
-		PushUInt(app->gpBuffer, light.intensity);
+		app->entityBounds.resize(app->entities.size());
+		ParallelFor(app->entities.size(), ENTITY_BOUNDS_GRAIN, [app](u32 e) {
+			const Entity& entity = app->entities[e];
+			app->entityBounds[e] = TransformAABB(app->meshes[app->models[entity.modelIndex].meshIdx].bounds, entity.worldMatrix);
+		});
+
+		BuildBVH(app->entityBVH, app->entityBounds);
+		return;
 	}
 
-	app->globalParamsSize = app->gpBuffer.head - app->globalParamsOffset;
+	ParallelFor(app->dirtyEntities.size(), ENTITY_BOUNDS_GRAIN, [app](u32 i) {
+		const Entity& entity = app->entities[app->dirtyEntities[i]];
+		app->entityBounds[app->dirtyEntities[i]] = TransformAABB(app->meshes[app->models[entity.modelIndex].meshIdx].bounds, entity.worldMatrix);
+	});
+
+	RefitBVH(app->entityBVH, app->dirtyEntities, app->entityBounds);
+}
 
-	UnmapBuffer(app->gpBuffer);
+// Gives the new entities their object records and uploads the records of the entities that moved
+static void UpdateObjectRecords(App* app)
+{
+	const u32 firstNewObject = app->objects.size();
 
+	for (u32 e = app->residentEntities; e < app->entities.size(); ++e)
+	{
+		Entity& entity = app->entities[e];
+		const Model& model = app->models[entity.modelIndex];
 
-	//Update uniform blocks ------
-	MapBuffer(app->ubuffer, GL_WRITE_ONLY);
+		entity.firstObject = app->objects.size();
+		app->objects.resize(app->objects.size() + app->meshes[model.meshIdx].submeshes.size());
+		PackObjectRecords(app, entity);
+	}
+	app->residentEntities = app->entities.size();
 
-	for (int i = 0; i < app->entities.size(); ++i)
+	// Entities that moved, the new ones among them were packed above
+	u32 movedCount = 0;
+	for (u32 i = 0; i < app->dirtyEntities.size(); ++i)
 	{
-		app->ubuffer.head = Align(app->ubuffer.head, app->uniformBlockAlignment);
-		app->entities[i].localParamsOffset = app->ubuffer.head;
+		Entity& entity = app->entities[app->dirtyEntities[i]];
+		if (entity.transformDirty)
+		{
+			PackObjectRecords(app, entity);
+			app->dirtyEntities[movedCount++] = app->dirtyEntities[i];
+		}
+	}
 
-		app->worldMatrix = app->entities[i].worldMatrix;
-		app->worldViewProjectionMatrix = app->camera.projectionMatrix * app->camera.viewMatrix * app->entities[i].worldMatrix;
+	const u32 objectCount = app->objects.size();
+	app->uploadedObjects = 0;
 
-		PushMat4(app->ubuffer, app->worldMatrix);
-		PushMat4(app->ubuffer, app->worldViewProjectionMatrix);
+	if (objectCount * sizeof(GPUObject) > app->objectBuffer.size)
+	{
+		// Same buffer object with bigger storage, so the binding in RenderEntities stays valid.
+		// Growing loses the contents, everything is uploaded again from the CPU copy.
+		GrowBuffer(app->objectBuffer, objectCount * sizeof(GPUObject), GL_DYNAMIC_DRAW);
 
-		app->entities[i].localParamsSize = app->ubuffer.head - app->entities[i].localParamsOffset;
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, app->objectBuffer.handle);
+		glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, objectCount * sizeof(GPUObject), app->objects.data());
+		app->uploadedObjects = objectCount;
 	}
+	else
+	{
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, app->objectBuffer.handle);
 
-	UnmapBuffer(app->ubuffer);
-}
+		if (firstNewObject < objectCount)
+		{
+			const u32 newCount = objectCount - firstNewObject;
+			glBufferSubData(GL_SHADER_STORAGE_BUFFER, firstNewObject * sizeof(GPUObject), newCount * sizeof(GPUObject), &app->objects[firstNewObject]);
+			app->uploadedObjects += newCount;
+		}
 
-void renderQuad();
-void renderQuadTangentSpace();
-void BindReliefTextures(int reliefIndex, App* app);
-u32 GetFinalTextureToRender(App* app);
+		for (u32 i = 0; i < movedCount; ++i)
+		{
+			const Entity& entity = app->entities[app->dirtyEntities[i]];
+			const u32 count = app->meshes[app->models[entity.modelIndex].meshIdx].submeshes.size();
 
+			glBufferSubData(GL_SHADER_STORAGE_BUFFER, entity.firstObject * sizeof(GPUObject), count * sizeof(GPUObject), &app->objects[entity.firstObject]);
+			app->uploadedObjects += count;
+		}
+	}
 
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+	app->dirtyEntities.clear();
+}
 
-void Render(App* app)
+// Casts the ray under the mouse into the entity BVH and finds the point lights reaching the hit entity
+static void PickEntity(App* app)
 {
-	switch (app->render_pipeline)
+	const vec2 ndc(app->input.mousePos.x / app->displaySize.x * 2.0f - 1.0f, 1.0f - app->input.mousePos.y / app->displaySize.y * 2.0f);
+	const glm::mat4 inverseViewProjection = glm::inverse(app->camera.projectionMatrix * app->camera.viewMatrix);
+
+	glm::vec4 nearPoint = inverseViewProjection * glm::vec4(ndc, -1.0f, 1.0f);
+	glm::vec4 farPoint = inverseViewProjection * glm::vec4(ndc, 1.0f, 1.0f);
+	const vec3 origin = vec3(nearPoint) / nearPoint.w;
+	const vec3 end = vec3(farPoint) / farPoint.w;
+
+	app->pickedEntity = RaycastBVH(app->entityBVH, origin, glm::normalize(end - origin), glm::length(end - origin), &app->pickedDistance);
+	app->pickedEntityLights = 0;
+	if (app->pickedEntity == BVH_INVALID)
+		return;
+
+	// Only the picked box matters, each light is tested against it directly
+	const AABB& box = app->entityBounds[app->pickedEntity];
+	for (u32 i = 0; i < app->lights.size(); ++i)
 	{
-		case RenderPipeline::DEFERRED:
-			RenderUsingDeferredPipeline(app);
-			break;
-		case RenderPipeline::FORWARD:
-			RenderUsingForwardPipeline(app);
-			break;
-		default:
-			break;
+		const Light& light = app->lights[i];
+		if (light.type == LightType::LIGHT_TYPE_POINT && SphereOverlapsAABB(box, light.position, light.radius))
+			app->pickedEntityLights++;
 	}
-
 }
 
-void RenderUsingDeferredPipeline(App* app)
+// The deferred pipeline allocates its targets in the frame graph. The G-Buffer only exists for the
+// tiled and light volume pipelines, the shading buffer for every pipeline but the deferred one.
+static void UpdatePipelineFramebuffers(App* app)
 {
-	// Clear the screen (also ImGui...)
-	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_2D, 0);
-	glActiveTexture(GL_TEXTURE1);
-	glBindTexture(GL_TEXTURE_2D, 0);
-	glActiveTexture(GL_TEXTURE2);
-	glBindTexture(GL_TEXTURE_2D, 0);
-	glUseProgram(0);
+	const RenderPipeline pipeline = app->render_pipeline;
+	if (pipeline == app->framebuffersPipeline)
+	{
+		if (app->lastFrameDisplaySize != app->displaySize)
+		{
+			if (app->gFbo.IsInitialized())
+				app->gFbo.Resize(app->displaySize.x, app->displaySize.y);
+			if (app->shadingFbo.IsInitialized())
+				app->shadingFbo.Resize(app->displaySize.x, app->displaySize.y);
+		}
+		return;
+	}
 
-	glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
-	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-	glViewport(0, 0, app->displaySize.x, app->displaySize.y);
-	glEnable(GL_DEPTH_TEST);
+	app->shadingFbo.Release();
+	app->gFbo.Release();
+	app->framebuffersPipeline = pipeline;
 
+	const bool tiled = pipeline == RenderPipeline::DEFERRED_TILED;
+	const bool lightVolumes = pipeline == RenderPipeline::DEFERRED_LIGHT_VOLUMES;
+	if (tiled || lightVolumes)
+		app->gFbo.Initialize(app->displaySize.x, app->displaySize.y);
 
-	app->gFbo.Bind();
+	// The light volumes sample the G-Buffer depth while they are depth and stencil tested, they get
+	// a copy of it instead of the attachment itself
+	if (pipeline != RenderPipeline::DEFERRED)
+	{
+		app->shadingFbo.ShareDepthStencil(tiled ? app->gFbo.GetTexture(ZBO) : 0);
+		app->shadingFbo.Initialize(app->displaySize.x, app->displaySize.y);
+	}
+}
 
-	// --------------------------------------- RELIEF MAPPING -------------------------------------
-	RenderReliefMapping(app, app->programs[app->reliefMapShaderID], true);
-	
-	// --------------------------------------- RENDERING ENTITIES -------------------------------------
-	RenderEntities(app, app->programs[app->geometryPassShaderID]);
-	
-	app->gFbo.Unbind();
+void Update(App* app)
+{
+	// The GUI was drawn since the last frame, nothing of the cached GL state can be trusted
+	BeginGLStateFrame();
+	BeginUniformStatsFrame();
 
-	// --------------------------------------- SHADING PASS -------------------------------------
+    // You can handle app->input keyboard/mouse here
+	app->camera.Update(app);
 
-	glDisable(GL_DEPTH_TEST);
+	// Resize window
 
-	app->shadingFbo.Bind();
+	UpdatePipelineFramebuffers(app);
 
-	Program& shaderPassProgram = app->programs[app->shadingPassShaderID];
-	glUseProgram(shaderPassProgram.handle);
+	if (app->lastFrameDisplaySize != app->displaySize)
+	{
+		app->camera.aspect_ratio = (float)app->displaySize.x / (float)app->displaySize.y;
+		app->camera.projectionMatrix = glm::perspective(glm::radians(app->camera.vertical_fov), app->camera.aspect_ratio, app->camera.nearPlane, app->camera.farPlane);
+	}
+	app->lastFrameDisplaySize = app->displaySize;
 
-	glBindBufferRange(GL_UNIFORM_BUFFER, BINDING(0), app->gpBuffer.handle, app->globalParamsOffset, app->globalParamsSize);
+	// Entity culling: the PVS of the camera cell, or else the BVH, gives the entities in the frustum,
+	// and the software occlusion rasterizes the largest of them on the worker threads while the
+	// lights are updated below
 
-	glUniform1i(app->programShadingPassUniformTexturePosition, 0);
-	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_2D, app->gFbo.GetTexture(G_POSITION_TEXTURE));
-	glUniform1i(app->programShadingPassUniformTextureNormals, 1);
-	glActiveTexture(GL_TEXTURE1);
-	glBindTexture(GL_TEXTURE_2D, app->gFbo.GetTexture(G_NORMALS_TEXTURE));
-	glUniform1i(app->programShadingPassUniformTextureAlbedo, 2);
-	glActiveTexture(GL_TEXTURE2);
-	glBindTexture(GL_TEXTURE_2D, app->gFbo.GetTexture(G_ALBEDO_TEXTURE));
-	glUniform1i(app->programShadingPassUniformTextureDepth, 3);
-	glActiveTexture(GL_TEXTURE3);
-	glBindTexture(GL_TEXTURE_2D, app->gFbo.GetTexture(DEPTH_TEXTURE));
+	app->camera.CalculateFrustumPlanes();
+	UpdateEntityBounds(app);
 
-	glUniform1f(glGetUniformLocation(shaderPassProgram.handle, "bright_color_threshold"), app->bright_threshold);
+	if (app->input.mouseButtons[LEFT] == BUTTON_PRESS && app->displaySize.x > 0 && app->displaySize.y > 0)
+		PickEntity(app);
 
+	if (!app->gpu_culling)
+	{
+		if (!app->pvs_culling || !CullEntitiesPVS(app))
+			CullBVH(app->entityBVH, app->camera.frustumPlanes, app->visibleEntities);
+		if (app->software_occlusion)
+			BeginOcclusionRasterization(app);
+	}
 
-	renderQuad();
+	// Lights (point lights outside the frustum are culled, only the records that changed since last frame are uploaded)
 
-	app->shadingFbo.Unbind();
+	ParallelFor(app->lights.size(), LIGHT_RADIUS_GRAIN, [app](u32 i) {
+		app->lights[i].radius = app->lights[i].CalculateRadius();
+	});
 
-	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_2D, 0);
-	glActiveTexture(GL_TEXTURE1);
-	glBindTexture(GL_TEXTURE_2D, 0);
-	glActiveTexture(GL_TEXTURE2);
-	glBindTexture(GL_TEXTURE_2D, 0);
-	glActiveTexture(GL_TEXTURE3);
-	glBindTexture(GL_TEXTURE_2D, 0);
+	UpdateLightStore(app->lightStore, app->lights, app->camera);
+	BindLightStore(app->lightStore);
 
-	glUseProgram(0);
+	// Global params
 
-	glEnable(GL_DEPTH_TEST);
+	MapRingRegion(app->gpBuffer);
+	app->globalParamsOffset = RingRegionOffset(app->gpBuffer);
 
-	// --------------------------------------- LIGHTS RENDERING --------------------------------------
+	GPUGlobalParams globalParams = {};
+	globalParams.cameraPosition = app->camera.position;
+	globalParams.visiblePointLightCount = app->lightStore.visiblePointLights.count;
+	globalParams.directionalLightCount = app->lightStore.directionalLights.count;
+	globalParams.viewProjection = app->camera.projectionMatrix * app->camera.viewMatrix;
+	PushData(app->gpBuffer.buffer, &globalParams, sizeof(globalParams));
+
+	app->globalParamsSize = sizeof(globalParams);
+
+	UnmapRingRegion(app->gpBuffer);
+
+
+	// Object data and draw commands ------
+	// Every submesh of the entities in the frustum goes through the render queue; once sorted, the
+	// runs of items sharing pool, material and mesh become one instanced indirect command with their
+	// instances front to back, and the commands are grouped per geometry pool so a pool is one multi-draw
+
+	if (app->gpu_culling)
+	{
+		// The GPU finds the visible objects and writes the commands, see RenderEntitiesGPUCulled
+		UpdateObjectRecords(app);
+		UpdateCullingObjects(app);
+		return;
+	}
+
+	if (app->software_occlusion)
+		CullOccludedEntities(app);
 
-	// ================ COPY DEPTH ATTACHMENT ================
+	RenderQueue& queue = app->renderQueue;
+	ClearRenderQueue(queue);
 
-	glBindFramebuffer(GL_READ_FRAMEBUFFER, app->gFbo.GetTexture(FBO));
-	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, app->shadingFbo.GetTexture(FBO)); // write to default framebuffer
-	glBlitFramebuffer(0, 0, app->displaySize.x, app->displaySize.y, 0, 0, app->displaySize.x, app->displaySize.y, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	for (u32 v = 0; v < app->visibleEntities.size(); ++v)
+	{
+		const u32 e = app->visibleEntities[v];
+		const Entity& entity = app->entities[e];
+		const Model& model = app->models[entity.modelIndex];
+		const Mesh& mesh = app->meshes[model.meshIdx];
+
+		const float depth = glm::length(vec3(entity.worldMatrix[3]) - app->camera.position) / app->camera.farPlane;
+
+		for (u32 i = 0; i < mesh.submeshes.size(); ++i)
+		{
+			const u32 material = app->materials[model.materialIdx[i]].albedoLayer;
+			const u32 meshKey = (entity.modelIndex << 10) | i;
+			PushRenderItem(queue, MakeRenderKey(RENDER_PASS_OPAQUE, mesh.submeshes[i].poolIdx, material, meshKey, depth), e, i);
+		}
+	}
+
+	queue.stateChangesUnsorted = CountStateChanges(queue);
+	SortRenderQueue(queue);
+	queue.stateChangesSorted = CountStateChanges(queue);
+
+	UpdateObjectRecords(app);
+
+	// Instance stream: the resident object of every queue item, in queue order. The instance
+	// attribute starts at the beginning of the ring, so base instances count from this region.
+	const u32 instanceCount = queue.items.size();
+	GrowRingBuffer(app->objectIndexBuffer, instanceCount * sizeof(u32));
+	const u32 firstInstance = RingRegionOffset(app->objectIndexBuffer) / sizeof(u32);
+
+	for (u32 p = 0; p < app->geometryPools.size(); ++p)
+		app->geometryPools[p].commands.clear();
+
+	if (instanceCount > 0)
+		MapRingRegion(app->objectIndexBuffer);
+
+	for (u32 i = 0; i < instanceCount; ++i)
+	{
+		const RenderItem& item = queue.items[i];
+		const Entity& entity = app->entities[item.entity];
+		const Model& model = app->models[entity.modelIndex];
+		const Submesh& submesh = app->meshes[model.meshIdx].submeshes[item.submesh];
+
+		GeometryPool& pool = app->geometryPools[submesh.poolIdx];
+		if (i == 0 || RenderKeyDrawState(item.key) != RenderKeyDrawState(queue.items[i - 1].key))
+		{
+			DrawElementsIndirectCommand command = {};
+			command.count = submesh.indices.size();
+			command.instanceCount = 0;
+			command.firstIndex = submesh.poolFirstIndex;
+			command.baseVertex = submesh.poolBaseVertex;
+			command.baseInstance = firstInstance + i;
+			pool.commands.push_back(command);
+		}
+		pool.commands.back().instanceCount++;
+
+		PushUInt(app->objectIndexBuffer.buffer, entity.firstObject + item.submesh);
+	}
+
+	if (instanceCount > 0)
+		UnmapRingRegion(app->objectIndexBuffer);
+
+	u32 commandCount = 0;
+	for (u32 p = 0; p < app->geometryPools.size(); ++p)
+		commandCount += app->geometryPools[p].commands.size();
+
+	GrowRingBuffer(app->drawCommandBuffer, commandCount * sizeof(DrawElementsIndirectCommand));
+
+	if (commandCount > 0)
+	{
+		MapRingRegion(app->drawCommandBuffer);
+
+		for (u32 p = 0; p < app->geometryPools.size(); ++p)
+		{
+			GeometryPool& pool = app->geometryPools[p];
+			pool.firstCommand = app->drawCommandBuffer.buffer.head / sizeof(DrawElementsIndirectCommand);
+			if (!pool.commands.empty())
+				PushData(app->drawCommandBuffer.buffer, pool.commands.data(), pool.commands.size() * sizeof(DrawElementsIndirectCommand));
+		}
 
-	// ================  RENDER LIGHT MESHES  ================
+		UnmapRingRegion(app->drawCommandBuffer);
+	}
+}
+
+void renderQuad();
+void renderQuadTangentSpace();
+void BindReliefTextures(int reliefIndex, App* app);
+
+
+
+void Render(App* app)
+{
+	app->entityDrawCalls = 0;
+
+	switch (app->render_pipeline)
+	{
+		case RenderPipeline::DEFERRED:
+			RenderUsingDeferredPipeline(app);
+			break;
+		case RenderPipeline::DEFERRED_TILED:
+			RenderUsingTiledDeferredPipeline(app);
+			break;
+		case RenderPipeline::FORWARD:
+			RenderUsingForwardPipeline(app);
+			break;
+		case RenderPipeline::FORWARD_CLUSTERED:
+			RenderUsingClusteredForwardPipeline(app);
+			break;
+		case RenderPipeline::DEFERRED_LIGHT_VOLUMES:
+			RenderUsingLightVolumeDeferredPipeline(app);
+			break;
+		default:
+			break;
+	}
+
+	// The global params, instance stream and draw commands of this frame are not written again
+	// until the GPU passes this point
+	FenceRingRegion(app->gpBuffer);
+	FenceRingRegion(app->objectIndexBuffer);
+	FenceRingRegion(app->drawCommandBuffer);
+}
+
+static void ExecuteGeometryPass(App* app, FrameGraph& graph, const FrameGraphPass& pass)
+{
+	EnableCapability(GL_DEPTH_TEST);
+
+	// --------------------------------------- RELIEF MAPPING -------------------------------------
+	RenderReliefMapping(app, app->programs[app->reliefMapCompactShaderID], app->reliefMapCompactUniforms, true);
+
+	// --------------------------------------- RENDERING ENTITIES -------------------------------------
+	RenderEntities(app, app->programs[app->geometryPassCompactShaderID], GetFrameGraphTexture(graph, pass.depthStencilAttachment.resource));
+}
+
+static void ExecuteShadingPass(App* app, FrameGraph& graph, const FrameGraphPass& pass)
+{
+	DisableCapability(GL_DEPTH_TEST);
+
+	Program& shaderPassProgram = app->programs[app->shadingPassCompactShaderID];
+	UseProgram(shaderPassProgram.handle);
+
+	BindBufferRange(GL_UNIFORM_BUFFER, BINDING(0), app->gpBuffer.buffer.handle, app->globalParamsOffset, app->globalParamsSize);
+
+	// World positions are reconstructed from the depth
+	const glm::mat4 inverseViewProjection = glm::inverse(app->camera.projectionMatrix * app->camera.viewMatrix);
+	SetUniformMatrix4f(shaderPassProgram, app->programShadingPassCompactUniformInverseViewProjection, inverseViewProjection);
+
+	ActiveTexture(GL_TEXTURE0);
+	BindTexture(GL_TEXTURE_2D, GetFrameGraphTexture(graph, pass.reads[0]));
+	ActiveTexture(GL_TEXTURE1);
+	BindTexture(GL_TEXTURE_2D, GetFrameGraphTexture(graph, pass.reads[1]));
+	ActiveTexture(GL_TEXTURE2);
+	BindTexture(GL_TEXTURE_2D, GetFrameGraphTexture(graph, pass.reads[2]));
+
+	SetUniform1f(shaderPassProgram, app->programShadingPassCompactUniformBrightThreshold, app->bright_threshold);
+
+	renderQuad();
+
+	EnableCapability(GL_DEPTH_TEST);
+}
+
+static void ExecuteGBufferDebugPass(App* app, FrameGraph& graph, const FrameGraphPass& pass)
+{
+	DisableCapability(GL_DEPTH_TEST);
+
+	Program& debugProgram = app->programs[app->gBufferDebugShaderID];
+	UseProgram(debugProgram.handle);
+
+	const glm::mat4 inverseViewProjection = glm::inverse(app->camera.projectionMatrix * app->camera.viewMatrix);
+	SetUniformMatrix4f(debugProgram, app->programGBufferDebugUniformInverseViewProjection, inverseViewProjection);
+	SetUniform1i(debugProgram, app->programGBufferDebugUniformMode, pass.userData);
+
+	ActiveTexture(GL_TEXTURE0);
+	BindTexture(GL_TEXTURE_2D, GetFrameGraphTexture(graph, pass.reads[0]));
+	ActiveTexture(GL_TEXTURE1);
+	BindTexture(GL_TEXTURE_2D, GetFrameGraphTexture(graph, pass.reads[1]));
+
+	renderQuad();
 
-	app->shadingFbo.Bind(false);
+	EnableCapability(GL_DEPTH_TEST);
+}
 
+static void ExecuteLightMeshesPass(App* app, FrameGraph&, const FrameGraphPass&)
+{
+	// The G-Buffer depth is attached directly, no copy needed
 	RenderLights(app, app->programs[app->lightsShaderID]);
+}
 
-	app->shadingFbo.Unbind();
+// Normalized weights of the center and positive side of a Gaussian kernel of the given radius
+static void ComputeBlurWeights(int radius, float* weights)
+{
+	const float sigma = (radius + 1) / 2.5f;
 
-	// --------------------------------------- BLOOM PASS -------------------------------------
+	float sum = 0.0f;
+	for (int i = 0; i <= radius; ++i)
+	{
+		weights[i] = glm::exp(-(float)(i * i) / (2.0f * sigma * sigma));
+		sum += i == 0 ? weights[i] : 2.0f * weights[i];
+	}
+
+	for (int i = 0; i <= radius; ++i)
+		weights[i] /= sum;
+}
 
+static void ExecuteBlurPass(App* app, FrameGraph& graph, const FrameGraphPass& pass)
+{
 	Program& blurShader = app->programs[app->blurShaderID];
-	app->blurFbo.BlurImage(app->blurIterations, app->shadingFbo.GetTexture(BRIGHT_COLOR_TEXTURE), blurShader, renderQuad);
+	UseProgram(blurShader.handle);
+
+	float weights[MAX_BLUR_RADIUS + 1];
+	ComputeBlurWeights(app->blurRadius, weights);
+	SetUniform1i(blurShader, app->programBlurUniformRadius, app->blurRadius);
+	SetUniform1fv(blurShader, app->programBlurUniformWeights, app->blurRadius + 1, weights);
+
+	SetUniform1i(blurShader, app->programBlurUniformHorizontal, pass.userData != 0);
+	ActiveTexture(GL_TEXTURE0);
+	BindTexture(GL_TEXTURE_2D, GetFrameGraphTexture(graph, pass.reads[0]));
+
+	renderQuad();
+}
+
+static void ExecuteBlurComputePass(App* app, FrameGraph& graph, const FrameGraphPass& pass)
+{
+	Program& blurComputeShader = app->programs[app->blurComputeShaderID];
+	UseProgram(blurComputeShader.handle);
+
+	float weights[MAX_BLUR_RADIUS + 1];
+	ComputeBlurWeights(app->blurRadius, weights);
+	SetUniform1i(blurComputeShader, app->programBlurComputeUniformRadius, app->blurRadius);
+	SetUniform1fv(blurComputeShader, app->programBlurComputeUniformWeights, app->blurRadius + 1, weights);
+
+	const bool horizontal = pass.userData != 0;
+	SetUniform1i(blurComputeShader, app->programBlurComputeUniformHorizontal, horizontal);
+
+	ActiveTexture(GL_TEXTURE0);
+	BindTexture(GL_TEXTURE_2D, GetFrameGraphTexture(graph, pass.reads[0]));
+	glBindImageTexture(0, GetFrameGraphTexture(graph, pass.storageWrites[0]), 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA16F);
+
+	// One work group per BLUR_GROUP_SIZE texels of a line along the blur direction
+	const FrameGraphTextureDesc& desc = graph.resources[pass.storageWrites[0]].desc;
+	const u32 lineLength = horizontal ? desc.width : desc.height;
+	const u32 lineCount = horizontal ? desc.height : desc.width;
+	glDispatchCompute((lineLength + BLUR_GROUP_SIZE - 1) / BLUR_GROUP_SIZE, lineCount, 1);
+
+	glBindImageTexture(0, 0, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA16F);
+}
+
+// One direction of the separable Gaussian blur, returns the blurred copy of source
+static u32 AddBlurPass(App* app, FrameGraph& graph, u32 source, bool horizontal)
+{
+	const FrameGraphTextureDesc& sourceDesc = graph.resources[source].desc;
+	const FrameGraphTextureDesc blurredDesc = { sourceDesc.width, sourceDesc.height, GL_RGBA16F, GL_RGBA, GL_FLOAT, GL_LINEAR };
+	const u32 blurred = CreateTransientTexture(graph, "Blurred", blurredDesc);
+
+	if (app->blurBackend == BlurBackend::COMPUTE)
+	{
+		const u32 pass = AddPass(graph, horizontal ? "Blur H (compute)" : "Blur V (compute)", ExecuteBlurComputePass, horizontal);
+		PassRead(graph, pass, source);
+		PassWriteStorage(graph, pass, blurred);
+	}
+	else
+	{
+		const u32 pass = AddPass(graph, horizontal ? "Blur H" : "Blur V", ExecuteBlurPass, horizontal);
+		PassRead(graph, pass, source);
+		PassWriteColor(graph, pass, blurred, LoadAction::DONT_CARE, StoreAction::STORE);
+	}
+
+	return blurred;
+}
+
+static void ExecuteBloomDownsamplePass(App* app, FrameGraph& graph, const FrameGraphPass& pass)
+{
+	Program& downsampleShader = app->programs[app->bloomDownsampleShaderID];
+	UseProgram(downsampleShader.handle);
+
+	const FrameGraphTextureDesc& source = graph.resources[pass.reads[0]].desc;
+	SetUniform2f(downsampleShader, app->programBloomDownsampleUniformTexelSize, vec2(1.0f / source.width, 1.0f / source.height));
+	SetUniform1i(downsampleShader, app->programBloomDownsampleUniformKarisAverage, pass.userData == 0);
+
+	ActiveTexture(GL_TEXTURE0);
+	BindTexture(GL_TEXTURE_2D, GetFrameGraphTexture(graph, pass.reads[0]));
+
+	renderQuad();
+}
+
+static void ExecuteBloomUpsamplePass(App* app, FrameGraph& graph, const FrameGraphPass& pass)
+{
+	Program& upsampleShader = app->programs[app->bloomUpsampleShaderID];
+	UseProgram(upsampleShader.handle);
+
+	const FrameGraphTextureDesc& source = graph.resources[pass.reads[0]].desc;
+	SetUniform2f(upsampleShader, app->programBloomUpsampleUniformTexelSize, vec2(1.0f / source.width, 1.0f / source.height));
+	SetUniform1f(upsampleShader, app->programBloomUpsampleUniformFilterRadius, app->bloomFilterRadius);
+
+	ActiveTexture(GL_TEXTURE0);
+	BindTexture(GL_TEXTURE_2D, GetFrameGraphTexture(graph, pass.reads[0]));
+
+	// The blurred lower level is added to what the downsample left in this one
+	EnableCapability(GL_BLEND);
+	glBlendFunc(GL_ONE, GL_ONE);
+
+	renderQuad();
+
+	DisableCapability(GL_BLEND);
+}
+
+// Returns the blurred bright color, or brightColor itself when there is nothing to blur
+static u32 AddBloomPasses(App* app, FrameGraph& graph, u32 brightColor)
+{
+	const FrameGraphTextureDesc brightDesc = graph.resources[brightColor].desc;
+	u32 bloom = brightColor;
+
+	if (app->bloomMode == BloomMode::GAUSSIAN)
+	{
+		// One pass per blur iteration, every iteration writes a new texture so they alias in pairs
+		for (int i = 0; i < app->blurIterations; ++i)
+			bloom = AddBlurPass(app, graph, bloom, (i % 2) == 0);
+		return bloom;
+	}
+
+	// Each level halves the previous one, so the whole chain costs about a third of a
+	// full resolution pass whatever the blur radius. R11G11B10F is plenty for bloom.
+	u32 levels[BLOOM_MIP_LEVELS];
+	u32 levelCount = 0;
+	u32 width = brightDesc.width;
+	u32 height = brightDesc.height;
+
+	while (levelCount < BLOOM_MIP_LEVELS && width > 1 && height > 1)
+	{
+		width /= 2;
+		height /= 2;
+
+		const FrameGraphTextureDesc levelDesc = { width, height, GL_R11F_G11F_B10F, GL_RGB, GL_FLOAT, GL_LINEAR };
+		levels[levelCount] = CreateTransientTexture(graph, "Bloom mip", levelDesc);
+
+		const u32 pass = AddPass(graph, "Bloom downsample", ExecuteBloomDownsamplePass, levelCount);
+		PassRead(graph, pass, bloom);
+		PassWriteColor(graph, pass, levels[levelCount], LoadAction::DONT_CARE, StoreAction::STORE);
+
+		bloom = levels[levelCount++];
+	}
+
+	// Too small to downsample even once
+	if (levelCount == 0)
+		return brightColor;
+
+	// Back up the chain, every level accumulates the blur of all the smaller ones
+	for (u32 i = levelCount - 1; i > 0; --i)
+	{
+		const u32 pass = AddPass(graph, "Bloom upsample", ExecuteBloomUpsamplePass);
+		PassRead(graph, pass, levels[i]);
+		PassWriteColor(graph, pass, levels[i - 1], LoadAction::LOAD, StoreAction::STORE);
+	}
+
+	return levels[0];
+}
+
+static void ExecuteFinalPass(App* app, FrameGraph& graph, const FrameGraphPass& pass)
+{
+	// The shading passes leave depth testing on, the quad must not be tested against the window depth
+	DisableCapability(GL_DEPTH_TEST);
+	Viewport(0, 0, app->displaySize.x, app->displaySize.y);
+
+	const u32 bloomTexture = pass.reads.size() > 1 ? GetFrameGraphTexture(graph, pass.reads[1]) : 0;
+	FinalRenderPass(app, GetFrameGraphTexture(graph, pass.reads[0]), bloomTexture);
+}
+
+void RenderUsingDeferredPipeline(App* app)
+{
+	// A minimized window has no backbuffer to draw to, and zero sized textures cannot be attached
+	if (app->displaySize.x <= 0 || app->displaySize.y <= 0)
+		return;
+
+	// Passes are declared in execution order, the ones the displayed texture does not depend on are culled
+	FrameGraph& graph = app->frameGraph;
+	BeginFrameGraph(graph);
+
+	const u32 width = app->displaySize.x;
+	const u32 height = app->displaySize.y;
+
+	const FrameGraphTextureDesc colorDesc = { width, height, GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE, GL_NEAREST };
+	const FrameGraphTextureDesc normalDesc = { width, height, GL_RG16, GL_RG, GL_UNSIGNED_SHORT, GL_NEAREST };
+	const FrameGraphTextureDesc hdrDesc = { width, height, GL_RGBA16F, GL_RGBA, GL_FLOAT, GL_NEAREST };
+	const FrameGraphTextureDesc depthStencilDesc = { width, height, GL_DEPTH24_STENCIL8, GL_DEPTH_STENCIL, GL_UNSIGNED_INT_24_8, GL_NEAREST };
+
+	// Compact G-Buffer: 12 bytes per pixel, positions come from the depth
+	const u32 gAlbedo = CreateTransientTexture(graph, "G_Albedo", colorDesc);
+	const u32 gNormals = CreateTransientTexture(graph, "G_Normals", normalDesc);
+	const u32 depthStencil = CreateTransientTexture(graph, "DepthStencil", depthStencilDesc);
+	const u32 sceneColor = CreateTransientTexture(graph, "SceneColor", hdrDesc);
+	const u32 brightColor = CreateTransientTexture(graph, "BrightColor", { width, height, GL_RGBA16F, GL_RGBA, GL_FLOAT, GL_LINEAR });
+
+	// --------------------------------------- GEOMETRY PASS -------------------------------------
+	u32 pass = AddPass(graph, "Geometry", ExecuteGeometryPass);
+	PassWriteColor(graph, pass, gAlbedo, LoadAction::CLEAR, StoreAction::STORE);
+	PassWriteColor(graph, pass, gNormals, LoadAction::CLEAR, StoreAction::STORE);
+	PassWriteDepthStencil(graph, pass, depthStencil, LoadAction::CLEAR, StoreAction::STORE);
+
+	// --------------------------------------- SHADING PASS -------------------------------------
+	pass = AddPass(graph, "Shading", ExecuteShadingPass);
+	PassRead(graph, pass, gNormals);
+	PassRead(graph, pass, gAlbedo);
+	PassRead(graph, pass, depthStencil);
+	PassWriteColor(graph, pass, sceneColor, LoadAction::DONT_CARE, StoreAction::STORE);
+	PassWriteColor(graph, pass, brightColor, LoadAction::DONT_CARE, StoreAction::STORE);
+
+	// --------------------------------------- LIGHTS RENDERING --------------------------------------
+	pass = AddPass(graph, "Light meshes", ExecuteLightMeshesPass);
+	PassWriteColor(graph, pass, sceneColor, LoadAction::LOAD, StoreAction::STORE);
+	PassWriteDepthStencil(graph, pass, depthStencil, LoadAction::LOAD, StoreAction::STORE);
+
+	// --------------------------------------- BLOOM PASS -------------------------------------
+	const u32 bloom = AddBloomPasses(app, graph, brightColor);
+
+	// --------------------------------------- G-BUFFER DEBUG VIEW -------------------------------------
+	// Positions, normals and linear depth have to be decoded to be displayed
+	u32 displayed = sceneColor;
+	switch (app->displayedTexture)
+	{
+	case G_POSITION_TEXTURE:
+	case G_NORMALS_TEXTURE:
+	case DEPTH_TEXTURE:
+		displayed = CreateTransientTexture(graph, "G_Debug", hdrDesc);
+
+		pass = AddPass(graph, "G-Buffer debug", ExecuteGBufferDebugPass, app->displayedTexture);
+		PassRead(graph, pass, gNormals);
+		PassRead(graph, pass, depthStencil);
+		PassWriteColor(graph, pass, displayed, LoadAction::DONT_CARE, StoreAction::STORE);
+		break;
+	case G_ALBEDO_TEXTURE: displayed = gAlbedo; break;
+	case BRIGHT_COLOR_TEXTURE: displayed = brightColor; break;
+	case BLURRED_TEXTURE: displayed = bloom; break;
+	default: break;
+	}
 
 	// --------------------------------------- RENDER SCREEN QUAD -------------------------------------
+	pass = AddPass(graph, "Final", ExecuteFinalPass);
+	PassWriteBackbuffer(graph, pass, LoadAction::CLEAR);
+	PassRead(graph, pass, displayed);
+	if (displayed == sceneColor && app->using_bloom && bloom != brightColor)
+		PassRead(graph, pass, bloom);
+
+	CompileFrameGraph(graph);
+	ExecuteFrameGraph(graph, app);
+}
+
+void RenderBloomAndFinalPass(App* app)
+{
+	if (app->displaySize.x <= 0 || app->displaySize.y <= 0)
+		return;
+
+	// The shaded image lives in the fixed framebuffers, only the bloom and debug targets are transient
+	FrameGraph& graph = app->frameGraph;
+	BeginFrameGraph(graph);
+
+	const u32 width = app->displaySize.x;
+	const u32 height = app->displaySize.y;
+	const FrameGraphTextureDesc hdrDesc = { width, height, GL_RGBA16F, GL_RGBA, GL_FLOAT, GL_NEAREST };
+
+	const u32 sceneColor = ImportTexture(graph, "SceneColor", app->shadingFbo.GetTexture(RENDER_TEXTURE), hdrDesc);
+	const u32 brightColor = ImportTexture(graph, "BrightColor", app->shadingFbo.GetTexture(BRIGHT_COLOR_TEXTURE), hdrDesc);
+
+	const u32 bloom = AddBloomPasses(app, graph, brightColor);
+
+	// Only the deferred pipelines display the G-Buffer, it is decoded as in RenderUsingDeferredPipeline
+	u32 displayed = sceneColor;
+	u32 pass = 0;
+	switch (app->displayedTexture)
+	{
+	case G_POSITION_TEXTURE:
+	case G_NORMALS_TEXTURE:
+	case DEPTH_TEXTURE:
+	{
+		const u32 gNormals = ImportTexture(graph, "G_Normals", app->gFbo.GetTexture(G_NORMALS_TEXTURE), { width, height, GL_RG16, GL_RG, GL_UNSIGNED_SHORT, GL_NEAREST });
+		const u32 depthStencil = ImportTexture(graph, "DepthStencil", app->gFbo.GetTexture(ZBO), { width, height, GL_DEPTH24_STENCIL8, GL_DEPTH_STENCIL, GL_UNSIGNED_INT_24_8, GL_NEAREST });
+		displayed = CreateTransientTexture(graph, "G_Debug", hdrDesc);
+
+		pass = AddPass(graph, "G-Buffer debug", ExecuteGBufferDebugPass, app->displayedTexture);
+		PassRead(graph, pass, gNormals);
+		PassRead(graph, pass, depthStencil);
+		PassWriteColor(graph, pass, displayed, LoadAction::DONT_CARE, StoreAction::STORE);
+		break;
+	}
+	case G_ALBEDO_TEXTURE: displayed = ImportTexture(graph, "G_Albedo", app->gFbo.GetTexture(G_ALBEDO_TEXTURE), { width, height, GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE, GL_NEAREST }); break;
+	case BRIGHT_COLOR_TEXTURE: displayed = brightColor; break;
+	case BLURRED_TEXTURE: displayed = bloom; break;
+	default: break;
+	}
 
-	FinalRenderPass(app);
+	pass = AddPass(graph, "Final", ExecuteFinalPass);
+	PassWriteBackbuffer(graph, pass, LoadAction::CLEAR);
+	PassRead(graph, pass, displayed);
+	if (displayed == sceneColor && app->using_bloom && bloom != brightColor)
+		PassRead(graph, pass, bloom);
 
-	// -------------------------------------------------------------------------------------------------
+	CompileFrameGraph(graph);
+	ExecuteFrameGraph(graph, app);
 }
 
+void RenderUsingTiledDeferredPipeline(App* app)
+{
+	glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	Viewport(0, 0, app->displaySize.x, app->displaySize.y);
+	EnableCapability(GL_DEPTH_TEST);
+
+	app->gFbo.Bind(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+	// --------------------------------------- RELIEF MAPPING -------------------------------------
+	RenderReliefMapping(app, app->programs[app->reliefMapCompactShaderID], app->reliefMapCompactUniforms, true);
+
+	// --------------------------------------- RENDERING ENTITIES -------------------------------------
+	RenderEntities(app, app->programs[app->geometryPassCompactShaderID], app->gFbo.GetTexture(ZBO));
+
+	app->gFbo.Unbind();
+
+	// --------------------------------------- TILED SHADING PASS -------------------------------------
+	// One work group per 16x16 tile: it builds the tile depth bounds, culls the lights against the
+	// tile frustum and shades its pixels with the surviving lights only.
+
+	Program& tiledShadingProgram = app->programs[app->tiledDeferredShaderID];
+	UseProgram(tiledShadingProgram.handle);
+
+	BindBufferRange(GL_UNIFORM_BUFFER, BINDING(0), app->gpBuffer.buffer.handle, app->globalParamsOffset, app->globalParamsSize);
+
+	// World positions are reconstructed from the depth
+	glm::mat4 inverseProjection = glm::inverse(app->camera.projectionMatrix);
+	glm::mat4 inverseViewProjection = glm::inverse(app->camera.projectionMatrix * app->camera.viewMatrix);
+	SetUniformMatrix4f(tiledShadingProgram, app->programTiledDeferredUniformView, app->camera.viewMatrix);
+	SetUniformMatrix4f(tiledShadingProgram, app->programTiledDeferredUniformInverseProjection, inverseProjection);
+	SetUniformMatrix4f(tiledShadingProgram, app->programTiledDeferredUniformInverseViewProjection, inverseViewProjection);
+	SetUniform1f(tiledShadingProgram, app->programTiledDeferredUniformBrightThreshold, app->bright_threshold);
+
+	ActiveTexture(GL_TEXTURE0);
+	BindTexture(GL_TEXTURE_2D, app->gFbo.GetTexture(G_NORMALS_TEXTURE));
+	ActiveTexture(GL_TEXTURE1);
+	BindTexture(GL_TEXTURE_2D, app->gFbo.GetTexture(G_ALBEDO_TEXTURE));
+	ActiveTexture(GL_TEXTURE2);
+	BindTexture(GL_TEXTURE_2D, app->gFbo.GetTexture(ZBO));
+
+	glBindImageTexture(0, app->shadingFbo.GetTexture(RENDER_TEXTURE), 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA16F);
+	glBindImageTexture(1, app->shadingFbo.GetTexture(BRIGHT_COLOR_TEXTURE), 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA16F);
+
+	const u32 TILE_SIZE = 16;
+	glDispatchCompute((app->displaySize.x + TILE_SIZE - 1) / TILE_SIZE, (app->displaySize.y + TILE_SIZE - 1) / TILE_SIZE, 1);
+
+	// The shaded image is read by the blur and final passes and drawn over by the light meshes
+	glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT | GL_FRAMEBUFFER_BARRIER_BIT);
+
+	glBindImageTexture(0, 0, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA16F);
+	glBindImageTexture(1, 0, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA16F);
+
+	// --------------------------------------- LIGHTS RENDERING --------------------------------------
+	// The shading buffer shares the G-Buffer depth, the light meshes are depth tested against it as is
+
+	app->shadingFbo.Bind();
+
+	RenderLights(app, app->programs[app->lightsShaderID]);
+
+	app->shadingFbo.Unbind();
+
+	// --------------------------------------- BLOOM AND SCREEN QUAD -------------------------------------
+
+	RenderBloomAndFinalPass(app);
+}
+
+void RenderUsingLightVolumeDeferredPipeline(App* app)
+{
+	glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	Viewport(0, 0, app->displaySize.x, app->displaySize.y);
+	EnableCapability(GL_DEPTH_TEST);
+
+	app->gFbo.Bind(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+	// --------------------------------------- RELIEF MAPPING -------------------------------------
+	RenderReliefMapping(app, app->programs[app->reliefMapCompactShaderID], app->reliefMapCompactUniforms, true);
+
+	// --------------------------------------- RENDERING ENTITIES -------------------------------------
+	RenderEntities(app, app->programs[app->geometryPassCompactShaderID], app->gFbo.GetTexture(ZBO));
+
+	app->gFbo.Unbind();
+
+	// The light volumes are depth and stencil tested against a copy of the G-Buffer depth, the
+	// G-Buffer one is sampled to reconstruct the positions
+	const ivec2 size = app->displaySize;
+	BindFramebuffer(GL_READ_FRAMEBUFFER, app->gFbo.GetTexture(FBO));
+	BindFramebuffer(GL_DRAW_FRAMEBUFFER, app->shadingFbo.GetTexture(FBO));
+	glBlitFramebuffer(0, 0, size.x, size.y, 0, 0, size.x, size.y, GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT, GL_NEAREST);
+	BindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+	BindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+
+	app->shadingFbo.Bind(GL_COLOR_BUFFER_BIT);
+
+	// Lights only write the lit color, bright colors are extracted once all of them are accumulated
+	GLuint drawBuffers[] = { GL_COLOR_ATTACHMENT0, GL_NONE };
+	glDrawBuffers(2, drawBuffers);
+
+	BindBufferRange(GL_UNIFORM_BUFFER, BINDING(0), app->gpBuffer.buffer.handle, app->globalParamsOffset, app->globalParamsSize);
+
+	ActiveTexture(GL_TEXTURE0);
+	BindTexture(GL_TEXTURE_2D, app->gFbo.GetTexture(G_NORMALS_TEXTURE));
+	ActiveTexture(GL_TEXTURE1);
+	BindTexture(GL_TEXTURE_2D, app->gFbo.GetTexture(G_ALBEDO_TEXTURE));
+	ActiveTexture(GL_TEXTURE2);
+	BindTexture(GL_TEXTURE_2D, app->gFbo.GetTexture(ZBO));
+
+	// World positions are reconstructed from the depth
+	const glm::mat4 viewProjection = app->camera.projectionMatrix * app->camera.viewMatrix;
+	const glm::mat4 inverseViewProjection = glm::inverse(viewProjection);
+
+	EnableCapability(GL_BLEND);
+	glBlendEquation(GL_FUNC_ADD);
+	glBlendFunc(GL_ONE, GL_ONE);
+	glDepthMask(GL_FALSE);
+
+	// --------------------------------------- DIRECTIONAL LIGHTS -------------------------------------
+
+	DisableCapability(GL_DEPTH_TEST);
+
+	Program& directionalProgram = app->programs[app->lightVolumeDirectionalShaderID];
+	UseProgram(directionalProgram.handle);
+	SetUniform2f(directionalProgram, app->programLightVolumeDirectionalUniformScreenSize, vec2(app->displaySize));
+	SetUniformMatrix4f(directionalProgram, app->programLightVolumeDirectionalUniformInverseViewProjection, inverseViewProjection);
+
+	renderQuad();
+
+	// --------------------------------------- POINT LIGHT VOLUMES -------------------------------------
+	// Per light: a stencil pass marks the pixels whose G-Buffer surface lies inside the sphere (back face
+	// behind the surface, front face in front of it), then only those pixels are shaded by the back faces.
+	// Drawing back faces keeps it correct with the camera inside the volume and shades every pixel once.
+
+	Program& stencilProgram = app->programs[app->lightVolumeStencilShaderID];
+	Program& pointProgram = app->programs[app->lightVolumePointShaderID];
+
+	UseProgram(pointProgram.handle);
+	SetUniform2f(pointProgram, app->programLightVolumePointUniformScreenSize, vec2(app->displaySize));
+	SetUniformMatrix4f(pointProgram, app->programLightVolumePointUniformInverseViewProjection, inverseViewProjection);
+
+	Mesh& sphereMesh = app->meshes[app->models[app->sphere].meshIdx];
+	const Submesh& sphereSubmesh = sphereMesh.submeshes[0];
+	GLuint stencilVao = FindVAO(sphereMesh, 0, stencilProgram);
+	GLuint pointVao = FindVAO(sphereMesh, 0, pointProgram);
+
+	EnableCapability(GL_STENCIL_TEST);
+
+	const std::vector<u32>& visibleLights = app->lightStore.visiblePointRecords;
+
+	for (u32 i = 0; i < visibleLights.size(); ++i)
+	{
+		const GPUPointLight& light = app->lightStore.pointRecords[visibleLights[i]];
+
+		// The tessellated sphere is inscribed in the unit sphere, grow it slightly so it covers the whole radius
+		glm::mat4 worldMatrix = TransformPositionScale(light.position, vec3(light.radius * 1.05f));
+		glm::mat4 worldViewProjectionMatrix = viewProjection * worldMatrix;
+
+		// ------------------  Stencil pass  ------------------
+
+		UseProgram(stencilProgram.handle);
+		SetUniformMatrix4f(stencilProgram, app->programLightVolumeStencilUniformWorldViewProjection, worldViewProjectionMatrix);
+
+		glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+		EnableCapability(GL_DEPTH_TEST);
+		DisableCapability(GL_CULL_FACE);
+		glClear(GL_STENCIL_BUFFER_BIT);
+
+		glStencilFunc(GL_ALWAYS, 0, 0);
+		glStencilOpSeparate(GL_BACK, GL_KEEP, GL_INCR_WRAP, GL_KEEP);
+		glStencilOpSeparate(GL_FRONT, GL_KEEP, GL_DECR_WRAP, GL_KEEP);
+
+		BindVertexArray(stencilVao);
+		glDrawElements(GL_TRIANGLES, sphereSubmesh.indices.size(), GL_UNSIGNED_INT, (void*)(u64)sphereSubmesh.indexOffset);
+
+		// ------------------  Light pass  ------------------
+
+		UseProgram(pointProgram.handle);
+		SetUniformMatrix4f(pointProgram, app->programLightVolumePointUniformWorldViewProjection, worldViewProjectionMatrix);
+		SetUniform1ui(pointProgram, app->programLightVolumePointUniformLightIndex, visibleLights[i]);
+
+		glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+		DisableCapability(GL_DEPTH_TEST);
+		EnableCapability(GL_CULL_FACE);
+		glCullFace(GL_FRONT);
+
+		glStencilFunc(GL_NOTEQUAL, 0, 0xFF);
+		glStencilOp(GL_KEEP, GL_KEEP, GL_KEEP);
+
+		BindVertexArray(pointVao);
+		glDrawElements(GL_TRIANGLES, sphereSubmesh.indices.size(), GL_UNSIGNED_INT, (void*)(u64)sphereSubmesh.indexOffset);
+	}
+
+	BindVertexArray(0);
+	DisableCapability(GL_STENCIL_TEST);
+	glCullFace(GL_BACK);
+	DisableCapability(GL_CULL_FACE);
+	DisableCapability(GL_BLEND);
+	glDepthMask(GL_TRUE);
+
+	GLuint allDrawBuffers[] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
+	glDrawBuffers(2, allDrawBuffers);
+
+	app->shadingFbo.Unbind();
+
+	// --------------------------------------- BRIGHT COLOR EXTRACTION -------------------------------------
+
+	app->shadingFbo.BindBrightColorTarget();
+
+	Program& brightExtractProgram = app->programs[app->brightExtractShaderID];
+	UseProgram(brightExtractProgram.handle);
+	SetUniform1f(brightExtractProgram, app->programBrightExtractUniformThreshold, app->bright_threshold);
+	ActiveTexture(GL_TEXTURE0);
+	BindTexture(GL_TEXTURE_2D, app->shadingFbo.GetTexture(RENDER_TEXTURE));
+
+	renderQuad();
+
+	app->shadingFbo.Unbind();
+
+	EnableCapability(GL_DEPTH_TEST);
+
+	// --------------------------------------- LIGHTS RENDERING --------------------------------------
+
+	app->shadingFbo.Bind();
+
+	RenderLights(app, app->programs[app->lightsShaderID]);
+
+	app->shadingFbo.Unbind();
+
+	// --------------------------------------- BLOOM AND SCREEN QUAD -------------------------------------
+
+	RenderBloomAndFinalPass(app);
+}
 
 void RenderUsingForwardPipeline(App* app)
 {
 	glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-	glViewport(0, 0, app->displaySize.x, app->displaySize.y);
-	glEnable(GL_DEPTH_TEST);
+	Viewport(0, 0, app->displaySize.x, app->displaySize.y);
+	EnableCapability(GL_DEPTH_TEST);
 
 	// ------------------------ ENTITIES -------------------------------------
 
-	app->shadingFbo.Bind();
-	RenderReliefMapping(app, app->programs[app->reliefMapShaderForwardID], false);
-	RenderEntities(app, app->programs[app->texturedMeshProgramIdx]);
+	app->shadingFbo.Bind(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	RenderReliefMapping(app, app->programs[app->reliefMapShaderForwardID], app->reliefMapForwardUniforms, false);
+	RenderEntities(app, app->programs[app->texturedMeshProgramIdx], app->shadingFbo.GetDepthStencil());
 	app->shadingFbo.Unbind();
 
 	// ------------------------ LIGHTS -------------------------------------
 
-	app->shadingFbo.Bind(false);
+	app->shadingFbo.Bind();
 	RenderLights(app, app->programs[app->lightsShaderID]);
 	app->shadingFbo.Unbind();
 
-	// ------------------------ BLOOM PASS -------------------------------------
-
-	Program& blurShader = app->programs[app->blurShaderID];
-	app->blurFbo.BlurImage(app->blurIterations, app->shadingFbo.GetTexture(BRIGHT_COLOR_TEXTURE), blurShader, renderQuad);
+	// ------------------------ BLOOM AND FINAL PASS -------------------------------------
 
-	// ------------------------ FINAL PASS -------------------------------------
+	RenderBloomAndFinalPass(app);
+}
 
-	FinalRenderPass(app);
+static void SetClusterUniforms(App* app, Program& program, const ClusterUniforms& uniforms)
+{
+	// Exponential slicing: slice = log(z) * scale - bias
+	float logDepthRange = logf(app->camera.farPlane / app->camera.nearPlane);
+
+	SetUniform2f(program, uniforms.screenSize, vec2(app->displaySize));
+	SetUniform1f(program, uniforms.nearPlane, app->camera.nearPlane);
+	SetUniform1f(program, uniforms.farPlane, app->camera.farPlane);
+	SetUniform1f(program, uniforms.clusterScale, CLUSTER_GRID_Z / logDepthRange);
+	SetUniform1f(program, uniforms.clusterBias, CLUSTER_GRID_Z * logf(app->camera.nearPlane) / logDepthRange);
+	SetUniform1f(program, uniforms.brightColorThreshold, app->bright_threshold);
 }
 
-void RenderReliefMapping(App* app, const Program& program, bool deferred_rendering)
+void RenderUsingClusteredForwardPipeline(App* app)
 {
+	glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	Viewport(0, 0, app->displaySize.x, app->displaySize.y);
+	EnableCapability(GL_DEPTH_TEST);
+
+	BindBufferRange(GL_UNIFORM_BUFFER, BINDING(0), app->gpBuffer.buffer.handle, app->globalParamsOffset, app->globalParamsSize);
+	BindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING(0), app->clusterLightCounts.handle);
+	BindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING(1), app->clusterLightIndices.handle);
+
+	// ------------------------ LIGHT ASSIGNMENT -------------------------------------
+	// Builds the list of lights touching every cluster (screen tile x exponential depth slice) once per frame
+
+	Program& cullingProgram = app->programs[app->clusteredLightCullingShaderID];
+	UseProgram(cullingProgram.handle);
 
-	Program reliefMapShading = program;
-	glUseProgram(reliefMapShading.handle);
+	glm::mat4 inverseProjection = glm::inverse(app->camera.projectionMatrix);
+	SetUniformMatrix4f(cullingProgram, app->programClusterCullingUniformView, app->camera.viewMatrix);
+	SetUniformMatrix4f(cullingProgram, app->programClusterCullingUniformInverseProjection, inverseProjection);
+	SetUniform1f(cullingProgram, app->programClusterCullingUniformNear, app->camera.nearPlane);
+	SetUniform1f(cullingProgram, app->programClusterCullingUniformFar, app->camera.farPlane);
+
+	glDispatchCompute(1, 1, CLUSTER_GRID_Z);
+	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+	// ------------------------ ENTITIES -------------------------------------
 
-	glUniformMatrix4fv(glGetUniformLocation(reliefMapShading.handle, "projection"), 1, GL_FALSE, (GLfloat*)&app->camera.projectionMatrix);
-	glUniformMatrix4fv(glGetUniformLocation(reliefMapShading.handle, "view"), 1, GL_FALSE, (GLfloat*)&app->camera.viewMatrix);
+	Program& reliefProgram = app->programs[app->reliefMapShaderForwardClusteredID];
+	SetClusterUniforms(app, reliefProgram, app->reliefMapClusterUniforms);
+
+	Program& meshProgram = app->programs[app->texturedMeshClusteredProgramIdx];
+	SetClusterUniforms(app, meshProgram, app->texturedMeshClusterUniforms);
+
+	app->shadingFbo.Bind(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	RenderReliefMapping(app, reliefProgram, app->reliefMapForwardClusteredUniforms, false);
+	RenderEntities(app, meshProgram, app->shadingFbo.GetDepthStencil());
+	app->shadingFbo.Unbind();
+
+	// ------------------------ LIGHTS -------------------------------------
+
+	app->shadingFbo.Bind();
+	RenderLights(app, app->programs[app->lightsShaderID]);
+	app->shadingFbo.Unbind();
+
+	// ------------------------ BLOOM AND FINAL PASS -------------------------------------
+
+	RenderBloomAndFinalPass(app);
+}
+
+void RenderReliefMapping(App* app, Program& program, const ReliefMappingUniforms& uniforms, bool deferred_rendering)
+{
+	UseProgram(program.handle);
+
+	SetUniformMatrix4f(program, uniforms.projection, app->camera.projectionMatrix);
+	SetUniformMatrix4f(program, uniforms.view, app->camera.viewMatrix);
 
 	if (deferred_rendering)
 	{
-		glBindBufferRange(GL_UNIFORM_BUFFER, BINDING(0), app->gpBuffer.handle, app->globalParamsOffset, app->globalParamsSize);
+		BindBufferRange(GL_UNIFORM_BUFFER, BINDING(0), app->gpBuffer.buffer.handle, app->globalParamsOffset, app->globalParamsSize);
 	}
 
-	glUniform3f(glGetUniformLocation(reliefMapShading.handle, "viewPos"), app->camera.position.x, app->camera.position.y, app->camera.position.z);
-	glUniform3f(glGetUniformLocation(reliefMapShading.handle, "lightPos"), app->lights[0].position.x, app->lights[0].position.y, app->lights[0].position.z);
-	glUniform1f(glGetUniformLocation(reliefMapShading.handle, "heightScale"), app->heigth_scale);
-	glUniform1i(glGetUniformLocation(reliefMapShading.handle, "clipBorders"), app->clip_borders);
-	glUniform1i(glGetUniformLocation(reliefMapShading.handle, "minLayers"), app->min_layers);
-	glUniform1i(glGetUniformLocation(reliefMapShading.handle, "maxLayers"), app->max_layers);
-
+	SetUniform3f(program, uniforms.viewPos, app->camera.position);
+	SetUniform3f(program, uniforms.lightPos, app->lights[0].position);
+	SetUniform1f(program, uniforms.heightScale, app->heigth_scale);
+	SetUniform1i(program, uniforms.clipBorders, app->clip_borders);
+	SetUniform1i(program, uniforms.minLayers, app->min_layers);
+	SetUniform1i(program, uniforms.maxLayers, app->max_layers);
+	SetUniform1i(program, uniforms.coneStepMapping, app->relief_search == ReliefSearch::RELAXED_CONE);
+	SetUniform1i(program, uniforms.coneSteps, app->cone_steps);
 
 	BindReliefTextures(app->reliefIdx, app);
 
@@ -968,60 +2114,73 @@ void RenderReliefMapping(App* app, const Program& program, bool deferred_renderi
 		modelMatrix = TransformPositionScale(vec3(0.f, 25.0f, 0.f), vec3(15.0f));
 	}
 
-	glUniformMatrix4fv(glGetUniformLocation(reliefMapShading.handle, "model"), 1, GL_FALSE, (GLfloat*)&modelMatrix);
-	renderQuadTangentSpace();
+	// LOD: fewer layers the smaller the quad is on screen, none at all past the cutoff distance
+	float layerScale = 1.0f;
+	if (app->relief_lod)
+	{
+		const vec3 center = vec3(modelMatrix[3]);
+		const float radius = glm::length(vec3(modelMatrix[0])) * glm::sqrt(2.0f); // the quad spans [-1, 1]
+		const float distance = glm::max(glm::length(app->camera.position - center), app->camera.nearPlane);
 
-	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_2D, 0);
-	glActiveTexture(GL_TEXTURE1);
-	glBindTexture(GL_TEXTURE_2D, 0);
-	glActiveTexture(GL_TEXTURE2);
-	glBindTexture(GL_TEXTURE_2D, 0);
+		const float projectedPixels = radius * app->displaySize.y / (distance * glm::tan(glm::radians(app->camera.vertical_fov) * 0.5f));
+		const float cutoff = app->reliefLodCutoffs[app->reliefIdx - 1];
 
-	glUseProgram(0);
-}
+		layerScale = glm::min(projectedPixels / app->relief_lod_full_detail_pixels, 1.0f);
+		layerScale *= 1.0f - glm::smoothstep(cutoff * 0.75f, cutoff, distance);
+	}
+	app->reliefLayerScale = layerScale;
+	SetUniform1f(program, uniforms.layerScale, layerScale);
 
+	SetUniformMatrix4f(program, uniforms.model, modelMatrix);
+	renderQuadTangentSpace();
+
+	ActiveTexture(GL_TEXTURE0);
+}
 
-void RenderEntities(App* app, const Program& program)
+void RenderEntities(App* app, Program& program, GLuint depthTexture)
 {
-	Program renderMeshShader = program;
-	glUseProgram(renderMeshShader.handle);
+	if (app->gpu_culling)
+	{
+		RenderEntitiesGPUCulled(app, program, depthTexture);
+		return;
+	}
 
-	glBindBufferRange(GL_UNIFORM_BUFFER, BINDING(0), app->gpBuffer.handle, app->globalParamsOffset, app->globalParamsSize);
+	Program& renderMeshShader = program;
+	UseProgram(renderMeshShader.handle);
 
-	for (int i = 0; i < app->entities.size(); ++i)
-	{
-		Model& model = app->models[app->entities[i].modelIndex];
-		Mesh& mesh = app->meshes[model.meshIdx];
-		glBindBufferRange(GL_UNIFORM_BUFFER, BINDING(1), app->ubuffer.handle, app->entities[i].localParamsOffset, app->entities[i].localParamsSize);
+	BindBufferRange(GL_UNIFORM_BUFFER, BINDING(0), app->gpBuffer.buffer.handle, app->globalParamsOffset, app->globalParamsSize);
+	BindBufferBase(GL_SHADER_STORAGE_BUFFER, OBJECTS_BINDING, app->objectBuffer.handle);
 
+	ActiveTexture(GL_TEXTURE0);
+	BindTexture(GL_TEXTURE_2D_ARRAY, app->albedoTextureArray);
 
-		for (u32 i = 0; i < mesh.submeshes.size(); ++i)
-		{
-			GLuint vao = FindVAO(mesh, i, renderMeshShader);
-			glBindVertexArray(vao);
+	// One call per geometry pool, the commands were built in Update(). Their base instance selects
+	// the object records (world matrix, material) of each draw.
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, app->drawCommandBuffer.buffer.handle);
+	const u32 commandsOffset = RingRegionOffset(app->drawCommandBuffer);
 
-			u32 submeshMaterialIdx = model.materialIdx[i];
-			Material& submeshMaterial = app->materials[submeshMaterialIdx];
+	for (u32 p = 0; p < app->geometryPools.size(); ++p)
+	{
+		GeometryPool& pool = app->geometryPools[p];
+		if (pool.commands.empty())
+			continue;
 
-			glActiveTexture(GL_TEXTURE0);
-			glBindTexture(GL_TEXTURE_2D, app->textures[submeshMaterial.albedoTextureIdx].handle);
-			glUniform1i(app->texturedMeshProgram_uTexture, 0);
+		GLuint vao = FindPoolVAO(pool, renderMeshShader, app->objectIndexBuffer.buffer.handle);
+		BindVertexArray(vao);
 
-			Submesh& submesh = mesh.submeshes[i];
-			glDrawElements(GL_TRIANGLES, submesh.indices.size(), GL_UNSIGNED_INT, (void*)(u64)submesh.indexOffset);
-		}
+		glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, (void*)(u64)(commandsOffset + pool.firstCommand * sizeof(DrawElementsIndirectCommand)), pool.commands.size(), 0);
+		app->entityDrawCalls++;
 	}
 
-	glBindTexture(GL_TEXTURE_2D, 0);
-	glBindVertexArray(0);
-	glUseProgram(0);
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+	BindVertexArray(0);
 }
 
-void RenderLights(App* app, const Program& shader)
+void RenderLights(App* app, Program& shader)
 {
-	Program lightsShader = shader;
-	glUseProgram(lightsShader.handle);
+	Program& lightsShader = shader;
+	UseProgram(lightsShader.handle);
+	app->visibleLightGizmos = 0;
 
 	for (u32 i = 0; i < app->lights.size(); ++i)
 	{
@@ -1045,46 +2204,49 @@ void RenderLights(App* app, const Program& shader)
 			break;
 		}
 
+		Mesh& mesh = app->meshes[app->models[modelIndex].meshIdx];
+		const glm::vec3 scale = glm::vec3(glm::length(vec3(worldMatrix[0])), glm::length(vec3(worldMatrix[1])), glm::length(vec3(worldMatrix[2])));
+		const glm::vec3 center = vec3(worldMatrix * vec4(mesh.boundingSphere.center, 1.0f));
+		if (!app->camera.IsSphereInFrustum(center, mesh.boundingSphere.radius * glm::max(scale.x, glm::max(scale.y, scale.z))))
+			continue;
+		app->visibleLightGizmos++;
+
 		// ------------------  Uniforms  ------------------
 		glm::mat4 worldViewProjectionMatrix = app->camera.projectionMatrix * app->camera.viewMatrix * worldMatrix;
-		glUniformMatrix4fv(app->programLightsUniformWorldMatrix, 1, GL_FALSE, (GLfloat*)&worldViewProjectionMatrix);
-		glUniform3f(app->programLightsUniformColor, app->lights[i].color.x, app->lights[i].color.y, app->lights[i].color.z);
+		SetUniformMatrix4f(lightsShader, app->programLightsUniformWorldMatrix, worldViewProjectionMatrix);
+		SetUniform3f(lightsShader, app->programLightsUniformColor, app->lights[i].color);
 
 		// ----------------------------------------------
 
-		Mesh& mesh = app->meshes[app->models[modelIndex].meshIdx];
 		GLuint vao = FindVAO(mesh, 0, lightsShader);
-		glBindVertexArray(vao);
+		BindVertexArray(vao);
 
 		glDrawElements(GL_TRIANGLES, mesh.submeshes[0].indices.size(), GL_UNSIGNED_INT, (void*)(u64)mesh.submeshes[0].indexOffset);
 
 	}
 }
 
-void FinalRenderPass(App* app)
+void FinalRenderPass(App* app, u32 sceneTexture, u32 bloomTexture)
 {
 	Program& finalPassShader = app->programs[app->finalPassShaderIdx];
-	glUseProgram(finalPassShader.handle);
+	UseProgram(finalPassShader.handle);
 
-	glUniform1i(glGetUniformLocation(finalPassShader.handle, "using_bloom"), app->using_bloom);
-	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_2D, GetFinalTextureToRender(app));
+	// Bloom is only added on top of the shaded image
+	const bool usingBloom = app->using_bloom && app->displayedTexture == RENDER_TEXTURE && bloomTexture != 0;
 
-	if (app->using_bloom && app->displayedTexture == RENDER_TEXTURE)
+	SetUniform1i(finalPassShader, app->programFinalPassUniformUsingBloom, usingBloom);
+	ActiveTexture(GL_TEXTURE0);
+	BindTexture(GL_TEXTURE_2D, sceneTexture);
+
+	if (usingBloom)
 	{
-		glActiveTexture(GL_TEXTURE1);
-		glBindTexture(GL_TEXTURE_2D, app->blurFbo.GetBlurredTexture());
+		ActiveTexture(GL_TEXTURE1);
+		BindTexture(GL_TEXTURE_2D, bloomTexture);
 	}
 
 	renderQuad();
-
-	glBindTexture(GL_TEXTURE_2D, 0);
-	glUseProgram(0);
 }
 
-
-
-
 unsigned int quadVAO2 = 0;
 unsigned int quadVBO2;
 void renderQuadTangentSpace()
@@ -1160,7 +2322,7 @@ void renderQuadTangentSpace()
 		// configure plane VAO
 		glGenVertexArrays(1, &quadVAO2);
 		glGenBuffers(1, &quadVBO2);
-		glBindVertexArray(quadVAO2);
+		BindVertexArray(quadVAO2);
 		glBindBuffer(GL_ARRAY_BUFFER, quadVBO2);
 		glBufferData(GL_ARRAY_BUFFER, sizeof(quadVertices), &quadVertices, GL_STATIC_DRAW);
 		glEnableVertexAttribArray(0);
@@ -1174,9 +2336,9 @@ void renderQuadTangentSpace()
 		glEnableVertexAttribArray(4);
 		glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, 14 * sizeof(float), (void*)(11 * sizeof(float)));
 	}
-	glBindVertexArray(quadVAO2);
+	BindVertexArray(quadVAO2);
 	glDrawArrays(GL_TRIANGLES, 0, 6);
-	glBindVertexArray(0);
+	BindVertexArray(0);
 }
 
 void BindReliefTextures(int reliefIndex, App* app)
@@ -1185,53 +2347,56 @@ void BindReliefTextures(int reliefIndex, App* app)
 	switch (reliefIndex)
 	{
 	case 1:
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D, app->textures[app->reliefTextures[0]].handle);
-		glActiveTexture(GL_TEXTURE1);
-		glBindTexture(GL_TEXTURE_2D, app->textures[app->reliefTextures[1]].handle);
-		glActiveTexture(GL_TEXTURE2);
-		glBindTexture(GL_TEXTURE_2D, app->textures[app->reliefTextures[2]].handle);
+		ActiveTexture(GL_TEXTURE0);
+		BindTexture(GL_TEXTURE_2D, app->textures[app->reliefTextures[0]].handle);
+		ActiveTexture(GL_TEXTURE1);
+		BindTexture(GL_TEXTURE_2D, app->textures[app->reliefTextures[1]].handle);
+		ActiveTexture(GL_TEXTURE2);
+		BindTexture(GL_TEXTURE_2D, app->textures[app->reliefTextures[2]].handle);
 
 		break;
 	case 2:
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D, app->textures[app->reliefTextures[3]].handle);
-		glActiveTexture(GL_TEXTURE1);
-		glBindTexture(GL_TEXTURE_2D, app->textures[app->reliefTextures[4]].handle);
-		glActiveTexture(GL_TEXTURE2);
-		glBindTexture(GL_TEXTURE_2D, app->textures[app->reliefTextures[5]].handle);
+		ActiveTexture(GL_TEXTURE0);
+		BindTexture(GL_TEXTURE_2D, app->textures[app->reliefTextures[3]].handle);
+		ActiveTexture(GL_TEXTURE1);
+		BindTexture(GL_TEXTURE_2D, app->textures[app->reliefTextures[4]].handle);
+		ActiveTexture(GL_TEXTURE2);
+		BindTexture(GL_TEXTURE_2D, app->textures[app->reliefTextures[5]].handle);
 
 		break;
 	case 3:
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D, app->textures[app->reliefTextures[6]].handle);
-		glActiveTexture(GL_TEXTURE1);
-		glBindTexture(GL_TEXTURE_2D, app->textures[app->reliefTextures[7]].handle);
-		glActiveTexture(GL_TEXTURE2);
-		glBindTexture(GL_TEXTURE_2D, app->textures[app->reliefTextures[8]].handle);
+		ActiveTexture(GL_TEXTURE0);
+		BindTexture(GL_TEXTURE_2D, app->textures[app->reliefTextures[6]].handle);
+		ActiveTexture(GL_TEXTURE1);
+		BindTexture(GL_TEXTURE_2D, app->textures[app->reliefTextures[7]].handle);
+		ActiveTexture(GL_TEXTURE2);
+		BindTexture(GL_TEXTURE_2D, app->textures[app->reliefTextures[8]].handle);
 
 		break;
 	case 4:
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D, app->textures[app->reliefTextures[9]].handle);
-		glActiveTexture(GL_TEXTURE1);
-		glBindTexture(GL_TEXTURE_2D, app->textures[app->reliefTextures[10]].handle);
-		glActiveTexture(GL_TEXTURE2);
-		glBindTexture(GL_TEXTURE_2D, app->textures[app->reliefTextures[11]].handle);
+		ActiveTexture(GL_TEXTURE0);
+		BindTexture(GL_TEXTURE_2D, app->textures[app->reliefTextures[9]].handle);
+		ActiveTexture(GL_TEXTURE1);
+		BindTexture(GL_TEXTURE_2D, app->textures[app->reliefTextures[10]].handle);
+		ActiveTexture(GL_TEXTURE2);
+		BindTexture(GL_TEXTURE_2D, app->textures[app->reliefTextures[11]].handle);
 
 		break;
 	case 5:
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D, app->textures[app->reliefTextures[12]].handle);
-		glActiveTexture(GL_TEXTURE1);
-		glBindTexture(GL_TEXTURE_2D, app->textures[app->reliefTextures[13]].handle);
-		glActiveTexture(GL_TEXTURE2);
-		glBindTexture(GL_TEXTURE_2D, app->textures[app->reliefTextures[14]].handle);
+		ActiveTexture(GL_TEXTURE0);
+		BindTexture(GL_TEXTURE_2D, app->textures[app->reliefTextures[12]].handle);
+		ActiveTexture(GL_TEXTURE1);
+		BindTexture(GL_TEXTURE_2D, app->textures[app->reliefTextures[13]].handle);
+		ActiveTexture(GL_TEXTURE2);
+		BindTexture(GL_TEXTURE_2D, app->textures[app->reliefTextures[14]].handle);
 
 		break;
 
 	}
 
+	ActiveTexture(GL_TEXTURE3);
+	BindTexture(GL_TEXTURE_2D, app->textures[app->reliefConeMaps[reliefIndex - 1]].handle);
+
 }
 
 
@@ -1253,7 +2418,7 @@ void renderQuad()
 		// setup plane VAO
 		glGenVertexArrays(1, &quadVAO);
 		glGenBuffers(1, &quadVBO);
-		glBindVertexArray(quadVAO);
+		BindVertexArray(quadVAO);
 		glBindBuffer(GL_ARRAY_BUFFER, quadVBO);
 		glBufferData(GL_ARRAY_BUFFER, sizeof(quadVertices), &quadVertices, GL_STATIC_DRAW);
 		glEnableVertexAttribArray(0);
@@ -1261,9 +2426,9 @@ void renderQuad()
 		glEnableVertexAttribArray(2);
 		glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)(3 * sizeof(float)));
 	}
-	glBindVertexArray(quadVAO);
+	BindVertexArray(quadVAO);
 	glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
-	glBindVertexArray(0);
+	BindVertexArray(0);
 }
 
 
@@ -1283,7 +2448,7 @@ GLuint FindVAO(Mesh& mesh, u32 submeshIndex, const Program& program)
 	// Create a new vao for this submesh/program
 
 	glGenVertexArrays(1, &vaoHandle);
-	glBindVertexArray(vaoHandle);
+	BindVertexArray(vaoHandle);
 
 	glBindBuffer(GL_ARRAY_BUFFER, mesh.vertexBufferHandle);
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.indexBufferHandle);
@@ -1313,7 +2478,7 @@ GLuint FindVAO(Mesh& mesh, u32 submeshIndex, const Program& program)
 		assert(attributeWasLinked); // The submesh should provide an attribute for each vertex inputs
 	}
 
-	glBindVertexArray(0);
+	BindVertexArray(0);
 
 	// Store it in the list of vaos for this submesh
 	Vao vao = { vaoHandle, program.handle };
@@ -1322,6 +2487,136 @@ GLuint FindVAO(Mesh& mesh, u32 submeshIndex, const Program& program)
 	return vaoHandle;
 }
 
+GLuint FindPoolVAO(GeometryPool& pool, const Program& program, GLuint objectIndexBufferHandle)
+{
+	// Try finding a vao for this pool/program/instance stream
+	for (u32 i = 0; i < (u32)pool.vaos.size(); ++i)
+	{
+		if (pool.vaos[i].programHandle == program.handle && pool.vaos[i].objectIndexBufferHandle == objectIndexBufferHandle)
+			return pool.vaos[i].handle;
+	}
+
+	GLuint vaoHandle = 0;
+
+	// Create a new vao for this pool/program
+
+	glGenVertexArrays(1, &vaoHandle);
+	BindVertexArray(vaoHandle);
+
+	glBindBuffer(GL_ARRAY_BUFFER, pool.vertexBufferHandle);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, pool.indexBufferHandle);
+
+	// Submesh offsets come from the base vertex of each indirect command, so attributes start at 0
+
+	for (u32 i = 0; i < program.vertexInputLayout.attributes.size(); ++i)
+	{
+		const u32 location = program.vertexInputLayout.attributes[i].location;
+		bool attributeWasLinked = false;
+
+		for (u32 j = 0; j < pool.vertexBufferLayout.attributes.size(); ++j)
+		{
+			if (location == pool.vertexBufferLayout.attributes[j].location)
+			{
+				const u32 ncomp = pool.vertexBufferLayout.attributes[j].componentCount;
+				const u32 offset = pool.vertexBufferLayout.attributes[j].offset;
+				const u32 stride = pool.vertexBufferLayout.stride;
+				glVertexAttribPointer(location, ncomp, GL_FLOAT, GL_FALSE, stride, (void*)(u64)offset);
+				glEnableVertexAttribArray(location);
+
+				attributeWasLinked = true;
+				break;
+			}
+		}
+
+		// Per-instance object index, advancing once per instance
+		if (!attributeWasLinked && location == INSTANCE_OBJECT_INDEX_LOCATION)
+		{
+			glBindBuffer(GL_ARRAY_BUFFER, objectIndexBufferHandle);
+			glVertexAttribIPointer(location, 1, GL_UNSIGNED_INT, sizeof(u32), (void*)0);
+			glEnableVertexAttribArray(location);
+			glVertexAttribDivisor(location, 1);
+			glBindBuffer(GL_ARRAY_BUFFER, pool.vertexBufferHandle);
+
+			attributeWasLinked = true;
+		}
+
+		assert(attributeWasLinked); // The pool should provide an attribute for each vertex inputs
+	}
+
+	BindVertexArray(0);
+
+	// Store it in the list of vaos for this pool
+	Vao vao = { vaoHandle, program.handle, objectIndexBufferHandle };
+	pool.vaos.push_back(vao);
+
+	return vaoHandle;
+}
+
+void BuildAlbedoTextureArray(App* app)
+{
+	// One layer per distinct albedo texture, every material remembers the layer it samples
+	std::vector<u32> layerTextures;
+
+	for (u32 i = 0; i < app->materials.size(); ++i)
+	{
+		Material& material = app->materials[i];
+
+		u32 textureIdx = material.albedoTextureIdx;
+		if (textureIdx >= app->textures.size())
+			textureIdx = app->whiteTexIdx;
+
+		u32 layer = 0;
+		while (layer < layerTextures.size() && layerTextures[layer] != textureIdx)
+			++layer;
+
+		if (layer == layerTextures.size())
+			layerTextures.push_back(textureIdx);
+
+		material.albedoLayer = layer;
+	}
+
+	if (layerTextures.empty())
+		layerTextures.push_back(app->whiteTexIdx);
+
+	const u32 mipLevels = (u32)std::log2((float)ALBEDO_ARRAY_SIZE) + 1;
+
+	glGenTextures(1, &app->albedoTextureArray);
+	BindTexture(GL_TEXTURE_2D_ARRAY, app->albedoTextureArray);
+	glTexStorage3D(GL_TEXTURE_2D_ARRAY, mipLevels, GL_RGBA8, ALBEDO_ARRAY_SIZE, ALBEDO_ARRAY_SIZE, layerTextures.size());
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+
+	// Textures come in any size, the blit rescales them to the layer size
+	GLuint framebuffers[2];
+	glGenFramebuffers(2, framebuffers);
+	BindFramebuffer(GL_READ_FRAMEBUFFER, framebuffers[0]);
+	BindFramebuffer(GL_DRAW_FRAMEBUFFER, framebuffers[1]);
+
+	for (u32 layer = 0; layer < layerTextures.size(); ++layer)
+	{
+		const GLuint textureHandle = app->textures[layerTextures[layer]].handle;
+
+		GLint width = 0, height = 0;
+		BindTexture(GL_TEXTURE_2D, textureHandle);
+		glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &width);
+		glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &height);
+		BindTexture(GL_TEXTURE_2D, 0);
+
+		glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, textureHandle, 0);
+		glFramebufferTextureLayer(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, app->albedoTextureArray, 0, layer);
+		glBlitFramebuffer(0, 0, width, height, 0, 0, ALBEDO_ARRAY_SIZE, ALBEDO_ARRAY_SIZE, GL_COLOR_BUFFER_BIT, GL_LINEAR);
+	}
+
+	BindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+	BindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+	glDeleteFramebuffers(2, framebuffers);
+
+	glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+	BindTexture(GL_TEXTURE_2D_ARRAY, 0);
+}
+
 
 glm::mat4 TransformScale(const vec3& scaleFactors)
 {
@@ -1343,6 +2638,20 @@ glm::mat4 TransformRotation(const glm::mat4& matrix, float angle, vec3 axis)
 	return transform;
 }
 
+void SpawnRandomPointLights(App* app, u32 count)
+{
+	const float range = 40.0f;
+
+	for (u32 i = 0; i < count; ++i)
+	{
+		vec3 position = vec3(((float)std::rand() / RAND_MAX * 2.0f - 1.0f) * range,
+			0.5f + (float)std::rand() / RAND_MAX * 3.0f,
+			((float)std::rand() / RAND_MAX * 2.0f - 1.0f) * range);
+
+		app->lights.push_back(Light(position, GenerateRandomBrightColor(), LightType::LIGHT_TYPE_POINT, glm::vec3(0.0f, -1.0f, -1.0f), 20U));
+	}
+}
+
 vec3 GenerateRandomBrightColor()
 {
 	int rgb[3];
@@ -1371,23 +2680,4 @@ vec3 GenerateRandomBrightColor()
 	return vec3((float)rgb[0], (float)rgb[1], (float)rgb[2]) / 255.f;
 }
 
-u32 GetFinalTextureToRender(App* app)
-{
-	u32 texture = 0U; 
-
-	if (app->displayedTexture == RENDER_TEXTURE || app->displayedTexture == BRIGHT_COLOR_TEXTURE)
-	{
-		texture = app->shadingFbo.GetTexture(app->displayedTexture);
-	}
-	else if (app->displayedTexture == BLURRED_TEXTURE)
-	{
-		texture = app->blurFbo.GetBlurredTexture();
-	}
-	else
-	{
-		texture = app->gFbo.GetTexture(app->displayedTexture);
-	}
-
-	return texture;
-}
 
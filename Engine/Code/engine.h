@@ -11,12 +11,49 @@
 #include "buffer_management.h"
 #include "Entity.h"
 #include "Light.h"
+#include "light_management.h"
 #include "Camera.h"
 #include "FrameBufferObject.h"
+#include "frame_graph.h"
+#include "cone_step_mapping.h"
+#include "render_queue.h"
+#include "gl_state.h"
+#include "program.h"
+#include "gpu_layout.h"
+#include "bvh.h"
+#include "gpu_culling.h"
+#include "software_occlusion.h"
+#include "pvs.h"
 
 
 #define BINDING(b) b
 
+// Clustered forward grid (must match the CLUSTER_GRID_* defines in shaders.glsl)
+#define CLUSTER_GRID_X 16
+#define CLUSTER_GRID_Y 9
+#define CLUSTER_GRID_Z 24
+#define MAX_LIGHTS_PER_CLUSTER 128
+
+// Per-instance attribute holding the index of the GPUObject drawn by the instance
+#define INSTANCE_OBJECT_INDEX_LOCATION 5
+
+// Shader storage binding of the object records (must match shaders.glsl)
+#define OBJECTS_BINDING 5
+
+// Every albedo texture is resized to this size in the albedo texture array
+#define ALBEDO_ARRAY_SIZE 1024
+
+// Levels of the bloom mip chain, the first one is half the display size
+#define BLOOM_MIP_LEVELS 6
+
+// Separable blur kernel limit and compute blur work group width (must match shaders.glsl)
+#define MAX_BLUR_RADIUS 32
+#define BLUR_GROUP_SIZE 128
+
+// Entities and lights handled per job in Update
+#define ENTITY_BOUNDS_GRAIN 64
+#define LIGHT_RADIUS_GRAIN  64
+
 typedef glm::vec2  vec2;
 typedef glm::vec3  vec3;
 typedef glm::vec4  vec4;
@@ -38,13 +75,32 @@ struct Texture
     std::string filepath;
 };
 
-struct Program
+// Uniforms RenderReliefMapping sets every frame, the relief programs share the names
+struct ReliefMappingUniforms
 {
-    GLuint             handle;
-    std::string        filepath;
-    std::string        programName;
-    u64                lastWriteTimestamp; // What is this for?
-	VertexShaderLayout vertexInputLayout;
+	UniformHandle projection;
+	UniformHandle view;
+	UniformHandle model;
+	UniformHandle viewPos;
+	UniformHandle lightPos;
+	UniformHandle heightScale;
+	UniformHandle clipBorders;
+	UniformHandle minLayers;
+	UniformHandle maxLayers;
+	UniformHandle coneStepMapping;
+	UniformHandle coneSteps;
+	UniformHandle layerScale;
+};
+
+// Uniforms of the clustered forward programs to find the cluster of a fragment
+struct ClusterUniforms
+{
+	UniformHandle screenSize;
+	UniformHandle nearPlane;
+	UniformHandle farPlane;
+	UniformHandle clusterScale;
+	UniformHandle clusterBias;
+	UniformHandle brightColorThreshold;
 };
 
 struct GLInfo
@@ -65,10 +121,61 @@ enum Mode
     Mode_FBO
 };
 
+// Object record in the objects storage buffer (std430), one per entity and submesh
+struct GPUObject
+{
+	glm::vec4 worldRows[3]; // affine world matrix, rows of the upper 3x4
+	u32 materialIndex;      // layer of the material albedo in the albedo texture array
+	u32 flags;              // EntityType in the low byte
+	u32 padding[2];
+};
+
+#define GPU_OBJECT_LAYOUT GLSLLayout::STD430, glm::vec4[3], u32, u32, u32, u32
+static_assert(offsetof(GPUObject, materialIndex) == GLSLOffset<GPU_OBJECT_LAYOUT>(1), "GPUObject must match the std430 Object layout");
+static_assert(offsetof(GPUObject, flags) == GLSLOffset<GPU_OBJECT_LAYOUT>(2), "GPUObject must match the std430 Object layout");
+static_assert(sizeof(GPUObject) == GLSLSize<GPU_OBJECT_LAYOUT>(), "GPUObject must match the std430 Object layout");
+
+// std140 GlobalParams uniform block of shaders.glsl, written to the ring buffer with one copy per frame
+struct GPUGlobalParams
+{
+	glm::vec3 cameraPosition;
+	u32 visiblePointLightCount;
+	u32 directionalLightCount;
+	u32 padding[3];
+	glm::mat4 viewProjection;
+};
+
+#define GPU_GLOBAL_PARAMS_LAYOUT GLSLLayout::STD140, glm::vec3, u32, u32, glm::mat4
+static_assert(offsetof(GPUGlobalParams, visiblePointLightCount) == GLSLOffset<GPU_GLOBAL_PARAMS_LAYOUT>(1), "GPUGlobalParams must match the std140 GlobalParams layout");
+static_assert(offsetof(GPUGlobalParams, directionalLightCount) == GLSLOffset<GPU_GLOBAL_PARAMS_LAYOUT>(2), "GPUGlobalParams must match the std140 GlobalParams layout");
+static_assert(offsetof(GPUGlobalParams, viewProjection) == GLSLOffset<GPU_GLOBAL_PARAMS_LAYOUT>(3), "GPUGlobalParams must match the std140 GlobalParams layout");
+static_assert(sizeof(GPUGlobalParams) == GLSLSize<GPU_GLOBAL_PARAMS_LAYOUT>(), "GPUGlobalParams must match the std140 GlobalParams layout");
+
 enum class RenderPipeline
 {
     FORWARD,
-    DEFERRED
+    DEFERRED,
+    DEFERRED_TILED,
+    FORWARD_CLUSTERED,
+    DEFERRED_LIGHT_VOLUMES
+};
+
+enum class BloomMode
+{
+    GAUSSIAN,  // separable Gaussian passes at full resolution, one per blur iteration
+    MIP_CHAIN  // downsampled into a mip chain and upsampled additively, constant cost
+};
+
+enum class ReliefSearch
+{
+    LINEAR,       // evenly spaced depth layers, then a linear interpolation
+    RELAXED_CONE  // relaxed cone steps, then a binary search
+};
+
+enum class BlurBackend
+{
+    FRAGMENT,  // full screen quad, every tap goes through the texture unit
+    COMPUTE    // each work group fetches its line and apron once into shared memory
 };
 
 enum FBO_TextureDisplay
@@ -107,12 +214,26 @@ struct App
     // program indices
     u32 finalPassShaderIdx;
 	u32 texturedMeshProgramIdx;
-    u32 geometryPassShaderID; 
-    u32 shadingPassShaderID; 
     u32 lightsShaderID;
-	u32 reliefMapShaderID;
+	u32 geometryPassCompactShaderID;
+	u32 reliefMapCompactShaderID;
+	u32 shadingPassCompactShaderID;
+	u32 gBufferDebugShaderID;
 	u32 reliefMapShaderForwardID;
 	u32 blurShaderID;
+	u32 blurComputeShaderID;
+	u32 tiledDeferredShaderID;
+	u32 texturedMeshClusteredProgramIdx;
+	u32 reliefMapShaderForwardClusteredID;
+	u32 clusteredLightCullingShaderID;
+	u32 lightVolumeStencilShaderID;
+	u32 lightVolumePointShaderID;
+	u32 lightVolumeDirectionalShaderID;
+	u32 brightExtractShaderID;
+	u32 bloomDownsampleShaderID;
+	u32 bloomUpsampleShaderID;
+	u32 hiZBuildShaderID;
+	u32 objectCullingShaderID;
 
     // texture indices
     u32 diceTexIdx;
@@ -134,25 +255,65 @@ struct App
     GLuint embeddedVertices;
     GLuint embeddedElements;
 
-    // Location of the texture uniform in the textured quad shader
-    GLuint programGPassUniformTexture;
-    GLuint programShadingPassUniformTexturePosition;
-    GLuint programShadingPassUniformTextureNormals;
-    GLuint programShadingPassUniformTextureAlbedo;
-	GLuint programShadingPassUniformTextureDepth;
-    GLuint programLightsUniformColor; 
-    GLuint programLightsUniformWorldMatrix;
-
-	//Relief Mapping uniform locations
-	GLuint programReliefMapUniformTextureDiffuse;
-	GLuint programReliefMapUniformTextureNormalMap;
-	GLuint programReliefMapUniformTextureDepthMap;
-	GLuint programReliefMapUniformModelMatrix;
-	GLuint programReliefMapUniformViewMatrix;
-	GLuint programReliefMapUniformProjectionMatrix;
-	GLuint programReliefMapUniformLightPos;
-	GLuint programReliefMapUniformViewPos;
-	GLuint programReliefMapUniformHeightScale;
+	UniformHandle programShadingPassCompactUniformInverseViewProjection;
+	UniformHandle programShadingPassCompactUniformBrightThreshold;
+	UniformHandle programGBufferDebugUniformInverseViewProjection;
+	UniformHandle programGBufferDebugUniformMode;
+	UniformHandle programLightsUniformColor;
+	UniformHandle programLightsUniformWorldMatrix;
+	UniformHandle programFinalPassUniformUsingBloom;
+
+	//Relief Mapping uniforms, one set per relief program
+	ReliefMappingUniforms reliefMapCompactUniforms;
+	ReliefMappingUniforms reliefMapForwardUniforms;
+	ReliefMappingUniforms reliefMapForwardClusteredUniforms;
+
+	//Tiled deferred uniforms
+	UniformHandle programTiledDeferredUniformView;
+	UniformHandle programTiledDeferredUniformInverseProjection;
+	UniformHandle programTiledDeferredUniformInverseViewProjection;
+	UniformHandle programTiledDeferredUniformBrightThreshold;
+
+	//Clustered forward uniforms
+	ClusterUniforms texturedMeshClusterUniforms;
+	ClusterUniforms reliefMapClusterUniforms;
+	UniformHandle programClusterCullingUniformView;
+	UniformHandle programClusterCullingUniformInverseProjection;
+	UniformHandle programClusterCullingUniformNear;
+	UniformHandle programClusterCullingUniformFar;
+
+	//GPU culling uniforms
+	UniformHandle programHiZBuildUniformSourceLevel;
+	UniformHandle programObjectCullingUniformObjectCount;
+	UniformHandle programObjectCullingUniformBatchCount;
+	UniformHandle programObjectCullingUniformPhase;
+	UniformHandle programObjectCullingUniformFrustumPlanes;
+	UniformHandle programObjectCullingUniformDepthSize;
+	UniformHandle programObjectCullingUniformHiZLevels;
+
+	//Light volume uniforms
+	UniformHandle programLightVolumeStencilUniformWorldViewProjection;
+	UniformHandle programLightVolumePointUniformWorldViewProjection;
+	UniformHandle programLightVolumePointUniformLightIndex;
+	UniformHandle programLightVolumePointUniformScreenSize;
+	UniformHandle programLightVolumePointUniformInverseViewProjection;
+	UniformHandle programLightVolumeDirectionalUniformScreenSize;
+	UniformHandle programLightVolumeDirectionalUniformInverseViewProjection;
+	UniformHandle programBrightExtractUniformThreshold;
+
+	//Blur uniforms
+	UniformHandle programBlurUniformHorizontal;
+	UniformHandle programBlurUniformRadius;
+	UniformHandle programBlurUniformWeights;
+	UniformHandle programBlurComputeUniformHorizontal;
+	UniformHandle programBlurComputeUniformRadius;
+	UniformHandle programBlurComputeUniformWeights;
+
+	//Bloom uniforms
+	UniformHandle programBloomDownsampleUniformTexelSize;
+	UniformHandle programBloomDownsampleUniformKarisAverage;
+	UniformHandle programBloomUpsampleUniformTexelSize;
+	UniformHandle programBloomUpsampleUniformFilterRadius;
 
     // VAO object to link our screen filling quad with our textured quad shader
     GLuint vao;
@@ -162,25 +323,21 @@ struct App
 	u32 plane;
 	u32 sphere;
 	u32 cube;
-	u32 texturedMeshProgram_uTexture;
 	Geometry geo;
 
 	// ------- Uniform blocks ---------- 
 
-    // Local Params Block 
-	Buffer ubuffer;
-	GLint maxUniformBufferSize;
-	GLint uniformBlockAlignment;
-	u32 blockOffset;
-	u32 blockSize;
-
     // Global Params Block 
-    Buffer gpBuffer; 
+    RingBuffer gpBuffer; 
     GLint maxGlobalParamsBufferSize; 
     GLint globalParamsAlignment; 
     u32 globalParamsOffset;
     u32 globalParamsSize; 
 
+    // Clustered forward light lists
+    Buffer clusterLightCounts;
+    Buffer clusterLightIndices;
+
 	// Transformations (temporal i guess)
 	vec3 cameraPos;
 	vec3 cameraRef;
@@ -192,16 +349,67 @@ struct App
 	//Entities
 	std::vector<Entity> entities;
 
+	// Instancing: one GPUObject per entity and submesh, resident in the object buffer at a fixed
+	// index. Only the records of new entities and of the entities in dirtyEntities are uploaded.
+	// The instance attribute stream holds the object index of every render queue item, so the
+	// base instance of a draw selects its objects. The stream and the draw commands are rewritten
+	// every frame into the region of a ring buffer the GPU is done with.
+	Buffer objectBuffer;
+	RingBuffer objectIndexBuffer;
+	std::vector<GPUObject> objects;
+	std::vector<u32> dirtyEntities;
+	u32 residentEntities;
+	u32 uploadedObjects; // records uploaded by the last update
+	RenderQueue renderQueue;
+	u32 entityDrawCalls;
+
+	// Culling: world bounds of the entities in a BVH, only the entities in the frustum reach the
+	// render queue. The BVH also answers ray and sphere queries.
+	BVH entityBVH;
+	std::vector<AABB> entityBounds;
+	std::vector<u32> visibleEntities;
+	u32 visibleLightGizmos;
+
+	// Entity under the mouse when the left button was last pressed, BVH_INVALID if none
+	u32 pickedEntity = BVH_INVALID;
+	float pickedDistance;
+	u32 pickedEntityLights; // point lights whose volume reaches its box
+
+	// GPU culling replaces the BVH culling and the render queue of the entities: the GPU tests
+	// every object against the frustum and a Hi-Z pyramid and writes the draw commands itself
+	bool gpu_culling = false;
+	GPUCulling gpuCulling;
+
+	// Software occlusion culling removes the entities hidden behind the largest ones in the
+	// frustum before they reach the render queue, on the worker threads (see software_occlusion.h)
+	bool software_occlusion = false;
+	SoftwareOcclusion softwareOcclusion;
+
+	// Potentially visible sets baked offline for the static entities (see pvs.h), they replace the
+	// BVH culling while the camera is inside the baked grid. Off by default, like the software
+	// occlusion, and enabled from the Info window once a PVS is loaded.
+	bool pvs_culling = false;
+	PVS pvs;
+
+	// Multi-draw indirect: submeshes pooled per vertex layout, albedo textures in one array
+	std::vector<GeometryPool> geometryPools;
+	RingBuffer drawCommandBuffer;
+	GLuint albedoTextureArray;
+
     //Lights
     std::vector<Light> lights; 
+    LightStore lightStore;
 
 	//Camera
 	Camera camera;
 
-    //FBO
+    //FBO, only allocated while a pipeline rendering into them is selected (see UpdatePipelineFramebuffers)
     GBuffer gFbo;
     ShadingBuffer shadingFbo; 
-    PingPongBuffer blurFbo; 
+    RenderPipeline framebuffersPipeline = RenderPipeline::DEFERRED; // pipeline they were allocated for
+
+    // Transient render targets of the deferred pipeline and of the bloom of every pipeline
+    FrameGraph frameGraph;
 
     RenderTargetType displayedTexture = RenderTargetType::RENDER_TEXTURE;
 
@@ -212,6 +420,16 @@ struct App
 	int max_layers = 32;
 	int reliefIdx = 1;
 	std::vector<int> reliefTextures;
+	std::vector<u32> reliefConeMaps; // one per relief texture set, built from its depth map
+	ReliefSearch relief_search = ReliefSearch::RELAXED_CONE;
+	int cone_steps = 12;
+
+	// Relief LOD: the layers (or cone steps) scale with the projected size of the surface and fade
+	// out up to the cutoff distance of its texture set, past it the surface is only normal mapped
+	bool relief_lod = true;
+	int relief_lod_full_detail_pixels = 720; // projected size getting the full layer range
+	std::vector<float> reliefLodCutoffs;     // one per relief texture set
+	float reliefLayerScale = 1.0f;           // scale used by the last draw, for the GUI
 	bool rotate = false;
 
 	u32 reliefDiffuseIdx;
@@ -229,7 +447,11 @@ struct App
 
     // Bloom
     bool using_bloom = true;
+    BloomMode bloomMode = BloomMode::MIP_CHAIN;
     int blurIterations = 10;
+    int blurRadius = 4;
+    BlurBackend blurBackend = BlurBackend::FRAGMENT;
+    float bloomFilterRadius = 1.0f;
     float bright_threshold = 1;
 
     // Render Pipeline
@@ -245,21 +467,36 @@ void Update(App* app);
 
 void Render(App* app);
 
+// Moves an entity, only the object records of moved entities are uploaded again
+void SetEntityTransform(App* app, u32 entityIndex, const glm::mat4& worldMatrix);
+
 void RenderUsingDeferredPipeline(App* app);
+void RenderUsingTiledDeferredPipeline(App* app);
 void RenderUsingForwardPipeline(App* app);
+void RenderUsingClusteredForwardPipeline(App* app);
+void RenderUsingLightVolumeDeferredPipeline(App* app);
 
-void RenderReliefMapping(App* app, const Program& program, bool deferred_rendering);
-void RenderEntities(App* app, const Program& shader);
-void RenderLights(App* app, const Program& shader);
-void FinalRenderPass(App* app);
+void RenderReliefMapping(App* app, Program& program, const ReliefMappingUniforms& uniforms, bool deferred_rendering);
+// depthTexture is the depth attachment of the bound framebuffer, GPU culling builds its Hi-Z from it
+void RenderEntities(App* app, Program& shader, GLuint depthTexture);
+void RenderLights(App* app, Program& shader);
+void FinalRenderPass(App* app, u32 sceneTexture, u32 bloomTexture);
+
+// Bloom and final pass of the pipelines shading into the fixed framebuffers
+void RenderBloomAndFinalPass(App* app);
 
 
 u32 LoadTexture2D(App* app, const char* filepath);
+u32 LoadConeStepMap(App* app, const char* depthMapPath);
 
 GLuint FindVAO(Mesh& mesh, u32 submeshIndex, const Program& program);
+GLuint FindPoolVAO(GeometryPool& pool, const Program& program, GLuint objectIndexBufferHandle);
+void BuildAlbedoTextureArray(App* app);
 
 //Transformations
 glm::mat4 TransformScale(const vec3& scaleFactors);
 glm::mat4 TransformPositionScale(const vec3& pos, const vec3& scaleFactors);
 glm::mat4 TransformRotation(const glm::mat4& matrix, float angle, vec3 axis);
+void SpawnRandomPointLights(App* app, u32 count);
+
 vec3 GenerateRandomBrightColor();
\ No newline at end of file
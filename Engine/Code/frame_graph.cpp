@@ -0,0 +1,471 @@
+#include "frame_graph.h"
+#include "engine.h"
+
+static u32 TextureBytes(const FrameGraphTextureDesc& desc)
+{
+	u32 bytesPerPixel = 4;
+	switch (desc.internalFormat)
+	{
+	case GL_RGBA16F: bytesPerPixel = 8; break;
+	case GL_RGBA32F: bytesPerPixel = 16; break;
+	case GL_RGB16F: bytesPerPixel = 6; break;
+	case GL_RG16F: bytesPerPixel = 4; break;
+	case GL_R16F: bytesPerPixel = 2; break;
+	case GL_R8: bytesPerPixel = 1; break;
+	default: break; // RGBA8, R11F_G11F_B10F, DEPTH24_STENCIL8...
+	}
+
+	return desc.width * desc.height * bytesPerPixel;
+}
+
+static bool IsSameTextureDesc(const FrameGraphTextureDesc& a, const FrameGraphTextureDesc& b)
+{
+	return a.width == b.width && a.height == b.height && a.internalFormat == b.internalFormat && a.filter == b.filter;
+}
+
+static GLuint AcquireTransientTexture(FrameGraph& graph, const FrameGraphTextureDesc& desc)
+{
+	// Any free texture with the same description will do, its previous contents are not preserved
+	for (u32 i = 0; i < graph.texturePool.size(); ++i)
+	{
+		TransientTexture& texture = graph.texturePool[i];
+		if (!texture.inUse && IsSameTextureDesc(texture.desc, desc))
+		{
+			texture.inUse = true;
+			texture.usedThisFrame = true;
+			return texture.handle;
+		}
+	}
+
+	TransientTexture texture = {};
+	texture.desc = desc;
+	texture.inUse = true;
+	texture.usedThisFrame = true;
+
+	glGenTextures(1, &texture.handle);
+	BindTexture(GL_TEXTURE_2D, texture.handle);
+	glTexImage2D(GL_TEXTURE_2D, 0, desc.internalFormat, desc.width, desc.height, 0, desc.format, desc.type, NULL);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, desc.filter);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, desc.filter);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	BindTexture(GL_TEXTURE_2D, 0);
+
+	graph.texturePool.push_back(texture);
+	return texture.handle;
+}
+
+static void ReleaseTransientTexture(FrameGraph& graph, GLuint handle)
+{
+	for (u32 i = 0; i < graph.texturePool.size(); ++i)
+	{
+		if (graph.texturePool[i].handle == handle)
+		{
+			graph.texturePool[i].inUse = false;
+			return;
+		}
+	}
+}
+
+static GLenum DepthStencilAttachmentPoint(const FrameGraphTextureDesc& desc)
+{
+	return desc.internalFormat == GL_DEPTH24_STENCIL8 || desc.internalFormat == GL_DEPTH32F_STENCIL8 ? GL_DEPTH_STENCIL_ATTACHMENT : GL_DEPTH_ATTACHMENT;
+}
+
+static GLuint FindTransientFramebuffer(FrameGraph& graph, const FrameGraphPass& pass)
+{
+	ASSERT(pass.colorAttachments.size() <= 8, "Too many color attachments in a frame graph pass");
+
+	GLuint colors[8] = {};
+	for (u32 i = 0; i < pass.colorAttachments.size(); ++i)
+		colors[i] = graph.resources[pass.colorAttachments[i].resource].texture;
+
+	const GLuint depthStencil = pass.hasDepthStencil ? graph.resources[pass.depthStencilAttachment.resource].texture : 0;
+
+	for (u32 i = 0; i < graph.framebufferPool.size(); ++i)
+	{
+		TransientFramebuffer& framebuffer = graph.framebufferPool[i];
+		if (framebuffer.colorCount == pass.colorAttachments.size() && framebuffer.depthStencil == depthStencil &&
+			memcmp(framebuffer.colors, colors, sizeof(colors)) == 0)
+		{
+			framebuffer.usedThisFrame = true;
+			return framebuffer.handle;
+		}
+	}
+
+	TransientFramebuffer framebuffer = {};
+	memcpy(framebuffer.colors, colors, sizeof(colors));
+	framebuffer.colorCount = pass.colorAttachments.size();
+	framebuffer.depthStencil = depthStencil;
+	framebuffer.usedThisFrame = true;
+
+	glGenFramebuffers(1, &framebuffer.handle);
+	BindFramebuffer(GL_FRAMEBUFFER, framebuffer.handle);
+
+	GLenum drawBuffers[8];
+	for (u32 i = 0; i < framebuffer.colorCount; ++i)
+	{
+		glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + i, colors[i], 0);
+		drawBuffers[i] = GL_COLOR_ATTACHMENT0 + i;
+	}
+	glDrawBuffers(framebuffer.colorCount, drawBuffers);
+
+	if (pass.hasDepthStencil)
+	{
+		const FrameGraphResource& resource = graph.resources[pass.depthStencilAttachment.resource];
+		glFramebufferTexture(GL_FRAMEBUFFER, DepthStencilAttachmentPoint(resource.desc), depthStencil, 0);
+	}
+
+	GLenum frameBufferStatus = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+	if (frameBufferStatus != GL_FRAMEBUFFER_COMPLETE)
+		ELOG("Framebuffer of frame graph pass %s is incomplete (0x%x)", pass.name, frameBufferStatus);
+
+	graph.framebufferPool.push_back(framebuffer);
+	return framebuffer.handle;
+}
+
+static u32 CollectAttachments(const FrameGraph& graph, const FrameGraphPass& pass, bool (*select)(const FrameGraphAttachment&, const FrameGraphResource&, u32), u32 passIndex, GLenum* attachments)
+{
+	u32 count = 0;
+	for (u32 i = 0; i < pass.colorAttachments.size(); ++i)
+	{
+		if (select(pass.colorAttachments[i], graph.resources[pass.colorAttachments[i].resource], passIndex))
+			attachments[count++] = GL_COLOR_ATTACHMENT0 + i;
+	}
+
+	if (pass.hasDepthStencil)
+	{
+		const FrameGraphResource& resource = graph.resources[pass.depthStencilAttachment.resource];
+		if (select(pass.depthStencilAttachment, resource, passIndex))
+			attachments[count++] = DepthStencilAttachmentPoint(resource.desc);
+	}
+
+	return count;
+}
+
+static bool IsDontCareOnLoad(const FrameGraphAttachment& attachment, const FrameGraphResource&, u32)
+{
+	return attachment.load == LoadAction::DONT_CARE;
+}
+
+static bool IsDiscardedOnStore(const FrameGraphAttachment& attachment, const FrameGraphResource& resource, u32 passIndex)
+{
+	// Nobody reads it after this pass either, so storing it would be wasted bandwidth
+	return attachment.store == StoreAction::DISCARD || (!resource.imported && resource.lastPass == passIndex);
+}
+
+static void ResolveTimerFrame(FrameGraph& graph, const FrameGraphTimerFrame& timer)
+{
+	if (timer.passCount == 0)
+		return;
+
+	// Issued FRAMES_IN_FLIGHT frames ago, the results are normally there already
+	GLuint64 timestamps[FRAME_GRAPH_MAX_TIMED_PASSES + 1];
+	for (u32 i = 0; i <= timer.passCount; ++i)
+		glGetQueryObjectui64v(timer.queries[i], GL_QUERY_RESULT, &timestamps[i]);
+
+	graph.passTimings.clear();
+	for (u32 i = 0; i < timer.passCount; ++i)
+		graph.passTimings.push_back({ timer.names[i], (timestamps[i + 1] - timestamps[i]) / 1000000.0f });
+}
+
+void BeginFrameGraph(FrameGraph& graph)
+{
+	graph.resources.clear();
+	graph.passes.clear();
+}
+
+u32 CreateTransientTexture(FrameGraph& graph, const char* name, const FrameGraphTextureDesc& desc)
+{
+	FrameGraphResource resource = {};
+	resource.name = name;
+	resource.desc = desc;
+
+	graph.resources.push_back(resource);
+	return graph.resources.size() - 1;
+}
+
+u32 ImportTexture(FrameGraph& graph, const char* name, GLuint texture, const FrameGraphTextureDesc& desc)
+{
+	FrameGraphResource resource = {};
+	resource.name = name;
+	resource.desc = desc;
+	resource.imported = true;
+	resource.texture = texture;
+
+	graph.resources.push_back(resource);
+	return graph.resources.size() - 1;
+}
+
+u32 AddPass(FrameGraph& graph, const char* name, FrameGraphExecuteFunction execute, u32 userData)
+{
+	FrameGraphPass pass = {};
+	pass.name = name;
+	pass.execute = execute;
+	pass.userData = userData;
+
+	graph.passes.push_back(pass);
+	return graph.passes.size() - 1;
+}
+
+void PassRead(FrameGraph& graph, u32 pass, u32 resource)
+{
+	ASSERT(resource < graph.resources.size(), "Unknown frame graph resource");
+	graph.passes[pass].reads.push_back(resource);
+}
+
+void PassWriteColor(FrameGraph& graph, u32 pass, u32 resource, LoadAction load, StoreAction store, const glm::vec4& clearColor)
+{
+	ASSERT(resource < graph.resources.size(), "Unknown frame graph resource");
+	graph.passes[pass].colorAttachments.push_back({ resource, load, store, clearColor });
+}
+
+void PassWriteDepthStencil(FrameGraph& graph, u32 pass, u32 resource, LoadAction load, StoreAction store)
+{
+	ASSERT(resource < graph.resources.size(), "Unknown frame graph resource");
+	graph.passes[pass].depthStencilAttachment = { resource, load, store, glm::vec4(0.0f) };
+	graph.passes[pass].hasDepthStencil = true;
+}
+
+void PassWriteBackbuffer(FrameGraph& graph, u32 pass, LoadAction load, const glm::vec4& clearColor)
+{
+	graph.passes[pass].writesBackbuffer = true;
+	graph.passes[pass].backbufferAttachment = { 0, load, StoreAction::STORE, clearColor };
+}
+
+void PassWriteStorage(FrameGraph& graph, u32 pass, u32 resource)
+{
+	ASSERT(resource < graph.resources.size(), "Unknown frame graph resource");
+	graph.passes[pass].storageWrites.push_back(resource);
+}
+
+void CompileFrameGraph(FrameGraph& graph)
+{
+	// Walk the passes backwards from the backbuffer: a pass is live if a later live pass needs one
+	// of its attachments. Loading an attachment keeps the earlier writers of it alive too.
+	std::vector<bool> needed(graph.resources.size(), false);
+	graph.culledPasses = 0;
+
+	for (u32 i = graph.passes.size(); i-- > 0;)
+	{
+		FrameGraphPass& pass = graph.passes[i];
+
+		bool live = pass.writesBackbuffer;
+		for (u32 j = 0; j < pass.colorAttachments.size(); ++j)
+			live = live || needed[pass.colorAttachments[j].resource];
+		if (pass.hasDepthStencil)
+			live = live || needed[pass.depthStencilAttachment.resource];
+		for (u32 j = 0; j < pass.storageWrites.size(); ++j)
+			live = live || needed[pass.storageWrites[j]];
+
+		pass.culled = !live;
+		if (pass.culled)
+		{
+			graph.culledPasses++;
+			continue;
+		}
+
+		for (u32 j = 0; j < pass.colorAttachments.size(); ++j)
+			needed[pass.colorAttachments[j].resource] = pass.colorAttachments[j].load == LoadAction::LOAD;
+		if (pass.hasDepthStencil)
+			needed[pass.depthStencilAttachment.resource] = pass.depthStencilAttachment.load == LoadAction::LOAD;
+		for (u32 j = 0; j < pass.storageWrites.size(); ++j)
+			needed[pass.storageWrites[j]] = false;
+
+		for (u32 j = 0; j < pass.reads.size(); ++j)
+			needed[pass.reads[j]] = true;
+	}
+
+	// Lifetimes of the resources in the live passes
+	for (u32 r = 0; r < graph.resources.size(); ++r)
+		graph.resources[r].used = false;
+
+	for (u32 i = 0; i < graph.passes.size(); ++i)
+	{
+		const FrameGraphPass& pass = graph.passes[i];
+		if (pass.culled)
+			continue;
+
+		std::vector<u32> touched = pass.reads;
+		for (u32 j = 0; j < pass.colorAttachments.size(); ++j)
+			touched.push_back(pass.colorAttachments[j].resource);
+		if (pass.hasDepthStencil)
+			touched.push_back(pass.depthStencilAttachment.resource);
+		touched.insert(touched.end(), pass.storageWrites.begin(), pass.storageWrites.end());
+
+		for (u32 j = 0; j < touched.size(); ++j)
+		{
+			FrameGraphResource& resource = graph.resources[touched[j]];
+			if (!resource.used)
+			{
+				resource.used = true;
+				resource.firstPass = i;
+			}
+			resource.lastPass = i;
+		}
+	}
+}
+
+void ExecuteFrameGraph(FrameGraph& graph, App* app)
+{
+	for (u32 i = 0; i < graph.texturePool.size(); ++i)
+	{
+		graph.texturePool[i].inUse = false;
+		graph.texturePool[i].usedThisFrame = false;
+	}
+	for (u32 i = 0; i < graph.framebufferPool.size(); ++i)
+		graph.framebufferPool[i].usedThisFrame = false;
+
+	graph.virtualBytes = 0;
+
+	FrameGraphTimerFrame& timer = graph.timerFrames[graph.timerFrame];
+	ResolveTimerFrame(graph, timer);
+	if (timer.queries[0] == 0)
+		glGenQueries(FRAME_GRAPH_MAX_TIMED_PASSES + 1, timer.queries);
+	timer.passCount = 0;
+
+	GLenum attachments[9];
+
+	for (u32 i = 0; i < graph.passes.size(); ++i)
+	{
+		FrameGraphPass& pass = graph.passes[i];
+		if (pass.culled)
+			continue;
+
+		// Textures come to life right before their first pass
+		for (u32 r = 0; r < graph.resources.size(); ++r)
+		{
+			FrameGraphResource& resource = graph.resources[r];
+			if (resource.used && !resource.imported && resource.firstPass == i)
+			{
+				resource.texture = AcquireTransientTexture(graph, resource.desc);
+				graph.virtualBytes += TextureBytes(resource.desc);
+			}
+		}
+
+		if (timer.passCount < FRAME_GRAPH_MAX_TIMED_PASSES)
+		{
+			glQueryCounter(timer.queries[timer.passCount], GL_TIMESTAMP);
+			timer.names[timer.passCount++] = pass.name;
+		}
+
+		const bool hasAttachments = !pass.colorAttachments.empty() || pass.hasDepthStencil;
+
+		GLuint framebuffer = 0;
+		if (pass.writesBackbuffer)
+		{
+			BindFramebuffer(GL_FRAMEBUFFER, 0);
+
+			// Color, depth and stencil of the window together, nothing of the last frame survives a clear
+			const LoadAction load = pass.backbufferAttachment.load;
+			if (load == LoadAction::DONT_CARE)
+			{
+				const GLenum windowBuffers[3] = { GL_COLOR, GL_DEPTH, GL_STENCIL };
+				glInvalidateFramebuffer(GL_FRAMEBUFFER, 3, windowBuffers);
+			}
+			else if (load == LoadAction::CLEAR)
+			{
+				Viewport(0, 0, app->displaySize.x, app->displaySize.y);
+				glDepthMask(GL_TRUE);
+				glStencilMask(0xFF);
+				glClearBufferfv(GL_COLOR, 0, glm::value_ptr(pass.backbufferAttachment.clearColor));
+				glClearBufferfi(GL_DEPTH_STENCIL, 0, 1.0f, 0);
+			}
+		}
+		else if (!hasAttachments)
+		{
+			BindFramebuffer(GL_FRAMEBUFFER, 0);
+		}
+		else
+		{
+			framebuffer = FindTransientFramebuffer(graph, pass);
+			BindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+
+			const FrameGraphAttachment& first = pass.colorAttachments.empty() ? pass.depthStencilAttachment : pass.colorAttachments[0];
+			Viewport(0, 0, graph.resources[first.resource].desc.width, graph.resources[first.resource].desc.height);
+
+			const u32 invalidateCount = CollectAttachments(graph, pass, IsDontCareOnLoad, i, attachments);
+			if (invalidateCount > 0)
+				glInvalidateFramebuffer(GL_FRAMEBUFFER, invalidateCount, attachments);
+
+			for (u32 j = 0; j < pass.colorAttachments.size(); ++j)
+			{
+				if (pass.colorAttachments[j].load == LoadAction::CLEAR)
+					glClearBufferfv(GL_COLOR, j, glm::value_ptr(pass.colorAttachments[j].clearColor));
+			}
+
+			if (pass.hasDepthStencil && pass.depthStencilAttachment.load == LoadAction::CLEAR)
+			{
+				glDepthMask(GL_TRUE);
+				glStencilMask(0xFF);
+				glClearBufferfi(GL_DEPTH_STENCIL, 0, 1.0f, 0);
+			}
+		}
+
+		pass.execute(app, graph, pass);
+
+		// Image stores are incoherent, make them visible to whatever reads the textures next
+		if (!pass.storageWrites.empty())
+			glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT | GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_FRAMEBUFFER_BARRIER_BIT);
+
+		if (framebuffer != 0)
+		{
+			BindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+			const u32 discardCount = CollectAttachments(graph, pass, IsDiscardedOnStore, i, attachments);
+			if (discardCount > 0)
+				glInvalidateFramebuffer(GL_FRAMEBUFFER, discardCount, attachments);
+			BindFramebuffer(GL_FRAMEBUFFER, 0);
+		}
+
+		// ...and go back to the pool after their last one, for later resources to alias them
+		for (u32 r = 0; r < graph.resources.size(); ++r)
+		{
+			FrameGraphResource& resource = graph.resources[r];
+			if (resource.used && !resource.imported && resource.lastPass == i)
+				ReleaseTransientTexture(graph, resource.texture);
+		}
+	}
+
+	glQueryCounter(timer.queries[timer.passCount], GL_TIMESTAMP);
+	graph.timerFrame = (graph.timerFrame + 1) % FRAMES_IN_FLIGHT;
+
+	// Drop what this frame did not need (e.g. textures of the previous size after a resize)
+	bool deleted = false;
+	for (u32 i = graph.framebufferPool.size(); i-- > 0;)
+	{
+		if (!graph.framebufferPool[i].usedThisFrame)
+		{
+			glDeleteFramebuffers(1, &graph.framebufferPool[i].handle);
+			deleted = true;
+			graph.framebufferPool.erase(graph.framebufferPool.begin() + i);
+		}
+	}
+
+	graph.transientTextures = 0;
+	graph.transientBytes = 0;
+
+	for (u32 i = graph.texturePool.size(); i-- > 0;)
+	{
+		if (!graph.texturePool[i].usedThisFrame)
+		{
+			glDeleteTextures(1, &graph.texturePool[i].handle);
+			deleted = true;
+			graph.texturePool.erase(graph.texturePool.begin() + i);
+		}
+		else
+		{
+			graph.transientTextures++;
+			graph.transientBytes += TextureBytes(graph.texturePool[i].desc);
+		}
+	}
+
+	// Deleted objects are unbound behind the state cache
+	if (deleted)
+		InvalidateGLState();
+}
+
+GLuint GetFrameGraphTexture(const FrameGraph& graph, u32 resource)
+{
+	ASSERT(graph.resources[resource].used, "The frame graph resource is not used by any live pass");
+	return graph.resources[resource].texture;
+}
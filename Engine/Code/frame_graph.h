@@ -0,0 +1,165 @@
+#pragma once
+
+#include "platform.h"
+#include "buffer_management.h"
+#include <glad/glad.h>
+
+// Frame graph: the passes of a frame declare the textures they read and write, passes whose
+// results never reach the screen are culled, and transient textures are only backed by GL memory
+// between their first and last use, so textures with non-overlapping lifetimes share it.
+//
+// The graph is rebuilt every frame (Begin, Create/Add/Read/Write, Compile, Execute). The pool of
+// GL textures and framebuffers survives between frames.
+//
+// Every live pass is timed on the GPU with timestamp queries, read back FRAMES_IN_FLIGHT frames
+// later so the CPU never waits for them.
+
+struct App;
+struct FrameGraph;
+struct FrameGraphPass;
+
+// What the pass needs from the attachment contents when it begins
+enum class LoadAction
+{
+	LOAD,      // keep what previous passes wrote
+	CLEAR,     // clear to the attachment clear value
+	DONT_CARE  // the pass overwrites every pixel, contents are invalidated
+};
+
+// What later passes need from the attachment contents when the pass ends
+enum class StoreAction
+{
+	STORE,
+	DISCARD    // invalidated after the pass
+};
+
+struct FrameGraphTextureDesc
+{
+	u32 width;
+	u32 height;
+	GLenum internalFormat;
+	GLenum format;
+	GLenum type;
+	GLenum filter;
+};
+
+struct FrameGraphResource
+{
+	const char* name;
+	FrameGraphTextureDesc desc;
+	bool imported; // owned outside the graph, never pooled nor discarded
+
+	// Lifetime in live passes, filled by CompileFrameGraph
+	u32 firstPass;
+	u32 lastPass;
+	bool used;
+
+	GLuint texture; // only valid while a pass using it executes
+};
+
+struct FrameGraphAttachment
+{
+	u32 resource;
+	LoadAction load;
+	StoreAction store;
+	glm::vec4 clearColor;
+};
+
+// Inputs are available with GetFrameGraphTexture(graph, pass.reads[i]) in declaration order
+typedef void (*FrameGraphExecuteFunction)(App* app, FrameGraph& graph, const FrameGraphPass& pass);
+
+struct FrameGraphPass
+{
+	const char* name;
+	FrameGraphExecuteFunction execute;
+	u32 userData;
+
+	std::vector<u32> reads;
+	std::vector<FrameGraphAttachment> colorAttachments;
+	FrameGraphAttachment depthStencilAttachment;
+	bool hasDepthStencil;
+
+	// Written with image stores (compute passes), no framebuffer is bound for them
+	std::vector<u32> storageWrites;
+
+	// Passes writing the default framebuffer are the roots of the graph and never culled
+	bool writesBackbuffer;
+	FrameGraphAttachment backbufferAttachment; // load action of the default framebuffer, resource unused
+	bool culled;
+};
+
+struct TransientTexture
+{
+	FrameGraphTextureDesc desc;
+	GLuint handle;
+	bool inUse;
+	bool usedThisFrame;
+};
+
+struct TransientFramebuffer
+{
+	GLuint handle;
+	GLuint colors[8];
+	u32 colorCount;
+	GLuint depthStencil;
+	bool usedThisFrame;
+};
+
+#define FRAME_GRAPH_MAX_TIMED_PASSES 64
+
+struct FrameGraphTimerFrame
+{
+	GLuint queries[FRAME_GRAPH_MAX_TIMED_PASSES + 1]; // timestamp before every pass and after the last one
+	const char* names[FRAME_GRAPH_MAX_TIMED_PASSES];
+	u32 passCount;
+};
+
+struct FrameGraphPassTiming
+{
+	const char* name;
+	float milliseconds;
+};
+
+struct FrameGraph
+{
+	std::vector<FrameGraphResource> resources;
+	std::vector<FrameGraphPass> passes;
+
+	std::vector<TransientTexture> texturePool;
+	std::vector<TransientFramebuffer> framebufferPool;
+
+	// Stats of the last executed frame
+	u32 culledPasses;
+	u32 transientTextures;
+	u32 transientBytes;  // GL memory actually backing the transient textures
+	u32 virtualBytes;    // memory the same textures would need without aliasing
+
+	FrameGraphTimerFrame timerFrames[FRAMES_IN_FLIGHT];
+	u32 timerFrame;
+	std::vector<FrameGraphPassTiming> passTimings; // GPU time of the live passes, FRAMES_IN_FLIGHT frames old
+};
+
+void BeginFrameGraph(FrameGraph& graph);
+
+u32 CreateTransientTexture(FrameGraph& graph, const char* name, const FrameGraphTextureDesc& desc);
+
+// Texture of a fixed framebuffer the passes can read or write like any other resource
+u32 ImportTexture(FrameGraph& graph, const char* name, GLuint texture, const FrameGraphTextureDesc& desc);
+
+u32 AddPass(FrameGraph& graph, const char* name, FrameGraphExecuteFunction execute, u32 userData = 0);
+
+void PassRead(FrameGraph& graph, u32 pass, u32 resource);
+void PassWriteColor(FrameGraph& graph, u32 pass, u32 resource, LoadAction load, StoreAction store, const glm::vec4& clearColor = glm::vec4(0.0f, 0.0f, 0.0f, 1.0f));
+void PassWriteDepthStencil(FrameGraph& graph, u32 pass, u32 resource, LoadAction load, StoreAction store);
+void PassWriteBackbuffer(FrameGraph& graph, u32 pass, LoadAction load, const glm::vec4& clearColor = glm::vec4(0.1f, 0.1f, 0.1f, 1.0f));
+
+// The pass writes every texel of the resource with image stores, it is visible to the passes after it
+void PassWriteStorage(FrameGraph& graph, u32 pass, u32 resource);
+
+// Culls the passes not contributing to the backbuffer and computes the resource lifetimes
+void CompileFrameGraph(FrameGraph& graph);
+
+// Runs the live passes in declaration order, binding their attachments and applying load/store actions
+void ExecuteFrameGraph(FrameGraph& graph, App* app);
+
+GLuint GetFrameGraphTexture(const FrameGraph& graph, u32 resource);
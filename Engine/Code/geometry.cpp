@@ -1,5 +1,6 @@
 #include "geometry.h"
 #include "engine.h"
+#include <float.h>
 
 u32 Geometry::LoadPlane(App* app)
 {
@@ -62,6 +63,7 @@ u32 Geometry::LoadPlane(App* app)
 	
 	//Mesh
 	planeModel.meshIdx = app->meshes.size();
+	ComputeMeshBounds(planeMesh);
 	app->meshes.push_back(planeMesh);
 
 
@@ -188,6 +190,7 @@ u32 Geometry::LoadSphere(App* app)
 
 	//Mesh
 	sphereModel.meshIdx = app->meshes.size();
+	ComputeMeshBounds(sphereMesh);
 	app->meshes.push_back(sphereMesh);
 
 	//Material
@@ -349,6 +352,7 @@ u32 Geometry::LoadCube(App* app)
 
 	//Mesh
 	cubeModel.meshIdx = app->meshes.size();
+	ComputeMeshBounds(cubeMesh);
 	app->meshes.push_back(cubeMesh);
 
 
@@ -405,3 +409,138 @@ void Geometry::CalculateTangentSpace(std::vector<GLfloat>& vertices, std::vector
 		counting++;
 	}
 }
+
+AABB TransformAABB(const AABB& box, const glm::mat4& matrix)
+{
+	// Each axis of the matrix moves the corners the most along its own sign (Arvo)
+	AABB result = { vec3(matrix[3]), vec3(matrix[3]) };
+	for (u32 axis = 0; axis < 3; ++axis)
+	{
+		const vec3 a = vec3(matrix[axis]) * box.min[axis];
+		const vec3 b = vec3(matrix[axis]) * box.max[axis];
+		result.min += glm::min(a, b);
+		result.max += glm::max(a, b);
+	}
+
+	return result;
+}
+
+AABB MergeAABB(const AABB& a, const AABB& b)
+{
+	return { glm::min(a.min, b.min), glm::max(a.max, b.max) };
+}
+
+bool SphereOverlapsAABB(const AABB& box, const glm::vec3& center, float radius)
+{
+	const glm::vec3 offset = center - glm::clamp(center, box.min, box.max);
+	return glm::dot(offset, offset) <= radius * radius;
+}
+
+void ComputeMeshBounds(Mesh& mesh)
+{
+	mesh.bounds = { vec3(FLT_MAX), vec3(-FLT_MAX) };
+
+	for (u32 i = 0; i < mesh.submeshes.size(); ++i)
+	{
+		Submesh& submesh = mesh.submeshes[i];
+		const u32 floatsPerVertex = submesh.vertexBufferLayout.stride / sizeof(float);
+		const u32 vertexCount = submesh.vertices.size() / floatsPerVertex;
+
+		submesh.bounds = { vec3(FLT_MAX), vec3(-FLT_MAX) };
+		for (u32 v = 0; v < vertexCount; ++v)
+		{
+			const vec3 position = glm::make_vec3(&submesh.vertices[v * floatsPerVertex]);
+			submesh.bounds.min = glm::min(submesh.bounds.min, position);
+			submesh.bounds.max = glm::max(submesh.bounds.max, position);
+		}
+
+		// Centered on the box, tighter than the half diagonal for round shapes
+		submesh.boundingSphere.center = (submesh.bounds.min + submesh.bounds.max) * 0.5f;
+		submesh.boundingSphere.radius = 0.0f;
+		for (u32 v = 0; v < vertexCount; ++v)
+		{
+			const vec3 position = glm::make_vec3(&submesh.vertices[v * floatsPerVertex]);
+			submesh.boundingSphere.radius = glm::max(submesh.boundingSphere.radius, glm::length(position - submesh.boundingSphere.center));
+		}
+
+		mesh.bounds = MergeAABB(mesh.bounds, submesh.bounds);
+	}
+
+	mesh.boundingSphere.center = (mesh.bounds.min + mesh.bounds.max) * 0.5f;
+	mesh.boundingSphere.radius = 0.0f;
+	for (u32 i = 0; i < mesh.submeshes.size(); ++i)
+	{
+		const BoundingSphere& sphere = mesh.submeshes[i].boundingSphere;
+		mesh.boundingSphere.radius = glm::max(mesh.boundingSphere.radius, glm::length(sphere.center - mesh.boundingSphere.center) + sphere.radius);
+	}
+}
+
+static bool HaveSameVertexLayout(const VertexBufferLayout& a, const VertexBufferLayout& b)
+{
+	if (a.stride != b.stride || a.attributes.size() != b.attributes.size())
+		return false;
+
+	for (u32 i = 0; i < a.attributes.size(); ++i)
+	{
+		if (a.attributes[i].location != b.attributes[i].location ||
+			a.attributes[i].componentCount != b.attributes[i].componentCount ||
+			a.attributes[i].offset != b.attributes[i].offset)
+			return false;
+	}
+
+	return true;
+}
+
+void BuildGeometryPools(App* app)
+{
+	std::vector<std::vector<float>> poolVertices;
+	std::vector<std::vector<u32>> poolIndices;
+
+	for (u32 m = 0; m < app->meshes.size(); ++m)
+	{
+		Mesh& mesh = app->meshes[m];
+
+		for (u32 i = 0; i < mesh.submeshes.size(); ++i)
+		{
+			Submesh& submesh = mesh.submeshes[i];
+
+			u32 poolIdx = 0;
+			while (poolIdx < app->geometryPools.size() && !HaveSameVertexLayout(app->geometryPools[poolIdx].vertexBufferLayout, submesh.vertexBufferLayout))
+				poolIdx++;
+
+			if (poolIdx == app->geometryPools.size())
+			{
+				GeometryPool pool = {};
+				pool.vertexBufferLayout = submesh.vertexBufferLayout;
+				app->geometryPools.push_back(pool);
+				poolVertices.push_back({});
+				poolIndices.push_back({});
+			}
+
+			// Indices stay relative to the submesh, the draw command adds the base vertex
+			const u32 floatsPerVertex = submesh.vertexBufferLayout.stride / sizeof(float);
+			submesh.poolIdx = poolIdx;
+			submesh.poolBaseVertex = poolVertices[poolIdx].size() / floatsPerVertex;
+			submesh.poolFirstIndex = poolIndices[poolIdx].size();
+
+			poolVertices[poolIdx].insert(poolVertices[poolIdx].end(), submesh.vertices.begin(), submesh.vertices.end());
+			poolIndices[poolIdx].insert(poolIndices[poolIdx].end(), submesh.indices.begin(), submesh.indices.end());
+		}
+	}
+
+	for (u32 p = 0; p < app->geometryPools.size(); ++p)
+	{
+		GeometryPool& pool = app->geometryPools[p];
+
+		glGenBuffers(1, &pool.vertexBufferHandle);
+		glBindBuffer(GL_ARRAY_BUFFER, pool.vertexBufferHandle);
+		glBufferData(GL_ARRAY_BUFFER, poolVertices[p].size() * sizeof(float), poolVertices[p].data(), GL_STATIC_DRAW);
+
+		glGenBuffers(1, &pool.indexBufferHandle);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, pool.indexBufferHandle);
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, poolIndices[p].size() * sizeof(u32), poolIndices[p].data(), GL_STATIC_DRAW);
+	}
+
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
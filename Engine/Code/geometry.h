@@ -27,6 +27,27 @@ const u16 indices[] = {
 };
 
 
+//BOUNDS --------
+struct AABB
+{
+	glm::vec3 min;
+	glm::vec3 max;
+};
+
+struct BoundingSphere
+{
+	glm::vec3 center;
+	float radius;
+};
+
+// Box containing the box transformed by the matrix
+AABB TransformAABB(const AABB& box, const glm::mat4& matrix);
+
+AABB MergeAABB(const AABB& a, const AABB& b);
+
+// Whether the sphere touches the box, its closest point in the box being within the radius
+bool SphereOverlapsAABB(const AABB& box, const glm::vec3& center, float radius);
+
 //MESH --------
 struct VertexBufferAttribute
 {
@@ -56,6 +77,7 @@ struct Vao
 {
 	GLuint handle;
 	GLuint programHandle;
+	GLuint objectIndexBufferHandle; // instance stream, geometry pool vaos only
 };
 
 struct Submesh
@@ -66,6 +88,15 @@ struct Submesh
 	u32					vertexOffset;
 	u32					indexOffset;
 	std::vector<Vao>	vaos;
+
+	// Location inside its geometry pool (in vertices and indices)
+	u32					poolIdx;
+	u32					poolBaseVertex;
+	u32					poolFirstIndex;
+
+	// In model space, from the vertex positions (see ComputeMeshBounds)
+	AABB				bounds;
+	BoundingSphere		boundingSphere;
 };
 
 struct Mesh
@@ -73,8 +104,18 @@ struct Mesh
 	std::vector<Submesh>	submeshes;
 	GLuint					vertexBufferHandle;
 	GLuint					indexBufferHandle;
+
+	// Bounds of all the submeshes, the bounds of the models using the mesh
+	AABB					bounds;
+	BoundingSphere			boundingSphere;
+
+	// Largest triangles of the submeshes, three model space positions each (see BuildOccluderTriangles)
+	std::vector<glm::vec3>	occluderTriangles;
 };
 
+// Fills the bounds of the submeshes and the mesh, the position has to be the first attribute
+void ComputeMeshBounds(Mesh& mesh);
+
 struct Material
 {
 	std::string		name;
@@ -86,6 +127,7 @@ struct Material
 	u32				specularTextureIdx;
 	u32				normalTextureIdx;
 	u32				bumpTextureIdx;
+	u32				albedoLayer; // Layer of the albedo texture array
 };
 
 struct Model
@@ -94,6 +136,33 @@ struct Model
 	std::vector<u32>	materialIdx;
 };
 
+//MULTI-DRAW --------
+
+// Layout read by glMultiDrawElementsIndirect from GL_DRAW_INDIRECT_BUFFER
+struct DrawElementsIndirectCommand
+{
+	u32 count;
+	u32 instanceCount;
+	u32 firstIndex;
+	u32 baseVertex;
+	u32 baseInstance;
+};
+
+// Vertices and indices of every submesh sharing a vertex layout, drawn with one multi-draw call
+struct GeometryPool
+{
+	VertexBufferLayout	vertexBufferLayout;
+	GLuint				vertexBufferHandle;
+	GLuint				indexBufferHandle;
+	std::vector<Vao>	vaos;
+
+	// Commands of the current frame, stored from firstCommand in the current draw command ring region
+	std::vector<DrawElementsIndirectCommand> commands;
+	u32					firstCommand;
+};
+
+void BuildGeometryPools(App* app);
+
 struct Geometry
 {
 	std::vector<float> vertices;
@@ -0,0 +1,253 @@
+#include "gl_state.h"
+
+#define GL_STATE_TEXTURE_TARGETS 3 // 2D, 2D array, cube map
+#define GL_STATE_BUFFER_TARGETS  2 // uniform, shader storage
+#define GL_STATE_CAPABILITIES    4 // depth test, blend, stencil test, cull face
+
+struct CachedBufferBinding
+{
+	bool known;
+	GLuint buffer;
+	GLintptr offset;
+	GLsizeiptr size; // -1 for the whole buffer (glBindBufferBase)
+};
+
+struct GLState
+{
+	bool programKnown;
+	GLuint program;
+
+	bool vertexArrayKnown;
+	GLuint vertexArray;
+
+	bool drawFramebufferKnown;
+	GLuint drawFramebuffer;
+	bool readFramebufferKnown;
+	GLuint readFramebuffer;
+
+	bool activeTextureKnown;
+	u32 activeTexture;
+	bool textureKnown[GL_STATE_TEXTURE_UNITS][GL_STATE_TEXTURE_TARGETS];
+	GLuint textures[GL_STATE_TEXTURE_UNITS][GL_STATE_TEXTURE_TARGETS];
+
+	CachedBufferBinding buffers[GL_STATE_BUFFER_TARGETS][GL_STATE_BUFFER_BINDINGS];
+
+	bool capabilityKnown[GL_STATE_CAPABILITIES];
+	bool capabilityEnabled[GL_STATE_CAPABILITIES];
+
+	bool viewportKnown;
+	GLint viewport[4];
+};
+
+static GLState state = {};
+static GLStateStats frameStats = {};
+static GLStateStats lastFrameStats = {};
+
+// Counts the call and tells whether it can be dropped
+static bool Elide(bool unchanged)
+{
+	if (unchanged)
+	{
+		frameStats.elided++;
+		return true;
+	}
+
+	frameStats.issued++;
+	return false;
+}
+
+static int TextureTargetSlot(GLenum target)
+{
+	switch (target)
+	{
+	case GL_TEXTURE_2D: return 0;
+	case GL_TEXTURE_2D_ARRAY: return 1;
+	case GL_TEXTURE_CUBE_MAP: return 2;
+	default: return -1;
+	}
+}
+
+static int BufferTargetSlot(GLenum target)
+{
+	switch (target)
+	{
+	case GL_UNIFORM_BUFFER: return 0;
+	case GL_SHADER_STORAGE_BUFFER: return 1;
+	default: return -1;
+	}
+}
+
+static int CapabilitySlot(GLenum capability)
+{
+	switch (capability)
+	{
+	case GL_DEPTH_TEST: return 0;
+	case GL_BLEND: return 1;
+	case GL_STENCIL_TEST: return 2;
+	case GL_CULL_FACE: return 3;
+	default: return -1;
+	}
+}
+
+void BeginGLStateFrame()
+{
+	InvalidateGLState();
+
+	lastFrameStats = frameStats;
+	frameStats = {};
+}
+
+void InvalidateGLState()
+{
+	state = {};
+}
+
+GLStateStats GetGLStateStats()
+{
+	return lastFrameStats;
+}
+
+void UseProgram(GLuint program)
+{
+	if (Elide(state.programKnown && state.program == program))
+		return;
+
+	glUseProgram(program);
+	state.programKnown = true;
+	state.program = program;
+}
+
+void BindVertexArray(GLuint vertexArray)
+{
+	if (Elide(state.vertexArrayKnown && state.vertexArray == vertexArray))
+		return;
+
+	glBindVertexArray(vertexArray);
+	state.vertexArrayKnown = true;
+	state.vertexArray = vertexArray;
+}
+
+void BindFramebuffer(GLenum target, GLuint framebuffer)
+{
+	const bool draw = target == GL_FRAMEBUFFER || target == GL_DRAW_FRAMEBUFFER;
+	const bool read = target == GL_FRAMEBUFFER || target == GL_READ_FRAMEBUFFER;
+
+	const bool drawUnchanged = !draw || (state.drawFramebufferKnown && state.drawFramebuffer == framebuffer);
+	const bool readUnchanged = !read || (state.readFramebufferKnown && state.readFramebuffer == framebuffer);
+	if (Elide(drawUnchanged && readUnchanged))
+		return;
+
+	glBindFramebuffer(target, framebuffer);
+	if (draw)
+	{
+		state.drawFramebufferKnown = true;
+		state.drawFramebuffer = framebuffer;
+	}
+	if (read)
+	{
+		state.readFramebufferKnown = true;
+		state.readFramebuffer = framebuffer;
+	}
+}
+
+void ActiveTexture(GLenum unit)
+{
+	const u32 index = unit - GL_TEXTURE0;
+	ASSERT(index < GL_STATE_TEXTURE_UNITS, "Texture unit out of the cached range");
+
+	if (Elide(state.activeTextureKnown && state.activeTexture == index))
+		return;
+
+	glActiveTexture(unit);
+	state.activeTextureKnown = true;
+	state.activeTexture = index;
+}
+
+void BindTexture(GLenum target, GLuint texture)
+{
+	const int slot = TextureTargetSlot(target);
+	if (slot < 0 || !state.activeTextureKnown)
+	{
+		Elide(false);
+		glBindTexture(target, texture);
+
+		// Without a known active unit any of them may have changed
+		if (slot >= 0)
+			memset(state.textureKnown, 0, sizeof(state.textureKnown));
+		return;
+	}
+
+	const u32 unit = state.activeTexture;
+	if (Elide(state.textureKnown[unit][slot] && state.textures[unit][slot] == texture))
+		return;
+
+	glBindTexture(target, texture);
+	state.textureKnown[unit][slot] = true;
+	state.textures[unit][slot] = texture;
+}
+
+void BindBufferBase(GLenum target, GLuint index, GLuint buffer)
+{
+	BindBufferRange(target, index, buffer, 0, -1);
+}
+
+void BindBufferRange(GLenum target, GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size)
+{
+	const int slot = BufferTargetSlot(target);
+	CachedBufferBinding* binding = slot >= 0 && index < GL_STATE_BUFFER_BINDINGS ? &state.buffers[slot][index] : NULL;
+
+	if (Elide(binding && binding->known && binding->buffer == buffer && binding->offset == offset && binding->size == size))
+		return;
+
+	if (size < 0)
+		glBindBufferBase(target, index, buffer);
+	else
+		glBindBufferRange(target, index, buffer, offset, size);
+
+	if (binding)
+	{
+		binding->known = true;
+		binding->buffer = buffer;
+		binding->offset = offset;
+		binding->size = size;
+	}
+}
+
+static void SetCapability(GLenum capability, bool enabled)
+{
+	const int slot = CapabilitySlot(capability);
+	if (Elide(slot >= 0 && state.capabilityKnown[slot] && state.capabilityEnabled[slot] == enabled))
+		return;
+
+	if (enabled)
+		glEnable(capability);
+	else
+		glDisable(capability);
+
+	if (slot >= 0)
+	{
+		state.capabilityKnown[slot] = true;
+		state.capabilityEnabled[slot] = enabled;
+	}
+}
+
+void EnableCapability(GLenum capability)
+{
+	SetCapability(capability, true);
+}
+
+void DisableCapability(GLenum capability)
+{
+	SetCapability(capability, false);
+}
+
+void Viewport(GLint x, GLint y, GLsizei width, GLsizei height)
+{
+	const GLint viewport[4] = { x, y, width, height };
+	if (Elide(state.viewportKnown && memcmp(state.viewport, viewport, sizeof(viewport)) == 0))
+		return;
+
+	glViewport(x, y, width, height);
+	state.viewportKnown = true;
+	memcpy(state.viewport, viewport, sizeof(viewport));
+}
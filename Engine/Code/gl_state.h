@@ -0,0 +1,46 @@
+#pragma once
+
+#include "platform.h"
+#include <glad/glad.h>
+
+// Cache of the GL state the renderer changes every frame. Every bind of the engine goes through
+// these instead of the gl* entry points; a call that would not change the bound state is dropped
+// and counted as elided.
+//
+// The cache only knows what went through it: call InvalidateGLState() after deleting objects that
+// may still be bound (GL unbinds them behind the cache) or after foreign code touched the state.
+
+#define GL_STATE_TEXTURE_UNITS   16
+#define GL_STATE_BUFFER_BINDINGS 16
+
+struct GLStateStats
+{
+	u32 issued;  // calls that reached the driver
+	u32 elided;  // calls dropped because the state was already set
+};
+
+// Starts a frame: forgets the cached state and moves the counters to the last frame stats
+void BeginGLStateFrame();
+
+void InvalidateGLState();
+
+// Counters of the previous frame
+GLStateStats GetGLStateStats();
+
+void UseProgram(GLuint program);
+void BindVertexArray(GLuint vertexArray);
+void BindFramebuffer(GLenum target, GLuint framebuffer);
+
+// Texture binds apply to the active unit, like glBindTexture
+void ActiveTexture(GLenum unit);
+void BindTexture(GLenum target, GLuint texture);
+
+// Indexed uniform and shader storage buffer bindings
+void BindBufferBase(GLenum target, GLuint index, GLuint buffer);
+void BindBufferRange(GLenum target, GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size);
+
+// GL_DEPTH_TEST, GL_BLEND, GL_STENCIL_TEST and GL_CULL_FACE are cached, other capabilities go straight through
+void EnableCapability(GLenum capability);
+void DisableCapability(GLenum capability);
+
+void Viewport(GLint x, GLint y, GLsizei width, GLsizei height);
@@ -0,0 +1,322 @@
+#include "gpu_culling.h"
+#include "engine.h"
+
+// Replaces the contents, the storage only grows
+static void UploadBuffer(Buffer& buffer, GLenum type, const void* data, u32 size)
+{
+	if (buffer.handle == 0)
+		buffer = CreateBuffer(size, type, GL_STATIC_DRAW);
+	GrowBuffer(buffer, size, GL_STATIC_DRAW);
+
+	glBindBuffer(buffer.type, buffer.handle);
+	glBufferSubData(buffer.type, 0, size, data);
+	glBindBuffer(buffer.type, 0);
+}
+
+void UpdateCullingObjects(App* app)
+{
+	GPUCulling& culling = app->gpuCulling;
+	const u32 objectCount = app->objects.size();
+	if (objectCount == culling.objectCount || objectCount == 0)
+		return;
+
+	// Object records per submesh of every mesh, then the batch index of each submesh that has any
+	std::vector<std::vector<u32>> submeshBatches(app->meshes.size());
+	for (u32 m = 0; m < app->meshes.size(); ++m)
+		submeshBatches[m].assign(app->meshes[m].submeshes.size(), 0);
+
+	for (u32 e = 0; e < app->entities.size(); ++e)
+	{
+		const u32 meshIdx = app->models[app->entities[e].modelIndex].meshIdx;
+		for (u32 i = 0; i < submeshBatches[meshIdx].size(); ++i)
+			submeshBatches[meshIdx][i]++;
+	}
+
+	// Batches ordered by pool, a pool draws a contiguous range of commands
+	std::vector<DrawElementsIndirectCommand> commands;
+	culling.poolFirstBatch.assign(app->geometryPools.size(), 0);
+	culling.poolBatchCount.assign(app->geometryPools.size(), 0);
+	u32 firstInstance = 0;
+
+	for (u32 p = 0; p < app->geometryPools.size(); ++p)
+	{
+		culling.poolFirstBatch[p] = commands.size();
+
+		for (u32 m = 0; m < app->meshes.size(); ++m)
+		{
+			for (u32 i = 0; i < submeshBatches[m].size(); ++i)
+			{
+				const Submesh& submesh = app->meshes[m].submeshes[i];
+				const u32 instanceCount = submeshBatches[m][i];
+				if (submesh.poolIdx != p || instanceCount == 0)
+					continue;
+
+				DrawElementsIndirectCommand command = {};
+				command.count = submesh.indices.size();
+				command.instanceCount = 0;
+				command.firstIndex = submesh.poolFirstIndex;
+				command.baseVertex = submesh.poolBaseVertex;
+				command.baseInstance = firstInstance;
+				firstInstance += instanceCount;
+
+				submeshBatches[m][i] = commands.size();
+				commands.push_back(command);
+			}
+		}
+
+		culling.poolBatchCount[p] = commands.size() - culling.poolFirstBatch[p];
+	}
+
+	culling.batchCount = commands.size();
+	culling.objectCount = objectCount;
+
+	// Phase 2 commands write their instances after all the phase 1 ones
+	for (u32 b = 0; b < culling.batchCount; ++b)
+	{
+		DrawElementsIndirectCommand command = commands[b];
+		command.baseInstance += objectCount;
+		commands.push_back(command);
+	}
+
+	std::vector<GPUCullObject> cullObjects(objectCount);
+	for (u32 e = 0; e < app->entities.size(); ++e)
+	{
+		const Entity& entity = app->entities[e];
+		const u32 meshIdx = app->models[entity.modelIndex].meshIdx;
+		const Mesh& mesh = app->meshes[meshIdx];
+
+		for (u32 i = 0; i < mesh.submeshes.size(); ++i)
+		{
+			GPUCullObject& cullObject = cullObjects[entity.firstObject + i];
+			cullObject.boundsCenter = (mesh.submeshes[i].bounds.min + mesh.submeshes[i].bounds.max) * 0.5f;
+			cullObject.boundsExtents = (mesh.submeshes[i].bounds.max - mesh.submeshes[i].bounds.min) * 0.5f;
+			cullObject.batch = submeshBatches[meshIdx][i];
+			cullObject.padding = 0;
+		}
+	}
+
+	// Nothing visible yet, the first frame draws everything in phase 2
+	const std::vector<u32> visibility(objectCount, 0);
+
+	const u32 commandsSize = commands.size() * sizeof(DrawElementsIndirectCommand);
+	UploadBuffer(culling.cullObjects, GL_SHADER_STORAGE_BUFFER, cullObjects.data(), objectCount * sizeof(GPUCullObject));
+	UploadBuffer(culling.visibility, GL_SHADER_STORAGE_BUFFER, visibility.data(), objectCount * sizeof(u32));
+	UploadBuffer(culling.commandTemplate, GL_COPY_READ_BUFFER, commands.data(), commandsSize);
+
+	if (culling.commands.handle == 0)
+		culling.commands = CreateBuffer(commandsSize, GL_DRAW_INDIRECT_BUFFER, GL_DYNAMIC_COPY);
+	GrowBuffer(culling.commands, commandsSize, GL_DYNAMIC_COPY);
+
+	for (u32 i = 0; i < FRAMES_IN_FLIGHT; ++i)
+	{
+		if (culling.readback[i].handle == 0)
+			culling.readback[i] = CreateBuffer(commandsSize, GL_COPY_WRITE_BUFFER, GL_STREAM_READ);
+		GrowBuffer(culling.readback[i], commandsSize, GL_STREAM_READ);
+
+		// The copies in flight have the old batch count
+		if (culling.readbackFences[i])
+			glDeleteSync(culling.readbackFences[i]);
+		culling.readbackFences[i] = 0;
+	}
+
+	// Instance ranges of both phases, written by the GPU so not in the CPU instance ring
+	if (culling.instances.handle == 0)
+		culling.instances = CreateBuffer(2 * objectCount * sizeof(u32), GL_ARRAY_BUFFER, GL_DYNAMIC_COPY);
+	GrowBuffer(culling.instances, 2 * objectCount * sizeof(u32), GL_DYNAMIC_COPY);
+}
+
+// Instance counts of the latest copy the GPU has completed, usually one or two frames old. Nothing
+// waits: if no copy is done yet the stats of the previous call are kept.
+static void ReadCullingStats(GPUCulling& culling)
+{
+	// From the newest copy to the oldest, the current slot is the one about to be written. Copies
+	// older than the newest completed one are done as well and not worth reading any more.
+	u32 frame = FRAMES_IN_FLIGHT;
+	for (u32 age = 1; age < FRAMES_IN_FLIGHT; ++age)
+	{
+		const u32 slot = (culling.readbackFrame + FRAMES_IN_FLIGHT - age) % FRAMES_IN_FLIGHT;
+		GLsync& fence = culling.readbackFences[slot];
+		if (!fence)
+			continue;
+
+		if (frame == FRAMES_IN_FLIGHT)
+		{
+			const GLenum status = glClientWaitSync(fence, 0, 0);
+			if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+				continue;
+			frame = slot;
+		}
+
+		glDeleteSync(fence);
+		fence = 0;
+	}
+
+	if (frame == FRAMES_IN_FLIGHT)
+		return;
+
+	std::vector<DrawElementsIndirectCommand> commands(2 * culling.batchCount);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, culling.readback[frame].handle);
+	glGetBufferSubData(GL_COPY_WRITE_BUFFER, 0, commands.size() * sizeof(DrawElementsIndirectCommand), commands.data());
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+	culling.drawnPhase1 = 0;
+	culling.drawnPhase2 = 0;
+	for (u32 b = 0; b < culling.batchCount; ++b)
+	{
+		culling.drawnPhase1 += commands[b].instanceCount;
+		culling.drawnPhase2 += commands[culling.batchCount + b].instanceCount;
+	}
+}
+
+static void CopyCommands(GPUCulling& culling, GLuint source, GLuint destination)
+{
+	glBindBuffer(GL_COPY_READ_BUFFER, source);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, destination);
+	glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, 2 * culling.batchCount * sizeof(DrawElementsIndirectCommand));
+	glBindBuffer(GL_COPY_READ_BUFFER, 0);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+}
+
+static void BuildHiZPyramid(App* app, GLuint depthTexture)
+{
+	GPUCulling& culling = app->gpuCulling;
+	const u32 depthWidth = app->displaySize.x;
+	const u32 depthHeight = app->displaySize.y;
+	const u32 baseWidth = glm::max(depthWidth / 2, 1u);
+	const u32 baseHeight = glm::max(depthHeight / 2, 1u);
+
+	if (culling.hiZTexture == 0 || culling.depthWidth != depthWidth || culling.depthHeight != depthHeight)
+	{
+		if (culling.hiZTexture != 0)
+		{
+			glDeleteTextures(1, &culling.hiZTexture);
+			InvalidateGLState();
+		}
+
+		culling.depthWidth = depthWidth;
+		culling.depthHeight = depthHeight;
+		culling.hiZLevels = 1 + (u32)glm::log2((float)glm::max(baseWidth, baseHeight));
+
+		glGenTextures(1, &culling.hiZTexture);
+		ActiveTexture(GL_TEXTURE0);
+		BindTexture(GL_TEXTURE_2D, culling.hiZTexture);
+		glTexStorage2D(GL_TEXTURE_2D, culling.hiZLevels, GL_R32F, baseWidth, baseHeight);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	}
+
+	Program& hiZProgram = app->programs[app->hiZBuildShaderID];
+	UseProgram(hiZProgram.handle);
+	ActiveTexture(GL_TEXTURE0);
+
+	// Level 0 reduces the depth buffer, every other level the one before it
+	for (u32 level = 0; level < culling.hiZLevels; ++level)
+	{
+		BindTexture(GL_TEXTURE_2D, level == 0 ? depthTexture : culling.hiZTexture);
+		SetUniform1i(hiZProgram, app->programHiZBuildUniformSourceLevel, level == 0 ? 0 : level - 1);
+		glBindImageTexture(0, culling.hiZTexture, level, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+
+		const u32 levelWidth = glm::max(baseWidth >> level, 1u);
+		const u32 levelHeight = glm::max(baseHeight >> level, 1u);
+		glDispatchCompute((levelWidth + HIZ_GROUP_SIZE - 1) / HIZ_GROUP_SIZE, (levelHeight + HIZ_GROUP_SIZE - 1) / HIZ_GROUP_SIZE, 1);
+		glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+	}
+
+	glBindImageTexture(0, 0, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+
+	// The depth buffer is still attached to the bound framebuffer, it must not stay bound for sampling
+	BindTexture(GL_TEXTURE_2D, 0);
+}
+
+static void CullObjects(App* app, u32 phase)
+{
+	GPUCulling& culling = app->gpuCulling;
+
+	Program& cullingProgram = app->programs[app->objectCullingShaderID];
+	UseProgram(cullingProgram.handle);
+
+	SetUniform1ui(cullingProgram, app->programObjectCullingUniformObjectCount, culling.objectCount);
+	SetUniform1ui(cullingProgram, app->programObjectCullingUniformBatchCount, culling.batchCount);
+	SetUniform1i(cullingProgram, app->programObjectCullingUniformPhase, phase);
+	SetUniform4fv(cullingProgram, app->programObjectCullingUniformFrustumPlanes, 6, app->camera.frustumPlanes);
+
+	if (phase == 1)
+	{
+		SetUniform2f(cullingProgram, app->programObjectCullingUniformDepthSize, vec2(culling.depthWidth, culling.depthHeight));
+		SetUniform1i(cullingProgram, app->programObjectCullingUniformHiZLevels, culling.hiZLevels);
+		ActiveTexture(GL_TEXTURE0);
+		BindTexture(GL_TEXTURE_2D, culling.hiZTexture);
+	}
+
+	glDispatchCompute((culling.objectCount + CULLING_GROUP_SIZE - 1) / CULLING_GROUP_SIZE, 1, 1);
+
+	// Commands and instances are read by the draws, the visibility by the next phase
+	glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT);
+
+	if (phase == 1)
+		BindTexture(GL_TEXTURE_2D, 0);
+}
+
+static void DrawPhase(App* app, Program& program, u32 phase)
+{
+	GPUCulling& culling = app->gpuCulling;
+
+	UseProgram(program.handle);
+	ActiveTexture(GL_TEXTURE0);
+	BindTexture(GL_TEXTURE_2D_ARRAY, app->albedoTextureArray);
+
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, culling.commands.handle);
+
+	for (u32 p = 0; p < app->geometryPools.size(); ++p)
+	{
+		if (culling.poolBatchCount[p] == 0)
+			continue;
+
+		GeometryPool& pool = app->geometryPools[p];
+		BindVertexArray(FindPoolVAO(pool, program, culling.instances.handle));
+
+		const u32 firstCommand = phase * culling.batchCount + culling.poolFirstBatch[p];
+		glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, (void*)(u64)(firstCommand * sizeof(DrawElementsIndirectCommand)), culling.poolBatchCount[p], 0);
+		app->entityDrawCalls++;
+	}
+
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+	BindVertexArray(0);
+}
+
+void RenderEntitiesGPUCulled(App* app, Program& program, GLuint depthTexture)
+{
+	GPUCulling& culling = app->gpuCulling;
+	if (culling.batchCount == 0)
+		return;
+
+	ReadCullingStats(culling);
+
+	// Every frame starts with commands that draw no instances
+	CopyCommands(culling, culling.commandTemplate.handle, culling.commands.handle);
+
+	BindBufferRange(GL_UNIFORM_BUFFER, BINDING(0), app->gpBuffer.buffer.handle, app->globalParamsOffset, app->globalParamsSize);
+	BindBufferBase(GL_SHADER_STORAGE_BUFFER, OBJECTS_BINDING, app->objectBuffer.handle);
+	BindBufferBase(GL_SHADER_STORAGE_BUFFER, CULL_OBJECTS_BINDING, culling.cullObjects.handle);
+	BindBufferBase(GL_SHADER_STORAGE_BUFFER, CULL_COMMANDS_BINDING, culling.commands.handle);
+	BindBufferBase(GL_SHADER_STORAGE_BUFFER, CULL_INSTANCES_BINDING, culling.instances.handle);
+	BindBufferBase(GL_SHADER_STORAGE_BUFFER, CULL_VISIBILITY_BINDING, culling.visibility.handle);
+
+	// Phase 1: what was visible last frame
+	CullObjects(app, 0);
+	DrawPhase(app, program, 0);
+
+	// Phase 2: everything against the depth phase 1 left
+	BuildHiZPyramid(app, depthTexture);
+	CullObjects(app, 1);
+	DrawPhase(app, program, 1);
+
+	// Read in a later frame, once this fence signals
+	CopyCommands(culling, culling.commands.handle, culling.readback[culling.readbackFrame].handle);
+	if (culling.readbackFences[culling.readbackFrame])
+		glDeleteSync(culling.readbackFences[culling.readbackFrame]);
+	culling.readbackFences[culling.readbackFrame] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	culling.readbackFrame = (culling.readbackFrame + 1) % FRAMES_IN_FLIGHT;
+}
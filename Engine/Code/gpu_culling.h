@@ -0,0 +1,82 @@
+#pragma once
+
+#include "platform.h"
+#include "buffer_management.h"
+#include "gpu_layout.h"
+#include <glad/glad.h>
+
+// GPU-driven entity culling in two phases, both inside the geometry pass:
+//
+//   1. The objects visible last frame are frustum tested on the GPU and drawn.
+//   2. A farthest-depth pyramid (Hi-Z) is built from the depth phase 1 left. Every object is
+//      tested against the frustum and the pyramid, the ones that were not visible last frame and
+//      now are get drawn on top, and the result is the visibility phase 1 uses next frame.
+//
+// Phase 1 only draws what was visible, so the pyramid never hides something that is in front of
+// it, and whatever the camera motion uncovered is caught by phase 2 in the same frame.
+//
+// Object records are grouped in batches sharing a submesh. The culling shader appends every
+// visible object to the instance range of its batch and bumps the instance count of the batch
+// indirect command, then each phase is one multi-draw per geometry pool. The CPU never looks at
+// the objects once their records are resident.
+
+struct App;
+struct Program;
+
+#define CULLING_GROUP_SIZE 64 // must match shaders.glsl
+#define HIZ_GROUP_SIZE     8  // must match shaders.glsl
+
+// Shader storage bindings of the culling shader (must match shaders.glsl)
+#define CULL_OBJECTS_BINDING    6
+#define CULL_COMMANDS_BINDING   7
+#define CULL_INSTANCES_BINDING  8
+#define CULL_VISIBILITY_BINDING 9
+
+// Model space bounds of an object record and the batch drawing it
+struct GPUCullObject
+{
+	glm::vec3 boundsCenter;
+	u32       batch;
+	glm::vec3 boundsExtents;
+	u32       padding;
+};
+
+#define GPU_CULL_OBJECT_LAYOUT GLSLLayout::STD430, glm::vec3, u32, glm::vec3, u32
+static_assert(offsetof(GPUCullObject, batch) == GLSLOffset<GPU_CULL_OBJECT_LAYOUT>(1), "GPUCullObject must match the std430 CullObject layout");
+static_assert(offsetof(GPUCullObject, boundsExtents) == GLSLOffset<GPU_CULL_OBJECT_LAYOUT>(2), "GPUCullObject must match the std430 CullObject layout");
+static_assert(offsetof(GPUCullObject, padding) == GLSLOffset<GPU_CULL_OBJECT_LAYOUT>(3), "GPUCullObject must match the std430 CullObject layout");
+static_assert(sizeof(GPUCullObject) == GLSLSize<GPU_CULL_OBJECT_LAYOUT>(), "GPUCullObject must match the std430 CullObject layout");
+
+struct GPUCulling
+{
+	// Rebuilt when object records are added
+	Buffer cullObjects;      // GPUCullObject per object record
+	Buffer visibility;       // u32 per object record, visible in the last phase 2
+	Buffer commandTemplate;  // commands with no instances, copied over commands every frame
+	Buffer commands;         // batchCount phase 1 commands, then batchCount phase 2 commands
+	Buffer instances;        // object index per drawn instance, the instance stream of the draws
+	u32 objectCount;
+	u32 batchCount;
+	std::vector<u32> poolFirstBatch; // batches of a geometry pool are contiguous
+	std::vector<u32> poolBatchCount;
+
+	// Farthest depth pyramid, level 0 is half the depth buffer size
+	GLuint hiZTexture;
+	u32 depthWidth;
+	u32 depthHeight;
+	u32 hiZLevels;
+
+	// Commands copied after the draws for the stats, each copy fenced and read back once the GPU is past it
+	Buffer readback[FRAMES_IN_FLIGHT];
+	GLsync readbackFences[FRAMES_IN_FLIGHT];
+	u32 readbackFrame;
+	u32 drawnPhase1; // instances drawn from last frame's visibility
+	u32 drawnPhase2; // instances newly visible
+};
+
+// Uploads the bounds and batches of the object records if records were added since last call
+void UpdateCullingObjects(App* app);
+
+// Culls the entities in two phases and draws the survivors with the given program into the bound
+// framebuffer, depthTexture being its depth attachment
+void RenderEntitiesGPUCulled(App* app, Program& program, GLuint depthTexture);
@@ -0,0 +1,80 @@
+#pragma once
+
+#include "platform.h"
+
+// Offsets of the members of a GLSL block under the std140 and std430 rules, computed at compile
+// time. The C++ records mirroring the shader blocks are written with a single copy and checked
+// member by member against the offsets GLSL will use, e.g. for
+//
+//     layout(std140) uniform Block { vec3 a; uint b; mat4 c; };
+//
+//     static_assert(offsetof(GPUBlock, c) == GLSLOffset<GLSLLayout::STD140, glm::vec3, u32, glm::mat4>(2), "...");
+//
+// so a record that no longer matches its block fails to compile.
+
+enum class GLSLLayout
+{
+	STD140, // uniform blocks
+	STD430  // shader storage blocks
+};
+
+constexpr u32 GLSLAlignUp(u32 value, u32 alignment)
+{
+	return (value + alignment - 1) / alignment * alignment;
+}
+
+// Base alignment and size of a block member of type T
+template <GLSLLayout Layout, typename T>
+struct GLSLType;
+
+template <GLSLLayout Layout> struct GLSLType<Layout, float>      { static constexpr u32 alignment = 4;  static constexpr u32 size = 4; };
+template <GLSLLayout Layout> struct GLSLType<Layout, i32>        { static constexpr u32 alignment = 4;  static constexpr u32 size = 4; };
+template <GLSLLayout Layout> struct GLSLType<Layout, u32>        { static constexpr u32 alignment = 4;  static constexpr u32 size = 4; };
+template <GLSLLayout Layout> struct GLSLType<Layout, glm::vec2>  { static constexpr u32 alignment = 8;  static constexpr u32 size = 8; };
+template <GLSLLayout Layout> struct GLSLType<Layout, glm::uvec2> { static constexpr u32 alignment = 8;  static constexpr u32 size = 8; };
+template <GLSLLayout Layout> struct GLSLType<Layout, glm::vec3>  { static constexpr u32 alignment = 16; static constexpr u32 size = 12; };
+template <GLSLLayout Layout> struct GLSLType<Layout, glm::vec4>  { static constexpr u32 alignment = 16; static constexpr u32 size = 16; };
+template <GLSLLayout Layout> struct GLSLType<Layout, glm::uvec4> { static constexpr u32 alignment = 16; static constexpr u32 size = 16; };
+template <GLSLLayout Layout> struct GLSLType<Layout, glm::mat4>  { static constexpr u32 alignment = 16; static constexpr u32 size = 64; };
+
+// Arrays: std140 rounds the element stride up to a vec4, std430 keeps the element alignment
+template <GLSLLayout Layout, typename T, size_t N>
+struct GLSLType<Layout, T[N]>
+{
+	static constexpr u32 alignment = Layout == GLSLLayout::STD140 ? GLSLAlignUp(GLSLType<Layout, T>::alignment, 16) : GLSLType<Layout, T>::alignment;
+	static constexpr u32 stride = GLSLAlignUp(GLSLType<Layout, T>::size, alignment);
+	static constexpr u32 size = stride * (u32)N;
+};
+
+// Offset of the member at index member in a block declaring Members in that order
+template <GLSLLayout Layout, typename... Members>
+constexpr u32 GLSLOffset(u32 member)
+{
+	const u32 alignments[] = { GLSLType<Layout, Members>::alignment... };
+	const u32 sizes[] = { GLSLType<Layout, Members>::size... };
+
+	u32 offset = 0;
+	for (u32 i = 0; i < member; ++i)
+		offset = GLSLAlignUp(offset, alignments[i]) + sizes[i];
+
+	return GLSLAlignUp(offset, alignments[member]);
+}
+
+// Size of the block, or the array stride of a struct with these members: rounded up to the
+// largest member alignment (to a vec4 at least with std140)
+template <GLSLLayout Layout, typename... Members>
+constexpr u32 GLSLSize()
+{
+	const u32 alignments[] = { GLSLType<Layout, Members>::alignment... };
+	const u32 sizes[] = { GLSLType<Layout, Members>::size... };
+
+	u32 offset = 0;
+	u32 alignment = Layout == GLSLLayout::STD140 ? 16 : 1;
+	for (u32 i = 0; i < sizeof...(Members); ++i)
+	{
+		offset = GLSLAlignUp(offset, alignments[i]) + sizes[i];
+		alignment = alignments[i] > alignment ? alignments[i] : alignment;
+	}
+
+	return GLSLAlignUp(offset, alignment);
+}
@@ -0,0 +1,169 @@
+#include "light_management.h"
+#include "engine.h"
+
+// Dirty records closer than this are merged into a single glBufferSubData call
+#define LIGHT_UPLOAD_MERGE_GAP 8
+
+// Lights packed per job
+#define LIGHT_PACKING_GRAIN 64
+
+static void InitLightBuffer(LightBuffer& lightBuffer, u32 recordSize, u32 capacity)
+{
+	lightBuffer.buffer = CreateBuffer(recordSize * capacity, GL_SHADER_STORAGE_BUFFER, GL_DYNAMIC_DRAW);
+	lightBuffer.recordSize = recordSize;
+	lightBuffer.count = 0;
+	lightBuffer.mirror.clear();
+}
+
+static void UploadLightRecords(LightStore& store, LightBuffer& lightBuffer, const void* data, u32 count)
+{
+	const u8* records = (const u8*)data;
+	const u32 recordSize = lightBuffer.recordSize;
+	const u32 size = count * recordSize;
+
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, lightBuffer.buffer.handle);
+
+	if (size > lightBuffer.buffer.size)
+	{
+		// Out of room: grow geometrically and upload everything once
+		u32 newSize = lightBuffer.buffer.size * 2;
+		while (newSize < size)
+			newSize *= 2;
+
+		glBufferData(GL_SHADER_STORAGE_BUFFER, newSize, NULL, GL_DYNAMIC_DRAW);
+		glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, size, records);
+		lightBuffer.buffer.size = newSize;
+
+		lightBuffer.mirror.assign(records, records + size);
+		lightBuffer.count = count;
+
+		store.uploadedBytes += size;
+		store.uploadedRanges++;
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+		return;
+	}
+
+	// Records past the old count are always dirty
+	const u32 previousCount = lightBuffer.count;
+	lightBuffer.mirror.resize(size);
+
+	u32 rangeBegin = 0;
+	u32 rangeEnd = 0;
+	bool rangeOpen = false;
+
+	for (u32 i = 0; i <= count; ++i)
+	{
+		bool dirty = false;
+		if (i < count)
+			dirty = i >= previousCount || memcmp(&lightBuffer.mirror[i * recordSize], records + i * recordSize, recordSize) != 0;
+
+		if (dirty)
+		{
+			if (!rangeOpen)
+			{
+				rangeBegin = i;
+				rangeOpen = true;
+			}
+			rangeEnd = i + 1;
+		}
+		else if (rangeOpen && (i == count || i - rangeEnd >= LIGHT_UPLOAD_MERGE_GAP))
+		{
+			const u32 offset = rangeBegin * recordSize;
+			const u32 rangeSize = (rangeEnd - rangeBegin) * recordSize;
+
+			glBufferSubData(GL_SHADER_STORAGE_BUFFER, offset, rangeSize, records + offset);
+			memcpy(&lightBuffer.mirror[offset], records + offset, rangeSize);
+
+			store.uploadedBytes += rangeSize;
+			store.uploadedRanges++;
+			rangeOpen = false;
+		}
+	}
+
+	lightBuffer.count = count;
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+void InitLightStore(LightStore& store, u32 initialCapacity)
+{
+	ASSERT(initialCapacity > 0, "The light store needs some initial capacity");
+
+	InitLightBuffer(store.pointLights, sizeof(GPUPointLight), initialCapacity);
+	InitLightBuffer(store.directionalLights, sizeof(GPUDirectionalLight), initialCapacity);
+	InitLightBuffer(store.visiblePointLights, sizeof(u32), initialCapacity);
+
+	store.uploadedBytes = 0;
+	store.uploadedRanges = 0;
+}
+
+void UpdateLightStore(LightStore& store, const std::vector<Light>& lights, const Camera& camera)
+{
+	// Records keep the order of the lights within their type, so every light knows its slot
+	// up front and the lights can be packed and culled in parallel
+	u32 pointCount = 0;
+	u32 directionalCount = 0;
+	store.recordSlots.resize(lights.size());
+	for (u32 i = 0; i < lights.size(); ++i)
+	{
+		switch (lights[i].type)
+		{
+		case LightType::LIGHT_TYPE_POINT:       store.recordSlots[i] = pointCount++; break;
+		case LightType::LIGHT_TYPE_DIRECTIONAL: store.recordSlots[i] = directionalCount++; break;
+		default: break;
+		}
+	}
+
+	store.pointRecords.resize(pointCount);
+	store.directionalRecords.resize(directionalCount);
+	store.pointVisibility.resize(pointCount);
+
+	ParallelFor(lights.size(), LIGHT_PACKING_GRAIN, [&store, &lights, &camera](u32 i) {
+		const Light& light = lights[i];
+		const u32 slot = store.recordSlots[i];
+
+		switch (light.type)
+		{
+		case LightType::LIGHT_TYPE_POINT:
+		{
+			GPUPointLight record = {};
+			record.position = light.position;
+			record.intensity = (float)light.intensity * 0.01f;
+			record.color = light.color;
+			record.radius = light.radius;
+			store.pointRecords[slot] = record;
+			store.pointVisibility[slot] = light.radius > 0.0f && camera.IsSphereInFrustum(light.position, light.radius);
+			break;
+		}
+		case LightType::LIGHT_TYPE_DIRECTIONAL:
+		{
+			GPUDirectionalLight record = {};
+			record.direction = light.direction;
+			record.intensity = (float)light.intensity * 0.01f;
+			record.color = light.color;
+			store.directionalRecords[slot] = record;
+			break;
+		}
+		default: break;
+		}
+	});
+
+	// Every point light stays resident, the visible list only references it
+	store.visiblePointRecords.clear();
+	for (u32 i = 0; i < pointCount; ++i)
+		if (store.pointVisibility[i])
+			store.visiblePointRecords.push_back(i);
+
+	store.uploadedBytes = 0;
+	store.uploadedRanges = 0;
+
+	UploadLightRecords(store, store.pointLights, store.pointRecords.data(), store.pointRecords.size());
+	UploadLightRecords(store, store.directionalLights, store.directionalRecords.data(), store.directionalRecords.size());
+	UploadLightRecords(store, store.visiblePointLights, store.visiblePointRecords.data(), store.visiblePointRecords.size());
+}
+
+void BindLightStore(const LightStore& store)
+{
+	BindBufferBase(GL_SHADER_STORAGE_BUFFER, POINT_LIGHTS_BINDING, store.pointLights.buffer.handle);
+	BindBufferBase(GL_SHADER_STORAGE_BUFFER, DIRECTIONAL_LIGHTS_BINDING, store.directionalLights.buffer.handle);
+	BindBufferBase(GL_SHADER_STORAGE_BUFFER, VISIBLE_POINT_LIGHTS_BINDING, store.visiblePointLights.buffer.handle);
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include "platform.h"
+#include "buffer_management.h"
+#include "Light.h"
+#include "Camera.h"
+#include "gpu_layout.h"
+
+// std430 records, must match PointLight / DirectionalLight in shaders.glsl.
+// Intensity is stored already scaled to [0, 1].
+struct GPUPointLight
+{
+	glm::vec3 position;
+	float intensity;
+	glm::vec3 color;
+	float radius;
+};
+
+struct GPUDirectionalLight
+{
+	glm::vec3 direction;
+	float intensity;
+	glm::vec3 color;
+	float padding;
+};
+
+#define GPU_POINT_LIGHT_LAYOUT GLSLLayout::STD430, glm::vec3, float, glm::vec3, float
+static_assert(offsetof(GPUPointLight, intensity) == GLSLOffset<GPU_POINT_LIGHT_LAYOUT>(1), "GPUPointLight must match the std430 PointLight layout");
+static_assert(offsetof(GPUPointLight, color) == GLSLOffset<GPU_POINT_LIGHT_LAYOUT>(2), "GPUPointLight must match the std430 PointLight layout");
+static_assert(offsetof(GPUPointLight, radius) == GLSLOffset<GPU_POINT_LIGHT_LAYOUT>(3), "GPUPointLight must match the std430 PointLight layout");
+static_assert(sizeof(GPUPointLight) == GLSLSize<GPU_POINT_LIGHT_LAYOUT>(), "GPUPointLight must match the std430 PointLight layout");
+
+#define GPU_DIRECTIONAL_LIGHT_LAYOUT GLSLLayout::STD430, glm::vec3, float, glm::vec3, float
+static_assert(offsetof(GPUDirectionalLight, intensity) == GLSLOffset<GPU_DIRECTIONAL_LIGHT_LAYOUT>(1), "GPUDirectionalLight must match the std430 DirectionalLight layout");
+static_assert(offsetof(GPUDirectionalLight, color) == GLSLOffset<GPU_DIRECTIONAL_LIGHT_LAYOUT>(2), "GPUDirectionalLight must match the std430 DirectionalLight layout");
+static_assert(sizeof(GPUDirectionalLight) == GLSLSize<GPU_DIRECTIONAL_LIGHT_LAYOUT>(), "GPUDirectionalLight must match the std430 DirectionalLight layout");
+
+#define POINT_LIGHTS_BINDING 2
+#define DIRECTIONAL_LIGHTS_BINDING 3
+#define VISIBLE_POINT_LIGHTS_BINDING 4
+
+// Shader storage buffer holding one array of fixed size records, plus a CPU copy of
+// what the GPU currently holds so only the records that changed get uploaded.
+struct LightBuffer
+{
+	Buffer buffer;
+	std::vector<u8> mirror;
+	u32 recordSize;
+	u32 count;
+};
+
+struct LightStore
+{
+	LightBuffer pointLights;
+	LightBuffer directionalLights;
+	LightBuffer visiblePointLights; // Indices into pointLights that passed the frustum test
+
+	// Packed records of the current frame, reused to avoid reallocating every frame
+	std::vector<GPUPointLight> pointRecords;
+	std::vector<GPUDirectionalLight> directionalRecords;
+	std::vector<u32> visiblePointRecords;
+	std::vector<u32> recordSlots;    // per light, its record among the lights of its type
+	std::vector<u8> pointVisibility; // per point record, inside the frustum
+
+	// Upload statistics of the last update
+	u32 uploadedBytes;
+	u32 uploadedRanges;
+};
+
+void InitLightStore(LightStore& store, u32 initialCapacity);
+
+// Packs the lights per type, culls the point lights against the camera frustum
+// and uploads the records that differ from last frame
+void UpdateLightStore(LightStore& store, const std::vector<Light>& lights, const Camera& camera);
+
+void BindLightStore(const LightStore& store);
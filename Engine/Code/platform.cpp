@@ -13,15 +13,20 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
+#include <pthread.h>
 #endif
 
 #include "engine.h"
 
 #include <GLFW/glfw3.h>
 #include <stdio.h>
+#include <string.h>
 #include <imgui.h>
 #include <imgui_impl_glfw.h>
 #include <imgui_impl_opengl3.h>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 
 #define WINDOW_TITLE  "Advanced Graphics Programming"
 #define WINDOW_WIDTH  1980
@@ -31,6 +36,75 @@
 u8* GlobalFrameArenaMemory = NULL;
 u32 GlobalFrameArenaHead = 0;
 
+#define JOB_DEQUE_SIZE 4096 // power of two
+#define JOB_CACHE_LINE_SIZE 64
+
+struct Job
+{
+    JobFunction function;
+    void*       userData;
+    u32         index;
+    JobCounter* counter;
+};
+
+// A thief reads the slot before knowing whether the job is its own, so the fields are atomic
+struct JobSlot
+{
+    std::atomic<JobFunction> function;
+    std::atomic<void*>       userData;
+    std::atomic<u32>         index;
+    std::atomic<JobCounter*> counter;
+};
+
+// Chase-Lev deque of fixed size (Le et al., "Correct and Efficient Work-Stealing for Weak Memory
+// Models"). The owner thread pushes and pops at the bottom, the others steal from the top.
+struct JobDeque
+{
+    // Thieves write top and the owner bottom, a cache line apart so neither invalidates the other.
+    // Padding rather than alignas: heap allocations are not over-aligned before C++17.
+    std::atomic<i64> top{ 0 };
+    u8               topPadding[JOB_CACHE_LINE_SIZE - sizeof(std::atomic<i64>)];
+    std::atomic<i64> bottom{ 0 };
+    u8               bottomPadding[JOB_CACHE_LINE_SIZE - sizeof(std::atomic<i64>)];
+    JobSlot          slots[JOB_DEQUE_SIZE];
+};
+
+static void WriteJobSlot(JobSlot& slot, const Job& job)
+{
+    slot.function.store(job.function, std::memory_order_relaxed);
+    slot.userData.store(job.userData, std::memory_order_relaxed);
+    slot.index.store(job.index, std::memory_order_relaxed);
+    slot.counter.store(job.counter, std::memory_order_relaxed);
+}
+
+static Job ReadJobSlot(const JobSlot& slot)
+{
+    Job job;
+    job.function = slot.function.load(std::memory_order_relaxed);
+    job.userData = slot.userData.load(std::memory_order_relaxed);
+    job.index = slot.index.load(std::memory_order_relaxed);
+    job.counter = slot.counter.load(std::memory_order_relaxed);
+    return job;
+}
+
+struct JobSystem
+{
+    std::vector<std::thread> threads;
+    JobDeque*                deques; // the main thread one first, then one per worker
+    u32                      dequeCount;
+
+    // Idle workers sleep until jobs are queued
+    std::atomic<i32>         queuedJobs{ 0 };
+    std::mutex               mutex;
+    std::condition_variable  jobsQueued;
+    bool                     quit;
+};
+
+JobSystem GlobalJobSystem;
+
+// Deque of the running thread, 0 for the main thread
+static thread_local u32 JobThreadIndex = 0;
+
 void OnGlfwError(int errorCode, const char *errorMessage)
 {
 	fprintf(stderr, "glfw failed with error %d: %s\n", errorCode, errorMessage);
@@ -114,8 +188,188 @@ void OnGlfwCloseWindow(GLFWwindow* window)
     app->isRunning = false;
 }
 
-int main()
+static bool PushJob(JobDeque& deque, const Job& job)
+{
+    const i64 bottom = deque.bottom.load(std::memory_order_relaxed);
+    const i64 top = deque.top.load(std::memory_order_acquire);
+
+    // Full: the slot at bottom may not be stolen yet
+    if (bottom - top >= JOB_DEQUE_SIZE)
+        return false;
+
+    WriteJobSlot(deque.slots[bottom & (JOB_DEQUE_SIZE - 1)], job);
+    deque.bottom.store(bottom + 1, std::memory_order_release);
+    return true;
+}
+
+static bool PopJob(JobDeque& deque, Job& job)
+{
+    const i64 bottom = deque.bottom.load(std::memory_order_relaxed) - 1;
+    deque.bottom.store(bottom, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    i64 top = deque.top.load(std::memory_order_relaxed);
+
+    if (top > bottom)
+    {
+        deque.bottom.store(bottom + 1, std::memory_order_relaxed);
+        return false;
+    }
+
+    job = ReadJobSlot(deque.slots[bottom & (JOB_DEQUE_SIZE - 1)]);
+    if (top < bottom)
+        return true;
+
+    // Last job, a thief may be taking it at the same time
+    const bool taken = deque.top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+    deque.bottom.store(bottom + 1, std::memory_order_relaxed);
+    return taken;
+}
+
+static bool StealJob(JobDeque& deque, Job& job)
+{
+    i64 top = deque.top.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    const i64 bottom = deque.bottom.load(std::memory_order_acquire);
+
+    if (top >= bottom)
+        return false;
+
+    // Read before claiming it, the owner does not reuse the slot until top moves past it
+    job = ReadJobSlot(deque.slots[top & (JOB_DEQUE_SIZE - 1)]);
+    return deque.top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+}
+
+// A job from the deque of the running thread, or else stolen from another one
+static bool GetJob(Job& job)
+{
+    JobSystem& jobs = GlobalJobSystem;
+    bool found = PopJob(jobs.deques[JobThreadIndex], job);
+    for (u32 i = 1; !found && i < jobs.dequeCount; ++i)
+        found = StealJob(jobs.deques[(JobThreadIndex + i) % jobs.dequeCount], job);
+
+    if (found)
+        jobs.queuedJobs.fetch_sub(1, std::memory_order_relaxed);
+    return found;
+}
+
+static void ExecuteJob(const Job& job)
+{
+    job.function(job.userData, job.index);
+    job.counter->pending.fetch_sub(1, std::memory_order_release);
+}
+
+static void WakeWorkers()
+{
+    JobSystem& jobs = GlobalJobSystem;
+
+    // Taking the mutex orders the wake up after the check of a worker about to sleep
+    {
+        std::lock_guard<std::mutex> lock(jobs.mutex);
+    }
+    jobs.jobsQueued.notify_all();
+}
+
+static void RunWorker(u32 threadIndex)
+{
+    JobSystem& jobs = GlobalJobSystem;
+    JobThreadIndex = threadIndex;
+
+    for (;;)
+    {
+        Job job;
+        if (GetJob(job))
+        {
+            ExecuteJob(job);
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(jobs.mutex);
+        jobs.jobsQueued.wait(lock, [&jobs] { return jobs.quit || jobs.queuedJobs.load(std::memory_order_relaxed) > 0; });
+        if (jobs.quit)
+            return;
+    }
+}
+
+static void PinThread(std::thread::native_handle_type thread, u32 core)
+{
+    // Cores the affinity mask cannot hold are left to the scheduler: on Windows they belong to
+    // another processor group, on Linux they are past the fixed size cpu_set_t
+#ifdef _WIN32
+    if (core >= sizeof(DWORD_PTR) * 8)
+        return;
+
+    const bool pinned = SetThreadAffinityMask(thread, (DWORD_PTR)1 << core) != 0;
+#else
+    if (core >= CPU_SETSIZE)
+        return;
+
+    cpu_set_t cores;
+    CPU_ZERO(&cores);
+    CPU_SET(core, &cores);
+    const bool pinned = pthread_setaffinity_np(thread, sizeof(cores), &cores) == 0;
+#endif
+    if (!pinned)
+        ELOG("Could not pin a thread to core %u", core);
+}
+
+// One worker per core besides the one of the main thread. With pinThreads every thread, the main
+// one too, stays on its own core.
+static void StartJobSystem(bool pinThreads)
 {
+    JobSystem& jobs = GlobalJobSystem;
+    jobs.quit = false;
+
+    const u32 coreCount = std::thread::hardware_concurrency();
+    const u32 workerCount = coreCount > 1 ? coreCount - 1 : 0;
+    jobs.dequeCount = workerCount + 1;
+    jobs.deques = new JobDeque[jobs.dequeCount];
+
+    for (u32 i = 0; i < workerCount; ++i)
+    {
+        jobs.threads.push_back(std::thread(RunWorker, i + 1));
+        if (pinThreads)
+            PinThread(jobs.threads.back().native_handle(), i + 1);
+    }
+
+    if (pinThreads)
+    {
+#ifdef _WIN32
+        PinThread(GetCurrentThread(), 0);
+#else
+        PinThread(pthread_self(), 0);
+#endif
+    }
+}
+
+static void StopJobSystem()
+{
+    JobSystem& jobs = GlobalJobSystem;
+    {
+        std::lock_guard<std::mutex> lock(jobs.mutex);
+        jobs.quit = true;
+    }
+    jobs.jobsQueued.notify_all();
+
+    for (u32 i = 0; i < jobs.threads.size(); ++i)
+        jobs.threads[i].join();
+    jobs.threads.clear();
+
+    delete[] jobs.deques;
+    jobs.deques = NULL;
+}
+
+int main(int argc, char** argv)
+{
+    // --bake-pvs: bake the potentially visible sets of the scene and exit
+    // --pin-threads: keep every thread of the job system on its own core
+    bool bakePVS = false;
+    bool pinThreads = false;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--bake-pvs") == 0)   bakePVS = true;
+        if (strcmp(argv[i], "--pin-threads") == 0) pinThreads = true;
+    }
+
     App app         = {};
     app.deltaTime   = 1.0f/60.0f;
     app.displaySize = ivec2(WINDOW_WIDTH, WINDOW_HEIGHT);
@@ -199,8 +453,16 @@ int main()
 
     GlobalFrameArenaMemory = (u8*)malloc(GLOBAL_FRAME_ARENA_SIZE);
 
+    StartJobSystem(pinThreads);
+
     Init(&app);
 
+    if (bakePVS)
+    {
+        BakePVS(&app, PVS_FILENAME);
+        app.isRunning = false;
+    }
+
     while (app.isRunning)
     {
         // Tell GLFW to call platform callbacks
@@ -262,6 +524,8 @@ int main()
         GlobalFrameArenaHead = 0;
     }
 
+    StopJobSystem();
+
     free(GlobalFrameArenaMemory);
 
     ImGui_ImplOpenGL3_Shutdown();
@@ -408,3 +672,85 @@ void LogString(const char* str)
     fprintf(stderr, "%s\n", str);
 #endif
 }
+
+f64 GetTime()
+{
+    return glfwGetTime();
+}
+
+u32 GetWorkerCount()
+{
+    return GlobalJobSystem.dequeCount - 1;
+}
+
+void RunJobs(JobFunction function, void* userData, u32 jobCount, JobCounter* counter)
+{
+    JobSystem& jobs = GlobalJobSystem;
+    JobDeque& deque = jobs.deques[JobThreadIndex];
+
+    counter->pending.fetch_add(jobCount, std::memory_order_relaxed);
+
+    for (u32 i = 0; i < jobCount; ++i)
+    {
+        const Job job = { function, userData, i, counter };
+        if (PushJob(deque, job))
+        {
+            jobs.queuedJobs.fetch_add(1, std::memory_order_relaxed);
+            continue;
+        }
+
+        // The deque is full, let the workers empty it while this one runs here
+        WakeWorkers();
+        ExecuteJob(job);
+    }
+
+    WakeWorkers();
+}
+
+void WaitForJobs(JobCounter* counter)
+{
+    while (counter->pending.load(std::memory_order_acquire) > 0)
+    {
+        Job job;
+        if (GetJob(job))
+            ExecuteJob(job);
+        else
+            std::this_thread::yield();
+    }
+}
+
+struct ParallelForJobs
+{
+    JobRangeFunction function;
+    void*            userData;
+    u32              count;
+    u32              grainSize;
+};
+
+static void RunParallelForJob(void* userData, u32 jobIndex)
+{
+    const ParallelForJobs& jobs = *(const ParallelForJobs*)userData;
+    const u32 first = jobIndex * jobs.grainSize;
+    const u32 end = first + jobs.grainSize < jobs.count ? first + jobs.grainSize : jobs.count;
+    jobs.function(jobs.userData, first, end);
+}
+
+void ParallelForRanges(u32 count, u32 grainSize, JobRangeFunction function, void* userData)
+{
+    if (grainSize == 0)
+        grainSize = 1;
+
+    // A single range is not worth a job
+    const u32 jobCount = (count + grainSize - 1) / grainSize;
+    if (jobCount <= 1)
+    {
+        if (count > 0)
+            function(userData, 0, count);
+        return;
+    }
+
+    ParallelForJobs jobs = { function, userData, count, grainSize };
+    JobCounter counter;
+    RunJobs(RunParallelForJob, &jobs, jobCount, &counter);
+    WaitForJobs(&counter);
+}
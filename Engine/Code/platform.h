@@ -14,6 +14,7 @@
 #include <glm/gtc/type_ptr.hpp>
 #include <vector>
 #include <string>
+#include <atomic>
 
 #pragma warning(disable : 4267) // conversion from X to Y, possible loss of data
 
@@ -88,6 +89,55 @@ u64 GetFileLastWriteTimestamp(const char *filepath);
  */
 void LogString(const char* str);
 
+/**
+ * Seconds elapsed since the platform layer started, from a high resolution clock.
+ */
+f64 GetTime();
+
+/**
+ * Job system: a worker thread per core besides the main thread, each one with its own work
+ * stealing deque (Chase-Lev). Jobs go to the deque of the thread starting them and idle threads
+ * steal from the others, so jobs can start jobs of their own and wait for them.
+ *
+ * A JobCounter counts the jobs of a group still pending. RunJobs returns right away, and the
+ * caller can do something else before WaitForJobs, which runs jobs (any, not only the group's)
+ * until the counter gets to zero instead of blocking the thread.
+ */
+struct JobCounter
+{
+    std::atomic<u32> pending{ 0 };
+};
+
+typedef void (*JobFunction)(void* userData, u32 jobIndex);
+
+// Worker threads, the main thread not counted
+u32 GetWorkerCount();
+
+// Starts jobCount jobs calling function with the indices [0, jobCount)
+void RunJobs(JobFunction function, void* userData, u32 jobCount, JobCounter* counter);
+
+void WaitForJobs(JobCounter* counter);
+
+typedef void (*JobRangeFunction)(void* userData, u32 first, u32 end);
+
+// Splits [0, count) in ranges of grainSize indices, one job each, and waits for all of them
+void ParallelForRanges(u32 count, u32 grainSize, JobRangeFunction function, void* userData);
+
+/**
+ * Calls body(i) for every i in [0, count) on the job system and returns when all calls are done.
+ * The grain size is the number of consecutive indices of a job: the cheaper the body, the larger
+ * it has to be for the job overhead to pay off.
+ */
+template <typename Body>
+void ParallelFor(u32 count, u32 grainSize, const Body& body)
+{
+    ParallelForRanges(count, grainSize, [](void* userData, u32 first, u32 end) {
+        const Body& body = *(const Body*)userData;
+        for (u32 i = first; i < end; ++i)
+            body(i);
+    }, (void*)&body);
+}
+
 #define ILOG(...)                 \
 {                                 \
 char logBuffer[1024] = {};        \
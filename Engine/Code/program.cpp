@@ -0,0 +1,209 @@
+#include "program.h"
+
+static UniformStats frameStats = {};
+static UniformStats lastFrameStats = {};
+
+// Bytes of one element of a uniform of the given type
+static u32 UniformTypeSize(GLenum type)
+{
+	switch (type)
+	{
+	case GL_FLOAT: case GL_INT: case GL_UNSIGNED_INT: case GL_BOOL: return 4;
+	case GL_FLOAT_VEC2: case GL_INT_VEC2: case GL_UNSIGNED_INT_VEC2: case GL_BOOL_VEC2: return 8;
+	case GL_FLOAT_VEC3: case GL_INT_VEC3: case GL_UNSIGNED_INT_VEC3: case GL_BOOL_VEC3: return 12;
+	case GL_FLOAT_VEC4: case GL_INT_VEC4: case GL_UNSIGNED_INT_VEC4: case GL_BOOL_VEC4: return 16;
+	case GL_FLOAT_MAT2: return 16;
+	case GL_FLOAT_MAT3: return 36;
+	case GL_FLOAT_MAT4: return 64;
+	default: return 4; // samplers and images hold a unit index
+	}
+}
+
+// Components of a vertex input of the given type
+static u32 AttributeComponentCount(GLenum type)
+{
+	switch (type)
+	{
+	case GL_FLOAT_VEC2: case GL_INT_VEC2: case GL_UNSIGNED_INT_VEC2: return 2;
+	case GL_FLOAT_VEC3: case GL_INT_VEC3: case GL_UNSIGNED_INT_VEC3: return 3;
+	case GL_FLOAT_VEC4: case GL_INT_VEC4: case GL_UNSIGNED_INT_VEC4: return 4;
+	default: return 1;
+	}
+}
+
+static std::string ResourceName(GLuint program, GLenum programInterface, GLuint index, GLint nameLength)
+{
+	std::string name(nameLength, '\0');
+	glGetProgramResourceName(program, programInterface, index, nameLength, NULL, &name[0]);
+	name.resize(strlen(name.c_str()));
+	return name;
+}
+
+static void ReflectBlocks(GLuint program, GLenum programInterface, std::vector<ProgramBlock>& blocks)
+{
+	GLint blockCount = 0;
+	glGetProgramInterfaceiv(program, programInterface, GL_ACTIVE_RESOURCES, &blockCount);
+
+	const GLenum properties[] = { GL_NAME_LENGTH, GL_BUFFER_BINDING, GL_BUFFER_DATA_SIZE };
+	for (GLint i = 0; i < blockCount; ++i)
+	{
+		GLint values[ARRAY_COUNT(properties)];
+		glGetProgramResourceiv(program, programInterface, i, ARRAY_COUNT(properties), properties, ARRAY_COUNT(values), NULL, values);
+
+		ProgramBlock block = {};
+		block.name = ResourceName(program, programInterface, i, values[0]);
+		block.binding = values[1];
+		block.dataSize = values[2];
+		blocks.push_back(block);
+	}
+}
+
+void ReflectProgram(Program& program)
+{
+	program.uniforms.clear();
+	program.uniformBlocks.clear();
+	program.storageBlocks.clear();
+	program.uniformValues.clear();
+	program.vertexInputLayout.attributes.clear();
+
+	// Uniforms outside of blocks, block members are set through buffers
+	GLint uniformCount = 0;
+	glGetProgramInterfaceiv(program.handle, GL_UNIFORM, GL_ACTIVE_RESOURCES, &uniformCount);
+
+	const GLenum uniformProperties[] = { GL_NAME_LENGTH, GL_TYPE, GL_ARRAY_SIZE, GL_LOCATION, GL_BLOCK_INDEX };
+	u32 valuesSize = 0;
+	for (GLint i = 0; i < uniformCount; ++i)
+	{
+		GLint values[ARRAY_COUNT(uniformProperties)];
+		glGetProgramResourceiv(program.handle, GL_UNIFORM, i, ARRAY_COUNT(uniformProperties), uniformProperties, ARRAY_COUNT(values), NULL, values);
+		if (values[4] != -1 || values[3] == -1)
+			continue;
+
+		ProgramUniform uniform = {};
+		uniform.name = ResourceName(program.handle, GL_UNIFORM, i, values[0]);
+		uniform.type = values[1];
+		uniform.arraySize = values[2];
+		uniform.location = values[3];
+		uniform.valueOffset = valuesSize;
+		uniform.valueSize = UniformTypeSize(uniform.type) * uniform.arraySize;
+
+		const size_t arraySuffix = uniform.name.find("[0]");
+		if (arraySuffix != std::string::npos)
+			uniform.name.resize(arraySuffix);
+
+		valuesSize += uniform.valueSize;
+		program.uniforms.push_back(uniform);
+	}
+	program.uniformValues.resize(valuesSize);
+
+	ReflectBlocks(program.handle, GL_UNIFORM_BLOCK, program.uniformBlocks);
+	ReflectBlocks(program.handle, GL_SHADER_STORAGE_BLOCK, program.storageBlocks);
+
+	// Vertex inputs, none for compute programs. Built-ins like gl_VertexID have no location.
+	GLint inputCount = 0;
+	glGetProgramInterfaceiv(program.handle, GL_PROGRAM_INPUT, GL_ACTIVE_RESOURCES, &inputCount);
+
+	const GLenum inputProperties[] = { GL_TYPE, GL_LOCATION };
+	for (GLint i = 0; i < inputCount; ++i)
+	{
+		GLint values[ARRAY_COUNT(inputProperties)];
+		glGetProgramResourceiv(program.handle, GL_PROGRAM_INPUT, i, ARRAY_COUNT(inputProperties), inputProperties, ARRAY_COUNT(values), NULL, values);
+		if (values[1] == -1)
+			continue;
+
+		program.vertexInputLayout.attributes.push_back({ (u8)values[1], (u8)AttributeComponentCount(values[0]) });
+	}
+}
+
+UniformHandle FindUniform(const Program& program, const char* name)
+{
+	for (u32 i = 0; i < program.uniforms.size(); ++i)
+	{
+		if (program.uniforms[i].name == name)
+			return (UniformHandle)i;
+	}
+
+	return INVALID_UNIFORM;
+}
+
+void BeginUniformStatsFrame()
+{
+	lastFrameStats = frameStats;
+	frameStats = {};
+}
+
+UniformStats GetUniformStats()
+{
+	return lastFrameStats;
+}
+
+// Records the value and tells whether it has to be sent
+static bool UniformChanged(Program& program, UniformHandle handle, const void* value, u32 size)
+{
+	// Uniforms optimized out of the program are silently ignored, like location -1 in glUniform*
+	if (handle == INVALID_UNIFORM)
+		return false;
+
+	ProgramUniform& uniform = program.uniforms[handle];
+	ASSERT(size <= uniform.valueSize, "Value larger than the uniform");
+
+	u8* cached = &program.uniformValues[uniform.valueOffset];
+	if (size <= uniform.sentSize && memcmp(cached, value, size) == 0)
+	{
+		frameStats.elided++;
+		return false;
+	}
+
+	memcpy(cached, value, size);
+	uniform.sentSize = glm::max(uniform.sentSize, size);
+	frameStats.sent++;
+	return true;
+}
+
+void SetUniform1i(Program& program, UniformHandle uniform, i32 value)
+{
+	if (UniformChanged(program, uniform, &value, sizeof(value)))
+		glProgramUniform1i(program.handle, program.uniforms[uniform].location, value);
+}
+
+void SetUniform1ui(Program& program, UniformHandle uniform, u32 value)
+{
+	if (UniformChanged(program, uniform, &value, sizeof(value)))
+		glProgramUniform1ui(program.handle, program.uniforms[uniform].location, value);
+}
+
+void SetUniform1f(Program& program, UniformHandle uniform, float value)
+{
+	if (UniformChanged(program, uniform, &value, sizeof(value)))
+		glProgramUniform1f(program.handle, program.uniforms[uniform].location, value);
+}
+
+void SetUniform2f(Program& program, UniformHandle uniform, const glm::vec2& value)
+{
+	if (UniformChanged(program, uniform, &value, sizeof(value)))
+		glProgramUniform2f(program.handle, program.uniforms[uniform].location, value.x, value.y);
+}
+
+void SetUniform3f(Program& program, UniformHandle uniform, const glm::vec3& value)
+{
+	if (UniformChanged(program, uniform, &value, sizeof(value)))
+		glProgramUniform3f(program.handle, program.uniforms[uniform].location, value.x, value.y, value.z);
+}
+
+void SetUniformMatrix4f(Program& program, UniformHandle uniform, const glm::mat4& value)
+{
+	if (UniformChanged(program, uniform, &value, sizeof(value)))
+		glProgramUniformMatrix4fv(program.handle, program.uniforms[uniform].location, 1, GL_FALSE, glm::value_ptr(value));
+}
+
+void SetUniform1fv(Program& program, UniformHandle uniform, u32 count, const float* values)
+{
+	if (UniformChanged(program, uniform, values, count * sizeof(float)))
+		glProgramUniform1fv(program.handle, program.uniforms[uniform].location, count, values);
+}
+
+void SetUniform4fv(Program& program, UniformHandle uniform, u32 count, const glm::vec4* values)
+{
+	if (UniformChanged(program, uniform, values, count * sizeof(glm::vec4)))
+		glProgramUniform4fv(program.handle, program.uniforms[uniform].location, count, glm::value_ptr(values[0]));
+}
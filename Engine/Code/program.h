@@ -0,0 +1,77 @@
+#pragma once
+
+#include "platform.h"
+#include "geometry.h"
+#include <glad/glad.h>
+
+// Shader programs and what their reflection found in them. LoadProgram enumerates the active
+// uniforms, uniform blocks, storage blocks and vertex inputs once, so nothing has to query GL by
+// name while rendering.
+//
+// Uniforms are set through handles resolved with FindUniform. The last value sent to each uniform
+// is kept in the program and a set with the same value never reaches GL. Values are sent with
+// glProgramUniform*, the program does not need to be bound.
+
+// Index in Program::uniforms, INVALID_UNIFORM for uniforms the program does not use
+typedef i32 UniformHandle;
+#define INVALID_UNIFORM -1
+
+struct ProgramUniform
+{
+	std::string name;   // without the [0] of arrays
+	GLint location;
+	GLenum type;
+	GLint arraySize;
+
+	// Last value sent, in Program::uniformValues
+	u32 valueOffset;
+	u32 valueSize;
+	u32 sentSize;       // bytes of the value GL is known to hold, 0 until the first set
+};
+
+struct ProgramBlock
+{
+	std::string name;
+	GLint binding;
+	GLint dataSize;
+};
+
+struct Program
+{
+    GLuint             handle;
+    std::string        filepath;
+    std::string        programName;
+    u64                lastWriteTimestamp; // What is this for?
+	VertexShaderLayout vertexInputLayout;
+
+	std::vector<ProgramUniform> uniforms;
+	std::vector<ProgramBlock>   uniformBlocks;
+	std::vector<ProgramBlock>   storageBlocks;
+	std::vector<u8>             uniformValues;
+};
+
+struct UniformStats
+{
+	u32 sent;
+	u32 elided;  // sets dropped because the uniform already held the value
+};
+
+// Fills the uniforms, blocks and vertex input layout of a linked program
+void ReflectProgram(Program& program);
+
+UniformHandle FindUniform(const Program& program, const char* name);
+
+// Moves the counters to the last frame stats
+void BeginUniformStatsFrame();
+
+// Counters of the previous frame
+UniformStats GetUniformStats();
+
+void SetUniform1i(Program& program, UniformHandle uniform, i32 value);
+void SetUniform1ui(Program& program, UniformHandle uniform, u32 value);
+void SetUniform1f(Program& program, UniformHandle uniform, float value);
+void SetUniform2f(Program& program, UniformHandle uniform, const glm::vec2& value);
+void SetUniform3f(Program& program, UniformHandle uniform, const glm::vec3& value);
+void SetUniformMatrix4f(Program& program, UniformHandle uniform, const glm::mat4& value);
+void SetUniform1fv(Program& program, UniformHandle uniform, u32 count, const float* values);
+void SetUniform4fv(Program& program, UniformHandle uniform, u32 count, const glm::vec4* values);
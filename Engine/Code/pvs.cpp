@@ -0,0 +1,395 @@
+#include "pvs.h"
+#include "engine.h"
+#include <map>
+#include <float.h>
+
+#define PVS_FILE_MAGIC 0x31535650 // "PVS1"
+
+struct PVSFileHeader
+{
+	u32 magic;
+	u32 entityCount;
+	u64 sceneHash;
+	glm::vec3 gridOrigin;
+	float cellSize;
+	u32 cellCountX;
+	u32 cellCountY;
+	u32 cellCountZ;
+	u32 setCount;
+};
+
+// Shared by the cell tasks of a bake
+struct PVSBake
+{
+	App* app;
+	float farPlane;
+	std::vector<u64> cellBits; // wordsPerSet words per cell
+};
+
+static const glm::vec3 CubeFaceDirections[6] = {
+	{ 1.0f, 0.0f, 0.0f }, { -1.0f, 0.0f, 0.0f }, { 0.0f, 1.0f, 0.0f },
+	{ 0.0f, -1.0f, 0.0f }, { 0.0f, 0.0f, 1.0f }, { 0.0f, 0.0f, -1.0f }
+};
+
+static const glm::vec3 CubeFaceUps[6] = {
+	{ 0.0f, 1.0f, 0.0f }, { 0.0f, 1.0f, 0.0f }, { 0.0f, 0.0f, 1.0f },
+	{ 0.0f, 0.0f, 1.0f }, { 0.0f, 1.0f, 0.0f }, { 0.0f, 1.0f, 0.0f }
+};
+
+// FNV-1a over the bounds of the first entityCount entities, tells whether a bake still matches the scene
+static u64 HashEntityBounds(App* app, u32 entityCount)
+{
+	u64 hash = 14695981039346656037ull;
+	const u8* bytes = (const u8*)app->entityBounds.data();
+	for (u32 i = 0; i < entityCount * sizeof(AABB); ++i)
+	{
+		hash ^= bytes[i];
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
+
+static AABB CellBounds(const PVS& pvs, u32 cell)
+{
+	const u32 x = cell % pvs.cellCountX;
+	const u32 y = (cell / pvs.cellCountX) % pvs.cellCountY;
+	const u32 z = cell / (pvs.cellCountX * pvs.cellCountY);
+
+	AABB bounds;
+	bounds.min = pvs.gridOrigin + vec3((float)x, (float)y, (float)z) * pvs.cellSize;
+	bounds.max = bounds.min + vec3(pvs.cellSize);
+	return bounds;
+}
+
+static bool Overlap(const AABB& a, const AABB& b)
+{
+	return a.min.x <= b.max.x && a.max.x >= b.min.x && a.min.y <= b.max.y && a.max.y >= b.min.y && a.min.z <= b.max.z && a.max.z >= b.min.z;
+}
+
+// Distance from the point to the closest point of the box, 0 inside
+static float DistanceToBox(const AABB& box, const vec3& point)
+{
+	return glm::length(glm::max(glm::max(box.min - point, point - box.max), vec3(0.0f)));
+}
+
+// Distance from the point to the farthest corner of the box
+static float FarthestDistanceToBox(const AABB& box, const vec3& point)
+{
+	return glm::length(glm::max(glm::abs(box.min - point), glm::abs(box.max - point)));
+}
+
+static bool IsBoxInFrustum(const glm::vec4 planes[6], const AABB& box)
+{
+	// The corner farthest along the normal has to be inside every plane
+	for (u32 i = 0; i < 6; ++i)
+	{
+		const vec3 corner(planes[i].x > 0.0f ? box.max.x : box.min.x, planes[i].y > 0.0f ? box.max.y : box.min.y, planes[i].z > 0.0f ? box.max.z : box.min.z);
+		if (glm::dot(vec3(planes[i]), corner) + planes[i].w < 0.0f)
+			return false;
+	}
+	return true;
+}
+
+// Job: the set of one cell
+static void BakeCell(void* userData, u32 cell)
+{
+	PVSBake& bake = *(PVSBake*)userData;
+	App* app = bake.app;
+	const PVS& pvs = app->pvs;
+	u64* bits = &bake.cellBits[cell * pvs.wordsPerSet];
+
+	const AABB cellBounds = CellBounds(pvs, cell);
+
+	// Entities touching the cell can be right in front of the camera
+	for (u32 e = 0; e < pvs.entityCount; ++e)
+		if (Overlap(cellBounds, app->entityBounds[e]))
+			bits[e / 64] |= 1ull << (e % 64);
+
+	MaskedDepthBuffer depth;
+	InitMaskedDepthBuffer(depth);
+
+	std::vector<u32> inFrustum;
+	std::vector<u32> candidates;
+	std::vector<u32> occluders;
+	const glm::mat4 projection = glm::perspective(glm::radians(90.0f), 1.0f, app->camera.nearPlane, bake.farPlane);
+
+	// A grid of eyes from corner to corner, faces included. Any point of the cell is within reach of
+	// one of them: from there the boxes are shifted by up to that much, so they are tested grown by
+	// it, and an occluder at distance z turns by up to reach / (z - reach) radians, so the tested
+	// rectangles are widened by as much. The nearest occluders would widen them the most, they are
+	// left out.
+	const float sampleSpacing = pvs.cellSize / (PVS_SAMPLES_PER_AXIS - 1);
+	const float sampleReach = 0.5f * sampleSpacing * sqrtf(3.0f);
+	const u32 sampleCount = PVS_SAMPLES_PER_AXIS * PVS_SAMPLES_PER_AXIS * PVS_SAMPLES_PER_AXIS;
+	const vec2 halfScreen = 0.5f * vec2(SOFTWARE_DEPTH_WIDTH, SOFTWARE_DEPTH_HEIGHT);
+
+	for (u32 s = 0; s < sampleCount; ++s)
+	{
+		const vec3 sample((float)(s % PVS_SAMPLES_PER_AXIS), (float)((s / PVS_SAMPLES_PER_AXIS) % PVS_SAMPLES_PER_AXIS), (float)(s / (PVS_SAMPLES_PER_AXIS * PVS_SAMPLES_PER_AXIS)));
+		const vec3 eye = cellBounds.min + sample * sampleSpacing;
+
+		for (u32 f = 0; f < 6; ++f)
+		{
+			const glm::mat4 viewProjection = projection * glm::lookAt(eye, eye + CubeFaceDirections[f], CubeFaceUps[f]);
+
+			glm::vec4 planes[6];
+			ExtractFrustumPlanes(viewProjection, planes);
+			CullBVH(app->entityBVH, planes, inFrustum);
+
+			// What touches the cell may enclose the eye, it does not occlude
+			candidates.clear();
+			for (u32 i = 0; i < inFrustum.size(); ++i)
+			{
+				const AABB& bounds = app->entityBounds[inFrustum[i]];
+				if (!Overlap(cellBounds, bounds) && DistanceToBox(bounds, eye) >= PVS_OCCLUDER_MIN_DISTANCE)
+					candidates.push_back(inFrustum[i]);
+			}
+
+			SelectOccluders(app, candidates, eye, app->camera.nearPlane, occluders);
+			ClearMaskedDepthBuffer(depth, 0, SOFTWARE_TILES_Y);
+			float nearestOccluder = FLT_MAX;
+			for (u32 o = 0; o < occluders.size(); ++o)
+			{
+				const Entity& entity = app->entities[occluders[o]];
+				const Mesh& mesh = app->meshes[app->models[entity.modelIndex].meshIdx];
+				RasterizeOccluder(depth, viewProjection * entity.worldMatrix, mesh.occluderTriangles, 0, SOFTWARE_TILES_Y);
+				nearestOccluder = glm::min(nearestOccluder, DistanceToBox(app->entityBounds[occluders[o]], eye));
+			}
+
+			const float parallax = occluders.empty() ? 0.0f : sampleReach / (nearestOccluder - sampleReach);
+
+			for (u32 e = 0; e < pvs.entityCount; ++e)
+			{
+				if (bits[e / 64] & (1ull << (e % 64)))
+					continue;
+
+				AABB grown = app->entityBounds[e];
+				grown.min -= vec3(sampleReach);
+				grown.max += vec3(sampleReach);
+
+				// Widened, boxes just outside the face can show through the occluders in it
+				const float reach = FarthestDistanceToBox(grown, eye) * parallax;
+				const AABB reached = { grown.min - vec3(reach), grown.max + vec3(reach) };
+				if (!IsBoxInFrustum(planes, reached))
+					continue;
+
+				ScreenRect rect;
+				if (!ProjectBox(viewProjection, grown, rect))
+				{
+					bits[e / 64] |= 1ull << (e % 64);
+					continue;
+				}
+
+				// Turning a direction by an angle moves its projection by up to 1 + x^2 + y^2 times
+				// as much, x and y being the farthest normalized device coordinates of the rectangle
+				// on screen
+				const vec2 extent = glm::min(glm::max(glm::abs(vec2(rect.minX, rect.minY) / halfScreen - 1.0f), glm::abs(vec2(rect.maxX, rect.maxY) / halfScreen - 1.0f)), vec2(1.0f));
+				const vec2 margin = parallax * (1.0f + glm::dot(extent, extent)) * halfScreen;
+				rect.minX -= margin.x; rect.maxX += margin.x;
+				rect.minY -= margin.y; rect.maxY += margin.y;
+				if (IsRectOnScreen(rect) && !IsRectOccluded(depth, rect))
+					bits[e / 64] |= 1ull << (e % 64);
+			}
+		}
+	}
+}
+
+void BakePVS(App* app, const char* filepath)
+{
+	const f64 startTime = GetTime();
+	PVS& pvs = app->pvs;
+
+	// Grid over the scene, with room to fly above it
+	AABB scene = { vec3(FLT_MAX), vec3(-FLT_MAX) };
+	for (u32 e = 0; e < app->entityBounds.size(); ++e)
+		scene = MergeAABB(scene, app->entityBounds[e]);
+	scene.max.y += PVS_HEIGHT_ABOVE_SCENE;
+
+	const vec3 extent = scene.max - scene.min;
+	pvs.gridOrigin = scene.min;
+	pvs.cellSize = PVS_CELL_SIZE;
+	pvs.cellCountX = glm::max((u32)ceilf(extent.x / PVS_CELL_SIZE), 1u);
+	pvs.cellCountY = glm::max((u32)ceilf(extent.y / PVS_CELL_SIZE), 1u);
+	pvs.cellCountZ = glm::max((u32)ceilf(extent.z / PVS_CELL_SIZE), 1u);
+	pvs.entityCount = app->entities.size();
+	pvs.sceneHash = HashEntityBounds(app, pvs.entityCount);
+	pvs.wordsPerSet = (pvs.entityCount + 63) / 64;
+
+	const u32 cellCount = pvs.cellCountX * pvs.cellCountY * pvs.cellCountZ;
+
+	PVSBake bake = {};
+	bake.app = app;
+	bake.farPlane = glm::length(extent) + PVS_CELL_SIZE;
+	bake.cellBits.assign(cellCount * pvs.wordsPerSet, 0);
+
+	JobCounter cells;
+	RunJobs(BakeCell, &bake, cellCount, &cells);
+	WaitForJobs(&cells);
+
+	// Cells with the same set point to one copy of it
+	std::map<std::vector<u64>, u32> setIndices;
+	pvs.cellSets.resize(cellCount);
+	pvs.sets.clear();
+
+	for (u32 cell = 0; cell < cellCount; ++cell)
+	{
+		const std::vector<u64> bits(bake.cellBits.begin() + cell * pvs.wordsPerSet, bake.cellBits.begin() + (cell + 1) * pvs.wordsPerSet);
+
+		std::map<std::vector<u64>, u32>::iterator it = setIndices.find(bits);
+		if (it == setIndices.end())
+		{
+			it = setIndices.insert({ bits, (u32)setIndices.size() }).first;
+			pvs.sets.insert(pvs.sets.end(), bits.begin(), bits.end());
+		}
+		pvs.cellSets[cell] = it->second;
+	}
+
+	pvs.loaded = true;
+
+	PVSFileHeader header = {};
+	header.magic = PVS_FILE_MAGIC;
+	header.entityCount = pvs.entityCount;
+	header.sceneHash = pvs.sceneHash;
+	header.gridOrigin = pvs.gridOrigin;
+	header.cellSize = pvs.cellSize;
+	header.cellCountX = pvs.cellCountX;
+	header.cellCountY = pvs.cellCountY;
+	header.cellCountZ = pvs.cellCountZ;
+	header.setCount = setIndices.size();
+
+	FILE* file = fopen(filepath, "wb");
+	if (!file)
+	{
+		ELOG("fopen() failed writing file %s", filepath);
+		return;
+	}
+
+	fwrite(&header, sizeof(header), 1, file);
+	fwrite(pvs.cellSets.data(), sizeof(u32), pvs.cellSets.size(), file);
+	fwrite(pvs.sets.data(), sizeof(u64), pvs.sets.size(), file);
+	fclose(file);
+
+	ILOG("PVS baked in %.1f s: %u cells, %u distinct sets, %u bytes written to %s", GetTime() - startTime, cellCount, header.setCount,
+		(u32)(sizeof(header) + pvs.cellSets.size() * sizeof(u32) + pvs.sets.size() * sizeof(u64)), filepath);
+}
+
+bool LoadPVS(App* app, const char* filepath)
+{
+	PVS& pvs = app->pvs;
+	pvs.loaded = false;
+
+	FILE* file = fopen(filepath, "rb");
+	if (!file)
+		return false;
+
+	PVSFileHeader header = {};
+	if (fread(&header, sizeof(header), 1, file) != 1 || header.magic != PVS_FILE_MAGIC)
+	{
+		ELOG("%s is not a PVS file", filepath);
+		fclose(file);
+		return false;
+	}
+
+	if (header.entityCount > app->entityBounds.size() || header.sceneHash != HashEntityBounds(app, header.entityCount))
+	{
+		ELOG("%s was baked for another scene, bake it again with --bake-pvs", filepath);
+		fclose(file);
+		return false;
+	}
+
+	// The counts size everything below, they have to match the file before anything is allocated
+	fseek(file, 0, SEEK_END);
+	const u64 fileSize = (u64)ftell(file);
+	fseek(file, sizeof(header), SEEK_SET);
+
+	const u64 cellCount = (u64)header.cellCountX * header.cellCountY * header.cellCountZ;
+	const u64 wordsPerSet = (header.entityCount + 63) / 64;
+	const u64 expectedSize = sizeof(header) + cellCount * sizeof(u32) + (u64)header.setCount * wordsPerSet * sizeof(u64);
+	if (cellCount == 0 || cellCount > UINT32_MAX || header.setCount == 0 || !(header.cellSize > 0.0f) || fileSize != expectedSize)
+	{
+		ELOG("%s is corrupt: %llu bytes for %llu cells and %u sets", filepath, (unsigned long long)fileSize, (unsigned long long)cellCount, header.setCount);
+		fclose(file);
+		return false;
+	}
+
+	pvs.gridOrigin = header.gridOrigin;
+	pvs.cellSize = header.cellSize;
+	pvs.cellCountX = header.cellCountX;
+	pvs.cellCountY = header.cellCountY;
+	pvs.cellCountZ = header.cellCountZ;
+	pvs.entityCount = header.entityCount;
+	pvs.sceneHash = header.sceneHash;
+	pvs.wordsPerSet = (header.entityCount + 63) / 64;
+
+	pvs.cellSets.resize(header.cellCountX * header.cellCountY * header.cellCountZ);
+	pvs.sets.resize(header.setCount * pvs.wordsPerSet);
+
+	const bool complete = fread(pvs.cellSets.data(), sizeof(u32), pvs.cellSets.size(), file) == pvs.cellSets.size()
+		&& fread(pvs.sets.data(), sizeof(u64), pvs.sets.size(), file) == pvs.sets.size();
+	fclose(file);
+
+	if (!complete)
+	{
+		ELOG("%s is truncated", filepath);
+		return false;
+	}
+
+	for (u32 cell = 0; cell < pvs.cellSets.size(); ++cell)
+	{
+		if (pvs.cellSets[cell] >= header.setCount)
+		{
+			ELOG("%s is corrupt: cell %u uses set %u of %u", filepath, cell, pvs.cellSets[cell], header.setCount);
+			return false;
+		}
+	}
+
+	pvs.loaded = true;
+	return true;
+}
+
+bool CullEntitiesPVS(App* app)
+{
+	PVS& pvs = app->pvs;
+	pvs.cameraCell = PVS_INVALID_CELL;
+	pvs.potentiallyVisible = 0;
+
+	if (!pvs.loaded)
+		return false;
+
+	const vec3 cellCoords = glm::floor((app->camera.position - pvs.gridOrigin) / pvs.cellSize);
+	if (cellCoords.x < 0.0f || cellCoords.y < 0.0f || cellCoords.z < 0.0f ||
+		cellCoords.x >= pvs.cellCountX || cellCoords.y >= pvs.cellCountY || cellCoords.z >= pvs.cellCountZ)
+		return false;
+
+	pvs.cameraCell = (u32)cellCoords.x + pvs.cellCountX * ((u32)cellCoords.y + pvs.cellCountY * (u32)cellCoords.z);
+	const u64* bits = &pvs.sets[pvs.cellSets[pvs.cameraCell] * pvs.wordsPerSet];
+
+	app->visibleEntities.clear();
+
+	for (u32 w = 0; w < pvs.wordsPerSet; ++w)
+	{
+		if (bits[w] == 0)
+			continue;
+
+		for (u32 bit = 0; bit < 64; ++bit)
+		{
+			if (!(bits[w] & (1ull << bit)))
+				continue;
+
+			const u32 e = w * 64 + bit;
+			pvs.potentiallyVisible++;
+			if (IsBoxInFrustum(app->camera.frustumPlanes, app->entityBounds[e]))
+				app->visibleEntities.push_back(e);
+		}
+	}
+
+	// Not baked, always potentially visible
+	for (u32 e = pvs.entityCount; e < app->entities.size(); ++e)
+	{
+		pvs.potentiallyVisible++;
+		if (IsBoxInFrustum(app->camera.frustumPlanes, app->entityBounds[e]))
+			app->visibleEntities.push_back(e);
+	}
+
+	return true;
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include "platform.h"
+#include "geometry.h"
+
+// Potentially visible sets: the space around the scene is divided in a grid of view cells, and
+// every cell stores the entities that can be seen from somewhere inside it as a bitset. While the
+// camera is in a cell, only the entities of its set are frustum culled and queued.
+//
+// BakePVS computes the sets offline, run the engine with --bake-pvs to write PVS_FILENAME. From a
+// grid of PVS_SAMPLES_PER_AXIS^3 points spanning each cell, faces and corners included, the six
+// faces of a cube are rendered with the software occlusion rasterizer (see software_occlusion.h),
+// and whatever box is not hidden in one of them joins the set, as well as the entities touching
+// the cell. The boxes are tested grown by the distance from any point of the cell to the closest
+// sample, and their projections widened by how much the occluders turn over that distance, so
+// what can be seen from between the samples is in the set too. Occluders closer than
+// PVS_OCCLUDER_MIN_DISTANCE to a sample are not used, they would turn too much to hide anything.
+// Cells sharing the same set store it once.
+//
+// The baked entities are taken as static. The file keeps a hash of their bounds and is ignored if
+// the scene changed since; entities added after the bake are always potentially visible.
+
+struct App;
+
+#define PVS_FILENAME              "scene.pvs"
+#define PVS_CELL_SIZE             8.0f
+#define PVS_SAMPLES_PER_AXIS      8     // eyes per cell along each axis, at least 2
+#define PVS_HEIGHT_ABOVE_SCENE    16.0f // cells go this high over the top of the scene
+#define PVS_OCCLUDER_MIN_DISTANCE 3.0f  // from a sample, more than half the diagonal between samples
+#define PVS_INVALID_CELL          0xFFFFFFFF
+
+struct PVS
+{
+	bool loaded;
+
+	// Grid of cells, x first, then y, then z
+	glm::vec3 gridOrigin;
+	float cellSize;
+	u32 cellCountX;
+	u32 cellCountY;
+	u32 cellCountZ;
+
+	u32 entityCount; // entities at bake time
+	u64 sceneHash;   // of their bounds
+
+	u32 wordsPerSet;
+	std::vector<u32> cellSets; // set of every cell
+	std::vector<u64> sets;     // wordsPerSet words per distinct set, bit e for entity e
+
+	// Stats of the last frame
+	u32 cameraCell;
+	u32 potentiallyVisible;
+};
+
+// Bakes the sets of the current scene and writes them to filepath
+void BakePVS(App* app, const char* filepath);
+
+// Reads the sets baked for the current scene, false if missing or out of date
+bool LoadPVS(App* app, const char* filepath);
+
+// Fills app->visibleEntities with the entities in the set of the camera cell that are inside the
+// frustum. False if there is no set for where the camera is, the caller has to cull on its own.
+bool CullEntitiesPVS(App* app);
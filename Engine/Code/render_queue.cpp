@@ -0,0 +1,93 @@
+#include "render_queue.h"
+
+static u64 KeyField(u32 value, u32 bits)
+{
+	ASSERT(value < (1u << bits), "Render key field out of range");
+	return (u64)(value & ((1u << bits) - 1));
+}
+
+u64 MakeRenderKey(u32 pass, u32 pool, u32 material, u32 mesh, float depth)
+{
+	const u32 maxDepth = (1u << RENDER_KEY_DEPTH_BITS) - 1;
+	const u32 quantizedDepth = (u32)(glm::clamp(depth, 0.0f, 1.0f) * maxDepth);
+
+	u64 key = KeyField(pass, RENDER_KEY_PASS_BITS);
+	key = (key << RENDER_KEY_POOL_BITS) | KeyField(pool, RENDER_KEY_POOL_BITS);
+	key = (key << RENDER_KEY_MATERIAL_BITS) | KeyField(material, RENDER_KEY_MATERIAL_BITS);
+	key = (key << RENDER_KEY_MESH_BITS) | KeyField(mesh, RENDER_KEY_MESH_BITS);
+	key = (key << RENDER_KEY_DEPTH_BITS) | quantizedDepth;
+	return key;
+}
+
+u64 RenderKeyDrawState(u64 key)
+{
+	return key >> RENDER_KEY_DEPTH_BITS;
+}
+
+void ClearRenderQueue(RenderQueue& queue)
+{
+	queue.items.clear();
+}
+
+void PushRenderItem(RenderQueue& queue, u64 key, u32 entity, u32 submesh)
+{
+	queue.items.push_back({ key, entity, submesh });
+}
+
+void SortRenderQueue(RenderQueue& queue)
+{
+	std::vector<RenderItem>& items = queue.items;
+	if (items.size() < 2)
+		return;
+
+	std::vector<RenderItem>& scratch = queue.scratch;
+	scratch.resize(items.size());
+
+	for (u32 shift = 0; shift < 64; shift += 8)
+	{
+		u32 offsets[256] = {};
+		for (u32 i = 0; i < items.size(); ++i)
+			offsets[(items[i].key >> shift) & 0xff]++;
+
+		// The unused high fields and the shared ones cost nothing
+		if (offsets[(items[0].key >> shift) & 0xff] == items.size())
+			continue;
+
+		u32 offset = 0;
+		for (u32 digit = 0; digit < 256; ++digit)
+		{
+			const u32 count = offsets[digit];
+			offsets[digit] = offset;
+			offset += count;
+		}
+
+		for (u32 i = 0; i < items.size(); ++i)
+			scratch[offsets[(items[i].key >> shift) & 0xff]++] = items[i];
+
+		items.swap(scratch);
+	}
+}
+
+u32 CountStateChanges(const RenderQueue& queue)
+{
+	// Each field is a separate bind: program, VAO, texture and mesh range
+	const u32 fieldBits[] = { RENDER_KEY_MESH_BITS, RENDER_KEY_MATERIAL_BITS, RENDER_KEY_POOL_BITS, RENDER_KEY_PASS_BITS };
+
+	u32 changes = 0;
+	for (u32 i = 1; i < queue.items.size(); ++i)
+	{
+		u64 previous = RenderKeyDrawState(queue.items[i - 1].key);
+		u64 current = RenderKeyDrawState(queue.items[i].key);
+
+		for (u32 f = 0; f < ARRAY_COUNT(fieldBits); ++f)
+		{
+			const u64 mask = (1ull << fieldBits[f]) - 1;
+			if ((previous & mask) != (current & mask))
+				changes++;
+
+			previous >>= fieldBits[f];
+			current >>= fieldBits[f];
+		}
+	}
+	return changes;
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include "platform.h"
+
+// Render queue: every entity submesh becomes an item with a 64-bit sort key, the queue is radix
+// sorted each frame and consecutive items sharing everything but the depth become one instanced
+// indirect command. Most significant fields first:
+//
+//   pass (2) | geometry pool / VAO (8) | material (12) | mesh (20) | depth (22)
+//
+// The program is chosen per pass, so the pass bits also separate programs. Depth is the distance
+// to the camera, so within a mesh the instances are drawn front to back for early-Z rejection.
+
+#define RENDER_KEY_DEPTH_BITS    22
+#define RENDER_KEY_MESH_BITS     20
+#define RENDER_KEY_MATERIAL_BITS 12
+#define RENDER_KEY_POOL_BITS     8
+#define RENDER_KEY_PASS_BITS     2
+
+#define RENDER_PASS_OPAQUE 0
+
+struct RenderItem
+{
+	u64 key;
+	u32 entity;
+	u32 submesh;
+};
+
+struct RenderQueue
+{
+	std::vector<RenderItem> items;
+	std::vector<RenderItem> scratch;
+
+	// Pass, VAO, material and mesh changes between consecutive items, as submitted and once sorted
+	u32 stateChangesUnsorted;
+	u32 stateChangesSorted;
+};
+
+// depth is normalized to [0, 1], mesh identifies the model and submesh
+u64 MakeRenderKey(u32 pass, u32 pool, u32 material, u32 mesh, float depth);
+
+// Items sharing a draw state key only differ in their depth
+u64 RenderKeyDrawState(u64 key);
+
+void ClearRenderQueue(RenderQueue& queue);
+
+void PushRenderItem(RenderQueue& queue, u64 key, u32 entity, u32 submesh);
+
+// Stable LSD radix sort by key, 8 bits per pass, passes where every key has the same digit are skipped
+void SortRenderQueue(RenderQueue& queue);
+
+u32 CountStateChanges(const RenderQueue& queue);
@@ -0,0 +1,427 @@
+#include "software_occlusion.h"
+#include "engine.h"
+#include <xmmintrin.h>
+#include <algorithm>
+#include <float.h>
+
+// Boxes tested per job
+#define OCCLUSION_TEST_GRAIN 32
+
+// Entities whose bounding sphere looks smaller than this (radius over distance) do not occlude
+#define OCCLUDER_MIN_SCREEN_SIZE 0.05f
+
+#define FULL_TILE_COVERAGE 0xFFFFFFFF
+
+void BuildOccluderTriangles(Mesh& mesh, u32 maxTriangles)
+{
+	struct Triangle
+	{
+		float area;
+		u32 submesh;
+		u32 firstIndex;
+	};
+
+	std::vector<Triangle> triangles;
+	for (u32 s = 0; s < mesh.submeshes.size(); ++s)
+	{
+		const Submesh& submesh = mesh.submeshes[s];
+		const u32 floatsPerVertex = submesh.vertexBufferLayout.stride / sizeof(float);
+
+		for (u32 i = 0; i + 2 < submesh.indices.size(); i += 3)
+		{
+			const vec3 a = glm::make_vec3(&submesh.vertices[submesh.indices[i + 0] * floatsPerVertex]);
+			const vec3 b = glm::make_vec3(&submesh.vertices[submesh.indices[i + 1] * floatsPerVertex]);
+			const vec3 c = glm::make_vec3(&submesh.vertices[submesh.indices[i + 2] * floatsPerVertex]);
+			triangles.push_back({ glm::length(glm::cross(b - a, c - a)), s, i });
+		}
+	}
+
+	const u32 keptCount = glm::min(maxTriangles, (u32)triangles.size());
+	std::partial_sort(triangles.begin(), triangles.begin() + keptCount, triangles.end(),
+		[](const Triangle& a, const Triangle& b) { return a.area > b.area; });
+
+	mesh.occluderTriangles.clear();
+	for (u32 t = 0; t < keptCount; ++t)
+	{
+		const Submesh& submesh = mesh.submeshes[triangles[t].submesh];
+		const u32 floatsPerVertex = submesh.vertexBufferLayout.stride / sizeof(float);
+
+		for (u32 i = 0; i < 3; ++i)
+			mesh.occluderTriangles.push_back(glm::make_vec3(&submesh.vertices[submesh.indices[triangles[t].firstIndex + i] * floatsPerVertex]));
+	}
+}
+
+// Merges a triangle into a tile, farthest being the farthest 1/w of the triangle over the tile
+static void UpdateTile(MaskedDepthBuffer& depth, u32 tile, float farthest, u32 coverage)
+{
+	float& reference = depth.referenceDepth[tile];
+	float& working = depth.workingDepth[tile];
+
+	// A triangle much nearer than the working layer, compared to the distance between both layers,
+	// starts a new one; merging it would push it back to the depth of the old triangles
+	if (farthest - working > working - reference)
+	{
+		working = FLT_MAX;
+		depth.coverage[tile] = 0;
+	}
+
+	working = glm::min(working, farthest);
+	depth.coverage[tile] |= coverage;
+
+	if (depth.coverage[tile] == FULL_TILE_COVERAGE)
+	{
+		reference = glm::max(reference, working);
+		working = FLT_MAX;
+		depth.coverage[tile] = 0;
+	}
+}
+
+// Rasterizes a triangle in front of the near plane into the tile rows [firstTileRow, endTileRow)
+static void RasterizeTriangle(MaskedDepthBuffer& depth, const glm::vec4 clip[3], u32 firstTileRow, u32 endTileRow)
+{
+	// Pixel coordinates with y up, depth as 1/w
+	vec3 v[3];
+	for (u32 i = 0; i < 3; ++i)
+	{
+		const float invW = 1.0f / clip[i].w;
+		v[i] = vec3((clip[i].x * invW * 0.5f + 0.5f) * SOFTWARE_DEPTH_WIDTH, (clip[i].y * invW * 0.5f + 0.5f) * SOFTWARE_DEPTH_HEIGHT, invW);
+	}
+
+	// Counter clockwise, both faces are drawn as the geometry pass does not cull them either
+	float area = (v[1].x - v[0].x) * (v[2].y - v[0].y) - (v[2].x - v[0].x) * (v[1].y - v[0].y);
+	if (area < 0.0f)
+	{
+		std::swap(v[1], v[2]);
+		area = -area;
+	}
+	if (area < 1e-6f)
+		return;
+
+	const float minX = glm::min(v[0].x, glm::min(v[1].x, v[2].x));
+	const float maxX = glm::max(v[0].x, glm::max(v[1].x, v[2].x));
+	const float minY = glm::min(v[0].y, glm::min(v[1].y, v[2].y));
+	const float maxY = glm::max(v[0].y, glm::max(v[1].y, v[2].y));
+
+	if (maxX < 0.0f || minX >= SOFTWARE_DEPTH_WIDTH || maxY < (float)(firstTileRow * SOFTWARE_TILE_HEIGHT) || minY >= (float)(endTileRow * SOFTWARE_TILE_HEIGHT))
+		return;
+
+	const u32 firstTileX = (u32)glm::max(minX, 0.0f) / SOFTWARE_TILE_WIDTH;
+	const u32 lastTileX = (u32)glm::min(maxX, SOFTWARE_DEPTH_WIDTH - 1.0f) / SOFTWARE_TILE_WIDTH;
+	const u32 firstTileY = glm::max((u32)glm::max(minY, 0.0f) / SOFTWARE_TILE_HEIGHT, firstTileRow);
+	const u32 lastTileY = glm::min((u32)glm::min(maxY, SOFTWARE_DEPTH_HEIGHT - 1.0f) / SOFTWARE_TILE_HEIGHT, endTileRow - 1);
+
+	// Edge functions A * x + B * y + C, positive inside
+	__m128 edgeA[3], edgeB[3], edgeC[3];
+	for (u32 i = 0; i < 3; ++i)
+	{
+		const vec3& a = v[i];
+		const vec3& b = v[(i + 1) % 3];
+		const float A = a.y - b.y;
+		const float B = b.x - a.x;
+		edgeA[i] = _mm_set1_ps(A);
+		edgeB[i] = _mm_set1_ps(B);
+		edgeC[i] = _mm_set1_ps(-(A * a.x + B * a.y));
+	}
+
+	// 1/w is linear in screen space; the farthest over a tile is at one of its corners, and never
+	// farther than the farthest vertex
+	const float dzdx = ((v[1].z - v[0].z) * (v[2].y - v[0].y) - (v[2].z - v[0].z) * (v[1].y - v[0].y)) / area;
+	const float dzdy = ((v[2].z - v[0].z) * (v[1].x - v[0].x) - (v[1].z - v[0].z) * (v[2].x - v[0].x)) / area;
+	const float farthestVertex = glm::min(v[0].z, glm::min(v[1].z, v[2].z));
+	const float tileFarthestOffset = glm::min(dzdx * SOFTWARE_TILE_WIDTH, 0.0f) + glm::min(dzdy * SOFTWARE_TILE_HEIGHT, 0.0f);
+
+	const __m128 laneOffsets = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+	const __m128 zero = _mm_setzero_ps();
+
+	for (u32 ty = firstTileY; ty <= lastTileY; ++ty)
+	{
+		for (u32 tx = firstTileX; tx <= lastTileX; ++tx)
+		{
+			const float x0 = (float)(tx * SOFTWARE_TILE_WIDTH);
+			const float y0 = (float)(ty * SOFTWARE_TILE_HEIGHT);
+
+			// Pixel centers of the first row, four at a time
+			const __m128 px = _mm_add_ps(_mm_set1_ps(x0), laneOffsets);
+			const __m128 py = _mm_set1_ps(y0 + 0.5f);
+			__m128 edge[3], stepX[3];
+			for (u32 i = 0; i < 3; ++i)
+			{
+				edge[i] = _mm_add_ps(_mm_add_ps(_mm_mul_ps(edgeA[i], px), _mm_mul_ps(edgeB[i], py)), edgeC[i]);
+				stepX[i] = _mm_mul_ps(edgeA[i], _mm_set1_ps(4.0f));
+			}
+
+			u32 coverage = 0;
+			for (u32 row = 0; row < SOFTWARE_TILE_HEIGHT; ++row)
+			{
+				for (u32 half = 0; half < 2; ++half)
+				{
+					__m128 e0 = edge[0], e1 = edge[1], e2 = edge[2];
+					if (half == 1)
+					{
+						e0 = _mm_add_ps(e0, stepX[0]);
+						e1 = _mm_add_ps(e1, stepX[1]);
+						e2 = _mm_add_ps(e2, stepX[2]);
+					}
+
+					const __m128 inside = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(e0, zero), _mm_cmpge_ps(e1, zero)), _mm_cmpge_ps(e2, zero));
+					coverage |= (u32)_mm_movemask_ps(inside) << (row * SOFTWARE_TILE_WIDTH + half * 4);
+				}
+
+				for (u32 i = 0; i < 3; ++i)
+					edge[i] = _mm_add_ps(edge[i], edgeB[i]);
+			}
+
+			if (coverage == 0)
+				continue;
+
+			const float cornerDepth = v[0].z + dzdx * (x0 - v[0].x) + dzdy * (y0 - v[0].y);
+			UpdateTile(depth, ty * SOFTWARE_TILES_X + tx, glm::max(cornerDepth + tileFarthestOffset, farthestVertex), coverage);
+		}
+	}
+}
+
+// Clips the triangle against the near plane (z > -w) and rasterizes what is left
+static void RasterizeClipTriangle(MaskedDepthBuffer& depth, const glm::vec4 clip[3], u32 firstTileRow, u32 endTileRow)
+{
+	// Outside one of the side or far planes as a whole
+	for (u32 axis = 0; axis < 3; ++axis)
+	{
+		if (clip[0][axis] > clip[0].w && clip[1][axis] > clip[1].w && clip[2][axis] > clip[2].w)
+			return;
+		if (axis < 2 && clip[0][axis] < -clip[0].w && clip[1][axis] < -clip[1].w && clip[2][axis] < -clip[2].w)
+			return;
+	}
+
+	float distances[3];
+	u32 insideCount = 0;
+	for (u32 i = 0; i < 3; ++i)
+	{
+		distances[i] = clip[i].z + clip[i].w;
+		insideCount += distances[i] > 0.0f ? 1 : 0;
+	}
+
+	if (insideCount == 3)
+	{
+		RasterizeTriangle(depth, clip, firstTileRow, endTileRow);
+		return;
+	}
+	if (insideCount == 0)
+		return;
+
+	// Sutherland-Hodgman, one plane leaves a triangle or a quad
+	glm::vec4 polygon[4];
+	u32 polygonCount = 0;
+	for (u32 i = 0; i < 3; ++i)
+	{
+		const u32 j = (i + 1) % 3;
+		if (distances[i] > 0.0f)
+			polygon[polygonCount++] = clip[i];
+		if ((distances[i] > 0.0f) != (distances[j] > 0.0f))
+			polygon[polygonCount++] = glm::mix(clip[i], clip[j], distances[i] / (distances[i] - distances[j]));
+	}
+
+	for (u32 i = 1; i + 1 < polygonCount; ++i)
+	{
+		const glm::vec4 triangle[3] = { polygon[0], polygon[i], polygon[i + 1] };
+		RasterizeTriangle(depth, triangle, firstTileRow, endTileRow);
+	}
+}
+
+void InitMaskedDepthBuffer(MaskedDepthBuffer& depth)
+{
+	// Padded so the box test can load four tiles from the last one
+	const u32 tileCount = SOFTWARE_TILES_X * SOFTWARE_TILES_Y;
+	depth.referenceDepth.resize(tileCount + 3, 0.0f);
+	depth.workingDepth.resize(tileCount);
+	depth.coverage.resize(tileCount);
+}
+
+void ClearMaskedDepthBuffer(MaskedDepthBuffer& depth, u32 firstTileRow, u32 endTileRow)
+{
+	const u32 firstTile = firstTileRow * SOFTWARE_TILES_X;
+	const u32 endTile = endTileRow * SOFTWARE_TILES_X;
+	std::fill(depth.referenceDepth.begin() + firstTile, depth.referenceDepth.begin() + endTile, 0.0f);
+	std::fill(depth.workingDepth.begin() + firstTile, depth.workingDepth.begin() + endTile, FLT_MAX);
+	std::fill(depth.coverage.begin() + firstTile, depth.coverage.begin() + endTile, 0);
+}
+
+void RasterizeOccluder(MaskedDepthBuffer& depth, const glm::mat4& worldViewProjection, const std::vector<glm::vec3>& triangles, u32 firstTileRow, u32 endTileRow)
+{
+	for (u32 t = 0; t < triangles.size(); t += 3)
+	{
+		const glm::vec4 clip[3] = {
+			worldViewProjection * glm::vec4(triangles[t + 0], 1.0f),
+			worldViewProjection * glm::vec4(triangles[t + 1], 1.0f),
+			worldViewProjection * glm::vec4(triangles[t + 2], 1.0f)
+		};
+		RasterizeClipTriangle(depth, clip, firstTileRow, endTileRow);
+	}
+}
+
+void SelectOccluders(App* app, const std::vector<u32>& entities, const glm::vec3& viewPosition, float nearPlane, std::vector<u32>& occluders)
+{
+	// The entities looking the largest from the view position
+	std::vector<std::pair<float, u32>> candidates;
+	for (u32 v = 0; v < entities.size(); ++v)
+	{
+		const u32 e = entities[v];
+		const Entity& entity = app->entities[e];
+		const Mesh& mesh = app->meshes[app->models[entity.modelIndex].meshIdx];
+		if (mesh.occluderTriangles.empty())
+			continue;
+
+		const float scale = glm::max(glm::length(vec3(entity.worldMatrix[0])), glm::max(glm::length(vec3(entity.worldMatrix[1])), glm::length(vec3(entity.worldMatrix[2]))));
+		const float radius = mesh.boundingSphere.radius * scale;
+		const vec3 center = vec3(entity.worldMatrix * glm::vec4(mesh.boundingSphere.center, 1.0f));
+		const float distance = glm::max(glm::length(center - viewPosition) - radius, nearPlane);
+
+		const float screenSize = radius / distance;
+		if (screenSize >= OCCLUDER_MIN_SCREEN_SIZE)
+			candidates.push_back({ screenSize, e });
+	}
+
+	const u32 occluderCount = glm::min((u32)candidates.size(), (u32)MAX_OCCLUDERS);
+	std::partial_sort(candidates.begin(), candidates.begin() + occluderCount, candidates.end(),
+		[](const std::pair<float, u32>& a, const std::pair<float, u32>& b) { return a.first > b.first; });
+
+	occluders.clear();
+	for (u32 i = 0; i < occluderCount; ++i)
+		occluders.push_back(candidates[i].second);
+}
+
+// Job: clears the tiles of a band and rasterizes every occluder into them
+static void RasterizeBand(void* userData, u32 band)
+{
+	App* app = (App*)userData;
+	SoftwareOcclusion& occlusion = app->softwareOcclusion;
+
+	const u32 tileRowsPerBand = SOFTWARE_TILES_Y / SOFTWARE_BAND_COUNT;
+	const u32 firstTileRow = band * tileRowsPerBand;
+	const u32 endTileRow = firstTileRow + tileRowsPerBand;
+
+	ClearMaskedDepthBuffer(occlusion.depth, firstTileRow, endTileRow);
+
+	for (u32 o = 0; o < occlusion.occluders.size(); ++o)
+	{
+		const Entity& entity = app->entities[occlusion.occluders[o]];
+		const Mesh& mesh = app->meshes[app->models[entity.modelIndex].meshIdx];
+		RasterizeOccluder(occlusion.depth, occlusion.viewProjection * entity.worldMatrix, mesh.occluderTriangles, firstTileRow, endTileRow);
+	}
+
+	occlusion.bandEndTime[band] = GetTime();
+}
+
+void BeginOcclusionRasterization(App* app)
+{
+	SoftwareOcclusion& occlusion = app->softwareOcclusion;
+
+	if (occlusion.depth.referenceDepth.empty())
+		InitMaskedDepthBuffer(occlusion.depth);
+
+	SelectOccluders(app, app->visibleEntities, app->camera.position, app->camera.nearPlane, occlusion.occluders);
+
+	occlusion.occluderTriangles = 0;
+	for (u32 i = 0; i < occlusion.occluders.size(); ++i)
+	{
+		const Entity& entity = app->entities[occlusion.occluders[i]];
+		occlusion.occluderTriangles += app->meshes[app->models[entity.modelIndex].meshIdx].occluderTriangles.size() / 3;
+	}
+
+	occlusion.viewProjection = app->camera.projectionMatrix * app->camera.viewMatrix;
+	occlusion.startTime = GetTime();
+	RunJobs(RasterizeBand, app, SOFTWARE_BAND_COUNT, &occlusion.rasterization);
+}
+
+bool ProjectBox(const glm::mat4& viewProjection, const AABB& box, ScreenRect& rect)
+{
+	rect.minX = FLT_MAX; rect.maxX = -FLT_MAX;
+	rect.minY = FLT_MAX; rect.maxY = -FLT_MAX;
+	rect.nearest = 0.0f;
+
+	for (u32 i = 0; i < 8; ++i)
+	{
+		const vec3 corner((i & 1) ? box.max.x : box.min.x, (i & 2) ? box.max.y : box.min.y, (i & 4) ? box.max.z : box.min.z);
+		const glm::vec4 clip = viewProjection * glm::vec4(corner, 1.0f);
+
+		// Crossing the near plane, the camera may well be inside
+		if (clip.z + clip.w <= 0.0f)
+			return false;
+
+		const float invW = 1.0f / clip.w;
+		const float x = (clip.x * invW * 0.5f + 0.5f) * SOFTWARE_DEPTH_WIDTH;
+		const float y = (clip.y * invW * 0.5f + 0.5f) * SOFTWARE_DEPTH_HEIGHT;
+		rect.minX = glm::min(rect.minX, x); rect.maxX = glm::max(rect.maxX, x);
+		rect.minY = glm::min(rect.minY, y); rect.maxY = glm::max(rect.maxY, y);
+		rect.nearest = glm::max(rect.nearest, invW);
+	}
+
+	return true;
+}
+
+bool IsRectOnScreen(const ScreenRect& rect)
+{
+	return rect.maxX >= 0.0f && rect.minX < SOFTWARE_DEPTH_WIDTH && rect.maxY >= 0.0f && rect.minY < SOFTWARE_DEPTH_HEIGHT;
+}
+
+// A rectangle is hidden if it is behind the reference layer of every tile it touches
+bool IsRectOccluded(const MaskedDepthBuffer& depth, const ScreenRect& rect)
+{
+	const u32 firstTileX = (u32)glm::max(rect.minX, 0.0f) / SOFTWARE_TILE_WIDTH;
+	const u32 lastTileX = (u32)glm::min(rect.maxX, SOFTWARE_DEPTH_WIDTH - 1.0f) / SOFTWARE_TILE_WIDTH;
+	const u32 firstTileY = (u32)glm::max(rect.minY, 0.0f) / SOFTWARE_TILE_HEIGHT;
+	const u32 lastTileY = (u32)glm::min(rect.maxY, SOFTWARE_DEPTH_HEIGHT - 1.0f) / SOFTWARE_TILE_HEIGHT;
+
+	const __m128 boxDepth = _mm_set1_ps(rect.nearest);
+
+	for (u32 ty = firstTileY; ty <= lastTileY; ++ty)
+	{
+		for (u32 tx = firstTileX; tx <= lastTileX; tx += 4)
+		{
+			// Lanes past the last tile of the row are ignored
+			const u32 laneMask = (1u << glm::min(lastTileX - tx + 1, 4u)) - 1;
+			const __m128 reference = _mm_loadu_ps(&depth.referenceDepth[ty * SOFTWARE_TILES_X + tx]);
+			if (_mm_movemask_ps(_mm_cmpge_ps(boxDepth, reference)) & laneMask)
+				return false;
+		}
+	}
+
+	return true;
+}
+
+bool IsBoxOccluded(const MaskedDepthBuffer& depth, const glm::mat4& viewProjection, const AABB& box)
+{
+	ScreenRect rect;
+	if (!ProjectBox(viewProjection, box, rect) || !IsRectOnScreen(rect))
+		return false;
+
+	return IsRectOccluded(depth, rect);
+}
+
+void CullOccludedEntities(App* app)
+{
+	SoftwareOcclusion& occlusion = app->softwareOcclusion;
+
+	WaitForJobs(&occlusion.rasterization);
+
+	f64 endTime = occlusion.startTime;
+	for (u32 band = 0; band < SOFTWARE_BAND_COUNT; ++band)
+		endTime = glm::max(endTime, occlusion.bandEndTime[band]);
+	occlusion.rasterizeMilliseconds = (f32)((endTime - occlusion.startTime) * 1000.0);
+
+	const f64 testStartTime = GetTime();
+
+	occlusion.occludedFlags.resize(app->visibleEntities.size());
+	ParallelFor(app->visibleEntities.size(), OCCLUSION_TEST_GRAIN, [app, &occlusion](u32 v) {
+		occlusion.occludedFlags[v] = IsBoxOccluded(occlusion.depth, occlusion.viewProjection, app->entityBounds[app->visibleEntities[v]]);
+	});
+
+	u32 visibleCount = 0;
+	for (u32 v = 0; v < app->visibleEntities.size(); ++v)
+		if (!occlusion.occludedFlags[v])
+			app->visibleEntities[visibleCount++] = app->visibleEntities[v];
+
+	occlusion.occludedEntities = app->visibleEntities.size() - visibleCount;
+	app->visibleEntities.resize(visibleCount);
+
+	occlusion.testMilliseconds = (f32)((GetTime() - testStartTime) * 1000.0);
+}
@@ -0,0 +1,102 @@
+#pragma once
+
+#include "platform.h"
+#include "geometry.h"
+
+// Masked software occlusion culling (Hasselgren, Andersson and Munkberg): the largest entities in
+// the frustum are rasterized on the CPU into a coarse depth buffer, and the boxes of the other
+// entities are tested against it before they reach the render queue. Everything happens in the
+// same frame, there is no readback latency.
+//
+// The buffer is made of 8x4 pixel tiles. Instead of a depth per pixel a tile keeps two layers: a
+// reference depth covering the whole tile, and a working layer with a coverage mask and the
+// farthest depth of the triangles merged into it. When the working layer covers the tile it
+// becomes the reference. Depths are 1/w, so farther is smaller and cleared tiles hold 0.
+//
+// Occluders are drawn with the largest triangles of their mesh (see BuildOccluderTriangles), a
+// subset of the real surface, so the buffer never claims more than the mesh hides.
+//
+// The screen is split in horizontal bands rasterized by jobs while Update() goes on
+// with the lights; CullOccludedEntities waits for them and tests the boxes with SSE.
+
+struct App;
+
+#define SOFTWARE_DEPTH_WIDTH  320
+#define SOFTWARE_DEPTH_HEIGHT 192
+#define SOFTWARE_TILE_WIDTH   8
+#define SOFTWARE_TILE_HEIGHT  4
+#define SOFTWARE_TILES_X      (SOFTWARE_DEPTH_WIDTH / SOFTWARE_TILE_WIDTH)
+#define SOFTWARE_TILES_Y      (SOFTWARE_DEPTH_HEIGHT / SOFTWARE_TILE_HEIGHT)
+#define SOFTWARE_BAND_COUNT   8 // SOFTWARE_TILES_Y has to be a multiple
+
+#define OCCLUDER_MAX_TRIANGLES 256 // per mesh
+#define MAX_OCCLUDERS          32  // per frame
+
+// Tile layers side by side, so the box test loads four tiles at once
+struct MaskedDepthBuffer
+{
+	std::vector<float> referenceDepth; // farthest 1/w of the tile
+	std::vector<float> workingDepth;   // farthest 1/w of the triangles in the working layer
+	std::vector<u32>   coverage;       // pixels of the working layer, bit x + 8 * y
+};
+
+struct SoftwareOcclusion
+{
+	MaskedDepthBuffer depth;
+
+	// Input of the bands, set before they start
+	glm::mat4 viewProjection;
+	std::vector<u32> occluders; // entities
+	JobCounter rasterization;
+
+	std::vector<u8> occludedFlags; // per entity tested
+
+	// Stats of the last frame
+	f64 startTime;
+	f64 bandEndTime[SOFTWARE_BAND_COUNT];
+	u32 occluderTriangles;
+	u32 occludedEntities;
+	f32 rasterizeMilliseconds; // from the start of the bands to the last one finished
+	f32 testMilliseconds;
+};
+
+void InitMaskedDepthBuffer(MaskedDepthBuffer& depth);
+
+// Resets the tile rows [firstTileRow, endTileRow) to the far plane
+void ClearMaskedDepthBuffer(MaskedDepthBuffer& depth, u32 firstTileRow, u32 endTileRow);
+
+// Rasterizes the triangles (see Mesh::occluderTriangles) into the tile rows [firstTileRow, endTileRow)
+void RasterizeOccluder(MaskedDepthBuffer& depth, const glm::mat4& worldViewProjection, const std::vector<glm::vec3>& triangles, u32 firstTileRow, u32 endTileRow);
+
+// Pixels covered by a projected box, and its nearest 1/w
+struct ScreenRect
+{
+	float minX;
+	float maxX;
+	float minY;
+	float maxY;
+	float nearest;
+};
+
+// Whether the box, in world space, is behind the depth rasterized with viewProjection
+bool IsBoxOccluded(const MaskedDepthBuffer& depth, const glm::mat4& viewProjection, const AABB& box);
+
+// Bounds of the box on screen, false if it crosses the near plane
+bool ProjectBox(const glm::mat4& viewProjection, const AABB& box, ScreenRect& rect);
+
+bool IsRectOnScreen(const ScreenRect& rect);
+
+// Whether the rectangle, which has to touch the screen, is behind the reference layer of every tile under it
+bool IsRectOccluded(const MaskedDepthBuffer& depth, const ScreenRect& rect);
+
+// The entities looking the largest from the view position, at most MAX_OCCLUDERS
+void SelectOccluders(App* app, const std::vector<u32>& entities, const glm::vec3& viewPosition, float nearPlane, std::vector<u32>& occluders);
+
+// Keeps the largest triangles of the mesh, in model space, as its occluder (Mesh::occluderTriangles)
+void BuildOccluderTriangles(Mesh& mesh, u32 maxTriangles);
+
+// Picks the occluders among app->visibleEntities and starts the jobs rasterizing them
+void BeginOcclusionRasterization(App* app);
+
+// Waits for the rasterization and removes the entities it hides from app->visibleEntities
+void CullOccludedEntities(App* app);
@@ -55,36 +55,39 @@ void main()
 // MESH SHADER		------ DEPRECATED ---------
 // ---------------------------------------------------------------------------------------------------------------------------------------------------------------------------
 
-#ifdef SHOW_TEXTURED_MESH
+#if defined(SHOW_TEXTURED_MESH) || defined(SHOW_TEXTURED_MESH_CLUSTERED)
 
 #if defined(VERTEX) ///////////////////////////////////////////////////
 
-struct Light {
-	unsigned int type; 
-	vec3 position;
-	vec3 color; 
-	vec3 direction;
-	unsigned int intensity;
-};
-
 layout(binding = 0, std140) uniform GlobalParams
 {
 	vec3 uCameraPosition;
-	unsigned int uLightCount; 
-	Light uLights[150];
-};
-
-layout(binding = 1, std140) uniform LocalParams
-{
-	mat4 uWorldMatrix;
-	mat4 uWorldViewProjectionMatrix;
+	unsigned int uVisiblePointLightCount;
+	unsigned int uDirectionalLightCount;
+	mat4 uViewProjection;
 };
 
 layout(location = 0) in vec3 aPosition;
 layout(location = 1) in vec3 aNormal;
 layout(location = 2) in vec2 aTexCoord;
+layout(location = 5) in uint aObjectIndex; // per instance
+
+struct Object
+{
+	vec4 worldRows[3]; // affine world matrix, rows of the upper 3x4
+	uint materialIndex; // albedo array layer
+	uint flags;
+	uint padding0;
+	uint padding1;
+};
+
+layout(binding = 5, std430) readonly buffer Objects
+{
+	Object uObjects[];
+};
 
 out vec2 vTexCoord;
+flat out uint vAlbedoLayer;
 out vec3 vPosition; // in worldspace
 out vec3 vNormal; // in worldspace
 out vec3 viewDir;
@@ -92,10 +95,13 @@ out vec3 viewDir;
 void main()
 {
 	vTexCoord = aTexCoord;
-	vPosition = vec3(uWorldMatrix * vec4(aPosition, 1.0));
-	vNormal = vec3(uWorldMatrix * vec4(aNormal, 0.0));
+	Object object = uObjects[aObjectIndex];
+	mat3x4 worldRows = mat3x4(object.worldRows[0], object.worldRows[1], object.worldRows[2]);
+	vAlbedoLayer = object.materialIndex;
+	vPosition = vec4(aPosition, 1.0) * worldRows;
+	vNormal = vec4(aNormal, 0.0) * worldRows;
 	viewDir = uCameraPosition - vPosition;
-	gl_Position = uWorldViewProjectionMatrix * vec4(aPosition, 1.0);
+	gl_Position = uViewProjection * vec4(vPosition, 1.0);
 
 	//float clippingScale = 5.0;
 
@@ -107,43 +113,116 @@ void main()
 #elif defined(FRAGMENT) ///////////////////////////////////////////////
 
 in vec2 vTexCoord;
+flat in uint vAlbedoLayer;
 in vec3 vPosition; // in worldspace
 in vec3 vNormal; // in worldspace
 in vec3 viewDir; 
 
-uniform sampler2D uTexture;
+uniform sampler2DArray uAlbedoArray;
 uniform float bright_color_threshold; 
 vec3 lightThreshold = vec3(0.2126, 0.7152, 0.0722);
 
-struct Light {
-	unsigned int type; 
+struct PointLight {
 	vec3 position;
-	vec3 color; 
+	float intensity;
+	vec3 color;
+	float radius;
+};
+
+struct DirectionalLight {
 	vec3 direction;
-	unsigned int intensity;
+	float intensity;
+	vec3 color;
+	float padding;
 };
 
 layout(binding = 0, std140) uniform GlobalParams
 {
 	vec3 uCameraPosition;
-	unsigned int uLightCount; 
-	Light uLights[150];
+	unsigned int uVisiblePointLightCount;
+	unsigned int uDirectionalLightCount;
+	mat4 uViewProjection;
 };
 
+layout(binding = 2, std430) readonly buffer PointLights
+{
+	PointLight uPointLights[];
+};
+
+// Indices of the point lights that survived the CPU frustum culling
+layout(binding = 4, std430) readonly buffer VisiblePointLights
+{
+	uint uVisiblePointLights[];
+};
+
+layout(binding = 3, std430) readonly buffer DirectionalLights
+{
+	DirectionalLight uDirectionalLights[];
+};
+
+#if defined(SHOW_TEXTURED_MESH_CLUSTERED)
+
+#define CLUSTER_GRID_X 16
+#define CLUSTER_GRID_Y 9
+#define CLUSTER_GRID_Z 24
+#define MAX_LIGHTS_PER_CLUSTER 128
+
+layout(binding = 0, std430) readonly buffer ClusterLightCounts
+{
+	uint uClusterLightCount[];
+};
+
+layout(binding = 1, std430) readonly buffer ClusterLightIndices
+{
+	uint uClusterLightIndices[];
+};
+
+uniform vec2 uScreenSize;
+uniform float uNear;
+uniform float uFar;
+uniform float uClusterScale;
+uniform float uClusterBias;
+
+uint GetClusterIndex()
+{
+	// Linear view space depth of the fragment
+	float z = gl_FragCoord.z * 2.0 - 1.0;
+	float depth = (2.0 * uNear * uFar) / (uFar + uNear - z * (uFar - uNear));
+
+	uint slice = uint(clamp(floor(log(depth) * uClusterScale - uClusterBias), 0.0, float(CLUSTER_GRID_Z - 1)));
+	uvec2 tile = uvec2(clamp(gl_FragCoord.xy / uScreenSize * vec2(CLUSTER_GRID_X, CLUSTER_GRID_Y), vec2(0.0), vec2(CLUSTER_GRID_X - 1, CLUSTER_GRID_Y - 1)));
+
+	return tile.x + tile.y * uint(CLUSTER_GRID_X) + slice * uint(CLUSTER_GRID_X * CLUSTER_GRID_Y);
+}
+
+#endif
+
 
 layout(location = 0) out vec4 FragColor;
 layout(location = 1) out vec4 BrightColor;
 
-vec3 CalculateLighting(Light light, vec3 normal, vec3 viewDir, vec3 frag_pos);
+vec3 CalculatePointLight(PointLight light, vec3 normal, vec3 view_dir, vec3 frag_pos);
+vec3 CalculateDirectionalLight(DirectionalLight light, vec3 normal, vec3 view_dir);
 
 void main()
 {
 	vec3 lightColorInfluence = vec3(0.0);
 	
-	for(int i = 0; i < uLightCount; ++i)
-		lightColorInfluence += CalculateLighting(uLights[i], vNormal, viewDir, vPosition);
+#if defined(SHOW_TEXTURED_MESH_CLUSTERED)
+	// Only the lights assigned to this fragment's cluster
+	uint cluster = GetClusterIndex();
+	uint clusterLightCount = uClusterLightCount[cluster];
+	for (uint i = 0u; i < clusterLightCount; ++i)
+		lightColorInfluence += CalculatePointLight(uPointLights[uClusterLightIndices[cluster * uint(MAX_LIGHTS_PER_CLUSTER) + i]], vNormal, viewDir, vPosition);
+#else
+	for(uint i = 0u; i < uVisiblePointLightCount; ++i)
+		lightColorInfluence += CalculatePointLight(uPointLights[uVisiblePointLights[i]], vNormal, viewDir, vPosition);
+#endif
 
-	FragColor = texture(uTexture, vTexCoord) * vec4(lightColorInfluence, 1.0);
+	for(uint i = 0u; i < uDirectionalLightCount; ++i)
+		lightColorInfluence += CalculateDirectionalLight(uDirectionalLights[i], vNormal, viewDir);
+
+	FragColor = texture(uAlbedoArray, vec3(vTexCoord, float(vAlbedoLayer))) * vec4(lightColorInfluence, 1.0);
 
 	float brightness = dot(FragColor.rgb, lightThreshold) * bright_color_threshold;
     if(brightness > 1.0)
@@ -152,10 +231,9 @@ void main()
         BrightColor = vec4(0.0, 0.0, 0.0, 1.0);
 }
 
-vec3 CalculateDirectionalLight(Light light, vec3 normal, vec3 view_dir)
+vec3 CalculateDirectionalLight(DirectionalLight light, vec3 normal, vec3 view_dir)
 {
-	float intensity = float(light.intensity);
-	intensity *= 0.01;
+	float intensity = light.intensity;
 	// Diffuse 
 	vec3 lightDirection = normalize(-light.direction);
 	float diff = max(dot(lightDirection, normal), 0.0);
@@ -170,11 +248,13 @@ vec3 CalculateDirectionalLight(Light light, vec3 normal, vec3 view_dir)
 	return result;
 }
 
-vec3 CalculatePointLight(Light light, vec3 normal, vec3 view_dir, vec3 frag_pos)
+vec3 CalculatePointLight(PointLight light, vec3 normal, vec3 view_dir, vec3 frag_pos)
 {
+	float distance = length(light.position - frag_pos);
+	if (distance >= light.radius)
+		return vec3(0.0);
 
-	float intensity = float(light.intensity);
-	intensity *= 0.01;
+	float intensity = light.intensity;
 
 	// Diffuse 
 	vec3 lightDirection = normalize(light.position - frag_pos);
@@ -186,9 +266,10 @@ vec3 CalculatePointLight(Light light, vec3 normal, vec3 view_dir, vec3 frag_pos)
     float spec = pow(max(dot(normal, halfwayDir), 0.0), 128.0);
 	vec3 specular = light.color * spec * intensity;
 
-	// Attenuation
- 	float distance = length(light.position - frag_pos);
-    float attenuation = 1.0 / (1.0 + 0.3 * distance + 0.5 * (distance * distance));    
+	// Attenuation, windowed so the contribution reaches zero at the light radius
+    float attenuation = 1.0 / (1.0 + 0.3 * distance + 0.5 * (distance * distance));
+	float window = clamp(1.0 - pow(distance / light.radius, 4.0), 0.0, 1.0);
+	attenuation *= window * window;
 
 	diffuse *= attenuation;
     specular *= attenuation;
@@ -198,213 +279,1102 @@ vec3 CalculatePointLight(Light light, vec3 normal, vec3 view_dir, vec3 frag_pos)
 }
 
 
-vec3 CalculateLighting(Light light, vec3 normal, vec3 view_dir, vec3 frag_pos)
+
+#endif
+#endif
+
+// ---------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+// GEOMETRY PASS SHADER
+// ---------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+
+#ifdef GEOMETRY_PASS_SHADER_COMPACT
+
+#if defined(VERTEX) ///////////////////////////////////////////////////
+
+layout(binding = 0, std140) uniform GlobalParams
 {
+	vec3 uCameraPosition;
+	unsigned int uVisiblePointLightCount;
+	unsigned int uDirectionalLightCount;
+	mat4 uViewProjection;
+};
 
-	vec3 result = vec3(0.0);
+layout(location = 0) in vec3 aPosition;
+layout(location = 1) in vec3 aNormal;
+layout(location = 2) in vec2 aTexCoord;
+layout(location = 5) in uint aObjectIndex; // per instance
 
-	switch(light.type)
-	{
-		case 0: 
-			result = CalculatePointLight(light, normal, view_dir, frag_pos);
-			break;
-		case 1:
-			result = CalculateDirectionalLight(light, normal, view_dir);
-			break;
+struct Object
+{
+	vec4 worldRows[3]; // affine world matrix, rows of the upper 3x4
+	uint materialIndex; // albedo array layer
+	uint flags;
+	uint padding0;
+	uint padding1;
+};
 
-		default: break;
-	}
+layout(binding = 5, std430) readonly buffer Objects
+{
+	Object uObjects[];
+};
 
-	return result;
+out vec2 vTexCoord;
+flat out uint vAlbedoLayer;
+out vec3 vPosition; // in worldspace
+out vec3 vNormal; // in worldspace
+
+
+void main()
+{
+	vTexCoord = aTexCoord;
+	Object object = uObjects[aObjectIndex];
+	mat3x4 worldRows = mat3x4(object.worldRows[0], object.worldRows[1], object.worldRows[2]);
+	vAlbedoLayer = object.materialIndex;
+	vPosition = vec4(aPosition, 1.0) * worldRows;
+	vNormal = vec4(aNormal, 0.0) * worldRows;
+	gl_Position = uViewProjection * vec4(vPosition, 1.0);
+
+	//float clippingScale = 5.0;
+
+	//gl_Position = vec4(aPosition, clippingScale);
+
+	//gl_Position.z = -gl_Position.z;
 }
 
+#elif defined(FRAGMENT) ///////////////////////////////////////////////
+
+in vec2 vTexCoord;
+flat in uint vAlbedoLayer;
+in vec3 vPosition; // in worldspace
+in vec3 vNormal; // in worldspace
+
+uniform sampler2DArray uAlbedoArray;
+
+layout(location = 0) out vec4 gAlbedoSpec;
+layout(location = 1) out vec2 gNormal;
+
+// Octahedral normal encoding, mapped to [0, 1] for the RG16 target
+vec2 OctahedralEncode(vec3 n)
+{
+	n /= (abs(n.x) + abs(n.y) + abs(n.z));
+	vec2 e = n.z >= 0.0 ? n.xy : (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+	return e * 0.5 + 0.5;
+}
+
+void main()
+{
+	gAlbedoSpec = vec4(texture(uAlbedoArray, vec3(vTexCoord, float(vAlbedoLayer))).rgb, 1.0);
+	gNormal = OctahedralEncode(normalize(vNormal));
+}
 
 #endif
 #endif
 
 // ---------------------------------------------------------------------------------------------------------------------------------------------------------------------------
-// GEOMETRY PASS SHADER
+// SHADING PASS SHADER
 // ---------------------------------------------------------------------------------------------------------------------------------------------------------------------------
 
-#ifdef GEOMETRY_PASS_SHADER
+#ifdef SHADING_PASS_SHADER_COMPACT
 
 #if defined(VERTEX) ///////////////////////////////////////////////////
 
-struct Light {
-	unsigned int type; 
+layout(binding = 0, std140) uniform GlobalParams
+{
+	vec3 uCameraPosition;
+	unsigned int uVisiblePointLightCount;
+	unsigned int uDirectionalLightCount;
+	mat4 uViewProjection;
+};
+
+layout(location = 0) in vec3 aPosition;
+layout(location = 1) in vec3 aNormal;
+layout(location = 2) in vec2 aTexCoord;
+
+out vec2 vTexCoord;
+
+void main()
+{
+	vTexCoord = aTexCoord;
+	gl_Position = vec4(aPosition, 1.0);
+}
+
+#elif defined(FRAGMENT) ///////////////////////////////////////////////
+
+
+struct PointLight {
 	vec3 position;
-	vec3 color; 
+	float intensity;
+	vec3 color;
+	float radius;
+};
+
+struct DirectionalLight {
 	vec3 direction;
-	unsigned int intensity;
+	float intensity;
+	vec3 color;
+	float padding;
 };
 
 layout(binding = 0, std140) uniform GlobalParams
 {
 	vec3 uCameraPosition;
-	unsigned int uLightCount; 
-	Light uLights[150];
+	unsigned int uVisiblePointLightCount;
+	unsigned int uDirectionalLightCount;
+	mat4 uViewProjection;
+};
+
+layout(binding = 2, std430) readonly buffer PointLights
+{
+	PointLight uPointLights[];
+};
+
+// Indices of the point lights that survived the CPU frustum culling
+layout(binding = 4, std430) readonly buffer VisiblePointLights
+{
+	uint uVisiblePointLights[];
 };
 
-layout(binding = 1, std140) uniform LocalParams
+layout(binding = 3, std430) readonly buffer DirectionalLights
 {
-	mat4 uWorldMatrix;
-	mat4 uWorldViewProjectionMatrix;
+	DirectionalLight uDirectionalLights[];
 };
 
+in vec2 vTexCoord;
+
+uniform sampler2D gNormal;
+uniform sampler2D gAlbedoSpec;
+uniform sampler2D gDepthStencil;
+uniform mat4 uInverseViewProjection;
+
+vec3 OctahedralDecode(vec2 e)
+{
+	e = e * 2.0 - 1.0;
+	vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+	float t = max(-n.z, 0.0);
+	n.x += n.x >= 0.0 ? -t : t;
+	n.y += n.y >= 0.0 ? -t : t;
+	return normalize(n);
+}
+
+// World position of the pixel from the hardware depth
+vec3 ReconstructPosition(vec2 texCoord, float depth)
+{
+	vec4 position = uInverseViewProjection * vec4(vec3(texCoord, depth) * 2.0 - 1.0, 1.0);
+	return position.xyz / position.w;
+}
+
+uniform float bright_color_threshold; 
+vec3 lightThreshold = vec3(0.2126, 0.7152, 0.0722);
+
+layout(location = 0) out vec4 FragColor;
+layout(location = 1) out vec4 BrightColor;
+
+vec3 CalculatePointLight(PointLight light, vec3 normal, vec3 view_dir, vec3 frag_pos, vec3 pixelColor);
+vec3 CalculateDirectionalLight(DirectionalLight light, vec3 normal, vec3 view_dir, vec3 pixelColor);
+
+void main()
+{
+	// retrieve data from gbuffer
+	float depth = texture(gDepthStencil, vTexCoord).r;
+	if (depth == 1.0)
+	{
+		// Nothing was drawn here
+		FragColor = vec4(0.0, 0.0, 0.0, 1.0);
+		BrightColor = vec4(0.0, 0.0, 0.0, 1.0);
+		return;
+	}
+
+	vec3 FragPos = ReconstructPosition(vTexCoord, depth);
+	vec3 Normal = OctahedralDecode(texture(gNormal, vTexCoord).rg);
+    vec3 Diffuse = texture(gAlbedoSpec, vTexCoord).rgb;
+    float Specular = 0;
+
+	vec3 viewDir  = normalize(uCameraPosition - FragPos);
+
+    vec3 lighting  = vec3(0.0);
+    for(uint i = 0u; i < uVisiblePointLightCount; ++i)
+		lighting += CalculatePointLight(uPointLights[uVisiblePointLights[i]], Normal, viewDir, FragPos, Diffuse);
+    for(uint i = 0u; i < uDirectionalLightCount; ++i)
+		lighting += CalculateDirectionalLight(uDirectionalLights[i], Normal, viewDir, Diffuse);
+
+    FragColor = vec4(lighting, 1.0);
+
+	float brightness = dot(FragColor.rgb, lightThreshold) * bright_color_threshold;
+    if(brightness > 1.0)
+        BrightColor = vec4(FragColor.rgb, 1.0);
+    else
+        BrightColor = vec4(0.0, 0.0, 0.0, 1.0);
+}
+
+vec3 CalculateDirectionalLight(DirectionalLight light, vec3 normal, vec3 view_dir, vec3 pixelColor)
+{
+	float intensity = light.intensity;
+	// Diffuse 
+	vec3 lightDirection = normalize(-light.direction);
+	float diff = max(dot(lightDirection, normal), 0.0);
+	vec3 diffuse = light.color * diff * pixelColor *  intensity;
+
+	// Specular
+	vec3 halfwayDir = normalize(lightDirection + view_dir);
+	float spec = pow(max(dot(normal, halfwayDir), 0.0), 128.0);
+	vec3 specular = light.color * spec * intensity;
+
+	vec3 result = (diffuse + specular);
+	return result;
+}
+
+vec3 CalculatePointLight(PointLight light, vec3 normal, vec3 view_dir, vec3 frag_pos, vec3 pixelColor)
+{
+	float distance = length(light.position - frag_pos);
+	if (distance >= light.radius)
+		return vec3(0.0);
+
+	float intensity = light.intensity;
+
+	// Diffuse 
+	vec3 lightDirection = normalize(light.position - frag_pos);
+	float diff = max(dot(normal, lightDirection), 0.0);
+	vec3 diffuse = light.color * diff * pixelColor * intensity;
+
+	// Specular
+    vec3 halfwayDir = normalize(lightDirection + view_dir);  
+    float spec = pow(max(dot(normal, halfwayDir), 0.0), 128.0);
+	vec3 specular = light.color * spec * intensity;
+
+	// Attenuation, windowed so the contribution reaches zero at the light radius
+    float attenuation = 1.0 / (1.0 + 0.3 * distance + 0.5 * (distance * distance));
+	float window = clamp(1.0 - pow(distance / light.radius, 4.0), 0.0, 1.0);
+	attenuation *= window * window;
+
+	diffuse *= attenuation;
+    specular *= attenuation;
+
+	vec3 result = (diffuse + specular);
+	return result;
+}
+
+
+#endif
+#endif
+
+// ---------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+// GBUFFER DEBUG SHADER
+// ---------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+
+#ifdef GBUFFER_DEBUG_SHADER
+
+#if defined(VERTEX) ///////////////////////////////////////////////////
+
 layout(location = 0) in vec3 aPosition;
-layout(location = 1) in vec3 aNormal;
 layout(location = 2) in vec2 aTexCoord;
 
 out vec2 vTexCoord;
-out vec3 vPosition; // in worldspace
-out vec3 vNormal; // in worldspace
-
 
 void main()
 {
 	vTexCoord = aTexCoord;
-	vPosition = vec3(uWorldMatrix * vec4(aPosition, 1.0));
-	vNormal = vec3(uWorldMatrix * vec4(aNormal, 0.0));
-	gl_Position = uWorldViewProjectionMatrix * vec4(aPosition, 1.0);
+	gl_Position = vec4(aPosition, 1.0);
+}
 
-	//float clippingScale = 5.0;
+#elif defined(FRAGMENT) ///////////////////////////////////////////////
 
-	//gl_Position = vec4(aPosition, clippingScale);
+in vec2 vTexCoord;
 
-	//gl_Position.z = -gl_Position.z;
+uniform sampler2D gNormal;
+uniform sampler2D gDepthStencil;
+uniform mat4 uInverseViewProjection;
+uniform int uMode; // RenderTargetType: 1 position, 2 normals, 4 depth
+
+layout(location = 0) out vec4 FragColor;
+
+float near = 0.1;
+float far = 100.0;
+
+float LinearizeDepth(float depth)
+{
+	float z = depth * 2.0 - 1.0; // back to NDC 
+	return (2.0 * near * far) / (far + near - z * (far - near));
+}
+
+vec3 OctahedralDecode(vec2 e)
+{
+	e = e * 2.0 - 1.0;
+	vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+	float t = max(-n.z, 0.0);
+	n.x += n.x >= 0.0 ? -t : t;
+	n.y += n.y >= 0.0 ? -t : t;
+	return normalize(n);
+}
+
+// World position of the pixel from the hardware depth
+vec3 ReconstructPosition(vec2 texCoord, float depth)
+{
+	vec4 position = uInverseViewProjection * vec4(vec3(texCoord, depth) * 2.0 - 1.0, 1.0);
+	return position.xyz / position.w;
+}
+
+void main()
+{
+	float depth = texture(gDepthStencil, vTexCoord).r;
+
+	// Same output as the old G-Buffer targets, black where nothing was drawn
+	vec3 color = vec3(0.0);
+	if (depth < 1.0)
+	{
+		if (uMode == 1)
+			color = ReconstructPosition(vTexCoord, depth);
+		else if (uMode == 2)
+			color = OctahedralDecode(texture(gNormal, vTexCoord).rg);
+		else
+			color = vec3(LinearizeDepth(depth) / far); // divide by far for demonstration
+	}
+
+	FragColor = vec4(color, 1.0);
+}
+
+#endif
+#endif
+
+// ---------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+// TILED DEFERRED SHADING SHADER
+// ---------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+
+#ifdef TILED_DEFERRED_SHADING_SHADER
+
+#if defined(COMPUTE) ///////////////////////////////////////////////////
+
+#define TILE_SIZE 16
+#define TILE_THREADS (TILE_SIZE * TILE_SIZE)
+#define MAX_LIGHTS_PER_TILE 256
+
+layout(local_size_x = TILE_SIZE, local_size_y = TILE_SIZE) in;
+
+struct PointLight {
+	vec3 position;
+	float intensity;
+	vec3 color;
+	float radius;
+};
+
+struct DirectionalLight {
+	vec3 direction;
+	float intensity;
+	vec3 color;
+	float padding;
+};
+
+layout(binding = 0, std140) uniform GlobalParams
+{
+	vec3 uCameraPosition;
+	unsigned int uVisiblePointLightCount;
+	unsigned int uDirectionalLightCount;
+	mat4 uViewProjection;
+};
+
+layout(binding = 2, std430) readonly buffer PointLights
+{
+	PointLight uPointLights[];
+};
+
+// Indices of the point lights that survived the CPU frustum culling
+layout(binding = 4, std430) readonly buffer VisiblePointLights
+{
+	uint uVisiblePointLights[];
+};
+
+layout(binding = 3, std430) readonly buffer DirectionalLights
+{
+	DirectionalLight uDirectionalLights[];
+};
+
+uniform sampler2D gNormal;
+uniform sampler2D gAlbedoSpec;
+uniform sampler2D gDepthStencil;
+
+layout(binding = 0, rgba16f) uniform writeonly image2D outColor;
+layout(binding = 1, rgba16f) uniform writeonly image2D outBrightColor;
+
+uniform mat4 uView;
+uniform mat4 uInverseProjection;
+uniform mat4 uInverseViewProjection;
+
+uniform float bright_color_threshold; 
+vec3 lightThreshold = vec3(0.2126, 0.7152, 0.0722);
+
+shared uint tileMinDepth;
+shared uint tileMaxDepth;
+shared uint tileLightCount;
+shared uint tileLightIndices[MAX_LIGHTS_PER_TILE];
+
+vec3 UnprojectToView(vec2 ndc);
+vec3 CalculatePointLight(PointLight light, vec3 normal, vec3 view_dir, vec3 frag_pos, vec3 pixelColor);
+vec3 CalculateDirectionalLight(DirectionalLight light, vec3 normal, vec3 view_dir, vec3 pixelColor);
+
+vec3 OctahedralDecode(vec2 e)
+{
+	e = e * 2.0 - 1.0;
+	vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+	float t = max(-n.z, 0.0);
+	n.x += n.x >= 0.0 ? -t : t;
+	n.y += n.y >= 0.0 ? -t : t;
+	return normalize(n);
+}
+
+// World position of the pixel from the hardware depth
+vec3 ReconstructPosition(vec2 texCoord, float depth)
+{
+	vec4 position = uInverseViewProjection * vec4(vec3(texCoord, depth) * 2.0 - 1.0, 1.0);
+	return position.xyz / position.w;
+}
+
+void main()
+{
+	ivec2 screenSize = imageSize(outColor);
+	ivec2 pixel = ivec2(gl_GlobalInvocationID.xy);
+	bool insideScreen = pixel.x < screenSize.x && pixel.y < screenSize.y;
+
+	if (gl_LocalInvocationIndex == 0)
+	{
+		tileMinDepth = 0x7F7FFFFFu; // FLT_MAX
+		tileMaxDepth = 0u;
+		tileLightCount = 0u;
+	}
+	barrier();
+
+	// retrieve data from gbuffer
+	ivec2 texel = min(pixel, screenSize - 1);
+	float depth = texelFetch(gDepthStencil, texel, 0).r;
+	vec3 FragPos = ReconstructPosition((vec2(texel) + 0.5) / vec2(screenSize), depth);
+	vec3 Normal = OctahedralDecode(texelFetch(gNormal, texel, 0).rg);
+	vec3 Diffuse = texelFetch(gAlbedoSpec, texel, 0).rgb;
+
+	// Background pixels keep the cleared depth and don't bound the tile
+	bool isGeometry = insideScreen && depth < 1.0;
+
+	// Positive view space depths keep their order when compared as uints
+	if (isGeometry)
+	{
+		float viewDepth = max(-(uView * vec4(FragPos, 1.0)).z, 0.0);
+		atomicMin(tileMinDepth, floatBitsToUint(viewDepth));
+		atomicMax(tileMaxDepth, floatBitsToUint(viewDepth));
+	}
+	barrier();
+
+	float minDepth = uintBitsToFloat(tileMinDepth);
+	float maxDepth = uintBitsToFloat(tileMaxDepth);
+	bool tileHasGeometry = tileMaxDepth != 0u;
+
+	// Side planes of the tile frustum (view space, through the eye, pointing inwards)
+	vec2 tileMin = vec2(gl_WorkGroupID.xy * TILE_SIZE) / vec2(screenSize) * 2.0 - 1.0;
+	vec2 tileMax = vec2((gl_WorkGroupID.xy + 1u) * TILE_SIZE) / vec2(screenSize) * 2.0 - 1.0;
+
+	vec3 corners[4];
+	corners[0] = UnprojectToView(vec2(tileMin.x, tileMin.y));
+	corners[1] = UnprojectToView(vec2(tileMax.x, tileMin.y));
+	corners[2] = UnprojectToView(vec2(tileMax.x, tileMax.y));
+	corners[3] = UnprojectToView(vec2(tileMin.x, tileMax.y));
+	vec3 tileCenter = (corners[0] + corners[1] + corners[2] + corners[3]) * 0.25;
+
+	vec3 planes[4];
+	for (int i = 0; i < 4; ++i)
+	{
+		vec3 planeNormal = normalize(cross(corners[i], corners[(i + 1) % 4]));
+		planes[i] = dot(planeNormal, tileCenter) < 0.0 ? -planeNormal : planeNormal;
+	}
+
+	// Light culling: every thread of the tile tests a strided subset of the point lights
+	for (uint i = gl_LocalInvocationIndex; i < uVisiblePointLightCount && tileHasGeometry; i += uint(TILE_THREADS))
+	{
+		uint lightIndex = uVisiblePointLights[i];
+		float radius = uPointLights[lightIndex].radius;
+		vec3 center = (uView * vec4(uPointLights[lightIndex].position, 1.0)).xyz;
+
+		bool visible = (-center.z + radius >= minDepth) && (-center.z - radius <= maxDepth);
+		for (int p = 0; p < 4 && visible; ++p)
+			visible = dot(planes[p], center) >= -radius;
+
+		if (visible)
+		{
+			uint index = atomicAdd(tileLightCount, 1u);
+			if (index < uint(MAX_LIGHTS_PER_TILE))
+				tileLightIndices[index] = lightIndex;
+		}
+	}
+	barrier();
+
+	if (!insideScreen)
+		return;
+
+	vec3 viewDir = normalize(uCameraPosition - FragPos);
+
+	vec3 lighting = vec3(0.0);
+	if (isGeometry)
+	{
+		// A tile reached by more lights than its list holds goes through every visible light instead,
+		// the lights out of range return early
+		if (tileLightCount <= uint(MAX_LIGHTS_PER_TILE))
+		{
+			for (uint i = 0u; i < tileLightCount; ++i)
+				lighting += CalculatePointLight(uPointLights[tileLightIndices[i]], Normal, viewDir, FragPos, Diffuse);
+		}
+		else
+		{
+			for (uint i = 0u; i < uVisiblePointLightCount; ++i)
+				lighting += CalculatePointLight(uPointLights[uVisiblePointLights[i]], Normal, viewDir, FragPos, Diffuse);
+		}
+		for (uint i = 0u; i < uDirectionalLightCount; ++i)
+			lighting += CalculateDirectionalLight(uDirectionalLights[i], Normal, viewDir, Diffuse);
+	}
+
+	vec4 FragColor = vec4(lighting, 1.0);
+	imageStore(outColor, pixel, FragColor);
+
+	float brightness = dot(FragColor.rgb, lightThreshold) * bright_color_threshold;
+	if (brightness > 1.0)
+		imageStore(outBrightColor, pixel, vec4(FragColor.rgb, 1.0));
+	else
+		imageStore(outBrightColor, pixel, vec4(0.0, 0.0, 0.0, 1.0));
+}
+
+vec3 UnprojectToView(vec2 ndc)
+{
+	vec4 position = uInverseProjection * vec4(ndc, 1.0, 1.0);
+	return position.xyz / position.w;
+}
+
+vec3 CalculateDirectionalLight(DirectionalLight light, vec3 normal, vec3 view_dir, vec3 pixelColor)
+{
+	float intensity = light.intensity;
+	// Diffuse 
+	vec3 lightDirection = normalize(-light.direction);
+	float diff = max(dot(lightDirection, normal), 0.0);
+	vec3 diffuse = light.color * diff * pixelColor *  intensity;
+
+	// Specular
+	vec3 halfwayDir = normalize(lightDirection + view_dir);
+	float spec = pow(max(dot(normal, halfwayDir), 0.0), 128.0);
+	vec3 specular = light.color * spec * intensity;
+
+	vec3 result = (diffuse + specular);
+	return result;
+}
+
+vec3 CalculatePointLight(PointLight light, vec3 normal, vec3 view_dir, vec3 frag_pos, vec3 pixelColor)
+{
+	float distance = length(light.position - frag_pos);
+	if (distance >= light.radius)
+		return vec3(0.0);
+
+	float intensity = light.intensity;
+
+	// Diffuse 
+	vec3 lightDirection = normalize(light.position - frag_pos);
+	float diff = max(dot(normal, lightDirection), 0.0);
+	vec3 diffuse = light.color * diff * pixelColor * intensity;
+
+	// Specular
+    vec3 halfwayDir = normalize(lightDirection + view_dir);  
+    float spec = pow(max(dot(normal, halfwayDir), 0.0), 128.0);
+	vec3 specular = light.color * spec * intensity;
+
+	// Attenuation, windowed so the contribution reaches zero at the light radius
+    float attenuation = 1.0 / (1.0 + 0.3 * distance + 0.5 * (distance * distance));
+	float window = clamp(1.0 - pow(distance / light.radius, 4.0), 0.0, 1.0);
+	attenuation *= window * window;
+
+	diffuse *= attenuation;
+    specular *= attenuation;
+
+	vec3 result = (diffuse + specular);
+	return result;
+}
+
+
+#endif
+#endif
+
+// ---------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+// CLUSTERED LIGHT CULLING SHADER
+// ---------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+
+#ifdef CLUSTERED_LIGHT_CULLING_SHADER
+
+#if defined(COMPUTE) ///////////////////////////////////////////////////
+
+#define CLUSTER_GRID_X 16
+#define CLUSTER_GRID_Y 9
+#define CLUSTER_GRID_Z 24
+#define MAX_LIGHTS_PER_CLUSTER 128
+
+// One work group per depth slice, one invocation per cluster of the slice
+layout(local_size_x = CLUSTER_GRID_X, local_size_y = CLUSTER_GRID_Y, local_size_z = 1) in;
+
+struct PointLight {
+	vec3 position;
+	float intensity;
+	vec3 color;
+	float radius;
+};
+
+layout(binding = 0, std140) uniform GlobalParams
+{
+	vec3 uCameraPosition;
+	unsigned int uVisiblePointLightCount;
+	unsigned int uDirectionalLightCount;
+	mat4 uViewProjection;
+};
+
+layout(binding = 2, std430) readonly buffer PointLights
+{
+	PointLight uPointLights[];
+};
+
+// Indices of the point lights that survived the CPU frustum culling
+layout(binding = 4, std430) readonly buffer VisiblePointLights
+{
+	uint uVisiblePointLights[];
+};
+
+layout(binding = 0, std430) writeonly buffer ClusterLightCounts
+{
+	uint uClusterLightCount[];
+};
+
+layout(binding = 1, std430) writeonly buffer ClusterLightIndices
+{
+	uint uClusterLightIndices[];
+};
+
+uniform mat4 uView;
+uniform mat4 uInverseProjection;
+uniform float uNear;
+uniform float uFar;
+
+
+vec3 UnprojectToView(vec2 ndc)
+{
+	vec4 position = uInverseProjection * vec4(ndc, -1.0, 1.0);
+	return position.xyz / position.w;
+}
+
+// Point where the ray from the eye through 'pointOnRay' crosses the plane at view depth 'depth'
+vec3 IntersectDepthPlane(vec3 pointOnRay, float depth)
+{
+	return pointOnRay * (-depth / pointOnRay.z);
+}
+
+void main()
+{
+	uvec3 cluster = gl_GlobalInvocationID;
+	uint clusterIndex = cluster.x + cluster.y * uint(CLUSTER_GRID_X) + cluster.z * uint(CLUSTER_GRID_X * CLUSTER_GRID_Y);
+
+	// Exponential depth slices between the camera near and far planes
+	float sliceNear = uNear * pow(uFar / uNear, float(cluster.z) / float(CLUSTER_GRID_Z));
+	float sliceFar = uNear * pow(uFar / uNear, float(cluster.z + 1u) / float(CLUSTER_GRID_Z));
+
+	vec2 tileSize = 2.0 / vec2(CLUSTER_GRID_X, CLUSTER_GRID_Y);
+	vec3 tileMin = UnprojectToView(vec2(cluster.xy) * tileSize - 1.0);
+	vec3 tileMax = UnprojectToView(vec2(cluster.xy + 1u) * tileSize - 1.0);
+
+	vec3 minNear = IntersectDepthPlane(tileMin, sliceNear);
+	vec3 minFar = IntersectDepthPlane(tileMin, sliceFar);
+	vec3 maxNear = IntersectDepthPlane(tileMax, sliceNear);
+	vec3 maxFar = IntersectDepthPlane(tileMax, sliceFar);
+
+	vec3 aabbMin = min(min(minNear, minFar), min(maxNear, maxFar));
+	vec3 aabbMax = max(max(minNear, minFar), max(maxNear, maxFar));
+
+	uint count = 0u;
+	uint baseIndex = clusterIndex * uint(MAX_LIGHTS_PER_CLUSTER);
+
+	for (uint i = 0u; i < uVisiblePointLightCount && count < uint(MAX_LIGHTS_PER_CLUSTER); ++i)
+	{
+		// Sphere vs cluster AABB
+		uint lightIndex = uVisiblePointLights[i];
+		float radius = uPointLights[lightIndex].radius;
+		vec3 center = (uView * vec4(uPointLights[lightIndex].position, 1.0)).xyz;
+		vec3 offset = clamp(center, aabbMin, aabbMax) - center;
+		bool visible = dot(offset, offset) <= radius * radius;
+
+		if (visible)
+		{
+			uClusterLightIndices[baseIndex + count] = lightIndex;
+			count++;
+		}
+	}
+
+	uClusterLightCount[clusterIndex] = count;
+}
+
+#endif
+#endif
+
+// ---------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+// HI-Z PYRAMID SHADER
+// ---------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+
+#ifdef HIZ_BUILD_SHADER
+
+#if defined(COMPUTE) ///////////////////////////////////////////////////
+
+#define HIZ_GROUP_SIZE 8 // must match HIZ_GROUP_SIZE in gpu_culling.h
+
+layout(local_size_x = HIZ_GROUP_SIZE, local_size_y = HIZ_GROUP_SIZE) in;
+
+// The depth buffer for the first level, the previous level of the pyramid for the others
+uniform sampler2D uSource;
+uniform int uSourceLevel;
+layout(binding = 0, r32f) uniform writeonly image2D uOutput;
+
+void main()
+{
+	ivec2 texel = ivec2(gl_GlobalInvocationID.xy);
+	ivec2 outputSize = imageSize(uOutput);
+	if (any(greaterThanEqual(texel, outputSize)))
+		return;
+
+	// Farthest depth of the 2x2 source texels, the last row and column also take the third texel
+	// of odd sized sources so no source texel is left out
+	ivec2 sourceSize = textureSize(uSource, uSourceLevel);
+	ivec2 first = texel * 2;
+	ivec2 last = min(first + 1, sourceSize - 1);
+	if (texel.x == outputSize.x - 1) last.x = sourceSize.x - 1;
+	if (texel.y == outputSize.y - 1) last.y = sourceSize.y - 1;
+
+	float depth = 0.0;
+	for (int y = first.y; y <= last.y; ++y)
+		for (int x = first.x; x <= last.x; ++x)
+			depth = max(depth, texelFetch(uSource, ivec2(x, y), uSourceLevel).r);
+
+	imageStore(uOutput, texel, vec4(depth));
+}
+
+#endif
+#endif
+
+// ---------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+// OBJECT CULLING SHADER
+// ---------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+
+#ifdef OBJECT_CULLING_SHADER
+
+#if defined(COMPUTE) ///////////////////////////////////////////////////
+
+#define CULLING_GROUP_SIZE 64 // must match CULLING_GROUP_SIZE in gpu_culling.h
+
+// One invocation per object record
+layout(local_size_x = CULLING_GROUP_SIZE) in;
+
+layout(binding = 0, std140) uniform GlobalParams
+{
+	vec3 uCameraPosition;
+	unsigned int uVisiblePointLightCount;
+	unsigned int uDirectionalLightCount;
+	mat4 uViewProjection;
+};
+
+struct Object
+{
+	vec4 worldRows[3]; // affine world matrix, rows of the upper 3x4
+	uint materialIndex; // albedo array layer
+	uint flags;
+	uint padding0;
+	uint padding1;
+};
+
+struct CullObject // must match GPU_CULL_OBJECT_LAYOUT in gpu_culling.h
+{
+	vec3 boundsCenter;  // model space
+	uint batch;
+	vec3 boundsExtents;
+	uint padding;
+};
+
+struct DrawCommand
+{
+	uint count;
+	uint instanceCount;
+	uint firstIndex;
+	uint baseVertex;
+	uint baseInstance;
+};
+
+layout(binding = 5, std430) readonly buffer Objects
+{
+	Object uObjects[];
+};
+
+layout(binding = 6, std430) readonly buffer CullObjects
+{
+	CullObject uCullObjects[];
+};
+
+// Phase 1 commands followed by the phase 2 ones, one per batch
+layout(binding = 7, std430) buffer DrawCommands
+{
+	DrawCommand uCommands[];
+};
+
+// Per instance object indices read by the draws
+layout(binding = 8, std430) writeonly buffer Instances
+{
+	uint uInstances[];
+};
+
+// Objects found visible by the last phase 2
+layout(binding = 9, std430) buffer Visibility
+{
+	uint uVisible[];
+};
+
+uniform uint uObjectCount;
+uniform uint uBatchCount;
+uniform int uPhase;
+uniform vec4 uFrustumPlanes[6];
+
+uniform sampler2D uHiZ;
+uniform vec2 uDepthSize; // the pyramid starts at half this size
+uniform int uHiZLevels;
+
+bool IsInFrustum(vec3 center, vec3 extents)
+{
+	for (int i = 0; i < 6; ++i)
+	{
+		vec3 normal = uFrustumPlanes[i].xyz;
+		if (dot(normal, center) + uFrustumPlanes[i].w + dot(abs(normal), extents) < 0.0)
+			return false;
+	}
+	return true;
 }
 
-#elif defined(FRAGMENT) ///////////////////////////////////////////////
+bool IsOccluded(vec3 center, vec3 extents)
+{
+	vec2 uvMin = vec2(1.0);
+	vec2 uvMax = vec2(0.0);
+	float nearestDepth = 1.0;
+
+	for (int i = 0; i < 8; ++i)
+	{
+		vec3 corner = center + extents * vec3((i & 1) != 0 ? 1.0 : -1.0, (i & 2) != 0 ? 1.0 : -1.0, (i & 4) != 0 ? 1.0 : -1.0);
+		vec4 clip = uViewProjection * vec4(corner, 1.0);
+
+		// A box crossing the near plane covers the camera, it cannot be hidden
+		if (clip.z < -clip.w)
+			return false;
+
+		vec3 ndc = clip.xyz / clip.w;
+		uvMin = min(uvMin, ndc.xy * 0.5 + 0.5);
+		uvMax = max(uvMax, ndc.xy * 0.5 + 0.5);
+		nearestDepth = min(nearestDepth, ndc.z * 0.5 + 0.5);
+	}
+
+	uvMin = clamp(uvMin, 0.0, 1.0);
+	uvMax = clamp(uvMax, 0.0, 1.0);
+
+	// Level where the box spans at most 2x2 texels, level n halves the depth buffer n + 1 times
+	ivec2 pixelMin = ivec2(uvMin * uDepthSize);
+	ivec2 pixelMax = min(ivec2(uvMax * uDepthSize), ivec2(uDepthSize) - 1);
+	ivec2 pixelSize = pixelMax - pixelMin + 1;
+	int level = clamp(int(ceil(log2(float(max(pixelSize.x, pixelSize.y))))) - 1, 0, uHiZLevels - 1);
+
+	ivec2 levelSize = textureSize(uHiZ, level);
+	ivec2 texelMin = min(pixelMin >> (level + 1), levelSize - 1);
+	ivec2 texelMax = min(pixelMax >> (level + 1), levelSize - 1);
+
+	float farthestDepth = max(max(texelFetch(uHiZ, texelMin, level).r, texelFetch(uHiZ, ivec2(texelMax.x, texelMin.y), level).r),
+	                          max(texelFetch(uHiZ, ivec2(texelMin.x, texelMax.y), level).r, texelFetch(uHiZ, texelMax, level).r));
+
+	return nearestDepth > farthestDepth;
+}
+
+void main()
+{
+	uint objectIndex = gl_GlobalInvocationID.x;
+	if (objectIndex >= uObjectCount)
+		return;
+
+	// World box of the model space bounds
+	Object object = uObjects[objectIndex];
+	CullObject cullObject = uCullObjects[objectIndex];
+	vec3 center = vec4(cullObject.boundsCenter, 1.0) * mat3x4(object.worldRows[0], object.worldRows[1], object.worldRows[2]);
+	vec3 extents = vec3(dot(abs(object.worldRows[0].xyz), cullObject.boundsExtents),
+	                    dot(abs(object.worldRows[1].xyz), cullObject.boundsExtents),
+	                    dot(abs(object.worldRows[2].xyz), cullObject.boundsExtents));
+
+	bool wasVisible = uVisible[objectIndex] != 0u;
+	bool draw = false;
+
+	if (uPhase == 0)
+	{
+		// Whatever was visible last frame, without occlusion test: it builds the depth phase 2 tests against
+		draw = wasVisible && IsInFrustum(center, extents);
+	}
+	else
+	{
+		bool visible = IsInFrustum(center, extents) && !IsOccluded(center, extents);
+		uVisible[objectIndex] = visible ? 1u : 0u;
+
+		// The ones still visible were drawn by phase 1
+		draw = visible && !wasVisible;
+	}
+
+	if (draw)
+	{
+		uint command = uint(uPhase) * uBatchCount + cullObject.batch;
+		uint slot = atomicAdd(uCommands[command].instanceCount, 1u);
+		uInstances[uCommands[command].baseInstance + slot] = objectIndex;
+	}
+}
+
+#endif
+#endif
+
+// ---------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+// LIGHT VOLUME STENCIL SHADER
+// ---------------------------------------------------------------------------------------------------------------------------------------------------------------------------
 
-in vec2 vTexCoord;
-in vec3 vPosition; // in worldspace
-in vec3 vNormal; // in worldspace
+#ifdef LIGHT_VOLUME_STENCIL_SHADER
 
-uniform sampler2D uTexture;
+#if defined(VERTEX) ///////////////////////////////////////////////////
 
-layout(location = 0) out vec4 FragColor;
-layout (location = 1) out vec3 gPosition;
-layout (location = 2) out vec3 gNormal;
-layout (location = 3) out vec3 gAlbedoSpec;
-layout(location = 4) out vec4 gDepth;
+layout(location = 0) in vec3 aPosition;
 
-float near = 0.1;
-float far = 100.0;
+uniform mat4 uWorldViewProjectionMatrix;
 
-float LinearizeDepth(float depth)
+void main()
 {
-	float z = depth * 2.0 - 1.0; // back to NDC 
-	return (2.0 * near * far) / (far + near - z * (far - near));
+	gl_Position = uWorldViewProjectionMatrix * vec4(aPosition, 1.0);
 }
 
+#elif defined(FRAGMENT) ///////////////////////////////////////////////
+
+// Only the stencil buffer is written
 void main()
 {
-	gPosition = vPosition; 
-	gNormal = normalize(vNormal);
-	gAlbedoSpec.rgb = texture(uTexture, vTexCoord).rgb;
-	float depth = LinearizeDepth(gl_FragCoord.z) / far; // divide by far for demonstration
-	gDepth = vec4(vec3(depth), 1.0);
-	FragColor = texture(uTexture, vTexCoord);
 }
 
 #endif
 #endif
 
 // ---------------------------------------------------------------------------------------------------------------------------------------------------------------------------
-// SHADING PASS SHADER
+// LIGHT VOLUME SHADING SHADERS (point: one sphere per light, directional: full screen)
 // ---------------------------------------------------------------------------------------------------------------------------------------------------------------------------
 
-#ifdef SHADING_PASS_SHADER
+#if defined(LIGHT_VOLUME_POINT_SHADER) || defined(LIGHT_VOLUME_DIRECTIONAL_SHADER)
 
 #if defined(VERTEX) ///////////////////////////////////////////////////
 
-struct Light {
-	unsigned int type; 
-	vec3 position;
-	vec3 color; 
-	vec3 direction;
-	unsigned int intensity;
-};
-
-layout(binding = 0, std140) uniform GlobalParams
-{
-	vec3 uCameraPosition;
-	unsigned int uLightCount; 
-	Light uLights[150];
-};
-
 layout(location = 0) in vec3 aPosition;
-layout(location = 1) in vec3 aNormal;
-layout(location = 2) in vec2 aTexCoord;
 
-out vec2 vTexCoord;
+#if defined(LIGHT_VOLUME_POINT_SHADER)
+uniform mat4 uWorldViewProjectionMatrix;
+#endif
 
 void main()
 {
-	vTexCoord = aTexCoord;
+#if defined(LIGHT_VOLUME_POINT_SHADER)
+	gl_Position = uWorldViewProjectionMatrix * vec4(aPosition, 1.0);
+#else
 	gl_Position = vec4(aPosition, 1.0);
+#endif
 }
 
 #elif defined(FRAGMENT) ///////////////////////////////////////////////
 
-
-struct Light {
-	unsigned int type; 
+struct PointLight {
 	vec3 position;
-	vec3 color; 
+	float intensity;
+	vec3 color;
+	float radius;
+};
+
+struct DirectionalLight {
 	vec3 direction;
-	unsigned int intensity;
+	float intensity;
+	vec3 color;
+	float padding;
 };
 
 layout(binding = 0, std140) uniform GlobalParams
 {
 	vec3 uCameraPosition;
-	unsigned int uLightCount; 
-	Light uLights[150];
+	unsigned int uVisiblePointLightCount;
+	unsigned int uDirectionalLightCount;
+	mat4 uViewProjection;
 };
 
-in vec2 vTexCoord;
+layout(binding = 2, std430) readonly buffer PointLights
+{
+	PointLight uPointLights[];
+};
+
+layout(binding = 3, std430) readonly buffer DirectionalLights
+{
+	DirectionalLight uDirectionalLights[];
+};
 
-uniform sampler2D gPosition;
 uniform sampler2D gNormal;
 uniform sampler2D gAlbedoSpec;
-uniform sampler2D gDepth;
+uniform sampler2D gDepthStencil;
+uniform vec2 uScreenSize;
+uniform mat4 uInverseViewProjection;
 
-uniform float bright_color_threshold; 
-vec3 lightThreshold = vec3(0.2126, 0.7152, 0.0722);
+#if defined(LIGHT_VOLUME_POINT_SHADER)
+uniform uint uLightIndex;
+#endif
 
+// Accumulated additively into the shading buffer, bright colors are extracted afterwards
 layout(location = 0) out vec4 FragColor;
-layout(location = 1) out vec4 BrightColor;
 
-vec3 CalculateLighting(Light light, vec3 normal, vec3 view_dir, vec3 frag_pos, vec3 pixelColor);
+vec3 CalculatePointLight(PointLight light, vec3 normal, vec3 view_dir, vec3 frag_pos, vec3 pixelColor);
+vec3 CalculateDirectionalLight(DirectionalLight light, vec3 normal, vec3 view_dir, vec3 pixelColor);
+
+vec3 OctahedralDecode(vec2 e)
+{
+	e = e * 2.0 - 1.0;
+	vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+	float t = max(-n.z, 0.0);
+	n.x += n.x >= 0.0 ? -t : t;
+	n.y += n.y >= 0.0 ? -t : t;
+	return normalize(n);
+}
+
+// World position of the pixel from the hardware depth
+vec3 ReconstructPosition(vec2 texCoord, float depth)
+{
+	vec4 position = uInverseViewProjection * vec4(vec3(texCoord, depth) * 2.0 - 1.0, 1.0);
+	return position.xyz / position.w;
+}
 
 void main()
 {
-	// retrieve data from gbuffer
-    vec3 FragPos = texture(gPosition, vTexCoord).rgb;
-    vec3 Normal = texture(gNormal, vTexCoord).rgb;
-    vec3 Diffuse = texture(gAlbedoSpec, vTexCoord).rgb;
-    float Specular = 0;
+	vec2 texCoord = gl_FragCoord.xy / uScreenSize;
+
+	// Nothing was drawn here, nothing to add
+	float depth = texture(gDepthStencil, texCoord).r;
+	if (depth == 1.0)
+		discard;
+
+    vec3 FragPos = ReconstructPosition(texCoord, depth);
+    vec3 Normal = OctahedralDecode(texture(gNormal, texCoord).rg);
+    vec3 Diffuse = texture(gAlbedoSpec, texCoord).rgb;
 
 	vec3 viewDir  = normalize(uCameraPosition - FragPos);
 
     vec3 lighting  = vec3(0.0);
-    for(int i = 0; i < uLightCount; ++i)
-		lighting += CalculateLighting(uLights[i], Normal, viewDir, FragPos, Diffuse);
+#if defined(LIGHT_VOLUME_POINT_SHADER)
+	lighting += CalculatePointLight(uPointLights[uLightIndex], Normal, viewDir, FragPos, Diffuse);
+#else
+    for(uint i = 0u; i < uDirectionalLightCount; ++i)
+		lighting += CalculateDirectionalLight(uDirectionalLights[i], Normal, viewDir, Diffuse);
+#endif
 
     FragColor = vec4(lighting, 1.0);
-
-	float brightness = dot(FragColor.rgb, lightThreshold) * bright_color_threshold;
-    if(brightness > 1.0)
-        BrightColor = vec4(FragColor.rgb, 1.0);
-    else
-        BrightColor = vec4(0.0, 0.0, 0.0, 1.0);
 }
 
-vec3 CalculateDirectionalLight(Light light, vec3 normal, vec3 view_dir, vec3 pixelColor)
+vec3 CalculateDirectionalLight(DirectionalLight light, vec3 normal, vec3 view_dir, vec3 pixelColor)
 {
-	float intensity = float(light.intensity);
-	intensity *= 0.01;
+	float intensity = light.intensity;
 	// Diffuse 
 	vec3 lightDirection = normalize(-light.direction);
 	float diff = max(dot(lightDirection, normal), 0.0);
@@ -419,10 +1389,13 @@ vec3 CalculateDirectionalLight(Light light, vec3 normal, vec3 view_dir, vec3 pix
 	return result;
 }
 
-vec3 CalculatePointLight(Light light, vec3 normal, vec3 view_dir, vec3 frag_pos, vec3 pixelColor)
+vec3 CalculatePointLight(PointLight light, vec3 normal, vec3 view_dir, vec3 frag_pos, vec3 pixelColor)
 {
-	float intensity = float(light.intensity);
-	intensity *= 0.01;
+	float distance = length(light.position - frag_pos);
+	if (distance >= light.radius)
+		return vec3(0.0);
+
+	float intensity = light.intensity;
 
 	// Diffuse 
 	vec3 lightDirection = normalize(light.position - frag_pos);
@@ -434,9 +1407,10 @@ vec3 CalculatePointLight(Light light, vec3 normal, vec3 view_dir, vec3 frag_pos,
     float spec = pow(max(dot(normal, halfwayDir), 0.0), 128.0);
 	vec3 specular = light.color * spec * intensity;
 
-	// Attenuation
- 	float distance = length(light.position - frag_pos);
-    float attenuation = 1.0 / (1.0 + 0.3 * distance + 0.5 * (distance * distance));    
+	// Attenuation, windowed so the contribution reaches zero at the light radius
+    float attenuation = 1.0 / (1.0 + 0.3 * distance + 0.5 * (distance * distance));
+	float window = clamp(1.0 - pow(distance / light.radius, 4.0), 0.0, 1.0);
+	attenuation *= window * window;
 
 	diffuse *= attenuation;
     specular *= attenuation;
@@ -445,25 +1419,47 @@ vec3 CalculatePointLight(Light light, vec3 normal, vec3 view_dir, vec3 frag_pos,
 	return result;
 }
 
+#endif
+#endif
+
+// ---------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+// BRIGHT EXTRACT SHADER
+// ---------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+
+#ifdef BRIGHT_EXTRACT_SHADER
+
+#if defined(VERTEX) ///////////////////////////////////////////////////
+
+layout(location = 0) in vec3 aPosition;
+layout(location = 2) in vec2 aTexCoord;
+
+out vec2 vTexCoord;
 
-vec3 CalculateLighting(Light light, vec3 normal, vec3 view_dir, vec3 frag_pos, vec3 pixelColor)
+void main()
 {
+	vTexCoord = aTexCoord;
+	gl_Position = vec4(aPosition, 1.0);
+}
 
-	vec3 result = vec3(0.0);
+#elif defined(FRAGMENT) ///////////////////////////////////////////////
 
-	switch(light.type)
-	{
-		case 0: 
-			result = CalculatePointLight(light, normal, view_dir, frag_pos, pixelColor);
-			break;
-		case 1:
-			result = CalculateDirectionalLight(light, normal, view_dir, pixelColor);
-			break;
+in vec2 vTexCoord;
 
-		default: break;
-	}
+uniform sampler2D uColorTexture;
+uniform float bright_color_threshold; 
+vec3 lightThreshold = vec3(0.2126, 0.7152, 0.0722);
 
-	return result;
+layout(location = 0) out vec4 BrightColor;
+
+void main()
+{
+	vec3 color = texture(uColorTexture, vTexCoord).rgb;
+
+	float brightness = dot(color, lightThreshold) * bright_color_threshold;
+    if(brightness > 1.0)
+        BrightColor = vec4(color, 1.0);
+    else
+        BrightColor = vec4(0.0, 0.0, 0.0, 1.0);
 }
 
 #endif
@@ -508,7 +1504,7 @@ void main()
 // RELIEF MAPPING SHADER
 // ---------------------------------------------------------------------------------------------------------------------------------------------------------------------------
 
-#ifdef RELIEF_MAPPING_SHADER
+#ifdef RELIEF_MAPPING_SHADER_COMPACT
 
 #if defined(VERTEX) ///////////////////////////////////////////////////
 
@@ -569,18 +1565,24 @@ uniform float heightScale;
 uniform bool clipBorders;
 uniform int minLayers;
 uniform int maxLayers;
+uniform sampler2D coneMap;
+uniform bool coneStepMapping;
+uniform int coneSteps;
+uniform float layerScale; // relief LOD of the draw, 0 means normal mapping only
 
-layout(location = 0) out vec4 FragColor;
-layout(location = 1) out vec3 gPosition;
-layout(location = 2) out vec3 gNormal;
-layout(location = 3) out vec3 gAlbedoSpec;
-layout(location = 4) out vec4 gDepth;
+layout(location = 0) out vec4 gAlbedoSpec;
+layout(location = 1) out vec2 gNormal;
 
-float near = 0.1;
-float far = 100.0;
+// Octahedral normal encoding, mapped to [0, 1] for the RG16 target
+vec2 OctahedralEncode(vec3 n)
+{
+	n /= (abs(n.x) + abs(n.y) + abs(n.z));
+	vec2 e = n.z >= 0.0 ? n.xy : (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+	return e * 0.5 + 0.5;
+}
 
-vec2 ParallaxMapping(vec2 texCoords, vec3 viewDir);
-float LinearizeDepth(float depth);
+vec2 ParallaxMapping(vec2 texCoords, vec3 viewDir, float lodScale);
+vec2 ConeStepMapping(vec2 texCoords, vec3 viewDir, float lodScale);
 
 void main()
 {
@@ -588,7 +1590,11 @@ void main()
 	vec3 viewDir = normalize(fs_in.TangentViewPos - fs_in.TangentFragPos);
 	vec2 texCoords = fs_in.TexCoords;
 
-	texCoords = ParallaxMapping(fs_in.TexCoords, viewDir);
+	// Halve the layers for every mip level of the depth map the pixel covers: past the first one the
+	// ray crosses fewer texels than there are layers
+	float lodScale = layerScale * exp2(-max(textureQueryLod(depthMap, fs_in.TexCoords).y, 0.0));
+	if (lodScale > 0.0)
+		texCoords = coneStepMapping ? ConeStepMapping(fs_in.TexCoords, viewDir, lodScale) : ParallaxMapping(fs_in.TexCoords, viewDir, lodScale);
 
 	if (clipBorders)
 	{
@@ -615,29 +1621,18 @@ void main()
 
 	vec3 specular = vec3(0.2) * spec;
 
-	gPosition = fs_in.FragPos;
-	gNormal = normal;
-	gAlbedoSpec.rgb = texture(diffuseMap, texCoords).rgb;
-	float depth = LinearizeDepth(gl_FragCoord.z) / far; // divide by far for demonstration
-	gDepth = vec4(vec3(depth), 1.0);
-	//FragColor = texture(diffuseMap, texCoords);
-	FragColor = vec4(ambient + diffuse + specular, 1.0);
-}
-
-float LinearizeDepth(float depth)
-{
-	float z = depth * 2.0 - 1.0; // back to NDC 
-	return (2.0 * near * far) / (far + near - z * (far - near));
+	gAlbedoSpec = vec4(texture(diffuseMap, texCoords).rgb, 1.0);
+	gNormal = OctahedralEncode(normal);
 }
 
-vec2 ParallaxMapping(vec2 texCoords, vec3 viewDir)
+vec2 ParallaxMapping(vec2 texCoords, vec3 viewDir, float lodScale)
 {
 	// number of depth layers
 	//const float minLayers = 8;
 	//const float maxLayers = 32;
 
 
-	float numLayers = mix(maxLayers, minLayers, abs(dot(vec3(0.0, 0.0, 1.0), viewDir)));
+	float numLayers = max(mix(maxLayers, minLayers, abs(dot(vec3(0.0, 0.0, 1.0), viewDir))) * lodScale, 1.0);
 	// calculate the size of each layer
 	float layerDepth = 1.0 / numLayers;
 	// depth of current layer
@@ -674,6 +1669,44 @@ vec2 ParallaxMapping(vec2 texCoords, vec3 viewDir)
 	return finalTexCoords;
 }
 
+// Relaxed cone stepping: every step goes as far as the cone of the texel it starts from allows. The
+// cones may let the ray cross the surface once, so the last step is refined with a binary search.
+vec2 ConeStepMapping(vec2 texCoords, vec3 viewDir, float lodScale)
+{
+	// Same ray as the linear search: the texture coordinates move by -P per unit of depth
+	vec3 rayDir = vec3(-viewDir.xy / viewDir.z * heightScale, 1.0);
+	float rayRatio = length(rayDir.xy);
+
+	vec3 position = vec3(texCoords, 0.0);
+	vec3 previous = position;
+
+	int steps = max(int(float(coneSteps) * lodScale + 0.5), 1);
+	for (int i = 0; i < steps; ++i)
+	{
+		// r: depth, g: square root of the cone ratio
+		vec2 cone = texture(coneMap, position.xy).rg;
+		float coneRatio = cone.g * cone.g;
+		float depthLeft = cone.r - position.z;
+		if (depthLeft <= 0.0)
+			break;
+
+		previous = position;
+		position += rayDir * (coneRatio * depthLeft / (rayRatio + coneRatio));
+	}
+
+	// The surface is crossed between the last two positions
+	for (int i = 0; i < 6; ++i)
+	{
+		vec3 middle = (previous + position) * 0.5;
+		if (texture(depthMap, middle.xy).r <= middle.z)
+			position = middle;
+		else
+			previous = middle;
+	}
+
+	return position.xy;
+}
+
 #endif
 #endif
 
@@ -702,29 +1735,32 @@ out vec4 FragColor;
   
 in vec2 TexCoords;
 
+#define MAX_BLUR_RADIUS 32 // must match MAX_BLUR_RADIUS in engine.h
+
 uniform sampler2D image;
   
 uniform bool horizontal;
-uniform float weight[5] = float[] (0.227027, 0.1945946, 0.1216216, 0.054054, 0.016216);
+uniform int uRadius;
+uniform float uWeights[MAX_BLUR_RADIUS + 1];
 
 void main()
 {             
     vec2 tex_offset = 1.0 / textureSize(image, 0); // gets size of single texel
-    vec3 result = texture(image, TexCoords).rgb * weight[0]; // current fragment's contribution
+    vec3 result = texture(image, TexCoords).rgb * uWeights[0]; // current fragment's contribution
     if(horizontal)
     {
-        for(int i = 1; i < 5; ++i)
+        for(int i = 1; i <= uRadius; ++i)
         {
-            result += texture(image, TexCoords + vec2(tex_offset.x * i, 0.0)).rgb * weight[i];
-            result += texture(image, TexCoords - vec2(tex_offset.x * i, 0.0)).rgb * weight[i];
+            result += texture(image, TexCoords + vec2(tex_offset.x * i, 0.0)).rgb * uWeights[i];
+            result += texture(image, TexCoords - vec2(tex_offset.x * i, 0.0)).rgb * uWeights[i];
         }
     }
     else
     {
-        for(int i = 1; i < 5; ++i)
+        for(int i = 1; i <= uRadius; ++i)
         {
-            result += texture(image, TexCoords + vec2(0.0, tex_offset.y * i)).rgb * weight[i];
-            result += texture(image, TexCoords - vec2(0.0, tex_offset.y * i)).rgb * weight[i];
+            result += texture(image, TexCoords + vec2(0.0, tex_offset.y * i)).rgb * uWeights[i];
+            result += texture(image, TexCoords - vec2(0.0, tex_offset.y * i)).rgb * uWeights[i];
         }
     }
     FragColor = vec4(result, 1.0);
@@ -733,11 +1769,173 @@ void main()
 #endif
 #endif
 
+// ---------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+// BLUR COMPUTE SHADER
+// ---------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+
+#ifdef BLUR_COMPUTE_SHADER
+
+#if defined(COMPUTE) ///////////////////////////////////////////////////
+
+#define BLUR_GROUP_SIZE 128 // must match BLUR_GROUP_SIZE in engine.h
+#define MAX_BLUR_RADIUS 32  // must match MAX_BLUR_RADIUS in engine.h
+
+// A work group blurs BLUR_GROUP_SIZE texels of one row (or column)
+layout(local_size_x = BLUR_GROUP_SIZE) in;
+
+uniform sampler2D uInput;
+layout(binding = 0, rgba16f) uniform writeonly image2D uOutput;
+
+uniform bool uHorizontal;
+uniform int uRadius;
+uniform float uWeights[MAX_BLUR_RADIUS + 1];
+
+// The texels of the group plus an apron of uRadius on each side, fetched once
+shared vec3 sLine[BLUR_GROUP_SIZE + 2 * MAX_BLUR_RADIUS];
+
+void main()
+{
+	ivec2 size = textureSize(uInput, 0);
+	ivec2 direction = uHorizontal ? ivec2(1, 0) : ivec2(0, 1);
+
+	int groupStart = int(gl_WorkGroupID.x) * BLUR_GROUP_SIZE;
+	ivec2 lineOrigin = uHorizontal ? ivec2(groupStart, gl_WorkGroupID.y) : ivec2(gl_WorkGroupID.y, groupStart);
+
+	int local = int(gl_LocalInvocationID.x);
+	for (int i = local; i < BLUR_GROUP_SIZE + 2 * uRadius; i += BLUR_GROUP_SIZE)
+	{
+		ivec2 texel = clamp(lineOrigin + direction * (i - uRadius), ivec2(0), size - 1);
+		sLine[i] = texelFetch(uInput, texel, 0).rgb;
+	}
+
+	barrier();
+
+	ivec2 texel = lineOrigin + direction * local;
+	if (any(greaterThanEqual(texel, size)))
+		return;
+
+	int center = local + uRadius;
+	vec3 result = sLine[center] * uWeights[0];
+	for (int i = 1; i <= uRadius; ++i)
+		result += (sLine[center - i] + sLine[center + i]) * uWeights[i];
+
+	imageStore(uOutput, texel, vec4(result, 1.0));
+}
+
+#endif
+#endif
+
+// ---------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+// BLOOM MIP CHAIN SHADERS
+// ---------------------------------------------------------------------------------------------------------------------------------------------------------------------------
+
+#if defined(BLOOM_DOWNSAMPLE_SHADER) || defined(BLOOM_UPSAMPLE_SHADER)
+
+#if defined(VERTEX) ///////////////////////////////////////////////////
+
+layout(location = 0) in vec3 aPosition;
+layout(location = 2) in vec2 aTexCoord;
+
+out vec2 vTexCoord;
+
+void main()
+{
+	vTexCoord = aTexCoord;
+	gl_Position = vec4(aPosition, 1.0);
+}
+
+#elif defined(FRAGMENT) ///////////////////////////////////////////////
+
+in vec2 vTexCoord;
+
+uniform sampler2D uSourceTexture;
+uniform vec2 uSourceTexelSize;
+
+layout(location = 0) out vec4 FragColor;
+
+#if defined(BLOOM_DOWNSAMPLE_SHADER)
+
+// Only set for the first level: weights every 2x2 block by its luminance so single very bright
+// pixels do not flicker as they move between texels
+uniform bool uKarisAverage;
+
+float KarisWeight(vec3 color)
+{
+	return 1.0 / (1.0 + dot(color, vec3(0.2126, 0.7152, 0.0722)));
+}
+
+// 13 bilinear taps over a 6x6 texel footprint of the source level (Jimenez, Advanced Warfare)
+void main()
+{
+	vec2 t = uSourceTexelSize;
+
+	vec3 a = texture(uSourceTexture, vTexCoord + t * vec2(-2.0,  2.0)).rgb;
+	vec3 b = texture(uSourceTexture, vTexCoord + t * vec2( 0.0,  2.0)).rgb;
+	vec3 c = texture(uSourceTexture, vTexCoord + t * vec2( 2.0,  2.0)).rgb;
+	vec3 d = texture(uSourceTexture, vTexCoord + t * vec2(-2.0,  0.0)).rgb;
+	vec3 e = texture(uSourceTexture, vTexCoord).rgb;
+	vec3 f = texture(uSourceTexture, vTexCoord + t * vec2( 2.0,  0.0)).rgb;
+	vec3 g = texture(uSourceTexture, vTexCoord + t * vec2(-2.0, -2.0)).rgb;
+	vec3 h = texture(uSourceTexture, vTexCoord + t * vec2( 0.0, -2.0)).rgb;
+	vec3 i = texture(uSourceTexture, vTexCoord + t * vec2( 2.0, -2.0)).rgb;
+	vec3 j = texture(uSourceTexture, vTexCoord + t * vec2(-1.0,  1.0)).rgb;
+	vec3 k = texture(uSourceTexture, vTexCoord + t * vec2( 1.0,  1.0)).rgb;
+	vec3 l = texture(uSourceTexture, vTexCoord + t * vec2(-1.0, -1.0)).rgb;
+	vec3 m = texture(uSourceTexture, vTexCoord + t * vec2( 1.0, -1.0)).rgb;
+
+	// Five overlapping 2x2 blocks: the center one weights 0.5, the corner ones 0.125 each
+	vec3 blocks[5] = vec3[](
+		(j + k + l + m) * 0.25,
+		(a + b + d + e) * 0.25,
+		(b + c + e + f) * 0.25,
+		(d + e + g + h) * 0.25,
+		(e + f + h + i) * 0.25);
+	float weights[5] = float[](0.5, 0.125, 0.125, 0.125, 0.125);
+
+	vec3 color = vec3(0.0);
+	float totalWeight = 0.0;
+	for (int block = 0; block < 5; ++block)
+	{
+		float weight = weights[block] * (uKarisAverage ? KarisWeight(blocks[block]) : 1.0);
+		color += blocks[block] * weight;
+		totalWeight += weight;
+	}
+
+	FragColor = vec4(max(color / totalWeight, vec3(0.0)), 1.0);
+}
+
+#else
+
+uniform float uFilterRadius;
+
+// 3x3 tent over the lower level, the result is added to this level by blending
+void main()
+{
+	vec2 r = uSourceTexelSize * uFilterRadius;
+
+	vec3 color = texture(uSourceTexture, vTexCoord).rgb * 4.0;
+	color += (texture(uSourceTexture, vTexCoord + vec2(-r.x, 0.0)).rgb +
+	          texture(uSourceTexture, vTexCoord + vec2( r.x, 0.0)).rgb +
+	          texture(uSourceTexture, vTexCoord + vec2(0.0, -r.y)).rgb +
+	          texture(uSourceTexture, vTexCoord + vec2(0.0,  r.y)).rgb) * 2.0;
+	color += texture(uSourceTexture, vTexCoord + vec2(-r.x, -r.y)).rgb +
+	         texture(uSourceTexture, vTexCoord + vec2( r.x, -r.y)).rgb +
+	         texture(uSourceTexture, vTexCoord + vec2(-r.x,  r.y)).rgb +
+	         texture(uSourceTexture, vTexCoord + vec2( r.x,  r.y)).rgb;
+
+	FragColor = vec4(color / 16.0, 1.0);
+}
+
+#endif
+
+#endif
+#endif
+
 // ---------------------------------------------------------------------------------------------------------------------------------------------------------------------------
 // RELIEF MAPPING SHADER FORWARD
 // ---------------------------------------------------------------------------------------------------------------------------------------------------------------------------
 
-#ifdef RELIEF_MAPPING_SHADER_FORWARD
+#if defined(RELIEF_MAPPING_SHADER_FORWARD) || defined(RELIEF_MAPPING_SHADER_FORWARD_CLUSTERED)
 
 #if defined(VERTEX) ///////////////////////////////////////////////////
 
@@ -781,21 +1979,81 @@ void main()
 
 #elif defined(FRAGMENT) ///////////////////////////////////////////////
 
-struct Light {
-	unsigned int type; 
+struct PointLight {
 	vec3 position;
-	vec3 color; 
+	float intensity;
+	vec3 color;
+	float radius;
+};
+
+struct DirectionalLight {
 	vec3 direction;
-	unsigned int intensity;
+	float intensity;
+	vec3 color;
+	float padding;
 };
 
 layout(binding = 0, std140) uniform GlobalParams
 {
 	vec3 uCameraPosition;
-	unsigned int uLightCount; 
-	Light uLights[150];
+	unsigned int uVisiblePointLightCount;
+	unsigned int uDirectionalLightCount;
+	mat4 uViewProjection;
+};
+
+layout(binding = 2, std430) readonly buffer PointLights
+{
+	PointLight uPointLights[];
+};
+
+// Indices of the point lights that survived the CPU frustum culling
+layout(binding = 4, std430) readonly buffer VisiblePointLights
+{
+	uint uVisiblePointLights[];
+};
+
+layout(binding = 3, std430) readonly buffer DirectionalLights
+{
+	DirectionalLight uDirectionalLights[];
+};
+
+#if defined(RELIEF_MAPPING_SHADER_FORWARD_CLUSTERED)
+
+#define CLUSTER_GRID_X 16
+#define CLUSTER_GRID_Y 9
+#define CLUSTER_GRID_Z 24
+#define MAX_LIGHTS_PER_CLUSTER 128
+
+layout(binding = 0, std430) readonly buffer ClusterLightCounts
+{
+	uint uClusterLightCount[];
+};
+
+layout(binding = 1, std430) readonly buffer ClusterLightIndices
+{
+	uint uClusterLightIndices[];
 };
 
+uniform vec2 uScreenSize;
+uniform float uNear;
+uniform float uFar;
+uniform float uClusterScale;
+uniform float uClusterBias;
+
+uint GetClusterIndex()
+{
+	// Linear view space depth of the fragment
+	float z = gl_FragCoord.z * 2.0 - 1.0;
+	float depth = (2.0 * uNear * uFar) / (uFar + uNear - z * (uFar - uNear));
+
+	uint slice = uint(clamp(floor(log(depth) * uClusterScale - uClusterBias), 0.0, float(CLUSTER_GRID_Z - 1)));
+	uvec2 tile = uvec2(clamp(gl_FragCoord.xy / uScreenSize * vec2(CLUSTER_GRID_X, CLUSTER_GRID_Y), vec2(0.0), vec2(CLUSTER_GRID_X - 1, CLUSTER_GRID_Y - 1)));
+
+	return tile.x + tile.y * uint(CLUSTER_GRID_X) + slice * uint(CLUSTER_GRID_X * CLUSTER_GRID_Y);
+}
+
+#endif
+
 in VS_OUT{
 	vec3 FragPos;
 	vec2 TexCoords;
@@ -811,6 +2069,10 @@ uniform float heightScale;
 uniform bool clipBorders;
 uniform int minLayers;
 uniform int maxLayers;
+uniform sampler2D coneMap;
+uniform bool coneStepMapping;
+uniform int coneSteps;
+uniform float layerScale; // relief LOD of the draw, 0 means normal mapping only
 
 uniform float bright_color_threshold; 
 vec3 lightThreshold = vec3(0.2126, 0.7152, 0.0722);
@@ -818,8 +2080,10 @@ vec3 lightThreshold = vec3(0.2126, 0.7152, 0.0722);
 layout(location = 0) out vec4 FragColor;
 layout(location = 1) out vec4 BrightColor;
 
-vec2 ParallaxMapping(vec2 texCoords, vec3 viewDir);
-vec3 CalculateLighting(Light light, vec3 normal, vec3 view_dir, vec3 frag_pos, vec3 pixelColor);
+vec2 ParallaxMapping(vec2 texCoords, vec3 viewDir, float lodScale);
+vec2 ConeStepMapping(vec2 texCoords, vec3 viewDir, float lodScale);
+vec3 CalculatePointLight(PointLight light, vec3 normal, vec3 view_dir, vec3 frag_pos, vec3 pixelColor);
+vec3 CalculateDirectionalLight(DirectionalLight light, vec3 normal, vec3 view_dir, vec3 pixelColor);
 
 void main()
 {
@@ -827,7 +2091,11 @@ void main()
 	vec3 viewDir = normalize(fs_in.TangentViewPos - fs_in.TangentFragPos);
 	vec2 texCoords = fs_in.TexCoords;
 
-	texCoords = ParallaxMapping(fs_in.TexCoords, viewDir);
+	// Halve the layers for every mip level of the depth map the pixel covers: past the first one the
+	// ray crosses fewer texels than there are layers
+	float lodScale = layerScale * exp2(-max(textureQueryLod(depthMap, fs_in.TexCoords).y, 0.0));
+	if (lodScale > 0.0)
+		texCoords = coneStepMapping ? ConeStepMapping(fs_in.TexCoords, viewDir, lodScale) : ParallaxMapping(fs_in.TexCoords, viewDir, lodScale);
 
 	if (clipBorders)
 	{
@@ -843,8 +2111,19 @@ void main()
 	vec3 color = texture(diffuseMap, texCoords).rgb;
 
 	vec3 lighting  = vec3(0.0);
-    for(int i = 0; i < uLightCount; ++i)
-		lighting += CalculateLighting(uLights[i], normal, viewDir, fs_in.FragPos, color);
+#if defined(RELIEF_MAPPING_SHADER_FORWARD_CLUSTERED)
+	// Only the lights assigned to this fragment's cluster
+	uint cluster = GetClusterIndex();
+	uint clusterLightCount = uClusterLightCount[cluster];
+	for (uint i = 0u; i < clusterLightCount; ++i)
+		lighting += CalculatePointLight(uPointLights[uClusterLightIndices[cluster * uint(MAX_LIGHTS_PER_CLUSTER) + i]], normal, viewDir, fs_in.FragPos, color);
+#else
+    for(uint i = 0u; i < uVisiblePointLightCount; ++i)
+		lighting += CalculatePointLight(uPointLights[uVisiblePointLights[i]], normal, viewDir, fs_in.FragPos, color);
+#endif
+
+    for(uint i = 0u; i < uDirectionalLightCount; ++i)
+		lighting += CalculateDirectionalLight(uDirectionalLights[i], normal, viewDir, color);
 
     FragColor = vec4(lighting, 1.0);
 
@@ -855,14 +2134,14 @@ void main()
         BrightColor = vec4(0.0, 0.0, 0.0, 1.0);
 }
 
-vec2 ParallaxMapping(vec2 texCoords, vec3 viewDir)
+vec2 ParallaxMapping(vec2 texCoords, vec3 viewDir, float lodScale)
 {
 	// number of depth layers
 	//const float minLayers = 8;
 	//const float maxLayers = 32;
 
 
-	float numLayers = mix(maxLayers, minLayers, abs(dot(vec3(0.0, 0.0, 1.0), viewDir)));
+	float numLayers = max(mix(maxLayers, minLayers, abs(dot(vec3(0.0, 0.0, 1.0), viewDir))) * lodScale, 1.0);
 	// calculate the size of each layer
 	float layerDepth = 1.0 / numLayers;
 	// depth of current layer
@@ -899,10 +2178,47 @@ vec2 ParallaxMapping(vec2 texCoords, vec3 viewDir)
 	return finalTexCoords;
 }
 
-vec3 CalculateDirectionalLight(Light light, vec3 normal, vec3 view_dir, vec3 pixelColor)
+// Relaxed cone stepping: every step goes as far as the cone of the texel it starts from allows. The
+// cones may let the ray cross the surface once, so the last step is refined with a binary search.
+vec2 ConeStepMapping(vec2 texCoords, vec3 viewDir, float lodScale)
+{
+	// Same ray as the linear search: the texture coordinates move by -P per unit of depth
+	vec3 rayDir = vec3(-viewDir.xy / viewDir.z * heightScale, 1.0);
+	float rayRatio = length(rayDir.xy);
+
+	vec3 position = vec3(texCoords, 0.0);
+	vec3 previous = position;
+
+	int steps = max(int(float(coneSteps) * lodScale + 0.5), 1);
+	for (int i = 0; i < steps; ++i)
+	{
+		// r: depth, g: square root of the cone ratio
+		vec2 cone = texture(coneMap, position.xy).rg;
+		float coneRatio = cone.g * cone.g;
+		float depthLeft = cone.r - position.z;
+		if (depthLeft <= 0.0)
+			break;
+
+		previous = position;
+		position += rayDir * (coneRatio * depthLeft / (rayRatio + coneRatio));
+	}
+
+	// The surface is crossed between the last two positions
+	for (int i = 0; i < 6; ++i)
+	{
+		vec3 middle = (previous + position) * 0.5;
+		if (texture(depthMap, middle.xy).r <= middle.z)
+			position = middle;
+		else
+			previous = middle;
+	}
+
+	return position.xy;
+}
+
+vec3 CalculateDirectionalLight(DirectionalLight light, vec3 normal, vec3 view_dir, vec3 pixelColor)
 {
-	float intensity = float(light.intensity);
-	intensity *= 0.01;
+	float intensity = light.intensity;
 	// Diffuse 
 	vec3 lightDirection = normalize(-light.direction);
 	float diff = max(dot(lightDirection, normal), 0.0);
@@ -917,10 +2233,13 @@ vec3 CalculateDirectionalLight(Light light, vec3 normal, vec3 view_dir, vec3 pix
 	return result;
 }
 
-vec3 CalculatePointLight(Light light, vec3 normal, vec3 view_dir, vec3 frag_pos, vec3 pixelColor)
+vec3 CalculatePointLight(PointLight light, vec3 normal, vec3 view_dir, vec3 frag_pos, vec3 pixelColor)
 {
-	float intensity = float(light.intensity);
-	intensity *= 0.01;
+	float distance = length(light.position - frag_pos);
+	if (distance >= light.radius)
+		return vec3(0.0);
+
+	float intensity = light.intensity;
 
 	// Diffuse 
 	vec3 lightDirection = normalize(light.position - frag_pos);
@@ -932,9 +2251,10 @@ vec3 CalculatePointLight(Light light, vec3 normal, vec3 view_dir, vec3 frag_pos,
     float spec = pow(max(dot(normal, halfwayDir), 0.0), 128.0);
 	vec3 specular = light.color * spec * intensity;
 
-	// Attenuation
- 	float distance = length(light.position - frag_pos);
-    float attenuation = 1.0 / (1.0 + 0.3 * distance + 0.5 * (distance * distance));    
+	// Attenuation, windowed so the contribution reaches zero at the light radius
+    float attenuation = 1.0 / (1.0 + 0.3 * distance + 0.5 * (distance * distance));
+	float window = clamp(1.0 - pow(distance / light.radius, 4.0), 0.0, 1.0);
+	attenuation *= window * window;
 
 	diffuse *= attenuation;
     specular *= attenuation;
@@ -944,26 +2264,6 @@ vec3 CalculatePointLight(Light light, vec3 normal, vec3 view_dir, vec3 frag_pos,
 }
 
 
-vec3 CalculateLighting(Light light, vec3 normal, vec3 view_dir, vec3 frag_pos, vec3 pixelColor)
-{
-
-	vec3 result = vec3(0.0);
-
-	switch(light.type)
-	{
-		case 0: 
-			result = CalculatePointLight(light, normal, view_dir, frag_pos, pixelColor);
-			break;
-		case 1:
-			result = CalculateDirectionalLight(light, normal, view_dir, pixelColor);
-			break;
-
-		default: break;
-	}
-
-	return result;
-}
-
 #endif
 #endif
 // NOTE: You can write several shaders in the same file if you want as